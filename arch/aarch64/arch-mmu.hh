@@ -120,6 +120,8 @@ template<int N>
 inline void pt_element_common<N>::set_user(bool v) { set_bit(6, v); } // AP[1]
 template<int N>
 inline void pt_element_common<N>::set_accessed(bool v) { set_bit(10, v); } // AF
+template<int N>
+inline void pt_element_common<N>::set_global(bool v) { set_bit(11, !v); } // nG
 
 template<int N>
 inline void pt_element_common<N>::set_sw_bit(unsigned off, bool v) {
@@ -194,10 +194,16 @@ void arch_init_premain()
 #if CONF_drivers_virtio_net
 #include "drivers/virtio-net.hh"
 #endif
+#if CONF_drivers_virtio_vsock
+#include "drivers/virtio-vsock.hh"
+#endif
 #endif
 #if CONF_drivers_virtio_fs
 #include "drivers/virtio-fs.hh"
 #endif
+#if CONF_drivers_virtio_balloon
+#include "drivers/virtio-balloon.hh"
+#endif
 #if CONF_drivers_nvme
 #include "drivers/nvme.hh"
 #endif
@@ -252,10 +258,16 @@ void arch_init_drivers()
 #if CONF_drivers_virtio_net
     drvman->register_driver(virtio::net::probe);
 #endif
+#if CONF_drivers_virtio_vsock
+    drvman->register_driver(virtio::vsock::probe);
+#endif
 #endif
 #if CONF_drivers_virtio_fs
     drvman->register_driver(virtio::fs::probe);
 #endif
+#if CONF_drivers_virtio_balloon
+    drvman->register_driver(virtio::balloon::probe);
+#endif
 #if CONF_drivers_nvme
     drvman->register_driver(nvme::driver::probe);
 #endif
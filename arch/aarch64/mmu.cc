@@ -123,6 +123,10 @@ void flush_tlb_local() {
     asm volatile("dsb sy; tlbi vmalle1; dsb sy; isb;");
 }
 
+void flush_tlb_range(uintptr_t start, size_t size) {
+    flush_tlb_all();
+}
+
 static pt_element<4> page_table_root[2] __attribute__((init_priority((int)init_prio::pt_root)));
 u64 mem_addr;
 
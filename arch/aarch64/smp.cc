@@ -57,6 +57,9 @@ void smp_init()
         auto c = new sched::cpu(i);
         c->arch.mpid = mpids[i];
         c->arch.smp_idx = i;
+        // Cores of one cluster (same Aff1 and above) share the last level
+        // cache on all the ARM platforms we run on.
+        c->llc_id = mpids[i] >> 8;
         c->arch.initstack.next = smp_stack_free;  /* setup thread stack */
         smp_stack_free = &c->arch.initstack;
         sched::cpus.push_back(c);
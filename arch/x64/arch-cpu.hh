@@ -167,6 +167,18 @@ inline void arch_cpu::set_interrupt_stack(arch_thread* t)
     set_ist_entry(2, s, sizeof(s));
 }
 
+// The state components enabled in XCR0: the AVX registers when the cpu has
+// them, so that the kernel can use them too (see memcpy() and memset())
+inline u64 xsave_features()
+{
+    using namespace processor;
+    auto bits = xcr0_x87 | xcr0_sse;
+    if (features().avx) {
+        bits |= xcr0_avx;
+    }
+    return bits;
+}
+
 inline void arch_cpu::init_on_cpu()
 {
     using namespace processor;
@@ -185,11 +197,7 @@ inline void arch_cpu::init_on_cpu()
     write_cr4(cr4);
 
     if (features().xsave) {
-        auto bits = xcr0_x87 | xcr0_sse;
-        if (features().avx) {
-            bits |= xcr0_avx;
-        }
-        write_xcr(xcr0, bits);
+        write_xcr(xcr0, xsave_features());
     }
 
     // We can't trust the FPU and the MXCSR to be always initialized to default values.
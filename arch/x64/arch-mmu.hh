@@ -102,6 +102,8 @@ template<int N>
 inline void pt_element_common<N>::set_user(bool v) { set_bit(2, v); }
 template<int N>
 inline void pt_element_common<N>::set_accessed(bool v) { set_bit(5, v); }
+template<int N>
+inline void pt_element_common<N>::set_global(bool v) { set_bit(8, v); }
 
 template<int N>
 inline void pt_element_common<N>::set_sw_bit(unsigned off, bool v) {
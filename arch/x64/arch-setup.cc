@@ -265,6 +265,14 @@ void init_syscall() {
 
 void arch_init_premain()
 {
+    // The kernel's ifuncs are resolved before init_on_cpu() runs on the boot
+    // cpu, so memcpy() and memset() may pick their AVX variants before the
+    // AVX state would otherwise be enabled. Enable it now.
+    if (processor::features().xsave) {
+        processor::write_cr4(processor::read_cr4() | processor::cr4_osxsave);
+        processor::write_xcr(processor::xcr0, xsave_features());
+    }
+
     auto omb = *osv_multiboot_info;
     if (omb.disk_err)
 	debug_early_u64("Error reading disk (real mode): ", static_cast<u64>(omb.disk_err));
@@ -293,6 +301,9 @@ void arch_init_premain()
 #if CONF_drivers_virtio_net
 #include "drivers/virtio-net.hh"
 #endif
+#if CONF_drivers_virtio_vsock
+#include "drivers/virtio-vsock.hh"
+#endif
 #endif
 #if CONF_drivers_virtio_rng
 #include "drivers/virtio-rng.hh"
@@ -300,6 +311,9 @@ void arch_init_premain()
 #if CONF_drivers_virtio_fs
 #include "drivers/virtio-fs.hh"
 #endif
+#if CONF_drivers_virtio_balloon
+#include "drivers/virtio-balloon.hh"
+#endif
 #if CONF_drivers_xen
 #include "drivers/xenplatform-pci.hh"
 #endif
@@ -360,6 +374,9 @@ void arch_init_drivers()
 #if CONF_drivers_virtio_net
     drvman->register_driver(virtio::net::probe);
 #endif
+#if CONF_drivers_virtio_vsock
+    drvman->register_driver(virtio::vsock::probe);
+#endif
 #endif
 #if CONF_drivers_virtio_rng
     drvman->register_driver(virtio::rng::probe);
@@ -367,6 +384,9 @@ void arch_init_drivers()
 #if CONF_drivers_virtio_fs
     drvman->register_driver(virtio::fs::probe);
 #endif
+#if CONF_drivers_virtio_balloon
+    drvman->register_driver(virtio::balloon::probe);
+#endif
 #if CONF_drivers_xen
     drvman->register_driver(xenfront::xenplatform_pci::probe);
 #endif
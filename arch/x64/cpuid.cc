@@ -62,6 +62,7 @@ cpuid_bit cpuid_bits[] = {
     { 1, 'c', 30, &f::rdrand, 0, nullptr, "rdrand" },
     { 1, 'd', 19, &f::clflush, 0, nullptr, "clflush" },
     { 7, 'b', 0, &f::fsgsbase, 0, nullptr, "fgsbase" },
+    { 7, 'b', 5, &f::avx2, 0, nullptr, "avx2" },
     { 7, 'b', 9, &f::repmovsb, 0, nullptr, "repmovsb" },
     { 0x80000001, 'd', 26, &f::gbpage, 0, nullptr, "gbpage" },
     { 0x80000007, 'd', 8, &f::invariant_tsc, 0, nullptr, "invariant_tsc"},
@@ -177,4 +178,68 @@ features_type::features_type()
     process_cpuid(*this);
 }
 
+const topology_type& topology()
+{
+    static topology_type t;
+    return t;
+}
+
+namespace {
+
+unsigned count_order(unsigned n)
+{
+    unsigned order = 0;
+    while ((1u << order) < n) {
+        ++order;
+    }
+    return order;
+}
+
+// Walk the deterministic cache parameters leaf (4 on Intel, 0x8000001d on
+// AMD) and return the APIC ID shift of the highest level cache, or 0 if the
+// leaf is not available.
+bool find_llc_shift(unsigned leaf, unsigned& shift)
+{
+    auto base = leaf & 0xf0000000;
+    if (cpuid(base).a < leaf) {
+        return false;
+    }
+    unsigned best_level = 0;
+    for (unsigned i = 0; i < 16; ++i) {
+        auto r = cpuid(leaf, i);
+        unsigned type = r.a & 0x1f;
+        if (type == 0) {
+            break;
+        }
+        unsigned level = (r.a >> 5) & 0x7;
+        if (level > best_level) {
+            best_level = level;
+            shift = count_order(((r.a >> 14) & 0xfff) + 1);
+        }
+    }
+    return best_level != 0;
+}
+
+}
+
+topology_type::topology_type()
+    : smt_shift(0)
+    , llc_shift(0)
+{
+    // Leaf 0xb, subleaf 0 describes the SMT level on both Intel and AMD
+    if (cpuid(0).a >= 0xb) {
+        auto r = cpuid(0xb, 0);
+        if (((r.c >> 8) & 0xff) == 1) {
+            smt_shift = r.a & 0x1f;
+        }
+    }
+    if (!find_llc_shift(4, llc_shift) && !find_llc_shift(0x8000001d, llc_shift)) {
+        // No cache information - assume all cpus share the last level cache
+        llc_shift = 32;
+    }
+    if (llc_shift < smt_shift) {
+        llc_shift = smt_shift;
+    }
+}
+
 }
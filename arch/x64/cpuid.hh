@@ -24,6 +24,7 @@ struct features_type {
     bool xsave;
     bool osxsave;
     bool avx;
+    bool avx2;
     bool rdrand;
     bool clflush;
     bool fsgsbase;
@@ -43,6 +44,19 @@ struct features_type {
 extern const features_type& features();
 extern const std::string& features_str();
 
+// CPU topology derived from CPUID: the number of low-order APIC ID bits
+// which distinguish the SMT siblings of one core (smt_shift), and the
+// logical processors sharing the last level cache (llc_shift). Two CPUs
+// whose APIC IDs are equal after shifting right by these amounts share a
+// core or a last level cache, respectively.
+struct topology_type {
+    topology_type();
+    unsigned smt_shift;
+    unsigned llc_shift;
+};
+
+extern const topology_type& topology();
+
 }
 
 
@@ -16,6 +16,7 @@
 #include <osv/elf.hh>
 #include "exceptions.hh"
 #include <algorithm>
+#include <limits>
 
 void page_fault(exception_frame *ef)
 {
@@ -54,68 +55,126 @@ void flush_tlb_local() {
     processor::write_cr3(processor::read_cr3());
 }
 
-// tlb_flush() does TLB flush on *all* processors, not returning before all
-// processors confirm flushing their TLB. This is slow, but necessary for
-// correctness so that, for example, after mprotect() returns, no thread on
-// no cpu can write to the protected page.
-mutex tlb_flush_mutex;
-sched::thread_handle tlb_flush_waiter;
-std::atomic<int> tlb_flush_pendingconfirms;
+// Invalidating more pages than this one by one is slower than flushing the
+// whole TLB and refilling it. INVLPG also drops the paging-structure caches,
+// so page tables freed in the range are safe to reuse afterwards.
+constexpr size_t tlb_flush_max_pages = 32;
+
+static void flush_tlb_local_range(uintptr_t start, size_t size)
+{
+    if (size > tlb_flush_max_pages * page_size) {
+        flush_tlb_local();
+        return;
+    }
+    for (auto addr = start; addr < start + size; addr += page_size) {
+        processor::invlpg(reinterpret_cast<void*>(addr));
+    }
+}
+
+// flush_tlb_range() flushes the range on *all* processors, not returning
+// before all processors confirm flushing their TLB. This is slow, but
+// necessary for correctness so that, for example, after mprotect() returns,
+// no thread on no cpu can write to the protected page.
+//
+// Each cpu has a slot for the flush it asks the other cpus to do, taken by
+// one thread of the cpu at a time, so cpus can shoot down ranges
+// concurrently. A cpu receiving the IPI does the flushes of all the cpus
+// that marked it in its requested_by mask; many requests arriving together
+// are merged into a single full flush.
+struct tlb_flush_cpu {
+    // The request of this cpu to the others
+    mutex lock;
+    uintptr_t start;
+    size_t size;
+    std::atomic<int> pending;
+    sched::thread_handle waiter;
+    // The cpus whose requests this cpu has to handle
+    std::atomic<unsigned long> requested_by;
+} __attribute__((aligned(64)));
+
+static tlb_flush_cpu tlb_flush_cpus[sched::max_cpus];
 
 inter_processor_interrupt tlb_flush_ipi{IPI_TLB_FLUSH, [] {
-        mmu::flush_tlb_local();
-        if (tlb_flush_pendingconfirms.fetch_add(-1) == 1) {
-            tlb_flush_waiter.wake_from_kernel_or_with_irq_disabled();
+        auto& me = tlb_flush_cpus[sched::cpu::current()->id];
+        auto requests = me.requested_by.exchange(0, std::memory_order_acquire);
+        size_t total = 0;
+        for (auto r = requests; r; r &= r - 1) {
+            total += std::min(tlb_flush_cpus[__builtin_ctzl(r)].size,
+                              tlb_flush_max_pages * page_size + 1);
+        }
+        bool full = total > tlb_flush_max_pages * page_size;
+        if (full) {
+            mmu::flush_tlb_local();
+        }
+        for (auto r = requests; r; r &= r - 1) {
+            auto& req = tlb_flush_cpus[__builtin_ctzl(r)];
+            if (!full) {
+                flush_tlb_local_range(req.start, req.size);
+            }
+            if (req.pending.fetch_add(-1) == 1) {
+                req.waiter.wake_from_kernel_or_with_irq_disabled();
+            }
         }
 }};
 
-void flush_tlb_all()
+void flush_tlb_range(uintptr_t start, size_t size)
 {
-    static std::vector<sched::cpu*> ipis(sched::max_cpus);
-
     if (sched::cpus.size() <= 1) {
-        mmu::flush_tlb_local();
+        flush_tlb_local_range(start, size);
         return;
     }
 
     SCOPE_LOCK(migration_lock);
-    mmu::flush_tlb_local();
-    std::lock_guard<mutex> guard(tlb_flush_mutex);
-    tlb_flush_waiter.reset(*sched::thread::current());
-    int count;
-    if (sched::thread::current()->is_app()) {
-        ipis.clear();
-        std::copy_if(sched::cpus.begin(), sched::cpus.end(), std::back_inserter(ipis),
-                [](sched::cpu* c) {
-            if (c == sched::cpu::current()) {
-                return false;
-            }
-
+    flush_tlb_local_range(start, size);
+    auto me = sched::cpu::current();
+    unsigned long targets = 0;
+    for (auto c : sched::cpus) {
+        if (c == me) {
+            continue;
+        }
+        if (sched::thread::current()->is_app()) {
+            // Cpus not running application threads flush their whole TLB
+            // before they switch to one
             c->lazy_flush_tlb.store(true, std::memory_order_relaxed);
             if (!c->app_thread.load(std::memory_order_seq_cst)) {
-                return false;
+                continue;
             }
             if (!c->lazy_flush_tlb.exchange(false, std::memory_order_relaxed)) {
-                return false;
+                continue;
             }
-            return true;
-        });
-        count = ipis.size();
-    } else {
-        count = sched::cpus.size() - 1;
+        }
+        targets |= 1ul << c->id;
+    }
+    if (!targets) {
+        return;
+    }
+
+    auto& req = tlb_flush_cpus[me->id];
+    std::lock_guard<mutex> guard(req.lock);
+    req.start = start;
+    req.size = size;
+    req.waiter.reset(*sched::thread::current());
+    int count = __builtin_popcountl(targets);
+    req.pending.store(count);
+    for (auto t = targets; t; t &= t - 1) {
+        tlb_flush_cpus[__builtin_ctzl(t)].requested_by.fetch_or(1ul << me->id, std::memory_order_release);
     }
-    tlb_flush_pendingconfirms.store(count);
     if (count == (int)sched::cpus.size() - 1) {
         tlb_flush_ipi.send_allbutself();
     } else {
-        for (auto&& c: ipis) {
-            tlb_flush_ipi.send(c);
+        for (auto t = targets; t; t &= t - 1) {
+            tlb_flush_ipi.send(sched::cpus[__builtin_ctzl(t)]);
         }
     }
-    sched::thread::wait_until([] {
-            return tlb_flush_pendingconfirms.load() == 0;
+    sched::thread::wait_until([&req] {
+            return req.pending.load() == 0;
     });
-    tlb_flush_waiter.clear();
+    req.waiter.clear();
+}
+
+void flush_tlb_all()
+{
+    flush_tlb_range(0, std::numeric_limits<size_t>::max());
 }
 
 static pt_element<4> page_table_root __attribute__((init_priority((int)init_prio::pt_root)));
@@ -127,6 +186,10 @@ pt_element<4> *get_root_pt(uintptr_t virt __attribute__((unused))) {
 void switch_to_runtime_page_tables()
 {
     processor::write_cr3(page_table_root.next_pt_addr());
+    // The linear maps are never changed once set up, so their pages are
+    // global and stay in the TLB when the other mappings are flushed. The
+    // other cpus copy cr4 from this one when they start.
+    processor::write_cr4(processor::read_cr4() | processor::cr4_pge);
 }
 
 enum {
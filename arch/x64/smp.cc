@@ -12,7 +12,10 @@
 #include "apic.hh"
 #include "ioapic.hh"
 #include <osv/mmu.hh>
+#include <osv/numa.hh>
 #include <string.h>
+#include <algorithm>
+#include <vector>
 #if CONF_drivers_acpi
 extern "C" {
 #include "acpi.h"
@@ -49,6 +52,9 @@ static void register_cpu(unsigned cpu_id, u32 apic_id, u32 acpi_id = 0)
     auto c = new sched::cpu(cpu_id);
     c->arch.apic_id = apic_id;
     c->arch.acpi_id = acpi_id;
+    auto& topo = processor::topology();
+    c->core_id = apic_id >> topo.smt_shift;
+    c->llc_id = topo.llc_shift < 32 ? apic_id >> topo.llc_shift : 0;
     c->arch.initstack.next = smp_stack_free;
     smp_stack_free = &c->arch.initstack;
     sched::cpus.push_back(c);
@@ -94,6 +100,106 @@ void parse_madt()
     }
     debugf("%u CPUs detected\n", nr_cpus);
 }
+
+// Describes the NUMA topology to the memory allocator. The proximity domains
+// of the SRAT are numbered densely, in the order the table mentions them.
+static void parse_srat()
+{
+    char srat_sig[] = ACPI_SIG_SRAT;
+    ACPI_TABLE_HEADER* srat_header;
+    if (AcpiGetTable(srat_sig, 0, &srat_header) != AE_OK) {
+        return;
+    }
+    auto srat = get_parent_from_member(srat_header, &ACPI_TABLE_SRAT::Header);
+    std::vector<u32> domains;
+    auto node_of = [&] (u32 domain) -> unsigned {
+        auto i = std::find(domains.begin(), domains.end(), domain);
+        if (i == domains.end()) {
+            domains.push_back(domain);
+            return domains.size() - 1;
+        }
+        return i - domains.begin();
+    };
+    auto set_cpu_node = [] (u32 apic_id, unsigned node) {
+        for (auto c : sched::cpus) {
+            if (c->arch.apic_id == apic_id) {
+                c->numa_node = node;
+            }
+        }
+    };
+    void* subtable = srat + 1;
+    void* srat_end = static_cast<void*>(srat) + srat->Header.Length;
+    while (subtable < srat_end) {
+        auto s = static_cast<ACPI_SUBTABLE_HEADER*>(subtable);
+        if (!s->Length) {
+            break;
+        }
+        switch (s->Type) {
+        case ACPI_SRAT_TYPE_CPU_AFFINITY: {
+            auto cpu = get_parent_from_member(s, &ACPI_SRAT_CPU_AFFINITY::Header);
+            if (cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY) {
+                u32 domain = cpu->ProximityDomainLo |
+                    cpu->ProximityDomainHi[0] << 8 |
+                    cpu->ProximityDomainHi[1] << 16 |
+                    cpu->ProximityDomainHi[2] << 24;
+                set_cpu_node(cpu->ApicId, node_of(domain));
+            }
+            break;
+        }
+        case ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY: {
+            auto cpu = get_parent_from_member(s, &ACPI_SRAT_X2APIC_CPU_AFFINITY::Header);
+            if (cpu->Flags & ACPI_SRAT_CPU_ENABLED) {
+                set_cpu_node(cpu->ApicId, node_of(cpu->ProximityDomain));
+            }
+            break;
+        }
+        case ACPI_SRAT_TYPE_MEMORY_AFFINITY: {
+            auto mem = get_parent_from_member(s, &ACPI_SRAT_MEM_AFFINITY::Header);
+            if ((mem->Flags & ACPI_SRAT_MEM_ENABLED) && mem->Length) {
+                memory::numa_add_memory(node_of(mem->ProximityDomain), mem->BaseAddress, mem->Length);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        subtable += s->Length;
+    }
+    if (domains.size() > memory::max_numa_nodes) {
+        debugf("Too many NUMA nodes, ignoring the SRAT\n");
+        for (auto c : sched::cpus) {
+            c->numa_node = 0;
+        }
+        return;
+    }
+
+    // The SLIT is indexed by proximity domain
+    char slit_sig[] = ACPI_SIG_SLIT;
+    ACPI_TABLE_HEADER* slit_header;
+    if (AcpiGetTable(slit_sig, 0, &slit_header) == AE_OK) {
+        auto slit = get_parent_from_member(slit_header, &ACPI_TABLE_SLIT::Header);
+        auto count = slit->LocalityCount;
+        for (unsigned from = 0; from < domains.size(); from++) {
+            for (unsigned to = 0; to < domains.size(); to++) {
+                if (domains[from] < count && domains[to] < count) {
+                    memory::numa_set_distance(from, to, slit->Entry[domains[from] * count + domains[to]]);
+                }
+            }
+        }
+    }
+
+    memory::numa_init();
+    // The allocator only knows nodes up to the last one with memory, the
+    // cpus of nodes after it go to node 0
+    for (auto c : sched::cpus) {
+        if (c->numa_node >= memory::numa_nodes()) {
+            c->numa_node = 0;
+        }
+    }
+    if (memory::numa_nodes() > 1) {
+        debugf("%u NUMA nodes detected\n", memory::numa_nodes());
+    }
+}
 #endif
 
 #define MPF_IDENTIFIER (('_'<<24) | ('P'<<16) | ('M'<<8) | '_')
@@ -205,6 +311,7 @@ void smp_init()
 #if CONF_drivers_acpi
     if (acpi::is_enabled()) {
         parse_madt();
+        parse_srat();
     } else {
 #endif
         parse_mp_table();
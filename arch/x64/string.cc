@@ -310,9 +310,114 @@ void *memcpy_repmov_ssse3(void *__restrict dest, const void *__restrict src, siz
     }
 }
 
+// AVX2 variants, used on cpus with both AVX2 and fast rep movsb/stosb:
+//  - up to avx2_copy_lim bytes (and unaligned copies up to 64K, like the
+//    SSSE3 variant does) are copied with 32-byte loads and stores;
+//  - larger ones up to nt_threshold bytes use rep movsb;
+//  - larger ones than that would just evict everything else from the last
+//    level cache, so they are written with non-temporal stores.
+static constexpr size_t avx2_copy_lim = 2048;
+static constexpr size_t nt_threshold = 4 << 20;
+
+// Like sse_memcpy(), this must also work for overlapping dest < src: every
+// chunk is loaded before it is stored, and the last 32 bytes (which the
+// loop may overwrite) are loaded up front.
+[[gnu::target("avx2")]]
+static inline void avx2_memcpy(void* dest, const void* src, size_t n)
+{
+    auto d = static_cast<__m256i*>(dest);
+    auto s = static_cast<const __m256i*>(src);
+    auto tail = _mm256_loadu_si256(static_cast<const __m256i*>(src + n - 32));
+    for (; n > 128; n -= 128, d += 4, s += 4) {
+        auto a = _mm256_loadu_si256(s);
+        auto b = _mm256_loadu_si256(s + 1);
+        auto c = _mm256_loadu_si256(s + 2);
+        auto e = _mm256_loadu_si256(s + 3);
+        _mm256_storeu_si256(d, a);
+        _mm256_storeu_si256(d + 1, b);
+        _mm256_storeu_si256(d + 2, c);
+        _mm256_storeu_si256(d + 3, e);
+    }
+    for (; n > 32; n -= 32, d++, s++) {
+        _mm256_storeu_si256(d, _mm256_loadu_si256(s));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(reinterpret_cast<char*>(d) + n - 32), tail);
+}
+
+extern "C" char memcpy_nt_loop[];
+
+// The non-temporal copy loop keeps the rest of the copy in %rdi, %rsi and
+// %rcx like rep movsb does, so it takes part in the memcpy_decode fixups.
+// A fixed up fault resumes at the top of the loop instead of re-executing
+// the load, which could then read past the end of the source.
+extern "C" void memcpy_fixup_nt(exception_frame *ef, size_t fixup)
+{
+    memcpy_fixup_byte(ef, fixup);
+    ef->rip = reinterpret_cast<ulong>(memcpy_nt_loop);
+}
+
+// Must not be inlined or cloned, as the loop label has to be unique
+[[gnu::noinline, gnu::noclone]]
+static void nt_memcpy(void *__restrict dest, const void *__restrict src, size_t n)
+{
+    // Align the destination for the non-temporal stores
+    size_t head = -reinterpret_cast<uintptr_t>(dest) & 31;
+    n -= head;
+    repmovsb(dest, src, head);
+    asm volatile
+       ("memcpy_nt_loop: \n\t"
+        "cmp $32, %%rcx\n\t"
+        "jb 2f\n\t"
+        "1: \n\t"
+        "vmovdqu (%%rsi), %%ymm0\n\t"
+        "vmovntdq %%ymm0, (%%rdi)\n\t"
+        "add $32, %%rsi\n\t"
+        "add $32, %%rdi\n\t"
+        "sub $32, %%rcx\n\t"
+        "jmp memcpy_nt_loop\n\t"
+        "2: \n\t"
+        "sfence\n\t"
+        "vzeroupper\n\t"
+        ".pushsection .memcpy_decode, \"ax\" \n\t"
+        ".quad 1b, 1, memcpy_fixup_nt\n\t"
+        ".popsection\n"
+            : "+D"(dest), "+S"(src), "+c"(n) : : "xmm0", "cc", "memory");
+    repmovsb(dest, src, n);
+}
+
+extern "C"
+[[gnu::optimize("omit-frame-pointer"), gnu::target("avx2")]]
+void *memcpy_repmov_avx2(void *__restrict dest, const void *__restrict src, size_t n)
+{
+    if (n < small_memcpy_lim) {
+        return small_memcpy(dest, src, n);
+    } else if (n < avx2_copy_lim || (n < 65536 && !both_aligned(dest, src, 32))) {
+        avx2_memcpy(dest, src, n);
+        return dest;
+    } else if (n < nt_threshold) {
+        auto ret = dest;
+        repmovsb(dest, src, n);
+        return ret;
+    } else {
+        nt_memcpy(dest, src, n);
+        return dest;
+    }
+}
+
+static bool use_avx2()
+{
+    // The AVX state is enabled in XCR0 whenever the cpu has AVX and XSAVE,
+    // see xsave_features()
+    auto& f = processor::features();
+    return f.xsave && f.avx && f.avx2 && f.repmovsb;
+}
+
 extern "C"
 void *(*resolve_memcpy())(void *__restrict dest, const void *__restrict src, size_t n)
 {
+    if (use_avx2()) {
+        return memcpy_repmov_avx2;
+    }
     if (processor::features().repmovsb) {
         if (processor::features().ssse3) {
             return memcpy_repmov_ssse3;
@@ -525,9 +630,59 @@ void *memset_repstosb(void *__restrict dest, int c, size_t n)
     return ret;
 }
 
+[[gnu::target("avx2")]]
+static inline void avx2_memset(void *dest, __m256i v, size_t n)
+{
+    auto d = static_cast<__m256i*>(dest);
+    auto end = static_cast<char*>(dest) + n;
+    for (; n > 128; n -= 128, d += 4) {
+        _mm256_storeu_si256(d, v);
+        _mm256_storeu_si256(d + 1, v);
+        _mm256_storeu_si256(d + 2, v);
+        _mm256_storeu_si256(d + 3, v);
+    }
+    for (; n > 32; n -= 32, d++) {
+        _mm256_storeu_si256(d, v);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(end - 32), v);
+}
+
+[[gnu::target("avx2")]]
+static void nt_memset(void *dest, __m256i v, size_t n)
+{
+    auto end = static_cast<char*>(dest) + n;
+    _mm256_storeu_si256(static_cast<__m256i*>(dest), v);
+    auto d = reinterpret_cast<__m256i*>((reinterpret_cast<uintptr_t>(dest) + 32) & ~31ul);
+    for (; reinterpret_cast<char*>(d + 1) <= end; d++) {
+        _mm256_stream_si256(d, v);
+    }
+    _mm_sfence();
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(end - 32), v);
+}
+
+extern "C"
+[[gnu::target("avx2")]]
+void *memset_avx2(void *__restrict dest, int c, size_t n)
+{
+    auto ret = dest;
+    if (n <= 64) {
+        small_memset(dest, c, n);
+    } else if (n < avx2_copy_lim) {
+        avx2_memset(dest, _mm256_set1_epi8(c), n);
+    } else if (n < nt_threshold) {
+        asm volatile("rep stosb" : "+D"(dest), "+c"(n) : "a"(c) : "memory");
+    } else {
+        nt_memset(dest, _mm256_set1_epi8(c), n);
+    }
+    return ret;
+}
+
 extern "C"
 void *(*resolve_memset())(void *__restrict dest, int c, size_t n)
 {
+    if (use_avx2()) {
+        return memset_avx2;
+    }
     if (processor::features().repmovsb) {
         return memset_repstosb;
     }
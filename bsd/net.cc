@@ -24,6 +24,7 @@
 #include <bsd/sys/net/ethernet.h>
 #include <bsd/sys/net/route.h>
 #include <bsd/sys/compat/linux/linux_netlink.h>
+#include <bsd/sys/compat/linux/linux_vsock.h>
 
 /* Generation of ip ids */
 void ip_initid(void);
@@ -35,6 +36,8 @@ extern "C" {
     extern  struct domain routedomain;
     /* AF_NETLINK */
     extern  struct domain netlinkdomain;
+    /* AF_VSOCK */
+    extern  struct domain vsockdomain;
 }
 
 void net_init(void)
@@ -57,6 +60,7 @@ void net_init(void)
     OSV_DOMAIN_SET(inet);
     OSV_DOMAIN_SET(route);
     OSV_DOMAIN_SET(netlink);
+    OSV_DOMAIN_SET(vsock);
     rts_init();
     route_init();
     vnet_route_init();
@@ -42,14 +42,16 @@
 #include <osv/clock.hh>
 
 struct callout {
-	/* OSv waiter thread for drain (drain) */
-	void *waiter_thread;
+	/* Timer wheel linkage, protected by the owning wheel's lock */
+	struct callout *c_next;
+	struct callout **c_pprev;
+	void *c_wheel;
+	unsigned c_slot;
 	/* State of this entry */
 	int c_flags;
 	uint64_t c_ticks;
-	/* Time when callout will be dispatched, both in ticks and in ns */
+	/* Tick when callout will be dispatched */
 	uint64_t c_time;
-	osv::clock::uptime::time_point c_to_ns;
 	/* Callout Handler */
 	void (*c_fn)(void *);
 	void* c_arg;
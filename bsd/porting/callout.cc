@@ -5,13 +5,14 @@
  * BSD license as described in the LICENSE file in the top-level directory.
  */
 
-#include <mutex>
-#include <set>
+#include <vector>
 #include "osv/trace.hh"
 #include <osv/debug.hh>
 #include <osv/sched.hh>
 #include <osv/clock.hh>
-using namespace osv::clock::literals;
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <osv/aligned_new.hh>
 
 #include <bsd/porting/rwlock.h>
 #include <bsd/porting/callout.h>
@@ -22,274 +23,373 @@ TRACEPOINT(trace_callout_init, "C=%p", void *);
 TRACEPOINT(trace_callout_reset, "C=%p to_ticks=%d fn=%p arg=%p", void *, uint64_t, void *, void *);
 TRACEPOINT(trace_callout_stop_wait, "C=%p", void *);
 TRACEPOINT(trace_callout_stop, "C=%p flags=%d, is_drain=%d", void *, int, int);
-TRACEPOINT(trace_callout_thread_waiting, "C=%p", void *);
-TRACEPOINT(trace_callout_thread_retry, "C=%p", void *);
+TRACEPOINT(trace_callout_thread_waiting, "cpu=%d next=%d", unsigned, uint64_t);
+TRACEPOINT(trace_callout_thread_cancelled, "C=%p", void *);
 TRACEPOINT(trace_callout_thread_dispatching, "C=%p fn=%p", void *, void *);
-TRACEPOINT(trace_callout_thread_waking, "C=%p thread=%p", void *, void *);
-
-int _callout_stop_safe_locked(struct callout *c, int safe);
 
 namespace callouts {
 
-    struct callout_compare {
-        bool operator() (callout *a, callout *b) const {
-            if (a->c_to_ns == b->c_to_ns) {
-                return (a < b);
-            }
-
-            return (a->c_to_ns < b->c_to_ns);
-        }
-    };
-
-    // We manage callouts in a single ordered set
-    std::set<callout *, callout_compare> _callouts;
+static uint64_t current_tick()
+{
+    return ns2ticks(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            osv::clock::uptime::now().time_since_epoch()).count());
+}
 
-    // Both global data and callout structure are protected using this lock
-    mutex _callout_mutex;
-    void lock(void) { _callout_mutex.lock(); }
-    void unlock(void) { _callout_mutex.unlock(); }
+// Each cpu keeps its callouts in a hierarchical timing wheel (Varghese and
+// Lauck) with four levels of 64 slots, so arming, re-arming and stopping a
+// callout are O(1) list operations no matter how many are pending, and the
+// dispatcher never has to search for the next expiring callout. Level 0 has a
+// slot per tick, and every following level a slot per 64 slots of the level
+// below; when the current tick crosses a slot boundary of a higher level, the
+// callouts in that slot are cascaded down. Callouts due further away than
+// the wheel spans (2^24 ticks) are parked in the top level and re-cascaded
+// until they get close.
+//
+// A callout is fired on the cpu that armed it, by that cpu's callout thread,
+// so a connection's timers run where its packets are processed. Each wheel
+// has its own lock, so cpus arming timers do not contend with each other.
+struct callout_wheel {
+    static constexpr unsigned level_bits = 6;
+    static constexpr unsigned level_size = 1 << level_bits;
+    static constexpr unsigned levels = 4;
+    static constexpr unsigned expired_slot = levels * level_size;
+    static constexpr uint64_t no_tick = UINT64_MAX;
+
+    explicit callout_wheel(sched::cpu* cpu);
+    void add(callout* c);
+    void remove(callout* c);
+    int cancel(callout* c);
+    uint64_t next_tick();
+    void expire(uint64_t tick);
+    void dispatch(callout* c);
+    void run();
+
+    mutex lock;
+    sched::thread* thread;
+    unsigned cpu_id;
+    // Next tick to be processed; callouts never expire before it
+    uint64_t now;
+    // Tick the dispatcher sleeps until; an earlier callout has to wake it
+    uint64_t wakeup = 0;
+    uint64_t occupied[levels] = {};
+    callout* slots[levels][level_size] = {};
+    // Callouts taken off the wheel that are about to be fired
+    callout* expired = nullptr;
+    // The callout being dispatched. Its handler has not been called yet
+    // unless started, and a stop or reset before that cancels the call.
+    callout* running = nullptr;
+    bool started = false;
+    bool cancelled = false;
+    unsigned drainers = 0;
+    condvar done;
+} CACHELINE_ALIGNED;
+
+static std::vector<callout_wheel*> wheels;
+
+static void link(callout** head, callout* c)
+{
+    c->c_next = *head;
+    if (c->c_next) {
+        c->c_next->c_pprev = &c->c_next;
+    }
+    c->c_pprev = head;
+    *head = c;
+}
 
-    // The callout dispatcher thread
-    sched::thread *_callout_dispatcher = nullptr;
-    bool _have_work = false;
+callout_wheel::callout_wheel(sched::cpu* cpu)
+    : cpu_id(cpu->id)
+    , now(current_tick())
+{
+    thread = sched::thread::make([this] { run(); },
+        sched::thread::attr().pin(cpu).name(std::string("callout") + std::to_string(cpu->id)));
+}
 
-    void add_callout(callout *c)
-    {
-        _callouts.insert(c);
+void callout_wheel::add(callout* c)
+{
+    uint64_t expires = std::max(c->c_time, now);
+    uint64_t delta = expires - now;
+    unsigned level = 0;
+    while (level < levels - 1 && delta >= (1ULL << (level_bits * (level + 1)))) {
+        level++;
     }
-
-    void remove_callout(callout *c)
-    {
-        _callouts.erase(c);
+    if (delta >= (1ULL << (level_bits * levels))) {
+        expires = now + (1ULL << (level_bits * levels)) - 1;
     }
+    unsigned slot = (expires >> (level_bits * level)) & (level_size - 1);
+    link(&slots[level][slot], c);
+    occupied[level] |= 1ULL << slot;
+    c->c_slot = level * level_size + slot;
+}
 
-    callout *get_one(void)
-    {
-        if (_callouts.empty()) {
-            return (nullptr);
-        }
-        return (*_callouts.begin());
+void callout_wheel::remove(callout* c)
+{
+    *c->c_pprev = c->c_next;
+    if (c->c_next) {
+        c->c_next->c_pprev = c->c_pprev;
     }
-
-    // FIXME: optimize this function
-    bool have_callout(callout *c)
-    {
-        for (auto i: _callouts) {
-            if (i == c) {
-                return (true);
-            }
+    if (c->c_slot != expired_slot) {
+        unsigned level = c->c_slot / level_size, slot = c->c_slot % level_size;
+        if (!slots[level][slot]) {
+            occupied[level] &= ~(1ULL << slot);
         }
-
-        return (false);
     }
+}
 
-    void mark_have_work(void)
-    {
-        _have_work = true;
+// Removes a pending callout, or cancels the call of one whose dispatch is
+// waiting for the callout's lock. Returns 1 if the handler will not be run
+// because of this, like FreeBSD does; the lltable code counts references on
+// that.
+int callout_wheel::cancel(callout* c)
+{
+    if (c->c_flags & CALLOUT_PENDING) {
+        remove(c);
+        c->c_flags &= ~CALLOUT_PENDING;
+        return 1;
     }
-
-    // wakes the dispatcher
-    void wake_dispatcher(void)
-    {
-        _callout_dispatcher->wake();
+    if (running == c && !started && !cancelled) {
+        cancelled = true;
+        return 1;
     }
+    return 0;
 }
 
-static sched::thread* callout_get_waiter(struct callout *c)
+// The earliest tick with a non-empty slot: at each level, the first occupied
+// slot at or after the one the current tick falls in. Slots only hold
+// callouts due within 64 slots of that, so rotating the bitmap is enough.
+uint64_t callout_wheel::next_tick()
 {
-    return reinterpret_cast<sched::thread*>(c->waiter_thread);
+    uint64_t next = no_tick;
+    for (unsigned level = 0; level < levels; level++) {
+        if (!occupied[level]) {
+            continue;
+        }
+        unsigned shift = level_bits * level;
+        uint64_t first = (now + (1ULL << shift) - 1) >> shift;
+        unsigned idx = first & (level_size - 1);
+        uint64_t rotated = idx ? (occupied[level] >> idx) | (occupied[level] << (level_size - idx))
+                               : occupied[level];
+        next = std::min(next, (first + __builtin_ctzll(rotated)) << shift);
+    }
+    return next;
 }
 
-static void callout_set_waiter(struct callout *c, sched::thread* t)
+void callout_wheel::expire(uint64_t tick)
 {
-    if (t != NULL)
-        assert(c->waiter_thread == NULL);
+    now = tick;
+    for (unsigned level = 1; level < levels; level++) {
+        unsigned shift = level_bits * level;
+        if (tick & ((1ULL << shift) - 1)) {
+            break;
+        }
+        unsigned slot = (tick >> shift) & (level_size - 1);
+        callout* c = slots[level][slot];
+        slots[level][slot] = nullptr;
+        occupied[level] &= ~(1ULL << slot);
+        while (c) {
+            callout* next = c->c_next;
+            add(c);
+            c = next;
+        }
+    }
 
-    c->waiter_thread = reinterpret_cast<void*>(t);
+    // Detach the slot before firing it, so that handlers re-arming their
+    // callout for "now" land in the next tick instead of looping here.
+    unsigned slot = tick & (level_size - 1);
+    expired = slots[0][slot];
+    if (expired) {
+        expired->c_pprev = &expired;
+    }
+    slots[0][slot] = nullptr;
+    occupied[0] &= ~(1ULL << slot);
+    for (callout* c = expired; c; c = c->c_next) {
+        c->c_slot = expired_slot;
+    }
+    now = tick + 1;
+
+    while (expired) {
+        callout* c = expired;
+        remove(c);
+        dispatch(c);
+    }
 }
 
-static void _callout_thread(void)
+void callout_wheel::dispatch(callout* c)
 {
-    callouts::lock();
-
-    while (true) {
-
-        // Wait for work
-        sched::thread::wait_until(callouts::_callout_mutex, [] {
-            return (callouts::get_one() != nullptr);
-        });
-
-        // get the first callout with the earliest time
-        callout *c = callouts::get_one();
-
-        assert(c->c_flags & (CALLOUT_ACTIVE | CALLOUT_PENDING));
-
-        //////////////////////
-        // Wait for timeout //
-        //////////////////////
-
-        auto cur = osv::clock::uptime::now();
-        bool expired = true;
-        if (cur < c->c_to_ns-1_ms) {
-            sched::timer t(*sched::thread::current());
-            t.set(c->c_to_ns);
-
-            trace_callout_thread_waiting(c);
-            sched::thread::wait_until(callouts::_callout_mutex, [&] {
-                return ( (t.expired()) || (callouts::_have_work));
-            });
-
-            callouts::_have_work = false;
-            expired = t.expired();
+    assert(c->c_flags & CALLOUT_PENDING);
+    c->c_flags &= ~CALLOUT_PENDING;
+
+    auto fn = c->c_fn;
+    auto arg = c->c_arg;
+    struct mtx* c_mtx = c->c_mtx;
+    struct rwlock* c_rwlock = c->c_rwlock;
+    bool locked = c_mtx || c_rwlock;
+    bool unlock_after = (c->c_flags & CALLOUT_RETURNUNLOCKED) == 0;
+
+    running = c;
+    started = !locked;
+    cancelled = false;
+
+    if (locked) {
+        DROP_LOCK(lock) {
+            if (c_rwlock)
+                rw_wlock(c_rwlock);
+            if (c_mtx)
+                mtx_lock(c_mtx);
         }
-
-        if (!expired  || (!callouts::have_callout(c))) {
-            trace_callout_thread_retry(c);
-            continue;
+        // Whoever held the lock may have stopped or re-armed the callout
+        // while we were waiting for it
+        if (cancelled) {
+            trace_callout_thread_cancelled(c);
+            unlock_after = true;
+        } else {
+            started = true;
         }
+    }
 
-        ///////////////
-        // Dispatch! //
-        ///////////////
-
-        auto fn = c->c_fn;
-        auto arg = c->c_arg;
-        struct mtx* c_mtx = c->c_mtx;
-        struct rwlock* c_rwlock = c->c_rwlock;
-        bool return_unlocked = ((c->c_flags & CALLOUT_RETURNUNLOCKED) == 0);
-
-        if (c_rwlock)
-            rw_wlock(c_rwlock);
-        if (c_mtx)
-            mtx_lock(c_mtx);
-
-        c->c_flags &= ~CALLOUT_PENDING;
-
-        callouts::unlock();
-
-        // Callout handler
-        trace_callout_thread_dispatching(c, (void*)fn);
-        fn(arg);
-
-        callouts::lock();
-
-        sched::thread* waiter = nullptr;
-
-        //
-        // note: after the handler have been invoked the callout structure
-        // can look much differently, the handler may reschedule the callout
-        // or even freed it.
-        //
-        // if the callout is in the set it means that it hasn't been freed
-        // by the user
-        //
-        // reset || drain || !stop
-        if (callouts::have_callout(c)) {
-
-            waiter = callout_get_waiter(c);
-            callout_set_waiter(c, NULL);
-            // if the callout hadn't been reschedule, remove it
-            if ( ((c->c_flags & CALLOUT_PENDING) == 0) || (waiter) ) {
-                c->c_flags |= CALLOUT_COMPLETED;
-                callouts::remove_callout(c);
-            }
+    DROP_LOCK(lock) {
+        // Handler; note that it may re-arm the callout or even free it, so
+        // the callout structure must not be touched once it returns.
+        if (started) {
+            trace_callout_thread_dispatching(c, (void*)fn);
+            fn(arg);
         }
-
-        // FIXME: should we do this in case the caller called callout_stop?
-        if (return_unlocked) {
+        if (locked && unlock_after) {
             if (c_rwlock)
                 rw_wunlock(c_rwlock);
             if (c_mtx)
                 mtx_unlock(c_mtx);
         }
+    }
+
+    running = nullptr;
+    started = false;
+    if (drainers) {
+        done.wake_all();
+    }
+}
+
+void callout_wheel::run()
+{
+    SCOPE_LOCK(lock);
+    while (true) {
+        // While we are dispatching nobody needs to wake us up
+        wakeup = 0;
+        uint64_t cur = current_tick();
+        uint64_t next;
+        while ((next = next_tick()) <= cur) {
+            expire(next);
+        }
+
+        wakeup = next;
+        trace_callout_thread_waiting(cpu_id, next);
+        if (next == no_tick) {
+            sched::thread::wait_until(lock, [&] { return wakeup != next; });
+        } else {
+            sched::timer t(*sched::thread::current());
+            t.set(osv::clock::uptime::time_point(std::chrono::nanoseconds(ticks2ns(next))));
+            sched::thread::wait_until(lock, [&] { return t.expired() || wakeup != next; });
+        }
+    }
+}
 
-        // if we have a waiter then the callout structure must be valid
-        if (waiter) {
-            trace_callout_thread_waking(c, waiter);
-            waiter->wake();
+// Locks the wheel the callout is on. The callout may move to another wheel
+// while we wait for the lock, so check again once we have it.
+static callout_wheel* lock_wheel(callout* c)
+{
+    while (true) {
+        auto w = static_cast<callout_wheel*>(__atomic_load_n(&c->c_wheel, __ATOMIC_ACQUIRE));
+        if (!w) {
+            return nullptr;
+        }
+        w->lock.lock();
+        if (w == c->c_wheel) {
+            return w;
         }
+        w->lock.unlock();
     }
 }
 
+}
+
+using callouts::callout_wheel;
+
 int callout_reset_on(struct callout *c, u64 to_ticks, void (*fn)(void *),
     void *arg, int ignore_cpu)
 {
-    auto cur = osv::clock::uptime::now();
-    int cur_ticks = ns2ticks(
-            std::chrono::duration_cast<std::chrono::nanoseconds>
-                (cur.time_since_epoch()).count());
-    int result = 0;
-    bool queued_first = false;
-
-    callouts::lock();
+    auto here = callouts::wheels[sched::cpu::current()->id];
+    callout_wheel* w = callouts::lock_wheel(c);
+    if (!w) {
+        here->lock.lock();
+        void* expected = nullptr;
+        if (!__atomic_compare_exchange_n(&c->c_wheel, &expected, here, false,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            here->lock.unlock();
+            return callout_reset_on(c, to_ticks, fn, arg, ignore_cpu);
+        }
+        w = here;
+    }
 
     trace_callout_reset(c, to_ticks, (void*)fn, arg);
 
-    result = _callout_stop_safe_locked(c, 0);
+    int result = w->cancel(c);
+
+    // Unless its handler is running, move the callout to the cpu arming it
+    if (w != here && w->running != c) {
+        __atomic_store_n(&c->c_wheel, here, __ATOMIC_RELEASE);
+        w->lock.unlock();
+        w = here;
+        w->lock.lock();
+    }
 
-    // Reset the callout
     c->c_ticks = to_ticks;
-    c->c_time = cur_ticks + to_ticks;           // for freebsd compatibility
-    c->c_to_ns = cur + ticks2ns(to_ticks) * 1_ns;      // this is what we use
+    c->c_time = callouts::current_tick() + to_ticks;
     c->c_fn = fn;
     c->c_arg = arg;
     c->c_flags |= (CALLOUT_PENDING | CALLOUT_ACTIVE);
+    w->add(c);
 
-    callouts::add_callout(c);
-    if (c == callouts::get_one()) {
-        callouts::mark_have_work();
-        queued_first = true;
+    bool wake = c->c_time < w->wakeup;
+    if (wake) {
+        w->wakeup = c->c_time;
     }
+    w->lock.unlock();
 
-    callouts::unlock();
-
-    if (queued_first)
-        callouts::wake_dispatcher();
+    if (wake) {
+        w->thread->wake();
+    }
 
     return result;
 }
 
 // callout_stop() and callout_drain()
-int _callout_stop_safe_locked(struct callout *c, int is_drain)
+int _callout_stop_safe(struct callout *c, int is_drain)
 {
-    int result = 0;
-
     trace_callout_stop(c, c->c_flags, is_drain);
 
-    if ((is_drain) &&
-        (sched::thread::current() != callouts::_callout_dispatcher) &&
-            (callout_pending(c) ||
-             (callout_active(c) && !callout_completed(c))) ) {
-
-        // Wait for callout
-        callout_set_waiter(c, sched::thread::current());
-        callouts::mark_have_work();
-        callouts::wake_dispatcher();
+    callout_wheel* w = callouts::lock_wheel(c);
+    if (!w) {
+        c->c_flags &= ~(CALLOUT_ACTIVE | CALLOUT_PENDING | CALLOUT_COMPLETED);
+        return 0;
+    }
 
+    int result = 0;
+    while (true) {
+        result |= w->cancel(c);
+        if (!is_drain || w->running != c || sched::thread::current() == w->thread) {
+            break;
+        }
+        // Wait for the handler to return; it may re-arm the callout, which
+        // we cancel again.
         trace_callout_stop_wait(c);
-
-        sched::thread::wait_until(callouts::_callout_mutex, [&] {
-            return (c->c_flags & CALLOUT_COMPLETED);
-        });
-
-        result = 1;
+        w->drainers++;
+        while (w->running == c) {
+            w->done.wait(&w->lock);
+        }
+        w->drainers--;
     }
 
-    callouts::remove_callout(c);
-
-    // Clear flags
     c->c_flags &= ~(CALLOUT_ACTIVE | CALLOUT_PENDING | CALLOUT_COMPLETED);
-
-    return (result);
-}
-
-int _callout_stop_safe(struct callout *c, int is_drain)
-{
-    int result = 0;
-
-    callouts::lock();
-    result = _callout_stop_safe_locked(c, is_drain);
-    callouts::unlock();
+    w->lock.unlock();
 
     return (result);
 }
@@ -322,9 +422,12 @@ void callout_init_mtx(struct callout *c, struct mtx *mtx, int flags)
 
 void init_callouts(void)
 {
-    // Start the callout thread
-    callouts::_callout_dispatcher = sched::thread::make(_callout_thread,
-            sched::thread::attr().name("callout"));
-    callouts::_callout_dispatcher->start();
+    // Start a callout thread on every cpu
+    callouts::wheels.resize(sched::cpus.size());
+    for (auto cpu : sched::cpus) {
+        callouts::wheels[cpu->id] = aligned_new<callout_wheel>(cpu);
+    }
+    for (auto w : callouts::wheels) {
+        w->thread->start();
+    }
 }
-
@@ -1443,7 +1443,10 @@ zfs_mount(struct mount *mp, const char *dev, int flags, const void *data)
 	}
 
 	kprintf("zfs: mounting %s from device %s\n", osname, dev);
-	return zfs_domount(mp, osname);
+	error = zfs_domount(mp, osname);
+	if (error == 0)
+		mp->m_flags |= MNT_LOCAL;
+	return error;
 }
 
 static int
@@ -1033,6 +1033,13 @@ again:
 		n -= nbytes;
 	}
 
+	/*
+	 * v_size was raised before each chunk was copied in; if a chunk
+	 * failed, bring it back to the size the file actually has.
+	 */
+	if (vp->v_size != zp->z_size)
+		vnode_pager_setsize(vp, zp->z_size);
+
 	zfs_range_unlock(rl);
 
 	/*
@@ -5116,4 +5123,5 @@ struct vnops zfs_vnops = {
 	zfs_fallocate,			/* fallocate */
 	zfs_readlink,			/* read link */
 	zfs_symlink,			/* symbolic link */
+	VOP_SHARED_READ | VOP_SHARED_WRITE, /* range locked, see zfs_range_lock() */
 };
@@ -1663,17 +1663,11 @@ zfs_free_range(znode_t *zp, uint64_t off, uint64_t len)
 	if (off + len > zp->z_size)
 		len = zp->z_size - off;
 
+	/*
+	 * Punching a hole leaves z_size, and so v_size, unchanged.
+	 */
 	error = dmu_free_long_range(zfsvfs->z_os, zp->z_id, off, len);
 
-	if (error == 0) {
-		/*
-		 * In FreeBSD we cannot free block in the middle of a file,
-		 * but only at the end of a file, so this code path should
-		 * never happen.
-		 */
-		vnode_pager_setsize(ZTOV(zp), off);
-	}
-
 	zfs_range_unlock(rl);
 
 	return (error);
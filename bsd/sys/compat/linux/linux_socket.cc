@@ -58,6 +58,7 @@
 #include <bsd/sys/compat/linux/linux.h>
 #include <bsd/sys/compat/linux/linux_socket.h>
 #include <bsd/sys/compat/linux/linux_netlink.h>
+#include <bsd/sys/compat/linux/linux_vsock.h>
 #include <osv/stubbing.hh>
 
 #define __NEED_sa_family_t
@@ -260,6 +261,8 @@ linux_to_bsd_domain(int domain)
 		return (AF_APPLETALK);
 	case LINUX_AF_NETLINK:
 		return (AF_NETLINK);
+	case LINUX_AF_VSOCK:
+		return (AF_VSOCK);
 	}
 	return (-1);
 }
@@ -285,6 +288,8 @@ bsd_to_linux_domain(int domain)
 		return (LINUX_AF_APPLETALK);
 	case AF_NETLINK:
 		return (LINUX_AF_NETLINK);
+	case AF_VSOCK:
+		return (LINUX_AF_VSOCK);
 	}
 	return (-1);
 }
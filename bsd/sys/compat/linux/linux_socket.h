@@ -93,6 +93,7 @@
 #define	LINUX_AF_APPLETALK	5
 #define	LINUX_AF_INET6		10
 #define	LINUX_AF_NETLINK	16
+#define	LINUX_AF_VSOCK		40
 
 /* Supported socket types */
 
@@ -0,0 +1,1017 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+/*
+ * AF_VSOCK stream sockets on top of the virtio-vsock transport.
+ *
+ * Each socket has a vsockpcb whose mutex is also the socket lock, like
+ * inpcb for TCP. The tables of bound ports and of connections are
+ * protected by vsock_table_mtx, which may be taken while holding a pcb
+ * lock but never the other way around: the input path looks the pcb up and
+ * takes a reference under the table lock, and only locks the pcb after
+ * dropping it. A pcb is freed when its last reference goes away.
+ *
+ * Flow control follows the virtio-vsock credit scheme: every packet tells
+ * the peer the size of our receive buffer (buf_alloc) and how many bytes
+ * the application has consumed so far (fwd_cnt), and we never have more
+ * bytes in flight than the peer's buf_alloc. Data without credit waits in
+ * so_snd.
+ *
+ * When a connected socket is closed its pcb outlives it, holding the rest
+ * of so_snd, until that data was sent and the peer reset the connection,
+ * or until vsock_close_timeout passed.
+ */
+
+#include <osv/initialize.hh>
+#include <osv/mutex.h>
+#include <bsd/porting/netport.h>
+#include <bsd/porting/callout.h>
+
+#include <bsd/sys/sys/param.h>
+#include <bsd/sys/sys/domain.h>
+#include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/sys/protosw.h>
+#include <bsd/sys/sys/socket.h>
+#include <bsd/sys/sys/socketvar.h>
+
+#include <bsd/sys/compat/linux/linux_vsock.h>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <vector>
+
+/* Same defaults as Linux */
+static u_long vsock_sendspace = 256 * 1024;
+static u_long vsock_recvspace = 256 * 1024;
+static int vsock_connect_timeout = 2 * hz;
+static int vsock_close_timeout = 8 * hz;
+
+#define VSOCK_EPHEMERAL_FIRST	1024
+
+enum class vsock_state {
+	closed,
+	listen,
+	connecting,
+	connected,
+	closing,	/* we sent, or are about to send, our SHUTDOWN */
+};
+
+/*
+ * Locking key:
+ * (p) locked by vp_mtx
+ * (t) locked by vsock_table_mtx
+ */
+struct vsockpcb {
+	mutex		vp_mtx;
+	struct socket	*vp_socket = nullptr;	/* (p) nullptr once closed */
+	vsock_state	vp_state = vsock_state::closed;	/* (p) */
+	int		vp_refs = 1;		/* (t) the socket's, or the orphan's */
+	bool		vp_bound = false;	/* (t) in vsock_bound */
+	bool		vp_linked = false;	/* (t) in vsock_conns */
+	bool		vp_timed = false;	/* (t) vp_deadline is set */
+	int		vp_deadline = 0;	/* (p) connect or close timeout */
+	uint32_t	vp_lport = VMADDR_PORT_ANY;	/* (p) */
+	uint32_t	vp_fcid = VMADDR_CID_ANY;	/* (p) */
+	uint32_t	vp_fport = VMADDR_PORT_ANY;	/* (p) */
+	uint32_t	vp_peer_buf_alloc = 0;	/* (p) peer's receive buffer */
+	uint32_t	vp_peer_fwd_cnt = 0;	/* (p) bytes the peer consumed */
+	uint32_t	vp_tx_cnt = 0;		/* (p) bytes we sent */
+	uint32_t	vp_rx_cnt = 0;		/* (p) bytes we received */
+	uint32_t	vp_buf_alloc = 0;	/* (p) last buf_alloc we sent */
+	uint32_t	vp_fwd_cnt_sent = 0;	/* (p) last fwd_cnt we sent */
+	int		vp_shut_want = 0;	/* (p) SHUTDOWN flags to send */
+	int		vp_shut_sent = 0;	/* (p) SHUTDOWN flags sent */
+	int		vp_peer_shut = 0;	/* (p) SHUTDOWN flags received */
+	struct mbuf	*vp_linger = nullptr;	/* (p) unsent data of an orphan */
+	uint32_t	vp_linger_len = 0;	/* (p) */
+};
+
+#define	sotovsockpcb(so)	((struct vsockpcb *)(so)->so_pcb)
+
+typedef std::tuple<uint32_t, uint32_t, uint32_t> vsock_key; /* lport, fcid, fport */
+
+static mutex vsock_table_mtx;
+static std::map<uint32_t, vsockpcb*> vsock_bound;
+static std::map<vsock_key, vsockpcb*> vsock_conns;
+static uint32_t vsock_next_port = VSOCK_EPHEMERAL_FIRST;
+static struct callout vsock_callout;
+
+static vsock_transport *vsock_tp;
+
+void
+vsock_register_transport(vsock_transport *transport)
+{
+	vsock_tp = transport;
+}
+
+static uint32_t
+vsock_local_cid(void)
+{
+	return vsock_tp ? vsock_tp->get_local_cid() : VMADDR_CID_ANY;
+}
+
+static void
+vsock_pcb_rele(struct vsockpcb *vp)
+{
+	WITH_LOCK(vsock_table_mtx) {
+		if (--vp->vp_refs) {
+			return;
+		}
+	}
+	m_freem(vp->vp_linger);
+	delete vp;
+}
+
+/*
+ * Find the pcb a packet is for: the connection it belongs to, or else the
+ * socket bound to its destination port. Returns it with a reference held.
+ */
+static struct vsockpcb *
+vsock_lookup(uint32_t lport, uint32_t fcid, uint32_t fport)
+{
+	WITH_LOCK(vsock_table_mtx) {
+		struct vsockpcb *vp = nullptr;
+		auto c = vsock_conns.find(vsock_key(lport, fcid, fport));
+		if (c != vsock_conns.end()) {
+			vp = c->second;
+		} else {
+			auto b = vsock_bound.find(lport);
+			if (b != vsock_bound.end()) {
+				vp = b->second;
+			}
+		}
+		if (vp) {
+			vp->vp_refs++;
+		}
+		return vp;
+	}
+}
+
+static int
+vsock_bind_port(struct vsockpcb *vp, uint32_t port)
+{
+	WITH_LOCK(vsock_table_mtx) {
+		if (port == VMADDR_PORT_ANY) {
+			auto first = vsock_next_port;
+			do {
+				port = vsock_next_port++;
+				if (vsock_next_port == VMADDR_PORT_ANY) {
+					vsock_next_port = VSOCK_EPHEMERAL_FIRST;
+				}
+				if (vsock_next_port == first) {
+					return EADDRNOTAVAIL;
+				}
+			} while (vsock_bound.count(port));
+		} else if (vsock_bound.count(port)) {
+			return EADDRINUSE;
+		}
+		vsock_bound[port] = vp;
+		vp->vp_lport = port;
+		vp->vp_bound = true;
+	}
+	return 0;
+}
+
+static void
+vsock_unbind(struct vsockpcb *vp)
+{
+	WITH_LOCK(vsock_table_mtx) {
+		if (vp->vp_bound) {
+			vsock_bound.erase(vp->vp_lport);
+			vp->vp_bound = false;
+		}
+	}
+}
+
+static bool
+vsock_link(struct vsockpcb *vp)
+{
+	WITH_LOCK(vsock_table_mtx) {
+		auto key = vsock_key(vp->vp_lport, vp->vp_fcid, vp->vp_fport);
+		if (!vsock_conns.emplace(key, vp).second) {
+			return false;
+		}
+		vp->vp_linked = true;
+	}
+	return true;
+}
+
+static void
+vsock_unlink(struct vsockpcb *vp)
+{
+	WITH_LOCK(vsock_table_mtx) {
+		if (vp->vp_linked) {
+			vsock_conns.erase(vsock_key(vp->vp_lport, vp->vp_fcid, vp->vp_fport));
+			vp->vp_linked = false;
+		}
+		vp->vp_timed = false;
+	}
+}
+
+static void vsock_timer(void *arg);
+
+static void
+vsock_set_timer(struct vsockpcb *vp, int timeout)
+{
+	vp->vp_deadline = bsd_ticks + timeout;
+	WITH_LOCK(vsock_table_mtx) {
+		vp->vp_timed = true;
+		if (!callout_pending(&vsock_callout)) {
+			callout_reset(&vsock_callout, hz, vsock_timer, NULL);
+		}
+	}
+}
+
+static void
+vsock_clear_timer(struct vsockpcb *vp)
+{
+	WITH_LOCK(vsock_table_mtx) {
+		vp->vp_timed = false;
+	}
+}
+
+static struct bsd_sockaddr *
+vsock_mkaddr(uint32_t cid, uint32_t port)
+{
+	struct bsd_sockaddr_vm *svm;
+
+	svm = (bsd_sockaddr_vm *)malloc(sizeof *svm);
+	bzero(svm, sizeof *svm);
+	svm->svm_len = sizeof(*svm);
+	svm->svm_family = AF_VSOCK;
+	svm->svm_cid = cid;
+	svm->svm_port = port;
+	return (struct bsd_sockaddr *)svm;
+}
+
+static int
+vsock_check_addr(struct bsd_sockaddr *nam, struct bsd_sockaddr_vm **svm)
+{
+	if (nam->sa_len < sizeof(struct bsd_sockaddr_vm)) {
+		return EINVAL;
+	}
+	if (nam->sa_family != AF_VSOCK) {
+		return EAFNOSUPPORT;
+	}
+	*svm = (struct bsd_sockaddr_vm *)nam;
+	return 0;
+}
+
+/*
+ * Credit we advertise: the receive buffer size and how much of what we
+ * received the application has read. An orphan reads everything.
+ */
+static void
+vsock_update_credit(struct vsockpcb *vp)
+{
+	struct socket *so = vp->vp_socket;
+	if (so) {
+		vp->vp_buf_alloc = so->so_rcv.sb_hiwat;
+	}
+}
+
+static uint32_t
+vsock_fwd_cnt(struct vsockpcb *vp)
+{
+	struct socket *so = vp->vp_socket;
+	return vp->vp_rx_cnt - (so ? so->so_rcv.sb_cc : 0);
+}
+
+static uint32_t
+vsock_peer_credit(struct vsockpcb *vp)
+{
+	uint32_t in_flight = vp->vp_tx_cnt - vp->vp_peer_fwd_cnt;
+	return in_flight < vp->vp_peer_buf_alloc ? vp->vp_peer_buf_alloc - in_flight : 0;
+}
+
+static void
+vsock_send(struct vsockpcb *vp, uint16_t op, uint32_t flags = 0,
+    struct mbuf *m = nullptr, uint32_t len = 0)
+{
+	struct virtio_vsock_hdr hdr = {};
+
+	vsock_update_credit(vp);
+	hdr.src_cid = vsock_local_cid();
+	hdr.dst_cid = vp->vp_fcid;
+	hdr.src_port = vp->vp_lport;
+	hdr.dst_port = vp->vp_fport;
+	hdr.len = len;
+	hdr.type = VIRTIO_VSOCK_TYPE_STREAM;
+	hdr.op = op;
+	hdr.flags = flags;
+	hdr.buf_alloc = vp->vp_buf_alloc;
+	hdr.fwd_cnt = vp->vp_fwd_cnt_sent = vsock_fwd_cnt(vp);
+	vsock_tp->send(hdr, m);
+}
+
+/* Answer a packet nobody wants with a reset */
+static void
+vsock_reply_rst(const struct virtio_vsock_hdr& in)
+{
+	struct virtio_vsock_hdr hdr = {};
+
+	if (in.op == VIRTIO_VSOCK_OP_RST || !vsock_tp) {
+		return;
+	}
+	hdr.src_cid = in.dst_cid;
+	hdr.dst_cid = in.src_cid;
+	hdr.src_port = in.dst_port;
+	hdr.dst_port = in.src_port;
+	hdr.type = in.type;
+	hdr.op = VIRTIO_VSOCK_OP_RST;
+	vsock_tp->send(hdr, nullptr);
+}
+
+/*
+ * Send as much of the pending data as the peer has credit for, then the
+ * SHUTDOWN we owe it once everything went out.
+ */
+static void
+vsock_output(struct vsockpcb *vp)
+{
+	struct socket *so = vp->vp_socket;
+	bool sent = false;
+
+	for (;;) {
+		uint32_t pending = so ? so->so_snd.sb_cc : vp->vp_linger_len;
+		uint32_t len = std::min({pending, vsock_peer_credit(vp),
+		    (uint32_t)VIRTIO_VSOCK_MAX_PKT_BUF_SIZE});
+		if (len == 0) {
+			break;
+		}
+		/* Retried on the next send or credit update if this fails */
+		struct mbuf *m = m_copym(so ? so->so_snd.sb_mb : vp->vp_linger, 0, len, M_NOWAIT);
+		if (m == NULL) {
+			break;
+		}
+		if (so) {
+			sbdrop_locked(so, &so->so_snd, len);
+		} else {
+			m_adj(vp->vp_linger, len);
+			vp->vp_linger_len -= len;
+			while (vp->vp_linger && vp->vp_linger->m_hdr.mh_len == 0) {
+				vp->vp_linger = m_free(vp->vp_linger);
+			}
+		}
+		vsock_send(vp, VIRTIO_VSOCK_OP_RW, 0, m, len);
+		vp->vp_tx_cnt += len;
+		sent = true;
+	}
+	if (sent && so) {
+		sowwakeup_locked(so);
+	}
+
+	uint32_t pending = so ? so->so_snd.sb_cc : vp->vp_linger_len;
+	if (pending == 0 && (vp->vp_shut_want & ~vp->vp_shut_sent)) {
+		vp->vp_shut_sent |= vp->vp_shut_want;
+		vsock_send(vp, VIRTIO_VSOCK_OP_SHUTDOWN, vp->vp_shut_sent);
+	}
+}
+
+/*
+ * The connection is over. Returns the number of references the caller has
+ * to release once it dropped the pcb lock.
+ */
+static int
+vsock_close(struct vsockpcb *vp)
+{
+	vsock_unlink(vp);
+	vp->vp_state = vsock_state::closed;
+	if (struct socket *so = vp->vp_socket) {
+		/* This may free the socket, which then detaches from vp */
+		soisdisconnected(so);
+		return 0;
+	}
+	/* An orphan, drop the reference it held on itself */
+	return 1;
+}
+
+static void
+vsock_input_listen(struct vsockpcb *head, const struct virtio_vsock_hdr& hdr)
+{
+	struct socket *so;
+	struct vsockpcb *vp;
+	bool linked;
+
+	if (hdr.op != VIRTIO_VSOCK_OP_REQUEST || !head->vp_socket ||
+	    (so = sonewconn(head->vp_socket, 0)) == NULL) {
+		vsock_reply_rst(hdr);
+		return;
+	}
+	vp = sotovsockpcb(so);
+	WITH_LOCK(vp->vp_mtx) {
+		vp->vp_lport = head->vp_lport;
+		vp->vp_fcid = hdr.src_cid;
+		vp->vp_fport = hdr.src_port;
+		vp->vp_peer_buf_alloc = hdr.buf_alloc;
+		vp->vp_peer_fwd_cnt = hdr.fwd_cnt;
+		/* Only this thread creates connections on a listening port */
+		linked = vsock_link(vp);
+		if (linked) {
+			vp->vp_state = vsock_state::connected;
+			vsock_send(vp, VIRTIO_VSOCK_OP_RESPONSE);
+		}
+	}
+	if (!linked) {
+		/*
+		 * The connection already exists, refuse the request and
+		 * take the new socket off the listen queue to free it.
+		 */
+		vsock_reply_rst(hdr);
+		ACCEPT_LOCK();
+		TAILQ_REMOVE(&head->vp_socket->so_incomp, so, so_list);
+		head->vp_socket->so_incqlen--;
+		so->so_qstate &= ~SQ_INCOMP;
+		so->so_head = NULL;
+		ACCEPT_UNLOCK();
+		soabort(so);
+		return;
+	}
+	/* Moves the socket to the accept queue, and drops the lock */
+	SOCK_LOCK(so);
+	soisconnected(so);
+}
+
+static int
+vsock_input_connecting(struct vsockpcb *vp, const struct virtio_vsock_hdr& hdr)
+{
+	struct socket *so = vp->vp_socket;
+
+	switch (hdr.op) {
+	case VIRTIO_VSOCK_OP_RESPONSE:
+		vsock_clear_timer(vp);
+		vp->vp_state = vsock_state::connected;
+		soisconnected(so);
+		return 0;
+	case VIRTIO_VSOCK_OP_RST:
+		so->so_error = ECONNRESET;
+		return vsock_close(vp);
+	default:
+		vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+		so->so_error = EPROTO;
+		return vsock_close(vp);
+	}
+}
+
+static int
+vsock_input_connected(struct vsockpcb *vp, const struct virtio_vsock_hdr& hdr,
+    struct mbuf *&m)
+{
+	struct socket *so = vp->vp_socket;
+
+	switch (hdr.op) {
+	case VIRTIO_VSOCK_OP_RW:
+		if (!so || (so->so_rcv.sb_state & SBS_CANTRCVMORE)) {
+			/* Nobody is going to read it */
+			vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+			return vsock_close(vp);
+		}
+		if (m) {
+			vp->vp_rx_cnt += hdr.len;
+			sbappendstream_locked(so, &so->so_rcv, m);
+			m = NULL;
+			sorwakeup_locked(so);
+		}
+		break;
+	case VIRTIO_VSOCK_OP_CREDIT_UPDATE:
+		break;
+	case VIRTIO_VSOCK_OP_CREDIT_REQUEST:
+		vsock_send(vp, VIRTIO_VSOCK_OP_CREDIT_UPDATE);
+		break;
+	case VIRTIO_VSOCK_OP_SHUTDOWN:
+		vp->vp_peer_shut |= hdr.flags &
+		    (VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND);
+		if (vp->vp_peer_shut & VIRTIO_VSOCK_SHUTDOWN_RCV) {
+			/* Whatever we did not send yet is of no use anymore */
+			if (so) {
+				sbdrop_locked(so, &so->so_snd, so->so_snd.sb_cc);
+				socantsendmore_locked(so);
+			} else {
+				m_freem(vp->vp_linger);
+				vp->vp_linger = NULL;
+				vp->vp_linger_len = 0;
+			}
+		}
+		if (so && (vp->vp_peer_shut & VIRTIO_VSOCK_SHUTDOWN_SEND)) {
+			socantrcvmore_locked(so);
+		}
+		if (vp->vp_peer_shut == (VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND)) {
+			/* Like Linux, confirm the end of the connection with a reset */
+			vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+			return vsock_close(vp);
+		}
+		break;
+	case VIRTIO_VSOCK_OP_RST:
+		/* Not an error, the peer closes connections this way too */
+		return vsock_close(vp);
+	default:
+		vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+		if (so) {
+			so->so_error = EPROTO;
+		}
+		return vsock_close(vp);
+	}
+	/* Any packet may have brought more credit */
+	vsock_output(vp);
+	return 0;
+}
+
+static int
+vsock_input_locked(struct vsockpcb *vp, const struct virtio_vsock_hdr& hdr,
+    struct mbuf *&m)
+{
+	if (vp->vp_state == vsock_state::listen) {
+		vsock_input_listen(vp, hdr);
+		return 0;
+	}
+	/* A socket bound to the port but connected elsewhere, or closed */
+	if (!vp->vp_linked || vp->vp_fcid != hdr.src_cid || vp->vp_fport != hdr.src_port) {
+		vsock_reply_rst(hdr);
+		return 0;
+	}
+	vp->vp_peer_buf_alloc = hdr.buf_alloc;
+	vp->vp_peer_fwd_cnt = hdr.fwd_cnt;
+	if (vp->vp_state == vsock_state::connecting) {
+		return vsock_input_connecting(vp, hdr);
+	}
+	return vsock_input_connected(vp, hdr, m);
+}
+
+void
+vsock_input(const struct virtio_vsock_hdr& hdr, struct mbuf *m)
+{
+	struct vsockpcb *vp;
+	int rele = 1;
+
+	if (hdr.dst_cid != vsock_local_cid()) {
+		m_freem(m);
+		return;
+	}
+	if (hdr.type != VIRTIO_VSOCK_TYPE_STREAM ||
+	    (vp = vsock_lookup(hdr.dst_port, hdr.src_cid, hdr.src_port)) == NULL) {
+		vsock_reply_rst(hdr);
+		m_freem(m);
+		return;
+	}
+	WITH_LOCK(vp->vp_mtx) {
+		rele += vsock_input_locked(vp, hdr, m);
+	}
+	m_freem(m);
+	while (rele--) {
+		vsock_pcb_rele(vp);
+	}
+}
+
+/*
+ * Returns the number of references to release, or -1 if the timeout did
+ * not expire yet.
+ */
+static int
+vsock_timeout(struct vsockpcb *vp)
+{
+	if (vp->vp_state != vsock_state::connecting &&
+	    vp->vp_state != vsock_state::closing) {
+		return 0;
+	}
+	if ((int)(bsd_ticks - vp->vp_deadline) < 0) {
+		return -1;
+	}
+	vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+	if (vp->vp_socket) {
+		vp->vp_socket->so_error = ETIMEDOUT;
+	}
+	return vsock_close(vp);
+}
+
+/* Runs every second while some connection waits for a connect or close timeout */
+static void
+vsock_timer(void *arg)
+{
+	std::vector<struct vsockpcb *> timed;
+	bool rearm = false;
+
+	WITH_LOCK(vsock_table_mtx) {
+		for (auto& c : vsock_conns) {
+			if (c.second->vp_timed) {
+				c.second->vp_refs++;
+				timed.push_back(c.second);
+			}
+		}
+	}
+	for (auto vp : timed) {
+		int rele = 1, ret;
+		WITH_LOCK(vp->vp_mtx) {
+			ret = vsock_timeout(vp);
+		}
+		if (ret < 0) {
+			rearm = true;
+		} else {
+			rele += ret;
+		}
+		while (rele--) {
+			vsock_pcb_rele(vp);
+		}
+	}
+	if (rearm) {
+		WITH_LOCK(vsock_table_mtx) {
+			if (!callout_pending(&vsock_callout)) {
+				callout_reset(&vsock_callout, hz, vsock_timer, NULL);
+			}
+		}
+	}
+}
+
+void
+vsock_transport_reset(void)
+{
+	std::vector<struct vsockpcb *> conns;
+
+	WITH_LOCK(vsock_table_mtx) {
+		for (auto& c : vsock_conns) {
+			c.second->vp_refs++;
+			conns.push_back(c.second);
+		}
+	}
+	for (auto vp : conns) {
+		int rele = 1;
+		WITH_LOCK(vp->vp_mtx) {
+			if (vp->vp_linked) {
+				if (vp->vp_socket) {
+					vp->vp_socket->so_error = ECONNRESET;
+				}
+				rele += vsock_close(vp);
+			}
+		}
+		while (rele--) {
+			vsock_pcb_rele(vp);
+		}
+	}
+}
+
+static void
+vsock_init(void)
+{
+	mutex_init(&vsock_table_mtx);
+	callout_init(&vsock_callout, CALLOUT_MPSAFE);
+}
+
+static void
+vsock_abort(struct socket *so)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+
+	WITH_LOCK(vp->vp_mtx) {
+		if (vp->vp_linked) {
+			vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+			vsock_unlink(vp);
+		}
+		vp->vp_state = vsock_state::closed;
+	}
+}
+
+static int
+vsock_accept(struct socket *so, struct bsd_sockaddr **nam)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	uint32_t cid, port;
+
+	if (so->so_state & SS_ISDISCONNECTED) {
+		return ECONNABORTED;
+	}
+	WITH_LOCK(vp->vp_mtx) {
+		cid = vp->vp_fcid;
+		port = vp->vp_fport;
+	}
+	*nam = vsock_mkaddr(cid, port);
+	return 0;
+}
+
+static int
+vsock_attach(struct socket *so, int proto, struct thread *td)
+{
+	struct vsockpcb *vp;
+	int error;
+
+	KASSERT(so->so_pcb == NULL, ("vsock_attach: so_pcb != NULL"));
+
+	if (so->so_snd.sb_hiwat == 0 || so->so_rcv.sb_hiwat == 0) {
+		error = soreserve_internal(so, vsock_sendspace, vsock_recvspace);
+		if (error) {
+			return error;
+		}
+	}
+	vp = new vsockpcb;
+	vp->vp_socket = so;
+	so->so_pcb = (caddr_t)vp;
+	so->set_mutex(&vp->vp_mtx);
+	return 0;
+}
+
+static int
+vsock_bind(struct socket *so, struct bsd_sockaddr *nam, struct thread *td)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	struct bsd_sockaddr_vm *svm;
+	int error;
+
+	if ((error = vsock_check_addr(nam, &svm))) {
+		return error;
+	}
+	if (svm->svm_cid != VMADDR_CID_ANY && svm->svm_cid != vsock_local_cid()) {
+		return EADDRNOTAVAIL;
+	}
+	WITH_LOCK(vp->vp_mtx) {
+		if (vp->vp_bound || vp->vp_state != vsock_state::closed) {
+			return EINVAL;
+		}
+		return vsock_bind_port(vp, svm->svm_port);
+	}
+}
+
+static int
+vsock_connect(struct socket *so, struct bsd_sockaddr *nam, struct thread *td)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	struct bsd_sockaddr_vm *svm;
+	int error;
+
+	if ((error = vsock_check_addr(nam, &svm))) {
+		return error;
+	}
+	if (!vsock_tp) {
+		return ENODEV;
+	}
+	/* There is no loopback transport, only the host can be reached */
+	if (svm->svm_cid == VMADDR_CID_ANY || svm->svm_cid == VMADDR_CID_LOCAL ||
+	    svm->svm_cid == vsock_local_cid()) {
+		return ENETUNREACH;
+	}
+	WITH_LOCK(vp->vp_mtx) {
+		switch (vp->vp_state) {
+		case vsock_state::closed:
+			break;
+		case vsock_state::connecting:
+			return EALREADY;
+		case vsock_state::connected:
+			return EISCONN;
+		default:
+			return EINVAL;
+		}
+		if (!vp->vp_bound && (error = vsock_bind_port(vp, VMADDR_PORT_ANY))) {
+			return error;
+		}
+		vp->vp_fcid = svm->svm_cid;
+		vp->vp_fport = svm->svm_port;
+		vp->vp_peer_buf_alloc = vp->vp_peer_fwd_cnt = 0;
+		vp->vp_tx_cnt = vp->vp_rx_cnt = 0;
+		vp->vp_shut_want = vp->vp_shut_sent = vp->vp_peer_shut = 0;
+		if (!vsock_link(vp)) {
+			return EADDRINUSE;
+		}
+		vp->vp_state = vsock_state::connecting;
+		soisconnecting(so);
+		vsock_set_timer(vp, vsock_connect_timeout);
+		vsock_send(vp, VIRTIO_VSOCK_OP_REQUEST);
+	}
+	return 0;
+}
+
+static void
+vsock_detach(struct socket *so)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	bool orphan = false;
+
+	KASSERT(vp != NULL, ("vsock_detach: vp == NULL"));
+
+	WITH_LOCK(vp->vp_mtx) {
+		vsock_unbind(vp);
+		switch (vp->vp_state) {
+		case vsock_state::connected:
+		case vsock_state::closing:
+			/*
+			 * Keep the connection until the rest of the data went
+			 * out and the peer reset it. so_snd is about to be
+			 * destroyed, so take our own reference to its data.
+			 */
+			if (so->so_snd.sb_cc) {
+				vp->vp_linger = m_copym(so->so_snd.sb_mb, 0, M_COPYALL, M_NOWAIT);
+				vp->vp_linger_len = vp->vp_linger ? so->so_snd.sb_cc : 0;
+			}
+			vp->vp_socket = nullptr;
+			vp->vp_state = vsock_state::closing;
+			vp->vp_shut_want = VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND;
+			vsock_set_timer(vp, vsock_close_timeout);
+			vsock_output(vp);
+			orphan = true;
+			break;
+		case vsock_state::connecting:
+			vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+			/* fall through */
+		default:
+			vp->vp_socket = nullptr;
+			vsock_unlink(vp);
+			vp->vp_state = vsock_state::closed;
+			break;
+		}
+		so->so_pcb = NULL;
+	}
+	if (!orphan) {
+		vsock_pcb_rele(vp);
+	}
+}
+
+static int
+vsock_disconnect(struct socket *so)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	int rele = 0;
+
+	WITH_LOCK(vp->vp_mtx) {
+		switch (vp->vp_state) {
+		case vsock_state::connected:
+			vp->vp_state = vsock_state::closing;
+			vp->vp_shut_want = VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND;
+			soisdisconnecting(so);
+			vsock_output(vp);
+			break;
+		case vsock_state::closing:
+			break;
+		case vsock_state::connecting:
+			vsock_send(vp, VIRTIO_VSOCK_OP_RST);
+			rele = vsock_close(vp);
+			break;
+		default:
+			return ENOTCONN;
+		}
+	}
+	assert(rele == 0);
+	return 0;
+}
+
+static int
+vsock_listen(struct socket *so, int backlog, struct thread *td)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	int error;
+
+	WITH_LOCK(vp->vp_mtx) {
+		if (!vp->vp_bound) {
+			return EINVAL;
+		}
+		if (vp->vp_state != vsock_state::closed && vp->vp_state != vsock_state::listen) {
+			return EINVAL;
+		}
+		if ((error = solisten_proto_check(so))) {
+			return error;
+		}
+		vp->vp_state = vsock_state::listen;
+		solisten_proto(so, backlog);
+	}
+	return 0;
+}
+
+static int
+vsock_peeraddr(struct socket *so, struct bsd_sockaddr **nam)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	uint32_t cid, port;
+
+	WITH_LOCK(vp->vp_mtx) {
+		if (vp->vp_fport == VMADDR_PORT_ANY) {
+			return ENOTCONN;
+		}
+		cid = vp->vp_fcid;
+		port = vp->vp_fport;
+	}
+	*nam = vsock_mkaddr(cid, port);
+	return 0;
+}
+
+/* The application read from so_rcv, tell the peer once it freed enough */
+static int
+vsock_rcvd(struct socket *so, int flags)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+
+	WITH_LOCK(vp->vp_mtx) {
+		if (vp->vp_state != vsock_state::connected &&
+		    vp->vp_state != vsock_state::closing) {
+			return 0;
+		}
+		if (vsock_fwd_cnt(vp) - vp->vp_fwd_cnt_sent >= so->so_rcv.sb_hiwat / 4) {
+			vsock_send(vp, VIRTIO_VSOCK_OP_CREDIT_UPDATE);
+		}
+	}
+	return 0;
+}
+
+static int
+vsock_usr_send(struct socket *so, int flags, struct mbuf *m, struct bsd_sockaddr *nam,
+    struct mbuf *control, struct thread *td)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+
+	if (control) {
+		m_freem(control);
+		m_freem(m);
+		return EINVAL;
+	}
+	WITH_LOCK(vp->vp_mtx) {
+		if (vp->vp_state != vsock_state::connected) {
+			m_freem(m);
+			return vp->vp_state == vsock_state::connecting ? ENOTCONN : EPIPE;
+		}
+		sbappendstream_locked(so, &so->so_snd, m);
+		vsock_output(vp);
+	}
+	return 0;
+}
+
+static int
+vsock_shutdown(struct socket *so)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+
+	WITH_LOCK(vp->vp_mtx) {
+		socantsendmore_locked(so);
+		if (vp->vp_state == vsock_state::connected) {
+			vp->vp_shut_want |= VIRTIO_VSOCK_SHUTDOWN_SEND;
+			vsock_output(vp);
+		}
+	}
+	return 0;
+}
+
+static int
+vsock_sockaddr(struct socket *so, struct bsd_sockaddr **nam)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+	uint32_t port;
+
+	WITH_LOCK(vp->vp_mtx) {
+		port = vp->vp_lport;
+	}
+	*nam = vsock_mkaddr(vsock_local_cid(), port);
+	return 0;
+}
+
+static void
+vsock_usr_close(struct socket *so)
+{
+	struct vsockpcb *vp = sotovsockpcb(so);
+
+	/*
+	 * Stop accepting connections before soclose() takes the accept lock
+	 * and then the socket lock, the reverse of the order input uses.
+	 */
+	WITH_LOCK(vp->vp_mtx) {
+		if (vp->vp_state == vsock_state::listen) {
+			vsock_unbind(vp);
+			vp->vp_state = vsock_state::closed;
+		}
+	}
+}
+
+static struct pr_usrreqs vsock_usrreqs = initialize_with([] (pr_usrreqs& x) {
+	x.pru_abort =		vsock_abort;
+	x.pru_accept =		vsock_accept;
+	x.pru_attach =		vsock_attach;
+	x.pru_bind =		vsock_bind;
+	x.pru_connect =		vsock_connect;
+	x.pru_detach =		vsock_detach;
+	x.pru_disconnect =	vsock_disconnect;
+	x.pru_listen =		vsock_listen;
+	x.pru_peeraddr =	vsock_peeraddr;
+	x.pru_rcvd =		vsock_rcvd;
+	x.pru_send =		vsock_usr_send;
+	x.pru_shutdown =	vsock_shutdown;
+	x.pru_sockaddr =	vsock_sockaddr;
+	x.pru_close =		vsock_usr_close;
+});
+
+extern struct domain vsockdomain;
+
+static struct protosw vsocksw[] = {
+	initialize_with([] (protosw& x) {
+	x.pr_type =		SOCK_STREAM;
+	x.pr_domain =		&vsockdomain;
+	x.pr_flags =		PR_CONNREQUIRED|PR_WANTRCVD;
+	x.pr_init =		vsock_init;
+	x.pr_usrreqs =		&vsock_usrreqs;
+	}),
+};
+
+struct domain vsockdomain = initialize_with([] (domain& x) {
+	x.dom_family =		PF_VSOCK;
+	x.dom_name =		"vsock";
+	x.dom_protosw =		vsocksw;
+	x.dom_protoswNPROTOSW =	&vsocksw[sizeof(vsocksw)/sizeof(vsocksw[0])];
+});
+
+VNET_DOMAIN_SET(vsock);
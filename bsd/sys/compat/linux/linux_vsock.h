@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef _LINUX_VSOCK_H_
+#define _LINUX_VSOCK_H_
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+struct mbuf;
+
+/* Domain ID for supporting VSOCK sockets on FreeBSD (actually 40 on Linux) */
+#define AF_VSOCK		AF_VENDOR01
+#define PF_VSOCK		AF_VSOCK
+
+#define VMADDR_CID_ANY		-1U
+#define VMADDR_PORT_ANY		-1U
+#define VMADDR_CID_HYPERVISOR	0
+#define VMADDR_CID_LOCAL	1
+#define VMADDR_CID_HOST		2
+
+/* Same layout as Linux struct sockaddr_vm once the family is converted */
+struct bsd_sockaddr_vm {
+	uint8_t		svm_len;
+	uint8_t		svm_family;
+	uint16_t	svm_reserved1;
+	uint32_t	svm_port;
+	uint32_t	svm_cid;
+	uint8_t		svm_flags;
+	uint8_t		svm_zero[3];
+};
+
+/* Header of every virtio-vsock packet, all fields are little-endian */
+struct virtio_vsock_hdr {
+	uint64_t	src_cid;
+	uint64_t	dst_cid;
+	uint32_t	src_port;
+	uint32_t	dst_port;
+	uint32_t	len;
+	uint16_t	type;
+	uint16_t	op;
+	uint32_t	flags;
+	uint32_t	buf_alloc;
+	uint32_t	fwd_cnt;
+} __attribute__((packed));
+
+#define VIRTIO_VSOCK_TYPE_STREAM	1
+
+#define VIRTIO_VSOCK_OP_INVALID		0
+#define VIRTIO_VSOCK_OP_REQUEST		1
+#define VIRTIO_VSOCK_OP_RESPONSE	2
+#define VIRTIO_VSOCK_OP_RST		3
+#define VIRTIO_VSOCK_OP_SHUTDOWN	4
+#define VIRTIO_VSOCK_OP_RW		5
+#define VIRTIO_VSOCK_OP_CREDIT_UPDATE	6
+#define VIRTIO_VSOCK_OP_CREDIT_REQUEST	7
+
+/* Flags of VIRTIO_VSOCK_OP_SHUTDOWN */
+#define VIRTIO_VSOCK_SHUTDOWN_RCV	1
+#define VIRTIO_VSOCK_SHUTDOWN_SEND	2
+
+/* Largest payload of a single packet the host accepts */
+#define VIRTIO_VSOCK_MAX_PKT_BUF_SIZE	(64 * 1024)
+
+/*
+ * The device side of AF_VSOCK. The virtio-vsock driver registers itself
+ * with vsock_register_transport() and hands every received packet to
+ * vsock_input(). There is at most one transport, the one to the host.
+ */
+class vsock_transport {
+public:
+	virtual ~vsock_transport() {}
+	virtual uint64_t get_local_cid() = 0;
+	/*
+	 * Queue a packet for the host. Takes ownership of the payload m
+	 * (nullptr for control packets), whose length must be hdr.len.
+	 * Never blocks: if the ring is full the packet waits in the driver.
+	 */
+	virtual void send(const virtio_vsock_hdr& hdr, struct mbuf* m) = 0;
+};
+
+void vsock_register_transport(vsock_transport* transport);
+/* Takes ownership of m, which holds exactly hdr.len bytes of payload */
+void vsock_input(const virtio_vsock_hdr& hdr, struct mbuf* m);
+/* The host dropped all connections, e.g. after a live migration */
+void vsock_transport_reset(void);
+
+#endif /* _LINUX_VSOCK_H_ */
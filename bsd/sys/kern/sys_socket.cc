@@ -39,9 +39,12 @@
 #include <osv/socket.hh>
 #include <osv/initialize.hh>
 #include <osv/poll.h>
+#include <osv/vfs_file.hh>
+#include <osv/pagecache.hh>
 
 #include <bsd/sys/sys/libkern.h>
 #include <bsd/sys/sys/param.h>
+#include <bsd/sys/sys/mbuf.h>
 #include <bsd/sys/sys/protosw.h>
 #include <bsd/sys/sys/socket.h>
 #include <bsd/sys/sys/socketvar.h>
@@ -56,6 +59,7 @@
 #include <bsd/sys/netinet/tcp_fsm.h>
 
 #include <mutex>
+#include <algorithm>
 
 using namespace std;
 
@@ -99,6 +103,102 @@ socket_file::write(struct uio *uio, int flags)
     return (error);
 }
 
+static void
+sendfile_ext_free(void *handle, void *unused)
+{
+    pagecache::unpin(handle);
+}
+
+/*
+ * sendfile() to a stream socket: the page cache pages holding the file data
+ * are attached to mbufs as external storage, and stay pinned until the
+ * stack frees the mbufs once the data is acknowledged. Pages the page cache
+ * cannot provide are read into page sized clusters. sosend() takes a chain
+ * as a whole, so each chain is kept within the free space of the send
+ * buffer. Returns EOPNOTSUPP if the caller should use the generic path, and
+ * no error once some data has been sent.
+ */
+int
+socket_file::sendfile(struct file *in_fp, off_t offset, size_t count, size_t *sent)
+{
+    constexpr unsigned max_pages = 16;
+    void *pages[max_pages];
+    void *handles[max_pages];
+
+    *sent = 0;
+    if (so->so_type != SOCK_STREAM || in_fp->f_type != DTYPE_VNODE)
+        return (EOPNOTSUPP);
+
+    while (*sent < count) {
+        off_t off = offset + *sent;
+        size_t skip = off % mmu::page_size;
+        size_t len = std::min(count - *sent, max_pages * mmu::page_size - skip);
+        /* A chain larger than the free space blocks (or fails with
+         * EWOULDBLOCK) until all of it fits, and with EMSGSIZE if it can
+         * never fit */
+        SOCK_LOCK(so);
+        long space = sbspace(&so->so_snd);
+        long hiwat = so->so_snd.sb_hiwat;
+        SOCK_UNLOCK(so);
+        size_t limit = std::min(hiwat, std::max(space, long(mmu::page_size)));
+        if (limit == 0)
+            return (*sent ? 0 : EMSGSIZE);
+        len = std::min(len, limit);
+        unsigned npages = (skip + len + mmu::page_size - 1) / mmu::page_size;
+        unsigned pinned = pagecache::pin(static_cast<vfs_file *>(in_fp),
+            off - skip, npages, pages, handles);
+
+        struct mbuf *top = nullptr, **mp = &top;
+        size_t chain_len = 0;
+        int error = 0;
+        unsigned i;
+        for (i = 0; i < npages; i++) {
+            size_t page_off = i ? 0 : skip;
+            size_t n = std::min(mmu::page_size - page_off, len - chain_len);
+            struct mbuf *m;
+            if (i < pinned) {
+                m = i ? m_get(M_WAITOK, MT_DATA) : m_gethdr(M_WAITOK, MT_DATA);
+                m_extadd(m, (caddr_t)pages[i], mmu::page_size, sendfile_ext_free,
+                    handles[i], nullptr, M_RDONLY, EXT_MOD_TYPE);
+                if (!(m->m_hdr.mh_flags & M_EXT)) {
+                    m_free(m);
+                    error = ENOBUFS;
+                    break;
+                }
+                m->m_hdr.mh_data = (caddr_t)pages[i] + page_off;
+            } else {
+                m = m_getjcl(M_WAITOK, MT_DATA, i ? 0 : M_PKTHDR, MJUMPAGESIZE);
+                struct iovec iov = { mtod(m, void *), n };
+                struct uio uio = { &iov, 1, off_t(off + chain_len), ssize_t(n), UIO_READ };
+                error = in_fp->read(&uio, FOF_OFFSET);
+                n -= uio.uio_resid;
+                if (error || !n) {
+                    m_free(m);
+                    break;
+                }
+            }
+            m->m_hdr.mh_len = n;
+            *mp = m;
+            mp = &m->m_hdr.mh_next;
+            chain_len += n;
+        }
+        for (; i < pinned; i++)
+            pagecache::unpin(handles[i]);
+
+        if (!top)
+            return (*sent ? 0 : error);
+        top->M_dat.MH.MH_pkthdr.len = chain_len;
+        /* sosend() consumes the chain even when it fails */
+        int send_error = sosend(so, nullptr, nullptr, top, nullptr, 0, nullptr);
+        if (send_error)
+            return (*sent ? 0 : send_error);
+        *sent += chain_len;
+        if (error || chain_len < len)
+            return (*sent ? 0 : error);
+    }
+    return (0);
+}
+
 int
 socket_file::truncate(off_t length)
 {
@@ -62,6 +62,7 @@ struct if_data {
                                 * be sent due to a lack of free space
                                 * on a HW ring
                                 */
+    u_long  ifi_ilro_merged;/* Rx segments coalesced into a previous one */
     wakeup_stats ifi_iwakeup_stats; /* Rx BH wakeup statistics */
     wakeup_stats ifi_owakeup_stats; /* Tx BH wakeup statistics */
 };
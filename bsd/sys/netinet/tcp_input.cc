@@ -91,6 +91,7 @@
 #include <osv/poll.h>
 #include <osv/net_trace.hh>
 #include <osv/aligned_new.hh>
+#include <algorithm>
 
 TRACEPOINT(trace_tcp_input_ack, "%p: We've got ACK: %u", void*, unsigned int);
 
@@ -937,6 +938,13 @@ relocked:
 			tcp_trace(TA_INPUT, ostate, tp,
 			    (void *)tcp_saveipgen, &tcp_savetcp, 0);
 #endif
+		/*
+		 * Let the interface hand us the following SYNs for this
+		 * socket in batches, see tcp_syn_batch_input().
+		 */
+		if (tp->listen_intf == NULL && !(inp->inp_vflag & INP_IPV6) &&
+		    m->M_dat.MH.MH_pkthdr.rcvif != NULL)
+			tcp_setup_listen_channel(tp, m->M_dat.MH.MH_pkthdr.rcvif);
 		tcp_dooptions(&to, optp, optlen, TO_SYN);
 		syncache_add(&inc, &to, th, inp, &so, m);
 		/*
@@ -3248,8 +3256,19 @@ tcp_setup_net_channel(tcpcb* tp, struct ifnet* intf)
 	}
 }
 
+void
+tcp_setup_listen_channel(tcpcb* tp, struct ifnet* intf)
+{
+	tp->listen_intf = intf;
+	intf->add_listener(tcp_connection_id(tp));
+}
+
 void tcp_teardown_net_channel(tcpcb *tp)
 {
+	if (tp->listen_intf) {
+		tp->listen_intf->del_listener(tcp_connection_id(tp));
+		tp->listen_intf = nullptr;
+	}
 	if (!tp->nc_intf) {
 		return;
 	}
@@ -3262,6 +3281,7 @@ void
 tcp_free_net_channel(tcpcb* tp)
 {
 	if (!tp->nc) {
+		tcp_teardown_net_channel(tp);
 		return;
 	}
 	tcp_teardown_net_channel(tp);
@@ -3287,3 +3307,167 @@ tcp_flush_net_channel(tcpcb *tp)
 		nc->process_queue();
 	}
 }
+
+/*
+ * A SYN for a listen socket, prepared by tcp_syn_batch_prepare() while the
+ * tcbinfo lock was held, waiting to be added to the syncache.
+ */
+struct tcp_batched_syn {
+	struct mbuf *m;
+	struct tcphdr *th;
+	struct in_conninfo inc;
+	struct tcpopt to;
+	struct syncache_listen sl;
+};
+
+enum class syn_batch_verdict { queued, slow_path, dropped };
+
+// INP_INFO_WLOCK held
+static syn_batch_verdict
+tcp_syn_batch_prepare(struct ifnet *ifp, struct mbuf *m, tcp_batched_syn *syn)
+{
+	auto ip = reinterpret_cast<struct ip *>(m->m_hdr.mh_data + ETHER_HDR_LEN);
+	int ip_len = ntohs(ip->ip_len);
+	if (ip->ip_v != IPVERSION || ip_len < (int)sizeof(struct tcpiphdr) ||
+	    m->M_dat.MH.MH_pkthdr.len < ETHER_HDR_LEN + ip_len) {
+		return syn_batch_verdict::slow_path;
+	}
+	if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_IP_CHECKED) {
+		if (!(m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_IP_VALID)) {
+			return syn_batch_verdict::slow_path;
+		}
+	} else if (in_cksum_hdr(ip)) {
+		return syn_batch_verdict::slow_path;
+	}
+	auto th = reinterpret_cast<struct tcphdr *>(ip + 1);
+	int off = th->th_off << 2;
+	int tlen = ip_len - sizeof(struct ip);
+	if (off < (int)sizeof(struct tcphdr) || off > tlen ||
+	    m->m_hdr.mh_len < ETHER_HDR_LEN + (int)sizeof(struct ip) + off) {
+		return syn_batch_verdict::slow_path;
+	}
+	if (!in_localip(ip->ip_dst)) {
+		return syn_batch_verdict::slow_path;
+	}
+
+	// Anything but a listen socket that accepts the SYN takes the
+	// regular path, which knows how to answer it.
+	auto inp = in_pcblookup(&V_tcbinfo, ip->ip_src, th->th_sport,
+	    ip->ip_dst, th->th_dport, INPLOOKUP_WILDCARD | INPLOOKUP_LOCKPCB, ifp);
+	if (!inp) {
+		return syn_batch_verdict::slow_path;
+	}
+	auto tp = intotcpcb(inp);
+	auto so = inp->inp_socket;
+	if ((inp->inp_flags & INP_TIMEWAIT) || !tp ||
+	    tp->get_state() != TCPS_LISTEN || !(so->so_options & SO_ACCEPTCONN) ||
+	    (inp->inp_ip_minttl && inp->inp_ip_minttl > ip->ip_ttl)) {
+		INP_UNLOCK(inp);
+		return syn_batch_verdict::slow_path;
+	}
+	// The sanity checks of the listen path in tcp_input()
+	if ((th->th_dport == th->th_sport &&
+	     ip->ip_dst.s_addr == ip->ip_src.s_addr) ||
+	    IN_MULTICAST(ntohl(ip->ip_dst.s_addr)) ||
+	    IN_MULTICAST(ntohl(ip->ip_src.s_addr)) ||
+	    ip->ip_src.s_addr == htonl(INADDR_BROADCAST) ||
+	    in_broadcast(ip->ip_dst, ifp)) {
+		INP_UNLOCK(inp);
+		return syn_batch_verdict::dropped;
+	}
+
+	log_packet_handling(m, NETISR_ETHER);
+	IPSTAT_INC(ips_total);
+	IPSTAT_INC(ips_delivered);
+	TCPSTAT_INC(tcps_rcvtotal);
+	m_adj(m, ETHER_HDR_LEN);
+	if (m->M_dat.MH.MH_pkthdr.len > ip_len) {
+		m_adj(m, ip_len - m->M_dat.MH.MH_pkthdr.len);
+	}
+	ip = mtod(m, struct ip *);
+	th = reinterpret_cast<struct tcphdr *>(ip + 1);
+	if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_VALID) {
+		if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_PSEUDO_HDR)
+			th->th_sum = m->M_dat.MH.MH_pkthdr.csum_data;
+		else
+			th->th_sum = in_pseudo(ip->ip_src.s_addr,
+			    ip->ip_dst.s_addr,
+			    htonl(m->M_dat.MH.MH_pkthdr.csum_data + tlen +
+				IPPROTO_TCP));
+		th->th_sum ^= 0xffff;
+	} else {
+		auto ipov = reinterpret_cast<struct ipovly *>(ip);
+		char b[9];
+		bcopy(ipov->ih_x1, b, 9);
+		bzero(ipov->ih_x1, 9);
+		ipov->ih_len = htons((u_short)tlen);
+		th->th_sum = in_cksum(m, sizeof(struct ip) + tlen);
+		bcopy(b, ipov->ih_x1, 9);
+	}
+	if (th->th_sum) {
+		TCPSTAT_INC(tcps_rcvbadsum);
+		INP_UNLOCK(inp);
+		return syn_batch_verdict::dropped;
+	}
+
+	tcp_fields_to_host(th);
+	tcp_dooptions(&syn->to, (u_char *)(th + 1), off - sizeof(struct tcphdr), TO_SYN);
+	bzero(&syn->inc, sizeof(syn->inc));
+	syn->inc.inc_faddr = ip->ip_src;
+	syn->inc.inc_laddr = ip->ip_dst;
+	syn->inc.inc_fport = th->th_sport;
+	syn->inc.inc_lport = th->th_dport;
+	syn->inc.inc_fibnum = so->so_fibnum;
+	if (syncache_listen_init(&syn->sl, inp, &syn->inc) != 0) {
+		INP_UNLOCK(inp);
+		return syn_batch_verdict::dropped;
+	}
+	INP_UNLOCK(inp);
+	syn->m = m;
+	syn->th = th;
+	return syn_batch_verdict::queued;
+}
+
+/*
+ * Process a batch of SYNs the interface classifier found to be addressed to
+ * registered listen sockets (classifier::classify_listen_syn()).  The
+ * tcbinfo write lock, which tcp_input() takes for every SYN, is only taken
+ * once per chunk of SYNs to look up their listen sockets, and they are then
+ * added to the syncache without any pcb lock held.  SYNs that turn out to
+ * need more than that are passed to if_input() unchanged.
+ */
+void
+tcp_syn_batch_input(struct ifnet *ifp, struct mbuf **ms, int n)
+{
+	constexpr int chunk = 16;
+	tcp_batched_syn syns[chunk];
+	struct mbuf *slow[chunk];
+
+	while (n > 0) {
+		int count = std::min(n, chunk), nsyns = 0, nslow = 0;
+		INP_INFO_WLOCK(&V_tcbinfo);
+		for (int i = 0; i < count; i++) {
+			switch (tcp_syn_batch_prepare(ifp, ms[i], &syns[nsyns])) {
+			case syn_batch_verdict::queued:
+				nsyns++;
+				break;
+			case syn_batch_verdict::slow_path:
+				slow[nslow++] = ms[i];
+				break;
+			case syn_batch_verdict::dropped:
+				m_freem(ms[i]);
+				break;
+			}
+		}
+		INP_INFO_WUNLOCK(&V_tcbinfo);
+		for (int i = 0; i < nsyns; i++) {
+			auto& syn = syns[i];
+			syncache_add_listen(&syn.inc, &syn.to, syn.th, &syn.sl, syn.m);
+		}
+		for (int i = 0; i < nslow; i++) {
+			(*ifp->if_input)(ifp, slow[i]);
+		}
+		ms += count;
+		n -= count;
+	}
+}
@@ -949,6 +949,36 @@ failed:
 	return (0);
 }
 
+/*
+ * Snapshot the state of the listen socket that syncache_add() needs, so
+ * that the rest of the work can be done without holding its INP lock or
+ * the tcbinfo lock. Must be called with the INP lock held.
+ */
+int syncache_listen_init(struct syncache_listen *sl, struct inpcb *inp,
+	struct in_conninfo *inc)
+{
+	struct socket *so = inp->inp_socket;
+	struct tcpcb *tp = intotcpcb(inp);
+
+	INP_LOCK_ASSERT(inp);
+
+#ifdef INET6
+	sl->sl_autoflowlabel = (inc->inc_flags & INC_ISIPV6) &&
+		(inp->inp_flags & IN6P_AUTOFLOWLABEL);
+#endif
+	sl->sl_ip_ttl = inp->inp_ip_ttl;
+	sl->sl_ip_tos = inp->inp_ip_tos;
+	sl->sl_win = sbspace(&so->so_rcv);
+	sl->sl_sb_hiwat = so->so_rcv.sb_hiwat;
+	sl->sl_ltflags = (tp->t_flags & (TF_NOOPT | TF_SIGNATURE));
+#ifdef MAC
+	if (mac_syncache_init(&sl->sl_maclabel) != 0)
+		return (ENOMEM);
+	mac_syncache_create(sl->sl_maclabel, inp);
+#endif
+	return (0);
+}
+
 /*
  * Given a LISTEN socket and an inbound SYN request, add
  * this to the syn cache, and send back a segment:
@@ -962,65 +992,18 @@ failed:
  * consume all available buffer space if it were ACKed.  By not ACKing
  * the data, we avoid this DoS scenario.
  */
-static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
-	struct tcphdr *th, struct inpcb *inp, struct socket **lsop, struct mbuf *m,
+static void _syncache_add_listen(struct in_conninfo *inc, struct tcpopt *to,
+	struct tcphdr *th, struct syncache_listen *sl, struct mbuf *m,
 	struct toe_usrreqs *tu, void *toepcb)
 {
-	struct tcpcb *tp;
-	struct socket *so;
 	struct syncache *sc = NULL;
 	struct syncache_head *sch;
 	struct mbuf *ipopts = NULL;
 	u_int32_t flowtmp;
-	u_int ltflags;
-	int win, sb_hiwat, ip_ttl, ip_tos;
+	int win = sl->sl_win;
 	char *s;
-#ifdef INET6
-	int autoflowlabel = 0;
-#endif
-#ifdef MAC
-	struct label *maclabel;
-#endif
 	struct syncache scs;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
-	INP_LOCK_ASSERT(inp); /* listen socket */
-	KASSERT((th->th_flags & (TH_RST|TH_ACK|TH_SYN)) == TH_SYN,
-		("%s: unexpected tcp flags", __func__));
-
-	/*
-	 * Combine all so/tp operations very early to drop the INP lock as
-	 * soon as possible.
-	 */
-	so = *lsop;
-	tp = sototcpcb(so);
-
-#ifdef INET6
-	if ((inc->inc_flags & INC_ISIPV6) &&
-		(inp->inp_flags & IN6P_AUTOFLOWLABEL))
-	autoflowlabel = 1;
-#endif
-	ip_ttl = inp->inp_ip_ttl;
-	ip_tos = inp->inp_ip_tos;
-	win = sbspace(&so->so_rcv);
-	sb_hiwat = so->so_rcv.sb_hiwat;
-	ltflags = (tp->t_flags & (TF_NOOPT | TF_SIGNATURE));
-
-	/* By the time we drop the lock these should no longer be used. */
-	so = NULL;
-	tp = NULL;
-
-#ifdef MAC
-	if (mac_syncache_init(&maclabel) != 0) {
-		INP_UNLOCK(inp);
-		INP_INFO_WUNLOCK(&V_tcbinfo);
-		goto done;
-	} else
-	mac_syncache_create(maclabel, inp);
-#endif
-	INP_UNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
-
 	/*
 	 * Remember the IP options, if any.
 	 */
@@ -1071,7 +1054,7 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 		 * storage, free it up.  The syncache entry will already
 		 * have an initialized label we can use.
 		 */
-		mac_syncache_destroy(&maclabel);
+		mac_syncache_destroy(&sl->sl_maclabel);
 #endif
 		/* Retransmit SYN|ACK and reset retransmit count. */
 		if ((s = tcp_log_addrs(&sc->sc_inc, th, NULL, NULL ))) {
@@ -1117,7 +1100,7 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 	 * Fill in the syncache values.
 	 */
 #ifdef MAC
-	sc->sc_label = maclabel;
+	sc->sc_label = sl->sl_maclabel;
 #endif
 	sc->sc_ipopts = ipopts;
 	bcopy(inc, &sc->sc_inc, sizeof(struct in_conninfo));
@@ -1125,8 +1108,8 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 	if (!(inc->inc_flags & INC_ISIPV6))
 #endif
 	{
-		sc->sc_ip_tos = ip_tos;
-		sc->sc_ip_ttl = ip_ttl;
+		sc->sc_ip_tos = sl->sl_ip_tos;
+		sc->sc_ip_ttl = sl->sl_ip_ttl;
 	}
 #ifndef TCP_OFFLOAD_DISABLE	
 	sc->sc_tu = tu;
@@ -1139,7 +1122,7 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 
 	/*
 	 * Initial receive window: clip sbspace to [0 .. TCP_MAXWIN].
-	 * win was derived from socket earlier in the function.
+	 * win was derived from the listen socket by syncache_listen_init().
 	 */
 	win = imax(win, 0);
 	win = imin(win, TCP_MAXWIN);
@@ -1194,14 +1177,14 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 	 * XXX: Currently we always record the option by default and will
 	 * attempt to use it in syncache_respond().
 	 */
-	if (to->to_flags & TOF_SIGNATURE || ltflags & TF_SIGNATURE)
+	if (to->to_flags & TOF_SIGNATURE || sl->sl_ltflags & TF_SIGNATURE)
 	sc->sc_flags |= SCF_SIGNATURE;
 #endif
 	if (to->to_flags & TOF_SACKPERM)
 		sc->sc_flags |= SCF_SACK;
 	if (to->to_flags & TOF_MSS)
 		sc->sc_peer_mss = to->to_mss; /* peer mss may be zero */
-	if (ltflags & TF_NOOPT)
+	if (sl->sl_ltflags & TF_NOOPT)
 		sc->sc_flags |= SCF_NOOPT;
 	if ((th->th_flags & (TH_ECE | TH_CWR)) && V_tcp_do_ecn)
 		sc->sc_flags |= SCF_ECN;
@@ -1209,12 +1192,12 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 	if (V_tcp_syncookies) {
 		syncookie_generate(sch, sc, &flowtmp);
 #ifdef INET6
-		if (autoflowlabel)
+		if (sl->sl_autoflowlabel)
 		sc->sc_flowlabel = flowtmp;
 #endif
 	} else {
 #ifdef INET6
-		if (autoflowlabel)
+		if (sl->sl_autoflowlabel)
 		sc->sc_flowlabel =
 		(htonl(ip6_randomflowlabel()) & IPV6_FLOWLABEL_MASK);
 #endif
@@ -1240,13 +1223,52 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 	done:
 #ifdef MAC
 	if (sc == &scs)
-	mac_syncache_destroy(&maclabel);
+	mac_syncache_destroy(&sl->sl_maclabel);
 #endif
-	if (m) {
+	if (m)
+		m_freem(m);
+}
 
-		*lsop = NULL;
+static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
+	struct tcphdr *th, struct inpcb *inp, struct socket **lsop, struct mbuf *m,
+	struct toe_usrreqs *tu, void *toepcb)
+{
+	struct syncache_listen sl;
+	int error;
+
+	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	INP_LOCK_ASSERT(inp); /* listen socket */
+	KASSERT((th->th_flags & (TH_RST|TH_ACK|TH_SYN)) == TH_SYN,
+		("%s: unexpected tcp flags", __func__));
+
+	/*
+	 * Combine all so/tp operations very early to drop the INP lock as
+	 * soon as possible.
+	 */
+	error = syncache_listen_init(&sl, inp, inc);
+	INP_UNLOCK(inp);
+	INP_INFO_WUNLOCK(&V_tcbinfo);
+
+	if (error == 0)
+		_syncache_add_listen(inc, to, th, &sl, m, tu, toepcb);
+	else if (m)
 		m_freem(m);
-	}
+	if (m)
+		*lsop = NULL;
+}
+
+/*
+ * Add an entry for a SYN received on a listen socket whose state was
+ * captured with syncache_listen_init(). Called without any locks held,
+ * which lets a batch of SYNs share a single pass over the tcbinfo lock.
+ * Consumes m.
+ */
+void syncache_add_listen(struct in_conninfo *inc, struct tcpopt *to,
+	struct tcphdr *th, struct syncache_listen *sl, struct mbuf *m)
+{
+	KASSERT((th->th_flags & (TH_RST|TH_ACK|TH_SYN)) == TH_SYN,
+		("%s: unexpected tcp flags", __func__));
+	_syncache_add_listen(inc, to, th, sl, m, NULL, NULL);
 }
 
 static int syncache_respond(struct syncache *sc)
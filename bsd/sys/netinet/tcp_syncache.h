@@ -52,6 +52,29 @@ int	 syncache_expand(struct in_conninfo *, struct tcpopt *,
 void	 syncache_add(struct in_conninfo *, struct tcpopt *,
 	     struct tcphdr *, struct inpcb *, struct socket **, struct mbuf *);
 
+/*
+ * State of a listen socket captured under its INP lock, so that SYNs can
+ * be added to the syncache after the lock is dropped.
+ */
+struct syncache_listen {
+	int		sl_ip_ttl;
+	int		sl_ip_tos;
+	int		sl_win;
+	int		sl_sb_hiwat;
+	u_int		sl_ltflags;
+#ifdef INET6
+	int		sl_autoflowlabel;
+#endif
+#ifdef MAC
+	struct label	*sl_maclabel;
+#endif
+};
+
+int	 syncache_listen_init(struct syncache_listen *, struct inpcb *,
+	     struct in_conninfo *);
+void	 syncache_add_listen(struct in_conninfo *, struct tcpopt *,
+	     struct tcphdr *, struct syncache_listen *, struct mbuf *);
+
 void	 syncache_chkrst(struct in_conninfo *, struct tcphdr *);
 void	 syncache_badack(struct in_conninfo *);
 int	 syncache_pcbcount(void);
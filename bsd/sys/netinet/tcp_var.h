@@ -223,6 +223,7 @@ public:
 
 	net_channel* nc;
 	struct ifnet* nc_intf;
+	struct ifnet* listen_intf;	/* listener registered with classifier */
 
 	uint32_t t_ispare[8];		/* 5 UTO, 3 TBD */
 	void	*t_pspare2[4];		/* 4 TBD */
@@ -700,8 +701,10 @@ void	 tcp_reass_destroy(void);
 void	 tcp_input(struct mbuf *, int);
 void	 tcp_flush_net_channel(tcpcb* tp);
 void	 tcp_setup_net_channel(tcpcb* tp, struct ifnet* intf);
+void	 tcp_setup_listen_channel(tcpcb* tp, struct ifnet* intf);
 void	 tcp_teardown_net_channel(tcpcb* tp);
 void	 tcp_free_net_channel(tcpcb* tp);
+void	 tcp_syn_batch_input(struct ifnet *, struct mbuf **, int);
 u_long	 tcp_maxmtu(struct in_conninfo *, int *);
 u_long	 tcp_maxmtu6(struct in_conninfo *, int *);
 void	 tcp_mss_update(struct tcpcb *, int, int, struct hc_metrics_lite *,
@@ -50,6 +50,9 @@
 #include <bsd/sys/sys/socketvar.h>
 
 #include <bsd/sys/net/if.h>
+#include <bsd/sys/net/if_var.h>
+#include <bsd/sys/net/ethernet.h>
+#include <bsd/sys/net/netisr.h>
 #include <bsd/sys/net/route.h>
 
 #include <bsd/sys/netinet/in.h>
@@ -70,6 +73,10 @@
 #include <bsd/sys/netinet/udp.h>
 #include <bsd/sys/netinet/udp_var.h>
 
+#include <osv/net_channel.hh>
+#include <osv/net_trace.hh>
+#include <osv/aligned_new.hh>
+
 /*
  * UDP protocol implementation.
  * Per RFC 768, August, 1980.
@@ -284,6 +291,223 @@ udp_append(struct inpcb *inp, struct ip *ip, struct mbuf *n, int off,
 		sorwakeup_locked(so);
 }
 
+/*
+ * Net channel fast path.  While a socket is the only one bound to its port,
+ * the interface classifier queues the plain unicast datagrams addressed to
+ * it on the socket's net channel, and they are processed here by the
+ * receiving thread instead of going through ip_input() and udp_input() on
+ * the driver's Rx thread.  Called with the INP lock held.
+ */
+static void
+udp_net_channel_packet(struct inpcb *inp, struct mbuf *m)
+{
+	struct ip *ip;
+	struct udphdr *uh;
+	struct bsd_sockaddr_in udp_in;
+	int hlen = sizeof(struct ip);
+	int ip_len, len;
+	u_short uh_sum;
+
+	INP_LOCK_ASSERT(inp);
+	log_packet_handling(m, NETISR_ETHER);
+	m_adj(m, ETHER_HDR_LEN);
+	ip = mtod(m, struct ip *);
+
+	/* The part of ip_input() the classifier did not already check. */
+	IPSTAT_INC(ips_total);
+	if (ip->ip_v != IPVERSION) {
+		IPSTAT_INC(ips_badvers);
+		goto bad;
+	}
+	if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_IP_CHECKED) {
+		if (!(m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_IP_VALID)) {
+			IPSTAT_INC(ips_badsum);
+			goto bad;
+		}
+	} else if (in_cksum_hdr(ip)) {
+		IPSTAT_INC(ips_badsum);
+		goto bad;
+	}
+	ip_len = ntohs(ip->ip_len);
+	if (ip_len < hlen + (int)sizeof(struct udphdr) ||
+	    m->M_dat.MH.MH_pkthdr.len < ip_len) {
+		IPSTAT_INC(ips_badlen);
+		goto bad;
+	}
+	if (m->M_dat.MH.MH_pkthdr.len > ip_len)
+		m_adj(m, ip_len - m->M_dat.MH.MH_pkthdr.len);
+	if (!in_localip(ip->ip_dst)) {
+		IPSTAT_INC(ips_cantforward);
+		goto bad;
+	}
+	IPSTAT_INC(ips_delivered);
+
+	UDPSTAT_INC(udps_ipackets);
+	uh = (struct udphdr *)((caddr_t)ip + hlen);
+	len = ntohs((u_short)uh->uh_ulen);
+	if (len > ip_len - hlen || len < (int)sizeof(struct udphdr)) {
+		UDPSTAT_INC(udps_badlen);
+		goto bad;
+	}
+	if (len != ip_len - hlen)
+		m_adj(m, len - (ip_len - hlen));
+
+	/* The classifier only steers datagrams that have a checksum. */
+	if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_VALID) {
+		if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_PSEUDO_HDR)
+			uh_sum = m->M_dat.MH.MH_pkthdr.csum_data;
+		else
+			uh_sum = in_pseudo(ip->ip_src.s_addr,
+			    ip->ip_dst.s_addr, htonl((u_short)len +
+			    m->M_dat.MH.MH_pkthdr.csum_data + IPPROTO_UDP));
+		uh_sum ^= 0xffff;
+	} else {
+		char b[9];
+
+		bcopy(((struct ipovly *)ip)->ih_x1, b, 9);
+		bzero(((struct ipovly *)ip)->ih_x1, 9);
+		((struct ipovly *)ip)->ih_len = uh->uh_ulen;
+		uh_sum = in_cksum(m, len + sizeof (struct ip));
+		bcopy(b, ((struct ipovly *)ip)->ih_x1, 9);
+	}
+	if (uh_sum) {
+		UDPSTAT_INC(udps_badsum);
+		goto bad;
+	}
+
+	if (inp->inp_ip_minttl && inp->inp_ip_minttl > ip->ip_ttl)
+		goto bad;
+
+	bzero(&udp_in, sizeof(udp_in));
+	udp_in.sin_len = sizeof(udp_in);
+	udp_in.sin_family = AF_INET;
+	udp_in.sin_port = uh->uh_sport;
+	udp_in.sin_addr = ip->ip_src;
+	udp_append(inp, ip, m, hlen, &udp_in);
+	return;
+
+bad:
+	m_freem(m);
+}
+
+static ipv4_tcp_conn_id
+udp_net_channel_id(struct inpcb *inp)
+{
+	return {
+		inp->inp_faddr,
+		inp->inp_laddr,
+		ntohs(inp->inp_fport),
+		ntohs(inp->inp_lport)
+	};
+}
+
+/*
+ * Start steering the datagrams of inp, which arrived on ifp, through its
+ * net channel.  This is only done while no other socket is bound to the
+ * same port, so that the classifier never has to choose between sockets.
+ * u_nc_intf is modified either with the hash lock write-locked, or with it
+ * read-locked and the INP lock held.
+ */
+static void
+udp_setup_net_channel(struct inpcb *inp, struct ifnet *ifp)
+{
+	struct udpcb *up = intoudpcb(inp);
+	struct socket *so = inp->inp_socket;
+	struct inpcb *tmp;
+
+	INP_LOCK_ASSERT(inp);
+	if (up->u_tun_func != NULL || (inp->inp_vflag & INP_IPV6) ||
+	    inp->inp_lport == 0 || inp->inp_phd == NULL ||
+	    (so->so_options & (SO_REUSEADDR | SO_REUSEPORT)))
+		return;
+
+	INP_HASH_RLOCK(&V_udbinfo);
+	LIST_FOREACH(tmp, &inp->inp_phd->phd_pcblist, inp_portlist) {
+		if (tmp != inp) {
+			INP_HASH_RUNLOCK(&V_udbinfo);
+			return;
+		}
+	}
+	if (up->u_nc_intf == NULL) {
+		if (up->u_nc == NULL) {
+			auto nc = aligned_new<net_channel>([=] (mbuf *m) {
+				udp_net_channel_packet(inp, m);
+			});
+			up->u_nc = nc;
+			so->so_nc = nc;
+			if (so->fp) {
+				WITH_LOCK(so->fp->f_lock) {
+					for (auto&& pl : so->fp->f_poll_list) {
+						nc->add_poller(*pl._req);
+					}
+					if (so->fp->f_epolls) {
+						for (auto&& ep : *so->fp->f_epolls) {
+							nc->add_epoll(ep);
+						}
+					}
+				}
+			}
+		}
+		up->u_nc_intf = ifp;
+		ifp->add_udp_net_channel(up->u_nc, udp_net_channel_id(inp));
+	}
+	INP_HASH_RUNLOCK(&V_udbinfo);
+}
+
+static void
+udp_teardown_net_channel(struct inpcb *inp)
+{
+	struct udpcb *up = intoudpcb(inp);
+
+	INP_HASH_WLOCK_ASSERT(&V_udbinfo);
+	if (up == NULL || up->u_nc_intf == NULL)
+		return;
+	up->u_nc_intf->del_udp_net_channel(udp_net_channel_id(inp));
+	up->u_nc_intf = NULL;
+	/* keep up->u_nc around since it might still contain packets */
+}
+
+/*
+ * Stop steering datagrams to the sockets bound to the port of inp, which is
+ * about to change its addresses or to be joined by another socket.  They
+ * go through udp_input() again, which sets the channel up again if it can.
+ */
+static void
+udp_teardown_port_net_channels(struct inpcb *inp)
+{
+	struct inpcb *tmp;
+
+	INP_HASH_WLOCK_ASSERT(&V_udbinfo);
+	if (inp->inp_phd == NULL)
+		return;
+	LIST_FOREACH(tmp, &inp->inp_phd->phd_pcblist, inp_portlist) {
+		udp_teardown_net_channel(tmp);
+	}
+}
+
+static void
+udp_free_net_channel(struct inpcb *inp)
+{
+	struct udpcb *up = intoudpcb(inp);
+	struct socket *so = inp->inp_socket;
+
+	INP_LOCK_ASSERT(inp);
+	if (up->u_nc == NULL)
+		return;
+	INP_HASH_WLOCK(&V_udbinfo);
+	udp_teardown_net_channel(inp);
+	INP_HASH_WUNLOCK(&V_udbinfo);
+	if (so && so->fp) {
+		for (auto&& pl : so->fp->f_poll_list) {
+			up->u_nc->del_poller(*pl._req);
+		}
+	}
+	if (so)
+		so->so_nc = nullptr;
+	osv::rcu_dispose(up->u_nc);
+	up->u_nc = NULL;
+}
+
 void
 udp_input(struct mbuf *m, int off)
 {
@@ -567,6 +791,9 @@ udp_input(struct mbuf *m, int off)
 		m_freem(m);
 		return;
 	}
+	if (intoudpcb(inp)->u_nc_intf == NULL && ifp != NULL &&
+	    !(m->m_hdr.mh_flags & (M_BCAST | M_MCAST)))
+		udp_setup_net_channel(inp, ifp);
 	udp_append(inp, ip, m, iphlen, &udp_in);
 	INP_UNLOCK(inp);
 	return;
@@ -1343,6 +1570,7 @@ udp_abort(struct socket *so)
 	INP_LOCK(inp);
 	if (inp->inp_faddr.s_addr != INADDR_ANY) {
 		INP_HASH_WLOCK(&V_udbinfo);
+		udp_teardown_port_net_channels(inp);
 		in_pcbdisconnect(inp);
 		inp->inp_laddr.s_addr = INADDR_ANY;
 		INP_HASH_WUNLOCK(&V_udbinfo);
@@ -1415,6 +1643,8 @@ udp_bind(struct socket *so, struct bsd_sockaddr *nam, struct thread *td)
 	INP_LOCK(inp);
 	INP_HASH_WLOCK(&V_udbinfo);
 	error = in_pcbbind(inp, nam, 0);
+	if (error == 0)
+		udp_teardown_port_net_channels(inp);
 	INP_HASH_WUNLOCK(&V_udbinfo);
 	INP_UNLOCK(inp);
 	return (error);
@@ -1430,6 +1660,7 @@ udp_close(struct socket *so)
 	INP_LOCK(inp);
 	if (inp->inp_faddr.s_addr != INADDR_ANY) {
 		INP_HASH_WLOCK(&V_udbinfo);
+		udp_teardown_port_net_channels(inp);
 		in_pcbdisconnect(inp);
 		inp->inp_laddr.s_addr = INADDR_ANY;
 		INP_HASH_WUNLOCK(&V_udbinfo);
@@ -1454,7 +1685,10 @@ udp_connect(struct socket *so, struct bsd_sockaddr *nam, struct thread *td)
 	}
 	sin = (struct bsd_sockaddr_in *)nam;
 	INP_HASH_WLOCK(&V_udbinfo);
+	udp_teardown_port_net_channels(inp);
 	error = in_pcbconnect(inp, nam, 0);
+	if (error == 0)
+		udp_teardown_port_net_channels(inp);
 	INP_HASH_WUNLOCK(&V_udbinfo);
 	if (error == 0)
 		soisconnected(so);
@@ -1476,6 +1710,7 @@ udp_detach(struct socket *so)
 	INP_LOCK(inp);
 	up = intoudpcb(inp);
 	KASSERT(up != NULL, ("%s: up == NULL", __func__));
+	udp_free_net_channel(inp);
 	inp->inp_ppcb = NULL;
 	in_pcbdetach(inp);
 	in_pcbfree(inp);
@@ -1496,6 +1731,7 @@ udp_disconnect(struct socket *so)
 		return (ENOTCONN);
 	}
 	INP_HASH_WLOCK(&V_udbinfo);
+	udp_teardown_port_net_channels(inp);
 	in_pcbdisconnect(inp);
 	inp->inp_laddr.s_addr = INADDR_ANY;
 	INP_HASH_WUNLOCK(&V_udbinfo);
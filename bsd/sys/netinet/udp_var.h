@@ -53,12 +53,16 @@ struct udpiphdr {
 
 typedef void(*udp_tun_func_t)(struct mbuf *, int off, struct inpcb *);
 
+struct net_channel;
+
 /*
  * UDP control block; one per udp.
  */
 struct udpcb {
 	udp_tun_func_t	u_tun_func;	/* UDP kernel tunneling callback. */
 	u_int		u_flags;	/* Generic UDP flags. */
+	struct net_channel *u_nc;	/* Rx fast path channel */
+	struct ifnet	*u_nc_intf;	/* interface u_nc is registered on */
 };
 
 #define	intoudpcb(ip)	((struct udpcb *)(ip)->inp_ppcb)
@@ -26,6 +26,16 @@ ifeq ($(conf_drivers_virtio_rng),1)
 export conf_drivers_virtio?=1
 endif
 
+export conf_drivers_virtio_balloon?=0
+ifeq ($(conf_drivers_virtio_balloon),1)
+export conf_drivers_virtio?=1
+endif
+
+export conf_drivers_virtio_vsock?=0
+ifeq ($(conf_drivers_virtio_vsock),1)
+export conf_drivers_virtio?=1
+endif
+
 export conf_drivers_nvme?=0
 ifeq ($(conf_drivers_nvme),1)
 export conf_drivers_pci?=1
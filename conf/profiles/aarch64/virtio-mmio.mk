@@ -1,4 +1,6 @@
 conf_drivers_mmio?=1
 
+conf_drivers_virtio_balloon?=1
 conf_drivers_virtio_blk?=1
 conf_drivers_virtio_net?=1
+conf_drivers_virtio_vsock?=1
@@ -1,7 +1,9 @@
 conf_drivers_pci?=1
 
+conf_drivers_virtio_balloon?=1
 conf_drivers_virtio_blk?=1
 conf_drivers_virtio_fs?=1
 conf_drivers_virtio_net?=1
 conf_drivers_virtio_rng?=1
 conf_drivers_virtio_scsi?=1
+conf_drivers_virtio_vsock?=1
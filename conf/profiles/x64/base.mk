@@ -27,6 +27,16 @@ ifeq ($(conf_drivers_virtio_rng),1)
 export conf_drivers_virtio?=1
 endif
 
+export conf_drivers_virtio_balloon?=0
+ifeq ($(conf_drivers_virtio_balloon),1)
+export conf_drivers_virtio?=1
+endif
+
+export conf_drivers_virtio_vsock?=0
+ifeq ($(conf_drivers_virtio_vsock),1)
+export conf_drivers_virtio?=1
+endif
+
 export conf_drivers_ahci?=0
 ifeq ($(conf_drivers_ahci),1)
 export conf_drivers_pci?=1
@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) 2013-2014 Cloudius Systems, Ltd.
+ * Copyright (C) 2018-2024 Waldemar Kozaczuk
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Implementation of the Linux futex() system call.
+//
+// Originally futex() was only needed by gcc's C++ runtime (__cxa_guard_*)
+// and was implemented with a single global mutex protecting a map of wait
+// queues. Nowadays it is the foundation of every pthread mutex, condition
+// variable and semaphore in glibc-linked applications and managed runtimes
+// like the JVM, so it needs to scale.
+//
+// Waiters are kept in a fixed-size table of buckets, each with its own
+// mutex and an intrusive list of waiters, selected by hashing the futex
+// address. Operations on unrelated futexes therefore almost never contend.
+// Every bucket also keeps an atomic count of its waiters, so a FUTEX_WAKE
+// on an address nobody waits on (the common case of an uncontended unlock
+// racing with a just-departed waiter) does not take any lock at all.
+//
+// A waiter record lives on the stack of the waiting thread. Wakers dequeue
+// the record and wake the thread while holding the bucket lock, so after the
+// lock is dropped the record is no longer reachable by anybody else.
+// FUTEX_REQUEUE and friends can move a waiter to another bucket; the record
+// therefore remembers which bucket it is on, and a waiter that times out
+// re-reads it after taking the lock (see lock_waiter_bucket()).
+
+#include <osv/sched.hh>
+#include <osv/mutex.h>
+#include <osv/wait_record.hh>
+#include <osv/trace.hh>
+#include <osv/clock.hh>
+
+#include <boost/intrusive/list.hpp>
+
+#include <atomic>
+#include <errno.h>
+#include <time.h>
+#include <linux/futex.h>
+
+TRACEPOINT(trace_futex_wait, "uaddr=%p val=%d bitset=%x", int*, int, uint32_t);
+TRACEPOINT(trace_futex_wait_ret, "uaddr=%p ret=%d", int*, int);
+TRACEPOINT(trace_futex_wake, "uaddr=%p nr=%d bitset=%x woken=%d", int*, int, uint32_t, int);
+TRACEPOINT(trace_futex_requeue, "uaddr=%p uaddr2=%p nr_wake=%d nr_requeue=%d ret=%d", int*, int*, int, int, int);
+TRACEPOINT(trace_futex_wake_op, "uaddr=%p uaddr2=%p op=%x ret=%d", int*, int*, uint32_t, int);
+
+#define FUTEX_BITSET_MATCH_ANY  0xffffffff
+
+namespace {
+
+namespace bi = boost::intrusive;
+
+struct futex_bucket;
+
+struct futex_waiter : public waiter {
+    futex_waiter(int* uaddr, uint32_t bitset, futex_bucket* bucket)
+        : waiter(sched::thread::current())
+        , uaddr(uaddr)
+        , bitset(bitset)
+        , bucket(bucket) {}
+    int* uaddr;
+    uint32_t bitset;
+    // Bucket this waiter is currently queued on. Only modified (by requeue)
+    // while holding the locks of both the old and new bucket.
+    std::atomic<futex_bucket*> bucket;
+    bi::list_member_hook<> hook;
+};
+
+typedef bi::list<futex_waiter,
+                 bi::member_hook<futex_waiter, bi::list_member_hook<>, &futex_waiter::hook>,
+                 bi::constant_time_size<false>> futex_waiter_list;
+
+struct futex_bucket {
+    // Number of waiters queued (or about to be queued) on this bucket. It is
+    // incremented before the waiter reads the futex word, so a waker that
+    // changed the futex word and then finds this zero knows there is no
+    // waiter it needs to wake.
+    std::atomic<unsigned> nr_waiters { 0 };
+    mutex lock;
+    futex_waiter_list waiters;
+} CACHELINE_ALIGNED;
+
+// Must be a power of two. 1024 buckets is enough to make collisions between
+// hot futexes unlikely even on large guests, at a cost of 64KB.
+constexpr unsigned futex_hash_bits = 10;
+constexpr unsigned futex_hash_size = 1u << futex_hash_bits;
+
+futex_bucket futex_table[futex_hash_size];
+
+inline futex_bucket* bucket_for(int* uaddr)
+{
+    // Futex words are 4-byte aligned so the low 2 bits carry no information.
+    // Use Fibonacci hashing to spread the remaining bits over the table.
+    auto key = reinterpret_cast<uintptr_t>(uaddr) >> 2;
+    return &futex_table[(key * 0x9E3779B97F4A7C15ull) >> (64 - futex_hash_bits)];
+}
+
+inline bool has_waiters(futex_bucket* b)
+{
+    // Pairs with the fetch_add() in futex_wait(): either the waiter sees
+    // the new futex value written by our caller, or we see its count.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return b->nr_waiters.load(std::memory_order_relaxed) != 0;
+}
+
+// Lock two buckets in a consistent (address) order to avoid deadlocks
+// between concurrent operations on the same pair of futexes.
+void double_lock(futex_bucket* b1, futex_bucket* b2)
+{
+    if (b1 > b2) {
+        std::swap(b1, b2);
+    }
+    b1->lock.lock();
+    if (b1 != b2) {
+        b2->lock.lock();
+    }
+}
+
+void double_unlock(futex_bucket* b1, futex_bucket* b2)
+{
+    b1->lock.unlock();
+    if (b1 != b2) {
+        b2->lock.unlock();
+    }
+}
+
+// Lock the bucket the given waiter is currently queued on. Because the
+// waiter may be requeued concurrently, re-check after taking the lock.
+futex_bucket* lock_waiter_bucket(futex_waiter& w)
+{
+    for (;;) {
+        auto b = w.bucket.load(std::memory_order_acquire);
+        b->lock.lock();
+        if (b == w.bucket.load(std::memory_order_relaxed)) {
+            return b;
+        }
+        b->lock.unlock();
+    }
+}
+
+// Dequeue and wake a waiter. Must be called with the lock of the bucket
+// it is queued on held.
+inline void wake_waiter(futex_bucket* b, futex_waiter& w)
+{
+    b->waiters.erase(b->waiters.iterator_to(w));
+    b->nr_waiters.fetch_sub(1, std::memory_order_relaxed);
+    w.wake();
+}
+
+// Wake up to nr waiters of uaddr matching bitset. Must be called with the
+// lock of b held.
+int wake_locked(futex_bucket* b, int* uaddr, int nr, uint32_t bitset)
+{
+    int woken = 0;
+    for (auto it = b->waiters.begin(); it != b->waiters.end() && woken < nr; ) {
+        auto& w = *it++;
+        if (w.uaddr == uaddr && (w.bitset & bitset)) {
+            wake_waiter(b, w);
+            woken++;
+        }
+    }
+    return woken;
+}
+
+int futex_wait(int* uaddr, int val, uint32_t bitset, sched::timer* tmr)
+{
+    auto b = bucket_for(uaddr);
+    futex_waiter w(uaddr, bitset, b);
+
+    b->nr_waiters.fetch_add(1, std::memory_order_seq_cst);
+    b->lock.lock();
+    if (*static_cast<volatile int*>(uaddr) != val) {
+        b->lock.unlock();
+        b->nr_waiters.fetch_sub(1, std::memory_order_relaxed);
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    b->waiters.push_back(w);
+    b->lock.unlock();
+
+    w.wait(tmr);
+    if (w.woken()) {
+        return 0;
+    }
+
+    // The timer expired. A waker may have dequeued us in the meantime, in
+    // which case it has also set woken() under the bucket lock and we treat
+    // this as a successful wakeup, like Linux does.
+    b = lock_waiter_bucket(w);
+    if (w.woken()) {
+        b->lock.unlock();
+        return 0;
+    }
+    b->waiters.erase(b->waiters.iterator_to(w));
+    b->nr_waiters.fetch_sub(1, std::memory_order_relaxed);
+    b->lock.unlock();
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+int futex_wake(int* uaddr, int nr, uint32_t bitset)
+{
+    auto b = bucket_for(uaddr);
+    if (!has_waiters(b)) {
+        return 0;
+    }
+    SCOPE_LOCK(b->lock);
+    return wake_locked(b, uaddr, nr, bitset);
+}
+
+// Implements FUTEX_REQUEUE and FUTEX_CMP_REQUEUE: wake up to nr_wake waiters
+// of uaddr and move up to nr_requeue of the remaining ones to wait on uaddr2.
+int futex_requeue(int* uaddr, int* uaddr2, int nr_wake, int nr_requeue,
+                  const int* cmpval)
+{
+    auto b1 = bucket_for(uaddr);
+    auto b2 = bucket_for(uaddr2);
+
+    if (!cmpval && !has_waiters(b1)) {
+        return 0;
+    }
+
+    double_lock(b1, b2);
+    if (cmpval && *static_cast<volatile int*>(uaddr) != *cmpval) {
+        double_unlock(b1, b2);
+        errno = EAGAIN;
+        return -1;
+    }
+    int woken = 0, requeued = 0;
+    for (auto it = b1->waiters.begin(); it != b1->waiters.end(); ) {
+        auto& w = *it++;
+        if (w.uaddr != uaddr) {
+            continue;
+        }
+        if (woken < nr_wake) {
+            wake_waiter(b1, w);
+            woken++;
+        } else if (requeued < nr_requeue) {
+            w.uaddr = uaddr2;
+            if (b1 != b2) {
+                b1->waiters.erase(b1->waiters.iterator_to(w));
+                b2->nr_waiters.fetch_add(1, std::memory_order_relaxed);
+                b1->nr_waiters.fetch_sub(1, std::memory_order_relaxed);
+                b2->waiters.push_back(w);
+                w.bucket.store(b2, std::memory_order_release);
+            }
+            requeued++;
+        } else {
+            break;
+        }
+    }
+    double_unlock(b1, b2);
+    // Like Linux, return the total number of waiters woken or requeued
+    return woken + requeued;
+}
+
+int sign_extend12(uint32_t v)
+{
+    return static_cast<int32_t>(v << 20) >> 20;
+}
+
+// Implements FUTEX_WAKE_OP: atomically apply the operation encoded in
+// encoded_op to *uaddr2, wake up to nr waiters on uaddr and, if the old
+// value of *uaddr2 satisfies the encoded comparison, also up to nr2
+// waiters on uaddr2.
+int futex_wake_op(int* uaddr, int* uaddr2, int nr, int nr2, uint32_t encoded_op)
+{
+    unsigned op = (encoded_op >> 28) & 0x7;
+    unsigned cmp = (encoded_op >> 24) & 0xf;
+    int oparg = sign_extend12(encoded_op >> 12);
+    int cmparg = sign_extend12(encoded_op);
+
+    if (encoded_op & (FUTEX_OP_OPARG_SHIFT << 28)) {
+        if (oparg < 0 || oparg > 31) {
+            errno = EINVAL;
+            return -1;
+        }
+        oparg = 1 << oparg;
+    }
+    if (op > FUTEX_OP_XOR || cmp > FUTEX_OP_CMP_GE) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    auto b1 = bucket_for(uaddr);
+    auto b2 = bucket_for(uaddr2);
+    double_lock(b1, b2);
+
+    int oldval;
+    switch (op) {
+    case FUTEX_OP_SET:
+        oldval = __atomic_exchange_n(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    case FUTEX_OP_ADD:
+        oldval = __atomic_fetch_add(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    case FUTEX_OP_OR:
+        oldval = __atomic_fetch_or(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    case FUTEX_OP_ANDN:
+        oldval = __atomic_fetch_and(uaddr2, ~oparg, __ATOMIC_SEQ_CST);
+        break;
+    default:
+        oldval = __atomic_fetch_xor(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    }
+
+    bool cond;
+    switch (cmp) {
+    case FUTEX_OP_CMP_EQ: cond = oldval == cmparg; break;
+    case FUTEX_OP_CMP_NE: cond = oldval != cmparg; break;
+    case FUTEX_OP_CMP_LT: cond = oldval < cmparg; break;
+    case FUTEX_OP_CMP_LE: cond = oldval <= cmparg; break;
+    case FUTEX_OP_CMP_GT: cond = oldval > cmparg; break;
+    default:              cond = oldval >= cmparg; break;
+    }
+
+    int woken = wake_locked(b1, uaddr, nr, FUTEX_BITSET_MATCH_ANY);
+    if (cond) {
+        woken += wake_locked(b2, uaddr2, nr2, FUTEX_BITSET_MATCH_ANY);
+    }
+    double_unlock(b1, b2);
+    return woken;
+}
+
+}
+
+int futex(int *uaddr, int op, int val, const struct timespec *timeout,
+        int *uaddr2, uint32_t val3)
+{
+    int cmd = op & FUTEX_CMD_MASK;
+    // For the requeue and wake-op commands, the timeout argument is really
+    // the integer val2.
+    int val2 = static_cast<int>(reinterpret_cast<uintptr_t>(timeout));
+
+    switch (cmd) {
+    case FUTEX_WAIT:
+        val3 = FUTEX_BITSET_MATCH_ANY;
+        // fall through
+    case FUTEX_WAIT_BITSET: {
+        if (!val3) {
+            errno = EINVAL;
+            return -1;
+        }
+        trace_futex_wait(uaddr, val, val3);
+        int ret;
+        if (timeout) {
+            sched::timer tmr(*sched::thread::current());
+            if (cmd == FUTEX_WAIT_BITSET) {
+                // If FUTEX_WAIT_BITSET we need to interpret timeout as an absolute
+                // time point. If futex operation FUTEX_CLOCK_REALTIME is set we will use
+                // real-time clock otherwise we will use monotonic clock
+                if (op & FUTEX_CLOCK_REALTIME) {
+                    tmr.set(osv::clock::wall::time_point(std::chrono::seconds(timeout->tv_sec) +
+                                                         std::chrono::nanoseconds(timeout->tv_nsec)));
+                } else {
+                    tmr.set(osv::clock::uptime::time_point(std::chrono::seconds(timeout->tv_sec) +
+                                                           std::chrono::nanoseconds(timeout->tv_nsec)));
+                }
+            } else {
+                tmr.set(std::chrono::seconds(timeout->tv_sec) +
+                        std::chrono::nanoseconds(timeout->tv_nsec));
+            }
+            ret = futex_wait(uaddr, val, val3, &tmr);
+        } else {
+            ret = futex_wait(uaddr, val, val3, nullptr);
+        }
+        trace_futex_wait_ret(uaddr, ret);
+        return ret;
+    }
+    case FUTEX_WAKE:
+        val3 = FUTEX_BITSET_MATCH_ANY;
+        // fall through
+    case FUTEX_WAKE_BITSET: {
+        if (val < 0 || !val3) {
+            errno = EINVAL;
+            return -1;
+        }
+        auto woken = futex_wake(uaddr, val, val3);
+        trace_futex_wake(uaddr, val, val3, woken);
+        return woken;
+    }
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE: {
+        if (val < 0 || val2 < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        int cmpval = static_cast<int>(val3);
+        auto ret = futex_requeue(uaddr, uaddr2, val, val2,
+                                 cmd == FUTEX_CMP_REQUEUE ? &cmpval : nullptr);
+        trace_futex_requeue(uaddr, uaddr2, val, val2, ret);
+        return ret;
+    }
+    case FUTEX_WAKE_OP: {
+        auto ret = futex_wake_op(uaddr, uaddr2, val, val2, val3);
+        trace_futex_wake_op(uaddr, uaddr2, val3, ret);
+        return ret;
+    }
+    default:
+        // Priority-inheritance futexes (FUTEX_LOCK_PI and friends) are not
+        // supported. Like a Linux kernel built without them, report ENOSYS
+        // so that callers can fall back to plain futexes.
+        errno = ENOSYS;
+        return -1;
+    }
+}
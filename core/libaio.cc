@@ -7,26 +7,479 @@
 
 // This is the Linux-specific asynchronous I/O API / ABI from libaio.
 // Note that this API is different the Posix AIO API.
+//
+// Reads and writes of O_DIRECT files backed directly by a block device are
+// turned into bios and submitted to the device's strategy routine without
+// waiting; the driver's completion path then posts an io_event to the
+// context's completion ring (and optionally signals an eventfd). Every other
+// request is performed synchronously by io_submit(), which is what Linux
+// does too for files that do not support asynchronous I/O, and is posted to
+// the ring as already completed.
 
 #include <api/libaio.h>
 
-#include <osv/stubbing.hh>
+#include <osv/prex.h>
+#include <osv/bio.h>
+#include <osv/device.h>
+#include <osv/file.h>
+#include <osv/fcntl.h>
+#include <osv/vnode.h>
+#include <osv/dentry.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <osv/clock.hh>
+#include <osv/mmu.hh>
+#include <osv/trace.hh>
 #include <osv/export.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <unordered_set>
+#include <vector>
+
+TRACEPOINT(trace_aio_setup, "ctx=%p nr_events=%d", io_context_t, int);
+TRACEPOINT(trace_aio_destroy, "ctx=%p", io_context_t);
+TRACEPOINT(trace_aio_submit_bio, "ctx=%p iocb=%p cmd=%d offset=%ld len=%lu", io_context_t, struct iocb *, int, off_t, size_t);
+TRACEPOINT(trace_aio_submit_sync, "ctx=%p iocb=%p cmd=%d", io_context_t, struct iocb *, int);
+TRACEPOINT(trace_aio_complete, "ctx=%p iocb=%p res=%ld", io_context_t, struct iocb *, long);
+TRACEPOINT(trace_aio_getevents, "ctx=%p min_nr=%ld nr=%ld", io_context_t, long, long);
+TRACEPOINT(trace_aio_getevents_ret, "ctx=%p ret=%d", io_context_t, int);
+
+// Same as the default fs.aio-max-nr on Linux
+static constexpr int max_aio_events = 65536;
+
+struct io_context {
+    explicit io_context(unsigned nr_events) : ring(nr_events) {}
+
+    // Protects the completion ring and the request accounting below. It is
+    // taken by the submitter and by the driver's completion thread.
+    mutex lock;
+    condvar completed;
+    // Circular buffer of completed but not yet reaped events. Its size is
+    // the maximum number of requests the context can have in flight.
+    std::vector<io_event> ring;
+    unsigned head = 0;
+    unsigned count = 0;
+    unsigned inflight = 0;
+    // Set by io_destroy(), which wakes up the threads waiting for events
+    bool destroyed = false;
+    // One reference is held by the set of live contexts below and one by
+    // every io_submit() and io_getevents() using the context. Protected by
+    // contexts_lock.
+    unsigned refs = 1;
+
+    int reserve();
+    void complete(struct iocb *iocb, long res);
+};
+
+// Contexts are handed out to the application as plain pointers, so keep
+// track of the live ones in order to reject bogus or destroyed handles.
+static mutex contexts_lock;
+static std::unordered_set<io_context*> contexts;
+
+static void put_context(io_context *ctx)
+{
+    bool last;
+    WITH_LOCK(contexts_lock) {
+        last = --ctx->refs == 0;
+    }
+    if (last) {
+        delete ctx;
+    }
+}
+
+namespace {
+
+// A reference to a live context, which keeps a concurrent io_destroy()
+// from freeing it while it is in use
+class context_ref {
+public:
+    explicit context_ref(io_context *ctx) : _ctx(ctx) {}
+    context_ref(context_ref&& other) : _ctx(other._ctx) {
+        other._ctx = nullptr;
+    }
+    context_ref(const context_ref&) = delete;
+    context_ref& operator=(const context_ref&) = delete;
+    ~context_ref() {
+        if (_ctx) {
+            put_context(_ctx);
+        }
+    }
+    io_context* get() const {
+        return _ctx;
+    }
+private:
+    io_context *_ctx;
+};
+
+}
+
+static context_ref lookup_context(io_context_t ctx)
+{
+    SCOPE_LOCK(contexts_lock);
+    if (!contexts.count(ctx)) {
+        return context_ref(nullptr);
+    }
+    ctx->refs++;
+    return context_ref(ctx);
+}
+
+// Reserves a slot in the completion ring for a new request, so that
+// completions never have to be dropped. Returns 0 or the errno to fail
+// the request with.
+int io_context::reserve()
+{
+    SCOPE_LOCK(lock);
+    if (destroyed) {
+        return EINVAL;
+    }
+    if (inflight + count == ring.size()) {
+        return EAGAIN;
+    }
+    inflight++;
+    return 0;
+}
+
+void io_context::complete(struct iocb *iocb, long res)
+{
+    trace_aio_complete(this, iocb, res);
+    WITH_LOCK(lock) {
+        auto& ev = ring[(head + count) % ring.size()];
+        ev.data = iocb->data;
+        ev.obj = iocb;
+        ev.res = res;
+        ev.res2 = 0;
+        count++;
+        inflight--;
+        completed.wake_all();
+    }
+}
+
+static void signal_eventfd(file *fp)
+{
+    uint64_t one = 1;
+    iovec iov{&one, sizeof(one)};
+    uio data{&iov, 1, 0, sizeof(one), UIO_WRITE};
+    fp->write(&data, 0);
+}
+
+namespace {
+
+struct aio_request {
+    io_context *ctx;
+    struct iocb *iocb;
+    file *resfp;
+};
+
+}
+
+static void aio_bio_done(struct bio *bio)
+{
+    auto req = static_cast<aio_request*>(bio->bio_caller1);
+    long res = (bio->bio_flags & BIO_ERROR) ? -EIO : long(bio->bio_bcount);
+    destroy_bio(bio);
+    req->ctx->complete(req->iocb, res);
+    if (req->resfp) {
+        signal_eventfd(req->resfp);
+        fdrop(req->resfp);
+    }
+    delete req;
+}
+
+// Returns the block device behind fp if the request can be sent to it as
+// a single bio, or nullptr if it has to be performed synchronously.
+static device* bio_device(file *fp, struct iocb *iocb)
+{
+    if (!(fp->f_flags & O_DIRECT) || !fp->f_dentry) {
+        return nullptr;
+    }
+    auto vp = fp->f_dentry->d_vnode;
+    if (vp->v_type != VBLK) {
+        return nullptr;
+    }
+    auto dev = static_cast<device*>(vp->v_data);
+    if (!dev->driver->devops->strategy) {
+        return nullptr;
+    }
+    switch (iocb->aio_lio_opcode) {
+    case IO_CMD_FSYNC:
+    case IO_CMD_FDSYNC:
+        return dev;
+    case IO_CMD_PREAD:
+    case IO_CMD_PWRITE: {
+        auto& c = iocb->u.c;
+        if (c.nbytes == 0 || c.offset < 0 ||
+            (c.offset % BSIZE) != 0 || (c.nbytes % BSIZE) != 0 ||
+            c.offset + c.nbytes > (unsigned long)dev->size) {
+            return nullptr;
+        }
+        // The driver DMAs straight into the buffer, so it has to be backed
+        // by memory that cannot fault while the request is in flight
+        if (!mmu::is_linear_mapped(c.buf, c.nbytes)) {
+            return nullptr;
+        }
+        return dev;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+static int submit_bio(io_context *ctx, device *dev, struct iocb *iocb, file *resfp)
+{
+    auto bio = alloc_bio();
+    auto req = new (std::nothrow) aio_request{ctx, iocb, resfp};
+    if (!bio || !req) {
+        if (bio) {
+            destroy_bio(bio);
+        }
+        delete req;
+        return ENOMEM;
+    }
+    switch (iocb->aio_lio_opcode) {
+    case IO_CMD_PREAD:
+        bio->bio_cmd = BIO_READ;
+        break;
+    case IO_CMD_PWRITE:
+        bio->bio_cmd = BIO_WRITE;
+        break;
+    default:
+        bio->bio_cmd = BIO_FLUSH;
+        break;
+    }
+    bio->bio_dev = dev;
+    if (bio->bio_cmd != BIO_FLUSH) {
+        bio->bio_data = iocb->u.c.buf;
+        bio->bio_offset = iocb->u.c.offset;
+        bio->bio_bcount = iocb->u.c.nbytes;
+    }
+    bio->bio_caller1 = req;
+    bio->bio_done = aio_bio_done;
+    trace_aio_submit_bio(ctx, iocb, bio->bio_cmd, bio->bio_offset, bio->bio_bcount);
+    dev->driver->devops->strategy(bio);
+    return 0;
+}
+
+static long submit_sync(io_context *ctx, struct iocb *iocb)
+{
+    trace_aio_submit_sync(ctx, iocb, iocb->aio_lio_opcode);
+    int fd = iocb->aio_fildes;
+    auto& c = iocb->u.c;
+    auto& v = iocb->u.v;
+    long ret;
+    switch (iocb->aio_lio_opcode) {
+    case IO_CMD_PREAD:
+        ret = pread(fd, c.buf, c.nbytes, c.offset);
+        break;
+    case IO_CMD_PWRITE:
+        ret = pwrite(fd, c.buf, c.nbytes, c.offset);
+        break;
+    case IO_CMD_PREADV:
+        ret = preadv(fd, v.vec, v.nr, v.offset);
+        break;
+    case IO_CMD_PWRITEV:
+        ret = pwritev(fd, v.vec, v.nr, v.offset);
+        break;
+    case IO_CMD_FSYNC:
+        ret = fsync(fd);
+        break;
+    case IO_CMD_FDSYNC:
+        ret = fdatasync(fd);
+        break;
+    default:
+        ret = 0;
+        break;
+    }
+    return ret < 0 ? -errno : ret;
+}
+
+// Validates and starts a single request. Returns 0 once the request has
+// been queued (its completion will show up in the ring), or a positive
+// errno if it was rejected and io_submit() should stop.
+static int submit_one(io_context *ctx, struct iocb *iocb)
+{
+    if (!iocb) {
+        return EFAULT;
+    }
+    switch (iocb->aio_lio_opcode) {
+    case IO_CMD_PREAD:
+    case IO_CMD_PWRITE:
+    case IO_CMD_PREADV:
+    case IO_CMD_PWRITEV:
+    case IO_CMD_FSYNC:
+    case IO_CMD_FDSYNC:
+    case IO_CMD_NOOP:
+        break;
+    default:
+        return EINVAL;
+    }
+
+    file *fp;
+    int error = fget(iocb->aio_fildes, &fp);
+    if (error) {
+        return error;
+    }
+    bool reading = iocb->aio_lio_opcode == IO_CMD_PREAD ||
+                   iocb->aio_lio_opcode == IO_CMD_PREADV;
+    bool writing = iocb->aio_lio_opcode == IO_CMD_PWRITE ||
+                   iocb->aio_lio_opcode == IO_CMD_PWRITEV;
+    if ((reading && !(fp->f_flags & FREAD)) ||
+        (writing && !(fp->f_flags & FWRITE))) {
+        fdrop(fp);
+        return EBADF;
+    }
+
+    file *resfp = nullptr;
+    if (iocb->u.c.flags & IOCB_FLAG_RESFD) {
+        error = fget(iocb->u.c.resfd, &resfp);
+        if (error) {
+            fdrop(fp);
+            return error;
+        }
+    }
+
+    error = ctx->reserve();
+    if (error) {
+        if (resfp) {
+            fdrop(resfp);
+        }
+        fdrop(fp);
+        return error;
+    }
+
+    auto dev = bio_device(fp, iocb);
+    fdrop(fp);
+    if (dev) {
+        error = submit_bio(ctx, dev, iocb, resfp);
+        if (!error) {
+            return 0;
+        }
+        WITH_LOCK(ctx->lock) {
+            ctx->inflight--;
+        }
+        if (resfp) {
+            fdrop(resfp);
+        }
+        return error;
+    }
+
+    ctx->complete(iocb, submit_sync(ctx, iocb));
+    if (resfp) {
+        signal_eventfd(resfp);
+        fdrop(resfp);
+    }
+    return 0;
+}
+
 OSV_LIBAIO_API
 int io_setup(int nr_events, io_context_t *ctxp_idp) {
-    // This is a stub that doesn't actually do anything. If the caller tries
-    // to follow the io_setup() call with any other libaio call, those will
-    // fail.
-    WARN_STUBBED();
-    if (nr_events < 0) {
+    if (nr_events <= 0 || !ctxp_idp || *ctxp_idp) {
         return -EINVAL;
     }
+    if (nr_events > max_aio_events) {
+        return -EAGAIN;
+    }
+    auto ctx = new (std::nothrow) io_context(nr_events);
+    if (!ctx) {
+        return -ENOMEM;
+    }
+    WITH_LOCK(contexts_lock) {
+        contexts.insert(ctx);
+    }
+    trace_aio_setup(ctx, nr_events);
+    *ctxp_idp = ctx;
+    return 0;
+}
+
+OSV_LIBAIO_API
+int io_destroy(io_context_t ctx_id) {
+    WITH_LOCK(contexts_lock) {
+        if (!contexts.erase(ctx_id)) {
+            return -EINVAL;
+        }
+    }
+    trace_aio_destroy(ctx_id);
+    // Requests already handed to the driver cannot be cancelled, so wait
+    // for them like Linux does. Threads still using the context hold
+    // references to it, the last one frees it.
+    WITH_LOCK(ctx_id->lock) {
+        ctx_id->destroyed = true;
+        ctx_id->completed.wake_all();
+        while (ctx_id->inflight) {
+            ctx_id->completed.wait(&ctx_id->lock);
+        }
+    }
+    put_context(ctx_id);
     return 0;
 }
 
-UNIMPL(OSV_LIBAIO_API int io_submit(io_context_t ctx, long nr, struct iocb *ios[]))
-UNIMPL(OSV_LIBAIO_API int io_getevents(io_context_t ctx_id, long min_nr, long nr,
-        struct io_event *events, struct timespec *timeout))
-UNIMPL(OSV_LIBAIO_API int io_destroy(io_context_t ctx))
-UNIMPL(OSV_LIBAIO_API int io_cancel(io_context_t ctx, struct iocb *iocb, struct io_event *evt))
+OSV_LIBAIO_API
+int io_submit(io_context_t ctx_id, long nr, struct iocb *ios[]) {
+    auto ref = lookup_context(ctx_id);
+    auto ctx = ref.get();
+    if (!ctx || nr < 0) {
+        return -EINVAL;
+    }
+    long i;
+    for (i = 0; i < nr; i++) {
+        int error = submit_one(ctx, ios[i]);
+        if (error) {
+            // Like Linux, report the error only if nothing was submitted
+            return i ? i : -error;
+        }
+    }
+    return i;
+}
+
+OSV_LIBAIO_API
+int io_getevents(io_context_t ctx_id, long min_nr, long nr,
+        struct io_event *events, struct timespec *timeout) {
+    auto ref = lookup_context(ctx_id);
+    auto ctx = ref.get();
+    if (!ctx || min_nr < 0 || nr < min_nr) {
+        return -EINVAL;
+    }
+    trace_aio_getevents(ctx, min_nr, nr);
+    osv::clock::uptime::time_point deadline;
+    if (timeout) {
+        if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000) {
+            return -EINVAL;
+        }
+        deadline = osv::clock::uptime::now() +
+            std::chrono::seconds(timeout->tv_sec) + std::chrono::nanoseconds(timeout->tv_nsec);
+    }
+    int ret = 0;
+    WITH_LOCK(ctx->lock) {
+        while (ctx->count < (unsigned long)min_nr && !ctx->destroyed) {
+            if (timeout) {
+                if (ctx->completed.wait(&ctx->lock, deadline)) {
+                    break;
+                }
+            } else {
+                ctx->completed.wait(&ctx->lock);
+            }
+        }
+        while (ret < nr && ctx->count) {
+            events[ret++] = ctx->ring[ctx->head];
+            ctx->head = (ctx->head + 1) % ctx->ring.size();
+            ctx->count--;
+        }
+        if (!ret && ctx->destroyed) {
+            ret = -EINVAL;
+        }
+    }
+    trace_aio_getevents_ret(ctx, ret);
+    return ret;
+}
+
+OSV_LIBAIO_API
+int io_cancel(io_context_t ctx_id, struct iocb *iocb, struct io_event *evt) {
+    if (!lookup_context(ctx_id).get()) {
+        return -EINVAL;
+    }
+    // Bios cannot be withdrawn once they are handed to the driver and
+    // synchronous requests are complete by the time io_submit() returns.
+    return -EAGAIN;
+}
@@ -6,6 +6,8 @@
  */
 
 #include <osv/mempool.hh>
+#include <osv/numa.hh>
+#include <osv/pagealloc.hh>
 #include <osv/ilog2.hh>
 #include "arch-setup.hh"
 #include <cassert>
@@ -42,6 +44,7 @@
 #include <osv/kernel_config_memory_debug.h>
 #include <osv/kernel_config_memory_l1_pool_size.h>
 #include <osv/kernel_config_memory_page_batch_size.h>
+#include <osv/kernel_config_memory_zero_pool_size.h>
 #include <osv/kernel_config_memory_jvm_balloon.h>
 
 // recent Boost gets confused by the "hidden" macro we add in some Musl
@@ -380,6 +383,45 @@ pool* pool::from_object(void* object)
     return header->owner;
 }
 
+// The malloc() size classes: 8 and 16 bytes, then multiples of 16 bytes
+// spaced a quarter of a power of two apart, so that rounding a request up
+// wastes at most 25% (a 33 byte object takes 48 bytes, not 64). The largest
+// classes still fit two or three objects in a page; bigger objects get a
+// page of their own.
+//
+// Objects are laid out back to back from the end of a page, so an object of
+// a class is aligned to the largest power of two dividing the class size.
+static constexpr unsigned malloc_pool_sizes[] = {
+    8, 16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1280, 1536, 1792,
+};
+static constexpr unsigned malloc_pool_count =
+    sizeof(malloc_pool_sizes) / sizeof(malloc_pool_sizes[0]);
+static constexpr size_t malloc_pool_max_size = malloc_pool_sizes[malloc_pool_count - 1];
+static_assert(2 * malloc_pool_max_size < page_size, "malloc pool classes too large");
+
+// Index of the smallest size class that can hold size bytes, which must not
+// exceed malloc_pool_max_size
+static inline unsigned malloc_pool_index(size_t size)
+{
+    if (size <= 16) {
+        return size > 8;
+    }
+    if (size <= 128) {
+        return (size + 15) / 16;
+    }
+    // Four classes in (2^k, 2^(k+1)], 2^(k-2) apart
+    unsigned k = ilog2(size - 1);
+    unsigned q = (size - 1) >> (k - 2);
+    return 9 + (k - 7) * 4 + (q - 4);
+}
+
+static inline size_t malloc_pool_alignment(unsigned index)
+{
+    return 1ul << count_trailing_zeros(malloc_pool_sizes[index]);
+}
+
 class malloc_pool : public pool {
 public:
     malloc_pool();
@@ -387,7 +429,7 @@ private:
     static size_t compute_object_size(unsigned pos);
 };
 
-malloc_pool malloc_pools[ilog2_roundup_constexpr(page_size) + 1]
+malloc_pool malloc_pools[malloc_pool_count]
     __attribute__((init_priority((int)init_prio::malloc_pools)));
 
 struct mark_smp_allocator_intialized {
@@ -420,11 +462,7 @@ malloc_pool::malloc_pool()
 
 size_t malloc_pool::compute_object_size(unsigned pos)
 {
-    size_t size = 1 << pos;
-    if (size > max_object_size) {
-        size = max_object_size;
-    }
-    return size;
+    return malloc_pool_sizes[pos];
 }
 
 page_range::page_range(size_t _size)
@@ -587,19 +625,181 @@ void reclaimer::wait_for_memory(size_t mem)
     _oom_blocked.wait(mem);
 }
 
+// NUMA topology, see numa.hh. Only written at boot, before the other cpus
+// are started.
+namespace numa {
+
+struct mem_range {
+    u64 start;
+    u64 end;
+    unsigned node;
+};
+// Where a node starts in physical memory. The first boundary is at 0, so
+// holes belong to the node below them.
+struct boundary {
+    u64 start;
+    unsigned node;
+};
+
+static constexpr unsigned max_mem_ranges = 4 * max_numa_nodes;
+static mem_range mem_ranges[max_mem_ranges];
+static unsigned nr_mem_ranges;
+static boundary boundaries[max_mem_ranges];
+static unsigned nr_boundaries;
+static unsigned nr_nodes = 1;
+static unsigned char distances[max_numa_nodes][max_numa_nodes];
+static unsigned char fallback[max_numa_nodes][max_numa_nodes];
+static size_t node_memory[max_numa_nodes];
+
+static const boundary* boundary_after(u64 phys)
+{
+    return std::upper_bound(boundaries, boundaries + nr_boundaries, phys,
+        [] (u64 phys, const boundary& b) { return phys < b.start; });
+}
+
+// The first address above addr where memory is on another node, or nullptr
+static void* next_boundary(const void* addr)
+{
+    if (nr_nodes == 1) {
+        return nullptr;
+    }
+    auto b = boundary_after(static_cast<const char*>(addr) - mmu::phys_mem);
+    return b == boundaries + nr_boundaries ? nullptr : mmu::phys_mem + b->start;
+}
+
+}
+
+unsigned numa_nodes()
+{
+    return numa::nr_nodes;
+}
+
+unsigned numa_node_of(const void* addr)
+{
+    if (numa::nr_nodes == 1) {
+        return 0;
+    }
+    return (numa::boundary_after(static_cast<const char*>(addr) - mmu::phys_mem) - 1)->node;
+}
+
+unsigned numa_distance(unsigned from, unsigned to)
+{
+    if (numa::nr_nodes == 1) {
+        return 10;
+    }
+    return numa::distances[from][to];
+}
+
+size_t numa_node_memory(unsigned node)
+{
+    if (numa::nr_nodes == 1) {
+        return stats::total();
+    }
+    return numa::node_memory[node];
+}
+
+const unsigned char* numa_fallback_order(unsigned node)
+{
+    return numa::fallback[node];
+}
+
+unsigned numa_current_node()
+{
+    return smp_allocator ? sched::cpu::current()->numa_node : 0;
+}
+
+void numa_add_memory(unsigned node, u64 phys_start, u64 size)
+{
+    if (node < max_numa_nodes && numa::nr_mem_ranges < numa::max_mem_ranges) {
+        numa::mem_ranges[numa::nr_mem_ranges++] = {phys_start, phys_start + size, node};
+    }
+}
+
+void numa_set_distance(unsigned from, unsigned to, unsigned distance)
+{
+    if (from < max_numa_nodes && to < max_numa_nodes) {
+        numa::distances[from][to] = std::min(distance, 255u);
+    }
+}
+
+static __thread numa_policy thread_policy;
+
+numa_policy& thread_numa_policy()
+{
+    return thread_policy;
+}
+
+int numa_policy::node_for(size_t page_idx) const
+{
+    auto allowed = nodes;
+    if (numa::nr_nodes < 64) {
+        allowed &= (u64(1) << numa::nr_nodes) - 1;
+    }
+    if (m == mode::local || !allowed) {
+        return -1;
+    }
+    // The local node is served from the page pools of the cpu. Those are
+    // almost all local pages, but pages freed on this cpu go there whatever
+    // their node is, so the policy is not strict.
+    unsigned local = numa_current_node();
+    unsigned node = local;
+    switch (m) {
+    case mode::preferred:
+        node = count_trailing_zeros(allowed);
+        break;
+    case mode::bind:
+        for (unsigned i = 0; i < numa::nr_nodes; i++) {
+            node = numa::fallback[local][i];
+            if (allowed & (u64(1) << node)) {
+                break;
+            }
+        }
+        break;
+    case mode::interleave:
+        for (auto k = page_idx % __builtin_popcountll(allowed); k; k--) {
+            allowed &= allowed - 1;
+        }
+        node = count_trailing_zeros(allowed);
+        break;
+    default:
+        break;
+    }
+    return node == local ? -1 : node;
+}
+
 class page_range_allocator {
 public:
     static constexpr unsigned max_order = page_ranges_max_order;
 
     page_range_allocator() : _deferred_free(nullptr) { }
 
+    // Both prefer memory of the given node, and fall back to the other nodes
+    // by distance
     template<bool UseBitmap = true>
-    page_range* alloc(size_t size, bool contiguous = true);
+    page_range* alloc(size_t size, bool contiguous = true, unsigned node = 0);
     page_range* alloc_aligned(size_t size, size_t offset, size_t alignment,
-                              bool fill = false);
+                              bool fill = false, unsigned node = 0);
     void free(page_range* pr);
+    // Shrink an allocated range to size bytes and free the rest of it
+    void trim(page_range* pr, size_t size);
 
     void initial_add(page_range* pr);
+    // Moves all free ranges to the lists of their node, splitting those that
+    // span nodes. Called once the NUMA topology is known.
+    void repartition();
+
+    // Free page reporting: carve out of a free range a run of at most
+    // max_size bytes of whole huge pages the host was not told about yet, or
+    // return nullptr. put_reported() frees such a run again and remembers
+    // it was reported, until some of its pages get allocated.
+    page_range* take_unreported(size_t max_size);
+    void put_reported(page_range* pr);
+    size_t reporting_blocks() const {
+        return align_up(_bitmap.size(), reporting_block_pages) / reporting_block_pages;
+    }
+    void enable_reporting(boost::dynamic_bitset<>& reported) {
+        _reported.swap(reported);
+    }
 
     template<typename Func>
     void for_each(unsigned min_order, Func f);
@@ -609,68 +809,134 @@ public:
     }
 
     bool empty() const {
-        return _not_empty.none();
+        for (unsigned node = 0; node < numa_nodes(); node++) {
+            if (_nodes[node]._not_empty.any()) {
+                return false;
+            }
+        }
+        return true;
     }
     size_t size() const {
-        size_t size = _free_huge.size();
-        for (auto&& list : _free) {
-            size += list.size();
+        size_t size = 0;
+        for (unsigned node = 0; node < numa_nodes(); node++) {
+            size += _nodes[node]._free_huge.size();
+            for (auto&& list : _nodes[node]._free) {
+                size += list.size();
+            }
         }
         return size;
     }
+    size_t free_bytes(unsigned node) {
+        size_t bytes = 0;
+        for_each_in(_nodes[node], 0, [&] (page_range& pr) { bytes += pr.size; return true; });
+        return bytes;
+    }
 
     void stats(stats::page_ranges_stats& stats) const {
-        stats.order[max_order].ranges_num = _free_huge.size();
-        stats.order[max_order].bytes = 0;
-        for (auto& pr : _free_huge) {
-            stats.order[max_order].bytes += pr.size;
+        for (auto order = max_order + 1; order--;) {
+            stats.order[order].ranges_num = 0;
+            stats.order[order].bytes = 0;
         }
+        for (unsigned node = 0; node < numa_nodes(); node++) {
+            auto& fl = _nodes[node];
+            stats.order[max_order].ranges_num += fl._free_huge.size();
+            for (auto& pr : fl._free_huge) {
+                stats.order[max_order].bytes += pr.size;
+            }
 
-        for (auto order = max_order; order--;) {
-            stats.order[order].ranges_num = _free[order].size();
-            stats.order[order].bytes = 0;
-            for (auto& pr : _free[order]) {
-                stats.order[order].bytes += pr.size;
+            for (auto order = max_order; order--;) {
+                stats.order[order].ranges_num += fl._free[order].size();
+                for (auto& pr : fl._free[order]) {
+                    stats.order[order].bytes += pr.size;
+                }
             }
         }
     }
 
 private:
+    // Free ranges never span two NUMA nodes, every node has lists of its own
+    struct free_lists {
+        bi::multiset<page_range,
+                     bi::member_hook<page_range,
+                                     bi::set_member_hook<>,
+                                     &page_range::set_hook>,
+                     bi::constant_time_size<false>> _free_huge;
+        bi::list<page_range,
+                 bi::member_hook<page_range,
+                                 bi::list_member_hook<>,
+                                 &page_range::list_hook>,
+                 bi::constant_time_size<false>> _free[max_order];
+
+        std::bitset<max_order + 1> _not_empty;
+    };
+    free_lists& lists_of(page_range& pr) {
+        return _nodes[numa_node_of(&pr)];
+    }
+    bool same_node(page_range& pr1, page_range& pr2) const {
+        return numa_nodes() == 1 || numa_node_of(&pr1) == numa_node_of(&pr2);
+    }
+    template<bool UseBitmap>
+    page_range* alloc_from(free_lists& fl, size_t size, bool contiguous);
+    template<typename Func>
+    bool for_each_in(free_lists& fl, unsigned min_order, Func f);
+    // Calls f for each part of the range that is on a single node
+    template<typename Func>
+    void split_by_node(page_range* pr, Func f);
+
     template<bool UseBitmap = true>
     void insert(page_range& pr) {
         auto addr = static_cast<void*>(&pr);
         auto pr_end = static_cast<page_range**>(addr + pr.size - sizeof(page_range**));
         *pr_end = &pr;
+        auto& fl = lists_of(pr);
         auto order = ilog2(pr.size / page_size);
         if (order >= max_order) {
-            _free_huge.insert(pr);
-            _not_empty[max_order] = true;
+            fl._free_huge.insert(pr);
+            fl._not_empty[max_order] = true;
         } else {
-            _free[order].push_front(pr);
-            _not_empty[order] = true;
+            fl._free[order].push_front(pr);
+            fl._not_empty[order] = true;
         }
         if (UseBitmap) {
             set_bits(pr, true);
         }
     }
-    void remove_huge(page_range& pr) {
-        _free_huge.erase(_free_huge.iterator_to(pr));
-        if (_free_huge.empty()) {
-            _not_empty[max_order] = false;
+    void remove_huge(free_lists& fl, page_range& pr) {
+        fl._free_huge.erase(fl._free_huge.iterator_to(pr));
+        if (fl._free_huge.empty()) {
+            fl._not_empty[max_order] = false;
         }
     }
-    void remove_list(unsigned order, page_range& pr) {
-        _free[order].erase(_free[order].iterator_to(pr));
-        if (_free[order].empty()) {
-            _not_empty[order] = false;
+    void remove_list(free_lists& fl, unsigned order, page_range& pr) {
+        fl._free[order].erase(fl._free[order].iterator_to(pr));
+        if (fl._free[order].empty()) {
+            fl._not_empty[order] = false;
         }
     }
     void remove(page_range& pr) {
+        auto& fl = lists_of(pr);
         auto order = ilog2(pr.size / page_size);
         if (order >= max_order) {
-            remove_huge(pr);
+            remove_huge(fl, pr);
         } else {
-            remove_list(order, pr);
+            remove_list(fl, order, pr);
+        }
+    }
+
+    static constexpr size_t reporting_block_pages = mmu::huge_page_size / page_size;
+    size_t get_block_idx(uintptr_t addr) const {
+        return (addr - reinterpret_cast<uintptr_t>(mmu::phys_mem)) / mmu::huge_page_size;
+    }
+    // Pages of the range are about to be used, they need reporting again
+    // once they are freed
+    void clear_reported(page_range& pr) {
+        if (_reported.empty()) {
+            return;
+        }
+        auto start = reinterpret_cast<uintptr_t>(&pr);
+        auto last = get_block_idx(start + pr.size - 1);
+        for (auto idx = get_block_idx(start); idx <= last; idx++) {
+            _reported[idx] = false;
         }
     }
 
@@ -691,18 +957,7 @@ private:
         }
     }
 
-    bi::multiset<page_range,
-                 bi::member_hook<page_range,
-                                 bi::set_member_hook<>,
-                                 &page_range::set_hook>,
-                 bi::constant_time_size<false>> _free_huge;
-    bi::list<page_range,
-             bi::member_hook<page_range,
-                             bi::list_member_hook<>,
-                             &page_range::list_hook>,
-             bi::constant_time_size<false>> _free[max_order];
-
-    std::bitset<max_order + 1> _not_empty;
+    free_lists _nodes[max_numa_nodes];
 
     template<typename T>
     class bitmap_allocator {
@@ -717,6 +972,9 @@ private:
     boost::dynamic_bitset<unsigned long,
                           bitmap_allocator<unsigned long>> _bitmap;
     page_range* _deferred_free;
+    // One bit per huge page, set if it is free and was reported to the
+    // host. Empty unless a balloon device does free page reporting.
+    boost::dynamic_bitset<> _reported;
 };
 
 page_range_allocator free_page_ranges
@@ -742,13 +1000,26 @@ void page_range_allocator::bitmap_allocator<T>::deallocate(T* p, size_t n)
 }
 
 template<bool UseBitmap>
-page_range* page_range_allocator::alloc(size_t size, bool contiguous)
+page_range* page_range_allocator::alloc(size_t size, bool contiguous, unsigned node)
+{
+    auto order = numa_fallback_order(node);
+    for (unsigned i = 0; i < numa_nodes(); i++) {
+        auto pr = alloc_from<UseBitmap>(_nodes[order[i]], size, contiguous);
+        if (pr) {
+            return pr;
+        }
+    }
+    return nullptr;
+}
+
+template<bool UseBitmap>
+page_range* page_range_allocator::alloc_from(free_lists& fl, size_t size, bool contiguous)
 {
     auto exact_order = ilog2_roundup(size / page_size);
     if (exact_order > max_order) {
         exact_order = max_order;
     }
-    auto bitset = _not_empty.to_ulong();
+    auto bitset = fl._not_empty.to_ulong();
     if (exact_order) {
         bitset &= ~((1 << exact_order) - 1);
     }
@@ -756,16 +1027,16 @@ page_range* page_range_allocator::alloc(size_t size, bool contiguous)
 
     page_range* range = nullptr;
     if (!bitset) {
-        if (!contiguous || !exact_order || _free[exact_order - 1].empty()) {
+        if (!contiguous || !exact_order || fl._free[exact_order - 1].empty()) {
             return nullptr;
         }
         // This linear search makes worst case complexity of the allocator
         // O(n). Unfortunately we do not have choice for contiguous allocation
         // so let us hope there is large enough range.
-        for (auto&& pr : _free[exact_order - 1]) {
+        for (auto&& pr : fl._free[exact_order - 1]) {
             if (pr.size >= size) {
                 range = &pr;
-                remove_list(exact_order - 1, *range);
+                remove_list(fl, exact_order - 1, *range);
                 break;
             }
         }
@@ -773,14 +1044,14 @@ page_range* page_range_allocator::alloc(size_t size, bool contiguous)
             return nullptr;
         }
     } else if (order == max_order) {
-        range = &*_free_huge.rbegin();
+        range = &*fl._free_huge.rbegin();
         if (range->size < size) {
             return nullptr;
         }
-        remove_huge(*range);
+        remove_huge(fl, *range);
     } else {
-        range = &_free[order].front();
-        remove_list(order, *range);
+        range = &fl._free[order].front();
+        remove_list(fl, order, *range);
     }
 
     auto& pr = *range;
@@ -793,14 +1064,16 @@ page_range* page_range_allocator::alloc(size_t size, bool contiguous)
     if (UseBitmap) {
         set_bits(pr, false);
     }
+    clear_reported(pr);
     return &pr;
 }
 
 page_range* page_range_allocator::alloc_aligned(size_t size, size_t offset,
-                                                size_t alignment, bool fill)
+                                                size_t alignment, bool fill,
+                                                unsigned node)
 {
     page_range* ret_header = nullptr;
-    for_each(std::max(ilog2(size / page_size), 1u) - 1, [&] (page_range& header) {
+    auto fits = [&] (page_range& header) {
         char* v = reinterpret_cast<char*>(&header);
         auto expected_ret = v + header.size - size + offset;
         auto alignment_shift = expected_ret - align_down(expected_ret, alignment);
@@ -819,10 +1092,15 @@ page_range* page_range_allocator::alloc_aligned(size_t size, size_t offset,
                 ret_header = new (v + header.size) page_range(size);
             }
             set_bits(*ret_header, false, fill);
+            clear_reported(*ret_header);
             return false;
         }
         return true;
-    });
+    };
+    auto order = numa_fallback_order(node);
+    for (unsigned i = 0; i < numa_nodes() && !ret_header; i++) {
+        for_each_in(_nodes[order[i]], std::max(ilog2(size / page_size), 1u) - 1, fits);
+    }
     return ret_header;
 }
 
@@ -831,19 +1109,32 @@ void page_range_allocator::free(page_range* pr)
     auto idx = get_bitmap_idx(*pr);
     if (idx && _bitmap[idx - 1]) {
         auto pr2 = *(reinterpret_cast<page_range**>(pr) - 1);
-        remove(*pr2);
-        pr2->size += pr->size;
-        pr = pr2;
+        if (same_node(*pr2, *pr)) {
+            remove(*pr2);
+            pr2->size += pr->size;
+            pr = pr2;
+        }
     }
     auto next_idx = get_bitmap_idx(*pr) + pr->size / page_size;
     if (next_idx < _bitmap.size() && _bitmap[next_idx]) {
         auto pr2 = static_cast<page_range*>(static_cast<void*>(pr) + pr->size);
-        remove(*pr2);
-        pr->size += pr2->size;
+        if (same_node(*pr2, *pr)) {
+            remove(*pr2);
+            pr->size += pr2->size;
+        }
     }
     insert(*pr);
 }
 
+void page_range_allocator::trim(page_range* pr, size_t size)
+{
+    auto tail = new (static_cast<void*>(pr) + size) page_range(pr->size - size);
+    pr->size = size;
+    // The new last page may carry a stale bit from an earlier merge
+    set_bits(*pr, false);
+    free(tail);
+}
+
 void page_range_allocator::initial_add(page_range* pr)
 {
     auto idx = get_bitmap_idx(*pr) + pr->size / page_size;
@@ -851,11 +1142,13 @@ void page_range_allocator::initial_add(page_range* pr)
         auto prev_idx = get_bitmap_idx(*pr) - 1;
         if (_bitmap.size() > prev_idx && _bitmap[prev_idx]) {
             auto pr2 = *(reinterpret_cast<page_range**>(pr) - 1);
-            remove(*pr2);
-            pr2->size += pr->size;
-            pr = pr2;
+            if (same_node(*pr2, *pr)) {
+                remove(*pr2);
+                pr2->size += pr->size;
+                pr = pr2;
+            }
         }
-        insert<false>(*pr);
+        split_by_node(pr, [this] (page_range* part) { insert<false>(*part); });
         _bitmap.reset();
         _bitmap.resize(idx);
 
@@ -865,25 +1158,128 @@ void page_range_allocator::initial_add(page_range* pr)
             _deferred_free = nullptr;
         }
     } else {
-        free(pr);
+        split_by_node(pr, [this] (page_range* part) { free(part); });
+    }
+}
+
+template<typename Func>
+void page_range_allocator::split_by_node(page_range* pr, Func f)
+{
+    void* end = static_cast<void*>(pr) + pr->size;
+    void* next;
+    while ((next = numa::next_boundary(pr)) && next < end) {
+        pr->size = static_cast<char*>(next) - reinterpret_cast<char*>(pr);
+        f(pr);
+        pr = new (next) page_range(static_cast<char*>(end) - static_cast<char*>(next));
+    }
+    f(pr);
+}
+
+void page_range_allocator::repartition()
+{
+    // Everything is on the lists of node 0 so far
+    auto& fl = _nodes[0];
+    bi::list<page_range,
+             bi::member_hook<page_range,
+                             bi::list_member_hook<>,
+                             &page_range::list_hook>,
+             bi::constant_time_size<false>> all;
+    for (auto& list : fl._free) {
+        all.splice(all.end(), list);
+    }
+    while (!fl._free_huge.empty()) {
+        auto& pr = *fl._free_huge.begin();
+        fl._free_huge.erase(fl._free_huge.begin());
+        all.push_back(pr);
+    }
+    fl._not_empty.reset();
+    while (!all.empty()) {
+        auto& pr = all.front();
+        all.pop_front();
+        split_by_node(&pr, [this] (page_range* part) { insert(*part); });
+    }
+}
+
+page_range* page_range_allocator::take_unreported(size_t max_size)
+{
+    if (_reported.empty()) {
+        return nullptr;
+    }
+    uintptr_t run_start = 0, run_end = 0;
+    page_range* found = nullptr;
+    for_each(ilog2(reporting_block_pages), [&] (page_range& pr) {
+        auto start = reinterpret_cast<uintptr_t>(&pr);
+        auto first = align_up(start, mmu::huge_page_size);
+        auto last = align_down(start + pr.size, mmu::huge_page_size);
+        for (auto block = first; block < last; block += mmu::huge_page_size) {
+            if (!_reported[get_block_idx(block)]) {
+                run_start = block;
+                run_end = block + mmu::huge_page_size;
+                while (run_end < last && run_end - run_start < max_size &&
+                       !_reported[get_block_idx(run_end)]) {
+                    run_end += mmu::huge_page_size;
+                }
+                found = &pr;
+                return false;
+            }
+        }
+        return true;
+    });
+    if (!found) {
+        return nullptr;
+    }
+
+    // Leave whatever surrounds the run in the allocator
+    remove(*found);
+    auto start = reinterpret_cast<uintptr_t>(found);
+    auto end = start + found->size;
+    if (run_end < end) {
+        insert(*new (reinterpret_cast<void*>(run_end)) page_range(end - run_end));
+    }
+    if (run_start > start) {
+        found->size = run_start - start;
+        insert(*found);
+    }
+    auto run = new (reinterpret_cast<void*>(run_start)) page_range(run_end - run_start);
+    set_bits(*run, false);
+    return run;
+}
+
+void page_range_allocator::put_reported(page_range* pr)
+{
+    auto start = reinterpret_cast<uintptr_t>(pr);
+    for (auto block = start; block < start + pr->size; block += mmu::huge_page_size) {
+        _reported[get_block_idx(block)] = true;
     }
+    free(pr);
 }
 
 template<typename Func>
 void page_range_allocator::for_each(unsigned min_order, Func f)
 {
-    for (auto& pr : _free_huge) {
-        if (!f(pr)) {
+    for (unsigned node = 0; node < numa_nodes(); node++) {
+        if (!for_each_in(_nodes[node], min_order, f)) {
             return;
         }
     }
+}
+
+template<typename Func>
+bool page_range_allocator::for_each_in(free_lists& fl, unsigned min_order, Func f)
+{
+    for (auto& pr : fl._free_huge) {
+        if (!f(pr)) {
+            return false;
+        }
+    }
     for (auto order = max_order; order-- > min_order;) {
-        for (auto& pr : _free[order]) {
+        for (auto& pr : fl._free[order]) {
             if (!f(pr)) {
-                return;
+                return false;
             }
         }
     }
+    return true;
 }
 
 namespace stats {
@@ -895,6 +1291,101 @@ namespace stats {
     }
 }
 
+void numa_init()
+{
+    using namespace numa;
+    unsigned nodes = 0;
+    for (unsigned i = 0; i < nr_mem_ranges; i++) {
+        nodes = std::max(nodes, mem_ranges[i].node + 1);
+    }
+    if (nodes < 2) {
+        return;
+    }
+
+    std::sort(mem_ranges, mem_ranges + nr_mem_ranges, [] (const mem_range& a, const mem_range& b) {
+        return a.start < b.start;
+    });
+    for (unsigned i = 0; i < nr_mem_ranges; i++) {
+        auto& r = mem_ranges[i];
+        node_memory[r.node] += r.end - r.start;
+        if (!nr_boundaries) {
+            boundaries[nr_boundaries++] = {0, r.node};
+        } else if (boundaries[nr_boundaries - 1].node != r.node) {
+            boundaries[nr_boundaries++] = {align_up(r.start, u64(page_size)), r.node};
+        }
+    }
+
+    for (unsigned from = 0; from < nodes; from++) {
+        for (unsigned to = 0; to < nodes; to++) {
+            if (!distances[from][to]) {
+                distances[from][to] = from == to ? 10 : 20;
+            }
+            fallback[from][to] = to;
+        }
+        // The node itself comes first, whatever the table says
+        std::sort(fallback[from], fallback[from] + nodes, [from] (unsigned a, unsigned b) {
+            auto da = a == from ? 0 : distances[from][a];
+            auto db = b == from ? 0 : distances[from][b];
+            return da < db || (da == db && a < b);
+        });
+    }
+
+    WITH_LOCK(free_page_ranges_lock) {
+        nr_nodes = nodes;
+        free_page_ranges.repartition();
+    }
+}
+
+size_t numa_node_free(unsigned node)
+{
+    WITH_LOCK(free_page_ranges_lock) {
+        return free_page_ranges.free_bytes(node);
+    }
+}
+
+void enable_page_reporting()
+{
+    size_t blocks;
+    WITH_LOCK(free_page_ranges_lock) {
+        blocks = free_page_ranges.reporting_blocks();
+    }
+    // Allocate outside of the lock, the bitmap may be large enough to come
+    // from the page ranges itself
+    boost::dynamic_bitset<> reported(blocks);
+    WITH_LOCK(free_page_ranges_lock) {
+        free_page_ranges.enable_reporting(reported);
+    }
+}
+
+bool take_unreported_range(size_t max_size, void*& addr, size_t& size)
+{
+    WITH_LOCK(free_page_ranges_lock) {
+        // While the host looks at it the range cannot be allocated, so keep
+        // well clear of the point where the reclaimer kicks in
+        if (stats::free() < 2 * watermark_lo + max_size) {
+            return false;
+        }
+        auto pr = free_page_ranges.take_unreported(max_size);
+        if (!pr) {
+            return false;
+        }
+        addr = pr;
+        size = pr->size;
+        free_memory.fetch_sub(size);
+    }
+    return true;
+}
+
+void return_reported_range(void* addr, size_t size)
+{
+    // The host may have discarded the header along with everything else
+    auto pr = new (addr) page_range(size);
+    WITH_LOCK(free_page_ranges_lock) {
+        on_free(size);
+        free_page_ranges.put_reported(pr);
+    }
+}
+
 static void* mapped_malloc_large(size_t size, size_t offset)
 {
     //TODO: For now pre-populate the memory, in future consider doing lazy population
@@ -935,10 +1426,11 @@ static void* malloc_large(size_t size, size_t alignment, bool block = true, bool
         WITH_LOCK(free_page_ranges_lock) {
             reclaimer_thread.wait_for_minimum_memory();
             page_range* ret_header;
+            auto node = numa_current_node();
             if (alignment > page_size) {
-                ret_header = free_page_ranges.alloc_aligned(size, page_size, alignment);
+                ret_header = free_page_ranges.alloc_aligned(size, page_size, alignment, false, node);
             } else {
-                ret_header = free_page_ranges.alloc(size, contiguous);
+                ret_header = free_page_ranges.alloc(size, contiguous, node);
             }
             if (ret_header) {
                 on_alloc(size);
@@ -1178,6 +1670,14 @@ static void free_page_range(void *addr, size_t size)
     free_page_range(static_cast<page_range*>(addr));
 }
 
+static void trim_page_range(page_range *range, size_t size)
+{
+    WITH_LOCK(free_page_ranges_lock) {
+        on_free(range->size - size);
+        free_page_ranges.trim(range, size);
+    }
+}
+
 static void free_large(void* obj)
 {
     obj = align_down(obj - 1, page_size);
@@ -1202,6 +1702,16 @@ namespace page_pool {
 
 static std::vector<stats::pool_stats> l1_pool_stats;
 
+struct page_batch {
+    // Number of pages per batch
+    static constexpr size_t nr_pages = CONF_memory_page_batch_size;
+    void* pages[nr_pages];
+};
+
+class l2;
+// One L2-pool per NUMA node
+static l2* node_l2[max_numa_nodes];
+
 // L1-pool (Percpu page buffer pool)
 //
 // if nr < max * 1 / 4
@@ -1213,7 +1723,8 @@ static std::vector<stats::pool_stats> l1_pool_stats;
 // nr_cpus threads are created to help filling the L1-pool.
 struct l1 {
     l1(sched::cpu* cpu)
-        : _fill_thread(sched::thread::make([] { fill_thread(); },
+        : _l2(node_l2[cpu->numa_node])
+        , _fill_thread(sched::thread::make([] { fill_thread(); },
             sched::thread::attr().pin(cpu).name(std::string("page_pool_l1_") + std::to_string(cpu->id))))
     {
         cpu_id = cpu->id;
@@ -1237,6 +1748,7 @@ struct l1 {
     }
     static void* alloc_page_local();
     static bool free_page_local(void* v);
+    static void* alloc_zeroed_page_local();
     void* pop()
     {
         assert(nr);
@@ -1252,28 +1764,37 @@ struct l1 {
     }
     void* top() { return _pages[nr - 1]; }
     void wake_thread() { _fill_thread->wake(); }
+    // Asks the fill thread to give the zeroed pages of this cpu back
+    void drain_zero_pages()
+    {
+        zero_drain.store(true, std::memory_order_relaxed);
+        _fill_thread->wake();
+    }
     static void fill_thread();
     static void refill();
     static void unfill();
+    static void free_zero_pages();
 
     static constexpr size_t max = CONF_memory_l1_pool_size;
     static constexpr size_t watermark_lo = max * 1 / 4;
     static constexpr size_t watermark_hi = max * 3 / 4;
     size_t nr = 0;
     unsigned int cpu_id;
+    // Pages known to be zero, taken from the zero pool a batch at a time
+    size_t nr_zero = 0;
+    size_t zero_hits = 0;
+    size_t zero_misses = 0;
+    std::atomic<bool> zero_drain = { false };
 
 private:
+    // The L2-pool of our node
+    l2* _l2;
     std::unique_ptr<sched::thread> _fill_thread;
     void* _pages[max];
+    void* _zero_pages[page_batch::nr_pages];
 };
 
-struct page_batch {
-    // Number of pages per batch
-    static constexpr size_t nr_pages = CONF_memory_page_batch_size;
-    void* pages[nr_pages];
-};
-
-// L2-pool (Global page buffer pool)
+// L2-pool (Per node page buffer pool)
 //
 // if nr < max * 1 / 4
 //    refill
@@ -1285,18 +1806,20 @@ struct page_batch {
 // L2-pool.
 //
 // When L2-pool needs refill or unfill, it moves a batch of pages from or to
-// global free page list.
+// global free page list, preferably to or from the memory of its node.
 //
-// Single thread is created to help filling the L2-pool.
+// Single thread per node is created to help filling the L2-pool.
 class l2 {
 public:
-    l2()
-        : _max(sched::cpus.size() * (l1::max / page_batch::nr_pages))
+    explicit l2(unsigned node)
+        : _node(node)
+        , _max(std::max(cpus_of(node), 1u) * (l1::max / page_batch::nr_pages))
         , _nr(0)
         , _watermark_lo(_max * 1 / 4)
         , _watermark_hi(_max * 3 / 4)
         , _stack(_max)
-        , _fill_thread(sched::thread::make([=] { fill_thread(); }, sched::thread::attr().name("page_pool_l2")))
+        , _fill_thread(sched::thread::make([=] { fill_thread(); }, sched::thread::attr().name(
+            numa_nodes() == 1 ? std::string("page_pool_l2") : "page_pool_l2_" + std::to_string(node))))
     {
        _fill_thread->start();
     }
@@ -1356,12 +1879,13 @@ public:
         return true;
     }
 
+    // Adds to stats, which sums up the pools of all nodes
     void stats(stats::pool_stats &stats)
     {
-        stats._nr = get_nr();
-        stats._max = _max;
-        stats._watermark_lo = _watermark_lo;
-        stats._watermark_hi = _watermark_hi;
+        stats._nr += get_nr();
+        stats._max += _max;
+        stats._watermark_lo += _watermark_lo;
+        stats._watermark_hi += _watermark_hi;
     }
 
     void fill_thread();
@@ -1373,6 +1897,13 @@ public:
     void dec_nr() { _nr.fetch_sub(1, std::memory_order_relaxed); }
 
 private:
+    static unsigned cpus_of(unsigned node)
+    {
+        return std::count_if(sched::cpus.begin(), sched::cpus.end(),
+            [node] (sched::cpu* c) { return c->numa_node == node; });
+    }
+
+    unsigned _node;
     size_t _max;
     std::atomic<size_t> _nr;
     size_t _watermark_lo;
@@ -1381,6 +1912,15 @@ private:
     std::unique_ptr<sched::thread> _fill_thread;
 };
 
+// N per-cpu threads for L1 page pool, 1 thread per node for L2 page pools
+// Switch to smp_allocator only when all the N + nodes threads are ready
+static void pool_thread_ready()
+{
+    if (smp_allocator_cnt++ == sched::cpus.size() + numa_nodes() - 1) {
+        smp_allocator = true;
+    }
+}
+
 std::atomic<unsigned int> l1_initialized_cnt{};
 PERCPU(l1*, percpu_l1);
 static sched::cpu::notifier _notifier([] () {
@@ -1388,18 +1928,115 @@ static sched::cpu::notifier _notifier([] () {
     if (++l1_initialized_cnt == sched::cpus.size()) {
         l1_pool_stats.resize(sched::cpus.size());
     }
-    // N per-cpu threads for L1 page pool, 1 thread for L2 page pool
-    // Switch to smp_allocator only when all the N + 1 threads are ready
-    if (smp_allocator_cnt++ == sched::cpus.size()) {
-        smp_allocator = true;
-    }
+    pool_thread_ready();
 });
 static inline l1& get_l1()
 {
     return **percpu_l1;
 }
 
-class l2 global_l2;
+// By now the architecture code has described the NUMA topology
+static struct l2_pools {
+    l2_pools()
+    {
+        for (unsigned node = 0; node < numa_nodes(); node++) {
+            node_l2[node] = new l2(node);
+        }
+    }
+} s_l2_pools;
+
+static inline l2& local_l2()
+{
+    return *node_l2[numa_current_node()];
+}
+
+// Zero pool (Global pre-zeroed page pool)
+//
+// A single thread running at idle priority takes batches of pages from the
+// L2-pool, clears them and keeps them here, so that the work is done while
+// the cpus would otherwise be idle. alloc_zeroed_page() moves a whole batch
+// to the L1-pool of its cpu when that runs out of zeroed pages. Zeroed pages
+// are freed like any other page, to the regular L1-pool.
+//
+// The pool is only refilled when it drops below half and not while memory is
+// low. Under memory pressure the reclaimer gets the pages back through
+// request_memory(), both those kept here and those the cpus hold.
+class zero_pool : public shrinker {
+public:
+    zero_pool()
+        : shrinker("zero_pool")
+        , _max(sched::cpus.size() * CONF_memory_zero_pool_size)
+        , _nr(0)
+        , _wanted(false)
+        , _stack(std::max<size_t>(_max, 1))
+    {
+        if (_max) {
+            _fill_thread.reset(sched::thread::make([=] { fill_thread(); },
+                sched::thread::attr().name("page_pool_zero")));
+            _fill_thread->set_priority(sched::thread::priority_idle);
+            _fill_thread->start();
+        } else {
+            deactivate_shrinker();
+        }
+    }
+
+    size_t request_memory(size_t n, bool hard)
+    {
+        size_t freed = 0;
+        page_batch* pb;
+        while (freed < n && _stack.pop(pb)) {
+            _nr.fetch_sub(1, std::memory_order_relaxed);
+            page_batch batch = *pb;
+            local_l2().free_batch(batch);
+            freed += page_batch::nr_pages * page_size;
+        }
+        // The pages the cpus hold are freed by their L1 threads, so they
+        // only count towards the next pass
+        if (freed < n) {
+            for (auto cpu : sched::cpus) {
+                auto pbuf = *percpu_l1.for_cpu(cpu);
+                if (pbuf) {
+                    pbuf->drain_zero_pages();
+                }
+            }
+        }
+        return freed;
+    }
+
+    page_batch* try_alloc_page_batch()
+    {
+        if (get_nr() < _max / 2) {
+            _wanted.store(true, std::memory_order_relaxed);
+            _fill_thread->wake();
+        }
+        page_batch* pb;
+        if (!_stack.pop(pb)) {
+            return nullptr;
+        }
+        _nr.fetch_sub(1, std::memory_order_relaxed);
+        return pb;
+    }
+
+    void stats(stats::pool_stats &stats)
+    {
+        stats._nr = get_nr();
+        stats._max = _max;
+        stats._watermark_lo = _max / 2;
+        stats._watermark_hi = _max;
+    }
+
+    void fill_thread();
+    size_t get_nr() { return _nr.load(std::memory_order_relaxed); }
+
+private:
+    size_t _max;
+    std::atomic<size_t> _nr;
+    std::atomic<bool> _wanted;
+    boost::lockfree::stack<page_batch*, boost::lockfree::fixed_sized<true>> _stack;
+    std::unique_ptr<sched::thread> _fill_thread;
+};
+
+class zero_pool global_zero_pool;
 
 // Percpu thread for L1 page pool
 void l1::fill_thread()
@@ -1412,9 +2049,13 @@ void l1::fill_thread()
             assert(!sched::thread::current()->is_app());
 #endif
             WITH_LOCK(preempt_lock) {
-                return pbuf.nr < pbuf.watermark_lo || pbuf.nr > pbuf.watermark_hi;
+                return pbuf.nr < pbuf.watermark_lo || pbuf.nr > pbuf.watermark_hi ||
+                       pbuf.zero_drain.load(std::memory_order_relaxed);
             }
         });
+        if (pbuf.zero_drain.exchange(false, std::memory_order_relaxed)) {
+            free_zero_pages();
+        }
         if (pbuf.nr < pbuf.watermark_lo) {
             while (pbuf.nr + page_batch::nr_pages < pbuf.max / 2) {
                 refill();
@@ -1439,7 +2080,7 @@ void l1::refill()
     SCOPE_LOCK(preempt_lock);
     auto& pbuf = get_l1();
     if (pbuf.nr + page_batch::nr_pages < pbuf.max / 2) {
-        auto* pb = global_l2.alloc_page_batch();
+        auto* pb = pbuf._l2->alloc_page_batch();
         if (pb) {
             // Other threads might have filled the array while we waited for
             // the page batch.  Make sure there is enough room to add the pages
@@ -1449,7 +2090,7 @@ void l1::refill()
                     pbuf.push(page);
                 }
             } else {
-                global_l2.free_page_batch(pb);
+                pbuf._l2->free_page_batch(pb);
             }
         }
     }
@@ -1470,7 +2111,7 @@ void l1::unfill()
         for (size_t i = 0 ; i < page_batch::nr_pages; i++) {
             pb->pages[i] = pbuf.pop();
         }
-        global_l2.free_page_batch(pb);
+        pbuf._l2->free_page_batch(pb);
     }
 }
 
@@ -1513,12 +2154,89 @@ bool l1::free_page_local(void* v)
     return true;
 }
 
-// Global thread for L2 page pool
-void l2::fill_thread()
+// Returns the zeroed pages of this cpu to the page allocator
+void l1::free_zero_pages()
 {
-    if (smp_allocator_cnt++ == sched::cpus.size()) {
-        smp_allocator = true;
+#if CONF_lazy_stack_invariant
+    assert(sched::preemptable() && arch::irq_enabled());
+#endif
+#if CONF_lazy_stack
+    arch::ensure_next_stack_page();
+#endif
+    void* pages[page_batch::nr_pages];
+    size_t nr;
+    WITH_LOCK(preempt_lock) {
+        auto& pbuf = get_l1();
+        nr = pbuf.nr_zero;
+        std::copy(pbuf._zero_pages, pbuf._zero_pages + nr, pages);
+        pbuf.nr_zero = 0;
+    }
+    for (size_t i = 0; i < nr; i++) {
+        free_page_range(pages[i], page_size);
     }
+}
+
+void* l1::alloc_zeroed_page_local()
+{
+#if CONF_lazy_stack_invariant
+    assert(sched::preemptable() && arch::irq_enabled());
+#endif
+#if CONF_lazy_stack
+    arch::ensure_next_stack_page();
+#endif
+    SCOPE_LOCK(preempt_lock);
+    auto& pbuf = get_l1();
+    if (pbuf.nr_zero == 0) {
+        auto* pb = global_zero_pool.try_alloc_page_batch();
+        if (!pb) {
+            pbuf.zero_misses++;
+            return nullptr;
+        }
+        for (auto page : pb->pages) {
+            pbuf._zero_pages[pbuf.nr_zero++] = page;
+        }
+        // The batch was stored in its own last page, clear it again
+        memset(pb, 0, sizeof(*pb));
+    }
+    pbuf.zero_hits++;
+    return pbuf._zero_pages[--pbuf.nr_zero];
+}
+
+// Idle priority thread for the zero pool
+void zero_pool::fill_thread()
+{
+    sched::thread::wait_until([] {return smp_allocator;});
+    for (;;) {
+        // Only refill on demand, so a pool that cannot be refilled (memory
+        // is low or the L2-pool is empty) does not keep us spinning
+        sched::thread::wait_until([=] { return _wanted.load(std::memory_order_relaxed); });
+        _wanted.store(false, std::memory_order_relaxed);
+        while (get_nr() < _max && stats::free() > memory::watermark_lo) {
+            // Only take what the L2-pool has at hand, never make an
+            // allocation wait for us
+            auto& pool = local_l2();
+            auto* pb = pool.try_alloc_page_batch();
+            if (!pb) {
+                break;
+            }
+            page_batch batch = *pb;
+            for (auto page : batch.pages) {
+                memset(page, 0, page_size);
+            }
+            *pb = batch;
+            if (_stack.push(pb)) {
+                _nr.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                pool.free_page_batch(pb);
+            }
+        }
+    }
+}
+
+// Per node thread for L2 page pool
+void l2::fill_thread()
+{
+    pool_thread_ready();
 
     sched::thread::wait_until([] {return smp_allocator;});
     for (;;) {
@@ -1552,7 +2270,7 @@ void l2::refill()
             }
             auto total_size = 0;
             for (size_t i = 0 ; i < page_batch::nr_pages; i++) {
-                batch.pages[i] = free_page_ranges.alloc(page_size);
+                batch.pages[i] = free_page_ranges.alloc(page_size, true, _node);
                 total_size += page_size;
             }
             on_alloc(total_size);
@@ -1601,7 +2319,10 @@ void l2::free_batch(page_batch& batch)
 namespace stats {
     void get_global_l2_stats(pool_stats &stats)
     {
-        page_pool::global_l2.stats(stats);
+        stats = {};
+        for (unsigned node = 0; node < numa_nodes(); node++) {
+            page_pool::node_l2[node]->stats(stats);
+        }
     }
 
     void get_l1_stats(unsigned int cpu_id, pool_stats &stats)
@@ -1611,6 +2332,19 @@ namespace stats {
         stats._watermark_lo = page_pool::l1::watermark_lo;
         stats._watermark_hi = page_pool::l1::watermark_hi;
     }
+
+    void get_zero_pool_stats(zero_pool_stats &stats)
+    {
+        page_pool::global_zero_pool.stats(stats.pool);
+        stats.hits = stats.misses = 0;
+        for (auto cpu : sched::cpus) {
+            auto pbuf = *page_pool::percpu_l1.for_cpu(cpu);
+            if (pbuf) {
+                stats.hits += pbuf->zero_hits;
+                stats.misses += pbuf->zero_misses;
+            }
+        }
+    }
 }
 
 static void* early_alloc_page()
@@ -1780,6 +2514,43 @@ static inline void untracked_free_page(void *v)
     page_pool::l1::free_page(v);
 }
 
+void* alloc_zeroed_page()
+{
+    void* p = nullptr;
+    if (CONF_memory_zero_pool_size && smp_allocator) {
+        p = page_pool::l1::alloc_zeroed_page_local();
+    }
+    if (p) {
+        trace_memory_page_alloc(p);
+    } else {
+        p = untracked_alloc_page();
+        memset(p, 0, page_size);
+    }
+#if CONF_memory_tracker
+    tracker_remember(p, page_size);
+#endif
+    return p;
+}
+
+// Bypasses the page pools, which only hold pages of the local node
+void* alloc_page_node(unsigned node)
+{
+    void* ret;
+    WITH_LOCK(free_page_ranges_lock) {
+        reclaimer_thread.wait_for_minimum_memory();
+        if (free_page_ranges.empty()) {
+            reclaimer_thread.wait_for_memory(page_size);
+        }
+        ret = free_page_ranges.alloc(page_size, true, node);
+        on_alloc(page_size);
+    }
+    trace_memory_page_alloc(ret);
+#if CONF_memory_tracker
+    tracker_remember(ret, page_size);
+#endif
+    return ret;
+}
+
 void free_page(void* v)
 {
     untracked_free_page(v);
@@ -1794,9 +2565,14 @@ void free_page(void* v)
  * not free(), as the memory is not preceded by a header.
  */
 void* alloc_huge_page(size_t N)
+{
+    return alloc_huge_page_node(N, numa_current_node());
+}
+
+void* alloc_huge_page_node(size_t N, unsigned node)
 {
     WITH_LOCK(free_page_ranges_lock) {
-        auto pr = free_page_ranges.alloc_aligned(N, 0, N, true);
+        auto pr = free_page_ranges.alloc_aligned(N, 0, N, true, node);
         if (pr) {
             on_alloc(N);
             return static_cast<void*>(pr);
@@ -1857,34 +2633,47 @@ extern "C" {
     size_t malloc_usable_size(void *object);
 }
 
-static inline void* std_malloc(size_t size, size_t alignment)
+// With zero set the memory is cleared, like calloc() does. Single pages come
+// pre-zeroed from the page pool and large objects mapped with map_anon() are
+// zero already, so only the rest needs to be cleared here.
+static inline void* std_malloc(size_t size, size_t alignment, bool zero = false)
 {
     if ((ssize_t)size < 0)
         return libc_error_ptr<void *>(ENOMEM);
     void *ret;
     size_t minimum_size = std::max(size, memory::pool::min_object_size);
-    if (smp_allocator && size <= memory::pool::max_object_size && alignment <= minimum_size) {
-        unsigned n = ilog2_roundup(minimum_size);
-        ret = memory::malloc_pools[n].alloc();
-        ret = translate_mem_area(mmu::mem_area::main, mmu::mem_area::mempool,
-                                 ret);
-        trace_memory_malloc_mempool(ret, size, 1 << n, alignment);
-    } else if (smp_allocator && alignment <= memory::pool::max_object_size && minimum_size <= alignment) {
-        unsigned n = ilog2_roundup(alignment);
+    unsigned n = memory::malloc_pool_count;
+    if (smp_allocator && std::max(minimum_size, alignment) <= memory::malloc_pool_max_size) {
+        // The first class large enough whose objects are aligned enough
+        n = memory::malloc_pool_index(std::max(minimum_size, alignment));
+        while (n < memory::malloc_pool_count && memory::malloc_pool_alignment(n) < alignment) {
+            n++;
+        }
+    }
+    if (n < memory::malloc_pool_count) {
         ret = memory::malloc_pools[n].alloc();
         ret = translate_mem_area(mmu::mem_area::main, mmu::mem_area::mempool,
                                  ret);
-        trace_memory_malloc_mempool(ret, size, 1 << n, alignment);
+        trace_memory_malloc_mempool(ret, size, memory::malloc_pool_sizes[n], alignment);
+        if (zero) {
+            memset(ret, 0, size);
+        }
     } else if (!smp_allocator && memory::will_fit_in_early_alloc_page(size,alignment)) {
         ret = memory::early_alloc_object(size, alignment);
         ret = translate_mem_area(mmu::mem_area::main, mmu::mem_area::mempool,
                                  ret);
+        if (zero) {
+            memset(ret, 0, size);
+        }
     } else if (minimum_size <= mmu::page_size && alignment <= mmu::page_size) {
         ret = mmu::translate_mem_area(mmu::mem_area::main, mmu::mem_area::page,
-                                       memory::alloc_page());
+                zero ? memory::alloc_zeroed_page() : memory::alloc_page());
         trace_memory_malloc_page(ret, size, mmu::page_size, alignment);
     } else {
         ret = memory::malloc_large(size, alignment, true, false);
+        if (zero && ret && mmu::is_linear_mapped(ret, 0)) {
+            memset(ret, 0, size);
+        }
     }
 #if CONF_memory_tracker
     memory::tracker_remember(ret, size);
@@ -1892,6 +2681,17 @@ static inline void* std_malloc(size_t size, size_t alignment)
     return ret;
 }
 
+static inline size_t malloc_alignment(size_t size)
+{
+    static_assert(alignof(max_align_t) >= 2 * sizeof(size_t),
+                  "alignof(max_align_t) smaller than glibc alignment guarantee");
+    auto alignment = alignof(max_align_t);
+    if (alignment > size) {
+        alignment = 1ul << ilog2_roundup(size);
+    }
+    return alignment;
+}
+
 void* calloc(size_t nmemb, size_t size)
 {
     if (nmemb == 0 || size == 0)
@@ -1899,10 +2699,16 @@ void* calloc(size_t nmemb, size_t size)
     if (nmemb > std::numeric_limits<size_t>::max() / size)
         return nullptr;
     auto n = nmemb * size;
+#if CONF_memory_debug == 0
+    auto alignment = malloc_alignment(n);
+    auto p = std_malloc(n, alignment, true);
+    trace_memory_malloc(p, n, alignment);
+#else
     auto p = malloc(n);
     if (!p)
         return nullptr;
     memset(p, 0, n);
+#endif
     return p;
 }
 
@@ -1936,6 +2742,64 @@ static size_t object_size(void *object)
     }
 }
 
+// Try to resize the object without moving it: it stays where it is if
+// malloc(size) would have given it the same size class or page, a large
+// object gives back or takes over the pages at its end, and a large mmap()ed
+// object grows into the address range following it if that is unused.
+static bool realloc_in_place(void* object, size_t size)
+{
+    if (!mmu::is_linear_mapped(object, 0)) {
+        void* base = object;
+        size_t offset = memory::large_object_offset(base);
+        auto header = static_cast<size_t*>(base);
+        size_t new_size = align_up(size + offset, mmu::page_size);
+        if (new_size < mmu::huge_page_size) {
+            // too small for a mapping, malloc() would not use one
+            return false;
+        }
+        if (new_size < *header) {
+            mmu::munmap(base + new_size, *header - new_size);
+            *header = new_size;
+            return true;
+        }
+        if (new_size > *header && !mmu::extend_anon(base, *header, new_size)) {
+            return false;
+        }
+        *header = new_size;
+        return true;
+    }
+
+    switch (mmu::get_mem_area(object)) {
+    case mmu::mem_area::mempool: {
+        auto obj = mmu::translate_mem_area(mmu::mem_area::mempool,
+                                           mmu::mem_area::main, object);
+        auto pool = memory::pool::from_object(obj);
+        size = std::max(size, memory::pool::min_object_size);
+        return pool && size <= memory::malloc_pool_max_size &&
+               memory::malloc_pool_index(size) ==
+               memory::malloc_pool_index(pool->get_size());
+    }
+    case mmu::mem_area::page:
+        return size > memory::malloc_pool_max_size && size <= mmu::page_size;
+    case mmu::mem_area::main: {
+        void* base = object;
+        size_t offset = memory::large_object_offset(base);
+        auto header = static_cast<memory::page_range*>(base);
+        size_t new_size = align_up(size + offset, mmu::page_size);
+        if (size <= mmu::page_size || new_size > header->size) {
+            return false;
+        }
+        if (new_size < header->size) {
+            // Give the pages past the new end back
+            memory::trim_page_range(header, new_size);
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
 static inline void* std_realloc(void* object, size_t size)
 {
     if (!object)
@@ -1944,6 +2808,16 @@ static inline void* std_realloc(void* object, size_t size)
         free(object);
         return nullptr;
     }
+    if ((ssize_t)size < 0)
+        return libc_error_ptr<void *>(ENOMEM);
+
+    if (realloc_in_place(object, size)) {
+#if CONF_memory_tracker
+        memory::tracker_forget(object);
+        memory::tracker_remember(object, size);
+#endif
+        return object;
+    }
 
     size_t old_size = object_size(object);
     size_t copy_size = size > old_size ? old_size : size;
@@ -2087,12 +2961,7 @@ static inline size_t object_size(void* v)
 
 void* malloc(size_t size)
 {
-    static_assert(alignof(max_align_t) >= 2 * sizeof(size_t),
-                  "alignof(max_align_t) smaller than glibc alignment guarantee");
-    auto alignment = alignof(max_align_t);
-    if (alignment > size) {
-        alignment = 1ul << ilog2_roundup(size);
-    }
+    auto alignment = malloc_alignment(size);
 #if CONF_memory_debug == 0
     void* buf = std_malloc(size, alignment);
 #else
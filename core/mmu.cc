@@ -31,6 +31,7 @@
 #include <osv/rcu.hh>
 #include <osv/rwlock.h>
 #include <numeric>
+#include <limits>
 #include <set>
 
 #include <osv/kernel_config_memory_debug.h>
@@ -120,10 +121,176 @@ struct vma_list_type : vma_list_base {
 __attribute__((init_priority((int)init_prio::vma_list)))
 vma_list_type vma_list;
 
+// So that we don't need to create a vma (with size, permission and alot of
+// other irrelevant data) just to find an address in the vma list, we have
+// the following addr_compare, which compares exactly like vma_compare does,
+// except that it takes a bare uintptr_t instead of a vma.
+class addr_compare {
+public:
+    bool operator()(const vma& x, uintptr_t y) const { return x.start() < y; }
+    bool operator()(uintptr_t x, const vma& y) const { return x < y.start(); }
+};
+
 // protects vma list and page table modifications.
 // anything that may add, remove, split vma, zaps pte or changes pte permission
 // should hold the lock for write
-rwlock_t vma_list_mutex;
+//
+// Page faults on anonymous memory do not take it: they look their vma up
+// in vma_index under RCU and hold a reference to the vma while handling the
+// fault. So while held for write, the vmas found with find_intersecting_vma()
+// and find_intersecting_vmas() are locked against those faults, and when
+// released, it publishes a new vma_index and unlocks the vmas.
+class vma_list_lock_for_write {
+public:
+    void lock();
+    void unlock();
+};
+
+struct vma_list_rwlock : private vma_list_lock_for_write {
+    rwlock_for_read& for_read() { return _lock.for_read(); }
+    vma_list_lock_for_write& for_write() { return *this; }
+    bool wowned() { return _lock.wowned(); }
+
+    rwlock_t _lock;
+    unsigned _write_depth = 0;
+};
+
+vma_list_rwlock vma_list_mutex;
+
+// The vmas whose faults do not take vma_list_mutex, sorted by address. A
+// snapshot, replaced when vma_list_mutex is released for write, so a vma
+// found here may have changed since: its range has to be checked again once
+// it is referenced. A vma which is not found here is faulted in under
+// vma_list_mutex.
+struct vma_index {
+    struct entry {
+        uintptr_t start;
+        uintptr_t end;
+        vma* v;
+        bool operator==(const entry& e) const {
+            return start == e.start && end == e.end && v == e.v;
+        }
+    };
+    std::vector<entry> entries;
+
+    vma* find(uintptr_t addr) const {
+        auto i = std::upper_bound(entries.begin(), entries.end(), addr,
+            [](uintptr_t a, const entry& e) { return a < e.start; });
+        if (i == entries.begin() || addr >= std::prev(i)->end) {
+            return nullptr;
+        }
+        return std::prev(i)->v;
+    }
+};
+
+static osv::rcu_ptr<vma_index> vma_index_ptr;
+// Removed vmas, vma_index may still point to them until a new one is
+// published
+static std::vector<vma*> retired_vmas;
+// The thread holding vma_list_mutex for write, waiting in lock_faults()
+static sched::thread_handle fault_lock_waiter;
+// The addresses whose vmas were locked or changed while vma_list_mutex was
+// held for write. Only this part of vma_index is rebuilt on release, so
+// mapping or unmapping does not cost a walk of all the vmas. The first
+// index covers everything.
+static uintptr_t vma_index_dirty_start = 0;
+static uintptr_t vma_index_dirty_end = std::numeric_limits<uintptr_t>::max();
+
+static void mark_vma_index_dirty(uintptr_t start, uintptr_t end)
+{
+    vma_index_dirty_start = std::min(vma_index_dirty_start, start);
+    vma_index_dirty_end = std::max(vma_index_dirty_end, end);
+}
+
+// The first vma ending after addr
+static vma_list_type::iterator first_vma_after(uintptr_t addr)
+{
+    auto i = vma_list.lower_bound(addr, addr_compare());
+    if (i != vma_list.begin() && std::prev(i)->end() > addr) {
+        --i;
+    }
+    return i;
+}
+
+static void publish_vma_index()
+{
+    auto old = vma_index_ptr.read_by_owner();
+    const std::vector<vma_index::entry> none;
+    auto& old_entries = old ? old->entries : none;
+
+    // Allocating may map memory and change vma_list, so not while walking it.
+    // A vma left out is only faulted in the slow way.
+    size_t walk = 0;
+    for (auto i = first_vma_after(vma_index_dirty_start);
+            i != vma_list.end() && i->start() < vma_index_dirty_end; ++i) {
+        walk++;
+    }
+    std::unique_ptr<vma_index> index(new vma_index);
+    auto& entries = index->entries;
+    entries.reserve(old_entries.size() + walk);
+
+    auto start = vma_index_dirty_start;
+    auto end = vma_index_dirty_end;
+    vma_index_dirty_start = std::numeric_limits<uintptr_t>::max();
+    vma_index_dirty_end = 0;
+
+    // Entries outside of [start, end) are still valid and copied over, the
+    // vmas inside are unlocked and indexed again
+    auto old_middle = std::lower_bound(old_entries.begin(), old_entries.end(), start,
+        [](const vma_index::entry& e, uintptr_t a) { return e.end <= a; });
+    auto old_suffix = std::lower_bound(old_middle, old_entries.end(), end,
+        [](const vma_index::entry& e, uintptr_t a) { return e.start < a; });
+    size_t suffix_size = old_entries.end() - old_suffix;
+    entries.insert(entries.end(), old_entries.begin(), old_middle);
+    size_t middle = entries.size();
+    for (auto i = first_vma_after(start); i != vma_list.end() && i->start() < end; ++i) {
+        i->unlock_faults();
+        if (i->lockless_faults() && i->size() &&
+                entries.size() + suffix_size < entries.capacity()) {
+            entries.push_back({i->start(), i->end(), &*i});
+        }
+    }
+    bool changed = !old ||
+        size_t(old_suffix - old_middle) != entries.size() - middle ||
+        !std::equal(old_middle, old_suffix, entries.begin() + middle);
+    if (changed) {
+        entries.insert(entries.end(), old_suffix, old_entries.end());
+        vma_index_ptr.assign(index.release());
+        if (old) {
+            osv::rcu_dispose(old);
+        }
+    }
+    std::vector<vma*> retired;
+    retired.swap(retired_vmas);
+    for (auto v : retired) {
+        osv::rcu_dispose(v);
+    }
+}
+
+void vma_list_lock_for_write::lock()
+{
+    vma_list_mutex._lock.wlock();
+    vma_list_mutex._write_depth++;
+}
+
+void vma_list_lock_for_write::unlock()
+{
+    if (vma_list_mutex._write_depth == 1) {
+        publish_vma_index();
+    }
+    vma_list_mutex._write_depth--;
+    vma_list_mutex._lock.wunlock();
+}
+
+// Deletes a vma removed from vma_list, once vm_fault() cannot find it
+static void destroy_vma(vma* v)
+{
+    if (v->lockless_faults()) {
+        retired_vmas.push_back(v);
+    } else {
+        delete v;
+    }
+}
 
 // A mutex serializing modifications to the high part of the page table
 // (linear map, etc.) which are not part of vma_list.
@@ -305,6 +472,9 @@ struct page_allocator {
     virtual bool map(uintptr_t offset, hw_ptep<1> ptep, pt_element<1> pte, bool write) = 0;
     virtual bool unmap(void *addr, uintptr_t offset, hw_ptep<0> ptep) = 0;
     virtual bool unmap(void *addr, uintptr_t offset, hw_ptep<1> ptep) = 0;
+    // Maps the pages at offset, offset + page_size, ... that are available
+    // without blocking into the given empty ptes (null ones are skipped).
+    virtual unsigned map_cached(uintptr_t offset, unsigned n, pt_element<0>* pteps[], pt_element<0> pte) { return 0; }
     virtual ~page_allocator() {}
 };
 
@@ -383,6 +553,9 @@ public:
     // 2M pte and page table operation wants to do something special with sub-region of it
     // since it disabled splitting.
     void sub_page(hw_ptep<1> ptep, int level, uintptr_t offset) { return; }
+    // operate_range() calls this before the walk with the start of the vma
+    // the offsets passed to page() are relative to.
+    void set_vma_start(uintptr_t vma_start) { return; }
 };
 
 template<typename PageOps, int N>
@@ -567,7 +740,10 @@ public:
     bool page(hw_ptep<N> ptep, uintptr_t offset) {
         phys addr = start + offset;
         assert(addr < end);
-        ptep.write(make_leaf_pte(ptep, addr, mmu::perm_rwx, mem_attr));
+        // Linear maps never change, keep them in the TLB across full flushes
+        auto pte = make_leaf_pte(ptep, addr, mmu::perm_rwx, mem_attr);
+        pte.set_global(true);
+        ptep.write(pte);
         return true;
     }
 };
@@ -653,6 +829,43 @@ public:
     unsigned nr_page_sizes(void) { return 1; }
 };
 
+/*
+ * fault_around collects the empty ptes of a small window of a file mapping
+ * around a read fault, and then has the page provider map those of them whose
+ * pages are already cached in one go. Sequential or strided access to a file
+ * mapped by several threads or processes then takes a fault per window
+ * instead of one per page.
+ */
+class fault_around : public vma_operation<allocate_intermediate_opt::no, skip_empty_opt::no> {
+public:
+    static constexpr unsigned max_pages = 16;
+private:
+    page_allocator* _page_provider;
+    pt_element<0> _pte;
+    uintptr_t _first;
+    unsigned _n;
+    unsigned _empty = 0;
+    pt_element<0>* _pteps[max_pages] = {};
+public:
+    fault_around(page_allocator* pops, pt_element<0> pte, uintptr_t first, unsigned n) :
+        _page_provider(pops), _pte(pte), _first(first), _n(n) { }
+    template<int N>
+    bool page(hw_ptep<N> ptep, uintptr_t offset) {
+        assert(!pt_level_traits<N>::large_capable::value);
+        if (ptep.read().empty()) {
+            _pteps[(offset - _first) >> page_size_shift] = reinterpret_cast<pt_element<0>*>(ptep.release());
+            _empty++;
+        }
+        return true;
+    }
+    unsigned nr_page_sizes(void) { return 1; }
+    void finalize(void) {
+        if (_empty) {
+            _page_provider->map_cached(_first, _n, _pteps, _pte);
+        }
+    }
+};
+
 class splithugepages : public vma_operation<allocate_intermediate_opt::no, skip_empty_opt::yes, account_opt::no> {
 public:
     splithugepages() { }
@@ -665,6 +878,10 @@ public:
     unsigned nr_page_sizes(void) { return 1; }
 };
 
+// Pages unmapped by unpopulate can only be freed once no cpu has them in
+// its TLB anymore. tlb_gather collects them, together with the range of
+// virtual addresses unmapped so far, and flushes that range on all cpus
+// before freeing them, once per batch of pages rather than once per page.
 struct tlb_gather {
     static constexpr size_t max_pages = 20;
     struct tlb_page {
@@ -673,20 +890,23 @@ struct tlb_gather {
     };
     size_t nr_pages = 0;
     tlb_page pages[max_pages];
-    bool push(void* addr, size_t size) {
-        bool flushed = false;
+    uintptr_t start = std::numeric_limits<uintptr_t>::max();
+    uintptr_t end = 0;
+    void unmapped(uintptr_t virt, size_t size) {
+        start = std::min(start, virt);
+        end = std::max(end, virt + size);
+    }
+    void push(void* addr, size_t size) {
         if (nr_pages == max_pages) {
             flush();
-            flushed = true;
         }
         pages[nr_pages++] = { addr, size };
-        return flushed;
     }
-    bool flush() {
-        if (!nr_pages) {
-            return false;
+    void flush() {
+        if (start >= end) {
+            return;
         }
-        mmu::flush_tlb_all();
+        mmu::flush_tlb_range(start, end - start);
         for (auto i = 0u; i < nr_pages; ++i) {
             auto&& tp = pages[i];
             if (tp.size == page_size) {
@@ -696,7 +916,8 @@ struct tlb_gather {
             }
         }
         nr_pages = 0;
-        return true;
+        start = std::numeric_limits<uintptr_t>::max();
+        end = 0;
     }
 };
 
@@ -709,9 +930,10 @@ class unpopulate : public vma_operation<allocate_intermediate_opt::no, skip_empt
 private:
     tlb_gather _tlb_gather;
     page_allocator* _pops;
-    bool do_flush = false;
+    uintptr_t _vma_start = 0;
 public:
     unpopulate(page_allocator* pops) : _pops(pops) {}
+    void set_vma_start(uintptr_t vma_start) { _vma_start = vma_start; }
     template<int N>
     bool page(hw_ptep<N> ptep, uintptr_t offset) {
         void* addr = phys_to_virt(ptep.read().addr());
@@ -719,10 +941,10 @@ public:
         // Note: we free the page even if it is already marked "not present".
         // evacuate() makes sure we are only called for allocated pages, and
         // not-present may only mean mprotect(PROT_NONE).
-        if (_pops->unmap(addr, offset, ptep)) {
-            do_flush = !_tlb_gather.push(addr, size);
-        } else {
-            do_flush = true;
+        bool free = _pops->unmap(addr, offset, ptep);
+        _tlb_gather.unmapped(_vma_start + offset, size);
+        if (free) {
+            _tlb_gather.push(addr, size);
         }
         this->account(size);
         return true;
@@ -732,7 +954,9 @@ public:
         ptep.write(make_empty_pte<1>());
     }
     bool tlb_flush_needed(void) {
-        return !_tlb_gather.flush() && do_flush;
+        // The gather flushes everything unmapped
+        _tlb_gather.flush();
+        return false;
     }
     void finalize(void) {}
 };
@@ -904,14 +1128,13 @@ template<typename T> ulong operate_range(T mapper, void *vma_start, void *start,
     start = align_down(start, page_size);
     size = std::max(align_up(size, page_size), page_size);
     uintptr_t virt = reinterpret_cast<uintptr_t>(start);
+    mapper.set_vma_start(reinterpret_cast<uintptr_t>(vma_start));
     map_range(reinterpret_cast<uintptr_t>(vma_start), virt, size, mapper);
 
-    // TODO: consider if instead of requesting a full TLB flush, we should
-    // instead try to make more judicious use of INVLPG - e.g., in
-    // split_large_page() and other specific places where we modify specific
-    // page table entries.
+    // Only the range walked can have changed, including large pages split
+    // in it: invalidating any address of a large page drops all of it.
     if (mapper.tlb_flush_needed()) {
-        mmu::flush_tlb_all();
+        mmu::flush_tlb_range(virt, size);
     }
     mapper.finalize();
     return mapper.account_results();
@@ -945,31 +1168,23 @@ bool contains(uintptr_t start, uintptr_t end, vma& y)
     return y.start() >= start && y.end() <= end;
 }
 
-// So that we don't need to create a vma (with size, permission and alot of
-// other irrelevant data) just to find an address in the vma list, we have
-// the following addr_compare, which compares exactly like vma_compare does,
-// except that it takes a bare uintptr_t instead of a vma.
-class addr_compare {
-public:
-    bool operator()(const vma& x, uintptr_t y) const { return x.start() < y; }
-    bool operator()(uintptr_t x, const vma& y) const { return x < y.start(); }
-};
-
 // Find the single (if any) vma which contains the given address.
 // The complexity is logarithmic in the number of vmas in vma_list.
+// Under vma_list_mutex for write, the vma is locked against page faults.
 static inline vma_list_type::iterator
 find_intersecting_vma(uintptr_t addr) {
     auto vma = vma_list.lower_bound(addr, addr_compare());
-    if (vma->start() == addr) {
-        return vma;
+    if (vma->start() != addr) {
+        // Otherwise, vma->start() > addr, so we need to check the previous vma
+        --vma;
+        if (addr < vma->start() || addr >= vma->end()) {
+            return vma_list.end();
+        }
     }
-    // Otherwise, vma->start() > addr, so we need to check the previous vma
-    --vma;
-    if (addr >= vma->start() && addr < vma->end()) {
-        return vma;
-    } else {
-        return vma_list.end();
+    if (vma_list_mutex.wowned()) {
+        vma->lock_faults();
     }
+    return vma;
 }
 
 // Find the list of vmas which intersect a given address range. Because the
@@ -977,6 +1192,7 @@ find_intersecting_vma(uintptr_t addr) {
 // [first, second), between the first returned iterator (inclusive), and the
 // second returned iterator (not inclusive).
 // The complexity is logarithmic in the number of vmas in vma_list.
+// Under vma_list_mutex for write, the vmas are locked against page faults.
 static inline std::pair<vma_list_type::iterator, vma_list_type::iterator>
 find_intersecting_vmas(const addr_range& r)
 {
@@ -1000,6 +1216,11 @@ find_intersecting_vmas(const addr_range& r)
     // end is the first vma starting >= r.end(), so any previous vma (after
     // start) surely started < r.end() so is part of the intersection.
     auto end = vma_list.lower_bound(r.end(), addr_compare());
+    if (vma_list_mutex.wowned()) {
+        for (auto i = start; i != end; ++i) {
+            i->lock_faults();
+        }
+    }
     return {start, end};
 }
 
@@ -1098,7 +1319,7 @@ ulong evacuate(uintptr_t start, uintptr_t end)
             WITH_LOCK(vma_range_set_mutex.for_write()) {
                 vma_range_set.erase(vma_range(&dead));
             }
-            delete &dead;
+            destroy_vma(&dead);
         }
     }
     return ret;
@@ -1133,6 +1354,23 @@ private:
     virtual void* fill(void* addr, uint64_t offset, uintptr_t size) {
         return addr;
     }
+    // The memory policy of the vma, or null to follow the one of the thread
+    // touching the memory
+    const memory::numa_policy* _policy;
+protected:
+    int policy_node(uintptr_t offset, size_t size) {
+        auto& policy = _policy ? *_policy : memory::thread_numa_policy();
+        return policy.node_for(offset / size);
+    }
+    void* alloc_page(uintptr_t offset) {
+        auto node = policy_node(offset, page_size);
+        return node < 0 ? memory::alloc_page() : memory::alloc_page_node(node);
+    }
+    void* alloc_huge_page(uintptr_t offset) {
+        size_t size = pt_level_traits<1>::size::value;
+        auto node = policy_node(offset, size);
+        return node < 0 ? memory::alloc_huge_page(size) : memory::alloc_huge_page_node(size, node);
+    }
     template<int N>
     bool set_pte(void *addr, hw_ptep<N> ptep, pt_element<N> pte) {
         if (!addr) {
@@ -1149,12 +1387,14 @@ private:
         return true;
     }
 public:
+    explicit uninitialized_anonymous_page_provider(const memory::numa_policy* policy = nullptr)
+        : _policy(policy) {}
     virtual bool map(uintptr_t offset, hw_ptep<0> ptep, pt_element<0> pte, bool write) override {
-        return set_pte(fill(memory::alloc_page(), offset, page_size), ptep, pte);
+        return set_pte(fill(alloc_page(offset), offset, page_size), ptep, pte);
     }
     virtual bool map(uintptr_t offset, hw_ptep<1> ptep, pt_element<1> pte, bool write) override {
         size_t size = pt_level_traits<1>::size::value;
-        return set_pte(fill(memory::alloc_huge_page(size), offset, size), ptep, pte);
+        return set_pte(fill(alloc_huge_page(offset), offset, size), ptep, pte);
     }
     virtual bool unmap(void *addr, uintptr_t offset, hw_ptep<0> ptep) override {
         clear_pte(ptep);
@@ -1174,6 +1414,17 @@ private:
         }
         return addr;
     }
+public:
+    using uninitialized_anonymous_page_provider::uninitialized_anonymous_page_provider;
+    // Small pages are taken already zeroed from the page pool when possible,
+    // which only holds pages of the local node
+    virtual bool map(uintptr_t offset, hw_ptep<0> ptep, pt_element<0> pte, bool write) override {
+        if (policy_node(offset, page_size) < 0) {
+            return set_pte(memory::alloc_zeroed_page(), ptep, pte);
+        }
+        return set_pte(fill(alloc_page(offset), offset, page_size), ptep, pte);
+    }
+    using uninitialized_anonymous_page_provider::map;
 };
 
 class map_file_page_read : public uninitialized_anonymous_page_provider {
@@ -1222,6 +1473,9 @@ public:
     virtual bool unmap(void *addr, uintptr_t offset, hw_ptep<1> ptep) override {
         return _file->put_page(addr, offset + _foffset, ptep);
     }
+    virtual unsigned map_cached(uintptr_t offset, unsigned n, pt_element<0>* pteps[], pt_element<0> pte) override {
+        return _file->map_cached_pages(offset + _foffset, n, pteps, pte, _shared);
+    }
 };
 
 uintptr_t allocate(vma *v, uintptr_t start, size_t size, bool search)
@@ -1356,6 +1610,36 @@ void* map_anon(const void* addr, size_t size, unsigned flags, unsigned perm)
     return v;
 }
 
+// Grow the anonymous mapping [addr, addr + old_size) in place to new_size
+// bytes. This is only possible when nothing is mapped right after it, in
+// which case the vma is simply extended; otherwise false is returned and
+// the mapping is left alone.
+bool extend_anon(const void* addr, size_t old_size, size_t new_size)
+{
+    auto start = reinterpret_cast<uintptr_t>(addr);
+    auto old_end = start + align_up(old_size, mmu::page_size);
+    auto new_end = start + align_up(new_size, mmu::page_size);
+    if (new_end <= old_end) {
+        return new_end == old_end;
+    }
+    PREVENT_STACK_PAGE_FAULT
+    SCOPE_LOCK(vma_list_mutex.for_write());
+    auto v = find_intersecting_vma(start);
+    if (v == vma_list.end() || v->start() != start || v->end() != old_end ||
+        !dynamic_cast<anon_vma*>(&*v) || !in_vma_range(reinterpret_cast<void*>(new_end - 1))) {
+        return false;
+    }
+    auto next = find_intersecting_vmas(addr_range(old_end, new_end));
+    if (next.first != next.second) {
+        return false;
+    }
+    v->set(start, new_end);
+    if (v->has_flags(mmap_populate)) {
+        populate_vma(&*v, reinterpret_cast<void*>(old_end), new_end - old_end);
+    }
+    return true;
+}
+
 std::unique_ptr<file_vma> default_file_mmap(file* file, addr_range range, unsigned flags, unsigned perm, off_t offset)
 {
     return std::unique_ptr<file_vma>(new file_vma(range, perm, flags, file, offset, new map_file_page_read(file, offset)));
@@ -1458,6 +1742,29 @@ static void vm_sigbus(uintptr_t addr, exception_frame* ef)
     osv::handle_mmap_fault(addr, SIGBUS, ef);
 }
 
+// Handles the fault without vma_list_mutex if the vma is in vma_index and
+// not being changed. Returns false if the fault has to be handled the slow
+// way, under vma_list_mutex, which also reports bad accesses.
+static bool fault_in_indexed_vma(uintptr_t addr, exception_frame* ef)
+{
+    vma* v;
+    WITH_LOCK(osv::rcu_read_lock) {
+        auto index = vma_index_ptr.read();
+        v = index ? index->find(addr) : nullptr;
+        if (!v || !v->get_fault_ref()) {
+            return false;
+        }
+    }
+    // The vma can neither change nor go away until we put the reference
+    bool handled = addr >= v->start() && addr < v->end() &&
+                   !access_fault(*v, ef->get_error());
+    if (handled) {
+        v->fault(addr, ef);
+    }
+    v->put_fault_ref();
+    return handled;
+}
+
 void vm_fault(uintptr_t addr, exception_frame* ef)
 {
     trace_mmu_vm_fault(addr, ef->get_error());
@@ -1475,6 +1782,10 @@ void vm_fault(uintptr_t addr, exception_frame* ef)
     }
 #endif
     addr = align_down(addr, mmu::page_size);
+    if (fault_in_indexed_vma(addr, ef)) {
+        trace_mmu_vm_fault_ret(addr, ef->get_error());
+        return;
+    }
     WITH_LOCK(vma_list_mutex.for_read()) {
         auto vma = find_intersecting_vma(addr);
         if (vma == vma_list.end() || access_fault(*vma, ef->get_error())) {
@@ -1502,7 +1813,13 @@ vma::~vma()
 
 void vma::set(uintptr_t start, uintptr_t end)
 {
+    if (vma_list_mutex.wowned()) {
+        mark_vma_index_dirty(_range.start(), _range.end());
+    }
     _range = addr_range(align_down(start, mmu::page_size), align_up(end, mmu::page_size));
+    if (vma_list_mutex.wowned()) {
+        mark_vma_index_dirty(_range.start(), _range.end());
+    }
 }
 
 void vma::protect(unsigned perm)
@@ -1551,6 +1868,46 @@ bool vma::has_flags(unsigned flag)
     return _flags & flag;
 }
 
+bool vma::get_fault_ref()
+{
+    auto refs = _fault_refs.load(std::memory_order_relaxed);
+    do {
+        if (refs & faults_locked) {
+            return false;
+        }
+    } while (!_fault_refs.compare_exchange_weak(refs, refs + 1, std::memory_order_acquire));
+    return true;
+}
+
+void vma::put_fault_ref()
+{
+    if (_fault_refs.fetch_sub(1, std::memory_order_release) == faults_locked + 1) {
+        fault_lock_waiter.wake();
+    }
+}
+
+// Only vma_list_mutex for write locks vmas, so if this one is locked it is
+// by the current thread
+void vma::lock_faults()
+{
+    if (_fault_refs.load(std::memory_order_relaxed) & faults_locked) {
+        return;
+    }
+    // publish_vma_index() unlocks it
+    mark_vma_index_dirty(start(), end());
+    fault_lock_waiter.reset(*sched::thread::current());
+    _fault_refs.fetch_or(faults_locked);
+    sched::thread::wait_until([this] {
+        return _fault_refs.load(std::memory_order_acquire) == faults_locked;
+    });
+    fault_lock_waiter.clear();
+}
+
+void vma::unlock_faults()
+{
+    _fault_refs.fetch_and(~faults_locked, std::memory_order_release);
+}
+
 template<typename T> ulong vma::operate_range(T mapper, void *addr, size_t size)
 {
     return mmu::operate_range(mapper, reinterpret_cast<void*>(start()), addr, size);
@@ -1610,12 +1967,43 @@ anon_vma::anon_vma(addr_range range, unsigned perm, unsigned flags)
 {
 }
 
+anon_vma::~anon_vma()
+{
+}
+
+bool vma::set_numa_policy(const memory::numa_policy& policy)
+{
+    return false;
+}
+
+// Vmas following the thread's policy share the static page providers, the
+// others get their own pointing at the policy of the vma
+bool anon_vma::set_numa_policy(const memory::numa_policy& policy)
+{
+    _numa_policy = policy;
+    if (policy.m == memory::numa_policy::mode::local) {
+        _numa_page_ops.reset();
+        _page_ops = (_flags & mmap_uninitialized) ? page_allocator_noinitp : page_allocator_initp;
+    } else if (!_numa_page_ops) {
+        if (_flags & mmap_uninitialized) {
+            _numa_page_ops.reset(new uninitialized_anonymous_page_provider(&_numa_policy));
+        } else {
+            _numa_page_ops.reset(new initialized_anonymous_page_provider(&_numa_policy));
+        }
+        _page_ops = _numa_page_ops.get();
+    }
+    return true;
+}
+
 void anon_vma::split(uintptr_t edge)
 {
     if (edge <= _range.start() || edge >= _range.end()) {
         return;
     }
-    vma* n = new anon_vma(addr_range(edge, _range.end()), _perm, _flags);
+    auto n = new anon_vma(addr_range(edge, _range.end()), _perm, _flags);
+    if (_numa_page_ops) {
+        n->set_numa_policy(_numa_policy);
+    }
     set(_range.start(), edge);
     vma_list.insert(*n);
     WITH_LOCK(vma_range_set_mutex.for_write()) {
@@ -1881,8 +2269,27 @@ void file_vma::fault(uintptr_t addr, exception_frame *ef)
         size = page_size;
     }
 
-    populate_vma<account_opt::no>(this, (void*)addr, size,
-            mmu::is_page_fault_write(ef->get_error()));
+    bool write = mmu::is_page_fault_write(ef->get_error());
+    populate_vma<account_opt::no>(this, (void*)addr, size, write);
+
+    if (!write && size == page_size) {
+        // Map the neighbours of the page that are already in the page cache.
+        // Pages past the end of the file are left alone, they must SIGBUS.
+        constexpr size_t window = fault_around::max_pages * page_size;
+        auto start = std::max(align_down(addr, window), _range.start());
+        auto end = std::min(align_down(addr, window) + window, _range.end());
+        auto file_end = _range.start() + align_up(fsize, page_size) - _offset;
+        end = std::min(end, file_end);
+        if (end - start > page_size) {
+            auto pte = make_leaf_pte(hw_ptep<0>::force(nullptr), 0, perm());
+            pte.set_dirty(map_dirty());
+            operate_range(fault_around(page_ops(), pte, start - _range.start(),
+                    (end - start) / page_size), (void*)start, end - start);
+            if (perm() & perm_exec) {
+                synchronize_cpu_caches((void*)start, end - start);
+            }
+        }
+    }
 }
 
 file_vma::~file_vma()
@@ -2074,6 +2481,39 @@ void free_initial_memory_range(uintptr_t addr, size_t size)
     memory::free_initial_memory_range(phys_cast<void>(addr), size);
 }
 
+error set_numa_policy(const void* addr, size_t size, const memory::numa_policy& policy)
+{
+    PREVENT_STACK_PAGE_FAULT
+    WITH_LOCK(vma_list_mutex.for_write()) {
+        if (!ismapped(addr, size)) {
+            return make_error(ENOMEM);
+        }
+        auto start = reinterpret_cast<uintptr_t>(addr);
+        auto end = start + size;
+        auto range = find_intersecting_vmas(addr_range(start, end));
+        for (auto i = range.first; i != range.second; ++i) {
+            i->split(end);
+            i->split(start);
+            if (contains(start, end, *i) && !i->set_numa_policy(policy)) {
+                return make_error(EINVAL);
+            }
+        }
+        return no_error();
+    }
+}
+
+bool get_numa_policy(const void* addr, memory::numa_policy& policy)
+{
+    auto v = reinterpret_cast<uintptr_t>(addr);
+    SCOPE_LOCK(vma_list_mutex.for_read());
+    auto range = find_intersecting_vmas(addr_range(v, v + 1));
+    if (range.first == range.second) {
+        return false;
+    }
+    policy = range.first->numa_policy();
+    return true;
+}
+
 error mprotect(const void *addr, size_t len, unsigned perm)
 {
     PREVENT_STACK_PAGE_FAULT
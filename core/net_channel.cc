@@ -12,6 +12,7 @@
 #include <bsd/sys/netinet/ip.h>
 #include <bsd/sys/netinet/ip.h>
 #include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/udp.h>
 #include <bsd/sys/net/ethernet.h>
 #include <bsd/sys/net/netisr.h>
 
@@ -118,22 +119,66 @@ void classifier::add(ipv4_tcp_conn_id id, net_channel* channel)
 }
 
 void classifier::remove(ipv4_tcp_conn_id id)
+{
+    remove(_ipv4_tcp_channels, id);
+}
+
+void classifier::add_udp(ipv4_tcp_conn_id id, net_channel* channel)
+{
+    WITH_LOCK(_mtx) {
+        _ipv4_udp_channels.emplace(id, channel);
+    }
+}
+
+void classifier::remove_udp(ipv4_tcp_conn_id id)
+{
+    remove(_ipv4_udp_channels, id);
+}
+
+void classifier::add_listener(ipv4_tcp_conn_id id)
+{
+    WITH_LOCK(_mtx) {
+        _ipv4_tcp_listeners.emplace(id, nullptr);
+    }
+}
+
+void classifier::remove_listener(ipv4_tcp_conn_id id)
+{
+    remove(_ipv4_tcp_listeners, id);
+}
+
+void classifier::remove(ipv4_tcp_channels& table, const ipv4_tcp_conn_id& id)
 {
     WITH_LOCK(_mtx) {
-        auto i = _ipv4_tcp_channels.owner_find(id,
+        auto i = table.owner_find(id,
                 std::hash<ipv4_tcp_conn_id>(), key_item_compare());
         assert(i);
-        _ipv4_tcp_channels.erase(i);
+        table.erase(i);
     }
 }
 
+// must be called with rcu lock held
+net_channel* classifier::find(ipv4_tcp_channels& table, const ipv4_tcp_conn_id& id)
+{
+    auto i = table.reader_find(id,
+            std::hash<ipv4_tcp_conn_id>(), key_item_compare());
+    if (!i) {
+        return nullptr;
+    }
+    return i->chan;
+}
+
 bool classifier::post_packet(mbuf* m)
 {
 #if CONF_lazy_stack_invariant
     assert(!sched::thread::current()->is_app());
 #endif
     WITH_LOCK(osv::rcu_read_lock) {
-        if (auto nc = classify_ipv4_tcp(m)) {
+        auto nc = classify_ipv4_tcp(m);
+        if (!nc && !_ipv4_udp_channels.empty()) {
+            nc = classify_ipv4_udp(m);
+        }
+        if (nc) {
             log_packet_in(m, NETISR_ETHER);
             if (!nc->push(m)) {
                 return false;
@@ -178,11 +223,90 @@ net_channel* classifier::classify_ipv4_tcp(mbuf* m)
     }
     auto src_port = ntohs(tcp_hdr->th_sport);
     auto dst_port = ntohs(tcp_hdr->th_dport);
-    auto id = ipv4_tcp_conn_id{src_addr, dst_addr, src_port, dst_port};
-    auto i = _ipv4_tcp_channels.reader_find(id,
-            std::hash<ipv4_tcp_conn_id>(), key_item_compare());
-    if (!i) {
+    return find(_ipv4_tcp_channels, ipv4_tcp_conn_id{src_addr, dst_addr, src_port, dst_port});
+}
+
+// must be called with rcu lock held
+//
+// Only plain unicast datagrams with a checksum are steered, everything else
+// (broadcasts, fragments, IP options, ...) needs the full udp_input() path.
+net_channel* classifier::classify_ipv4_udp(mbuf* m)
+{
+    caddr_t h = m->m_hdr.mh_data;
+    if (unsigned(m->m_hdr.mh_len) < ETHER_HDR_LEN + sizeof(ip) + sizeof(udphdr)) {
         return nullptr;
     }
-    return i->chan;
+    auto ether_hdr = reinterpret_cast<ether_header*>(h);
+    if (ntohs(ether_hdr->ether_type) != ETHERTYPE_IP ||
+        ETHER_IS_MULTICAST(ether_hdr->ether_dhost)) {
+        return nullptr;
+    }
+    h += ETHER_HDR_LEN;
+    auto ip_hdr = reinterpret_cast<ip*>(h);
+    if (ip_hdr->ip_hl << 2 != sizeof(ip) || ip_hdr->ip_p != IPPROTO_UDP) {
+        return nullptr;
+    }
+    if (ntohs(ip_hdr->ip_off) & ~IP_DF) {
+        return nullptr;
+    }
+    auto src_addr = ip_hdr->ip_src;
+    auto dst_addr = ip_hdr->ip_dst;
+    if (IN_MULTICAST(ntohl(dst_addr.s_addr)) || dst_addr.s_addr == INADDR_BROADCAST) {
+        return nullptr;
+    }
+    auto udp_hdr = reinterpret_cast<udphdr*>(h + sizeof(ip));
+    if (udp_hdr->uh_sum == 0) {
+        return nullptr;
+    }
+    auto src_port = ntohs(udp_hdr->uh_sport);
+    auto dst_port = ntohs(udp_hdr->uh_dport);
+    // connected socket, then one bound to this address, then to INADDR_ANY
+    in_addr any = { INADDR_ANY };
+    auto nc = find(_ipv4_udp_channels, ipv4_tcp_conn_id{src_addr, dst_addr, src_port, dst_port});
+    if (!nc) {
+        nc = find(_ipv4_udp_channels, ipv4_tcp_conn_id{any, dst_addr, 0, dst_port});
+    }
+    if (!nc) {
+        nc = find(_ipv4_udp_channels, ipv4_tcp_conn_id{any, any, 0, dst_port});
+    }
+    return nc;
+}
+
+bool classifier::classify_listen_syn(mbuf* m)
+{
+    if (_ipv4_tcp_listeners.empty()) {
+        return false;
+    }
+    caddr_t h = m->m_hdr.mh_data;
+    if (unsigned(m->m_hdr.mh_len) < ETHER_HDR_LEN + sizeof(ip) + sizeof(tcphdr)) {
+        return false;
+    }
+    auto ether_hdr = reinterpret_cast<ether_header*>(h);
+    if (ntohs(ether_hdr->ether_type) != ETHERTYPE_IP ||
+        ETHER_IS_MULTICAST(ether_hdr->ether_dhost)) {
+        return false;
+    }
+    h += ETHER_HDR_LEN;
+    auto ip_hdr = reinterpret_cast<ip*>(h);
+    if (ip_hdr->ip_hl << 2 != sizeof(ip) || ip_hdr->ip_p != IPPROTO_TCP) {
+        return false;
+    }
+    if (ntohs(ip_hdr->ip_off) & ~IP_DF) {
+        return false;
+    }
+    auto tcp_hdr = reinterpret_cast<tcphdr*>(h + sizeof(ip));
+    if ((tcp_hdr->th_flags & (TH_SYN | TH_ACK | TH_RST | TH_FIN)) != TH_SYN) {
+        return false;
+    }
+    auto dst_addr = ip_hdr->ip_dst;
+    auto dst_port = ntohs(tcp_hdr->th_dport);
+    in_addr any = { INADDR_ANY };
+    bool found = false;
+    WITH_LOCK(osv::rcu_read_lock) {
+        found = _ipv4_tcp_listeners.reader_find(ipv4_tcp_conn_id{any, dst_addr, 0, dst_port},
+                    std::hash<ipv4_tcp_conn_id>(), key_item_compare()) ||
+                _ipv4_tcp_listeners.reader_find(ipv4_tcp_conn_id{any, any, 0, dst_port},
+                    std::hash<ipv4_tcp_conn_id>(), key_item_compare());
+    }
+    return found;
 }
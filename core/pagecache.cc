@@ -9,7 +9,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <deque>
-#include <stack>
+#include <vector>
 #include <boost/variant.hpp>
 #include <osv/pagecache.hh>
 #include <osv/mempool.hh>
@@ -79,15 +79,24 @@ std::unordered_set<mmu::hw_ptep<0>>::iterator end(std::unique_ptr<std::unordered
 
 namespace pagecache {
 
-static unsigned lru_max_length = 100;
-static unsigned lru_free_count = 20;
+// The read and write caches are split into shards, each with its own lock,
+// so that faults on different files, or on different parts of the same file,
+// do not serialize on a single lock. Pages of a file go to the shards in runs
+// of 1 << shard_run_shift pages, so that faulting around a page takes each
+// lock once.
+constexpr unsigned nr_shards = 64;
+constexpr unsigned shard_run_shift = 4;
+
+// The write cache LRU is kept per shard, these are the per shard limits
+static unsigned lru_max_length = 16;
+static unsigned lru_free_count = 4;
 constexpr unsigned max_lru_free_count = 200;
 static void* zero_page;
 
 void  __attribute__((constructor(init_prio::pagecache))) setup()
 {
-    lru_max_length = std::max(memory::phys_mem_size / memory::page_size / 100, size_t(100));
-    lru_free_count = std::min(lru_max_length/5, max_lru_free_count);
+    lru_max_length = std::max(memory::phys_mem_size / memory::page_size / 100 / nr_shards, size_t(16));
+    lru_free_count = std::max(std::min(lru_max_length/5, max_lru_free_count), 1U);
     zero_page = memory::alloc_page();
     memset(zero_page, 0, mmu::page_size);
 }
@@ -98,6 +107,8 @@ protected:
     void* _page;
     typedef boost::variant<std::nullptr_t, mmu::hw_ptep<0>, std::unique_ptr<std::unordered_set<mmu::hw_ptep<0>>>> ptep_list;
     ptep_list _ptes; // set of pointers to ptes that map the page
+    unsigned _pins = 0; // references that are not mappings, see pin()
+    bool _dropped = false; // removed from the cache while still pinned
 
     template<typename T>
     class ptes_visitor : public boost::static_visitor<T> {
@@ -192,6 +203,25 @@ public:
     void* addr() {
         return _page;
     }
+    bool mapped() {
+        return _ptes.which() != 0;
+    }
+    void pin() {
+        _pins++;
+    }
+    // returns true when the last pin is dropped
+    bool unpin() {
+        return --_pins == 0;
+    }
+    bool pinned() {
+        return _pins;
+    }
+    void mark_dropped() {
+        _dropped = true;
+    }
+    bool dropped() {
+        return _dropped;
+    }
     int flush() {
         return for_each_pte([] (mmu::hw_ptep<0> pte) { mmu::clear_pte(pte); return 1;});
     }
@@ -248,11 +278,24 @@ public:
     void mark_dirty() {
         _dirty |= true;
     }
+    bool dirty() {
+        return _dirty;
+    }
     bool flush_check_dirty() {
         return for_each_pte([] (mmu::hw_ptep<0> pte) { return mmu::clear_pte(pte).dirty(); }, std::logical_or<bool>(), false);
     }
 };
 
+// A read cache page of a file system that has no cache of its own to keep
+// it in, so the page is freed once it is neither mapped nor pinned
+class cached_page_owned : public cached_page {
+public:
+    cached_page_owned(hashkey key, void* page) : cached_page(key, page) {}
+    virtual ~cached_page_owned() {
+        memory::free_page(_page);
+    }
+};
+
 class cached_page_arc;
 
 static unsigned drop_arc_read_cached_page(cached_page_arc* cp, bool flush = true);
@@ -315,13 +358,37 @@ static bool operator==(const cached_page_arc::arc_map::value_type& l, const cach
 std::unordered_multimap<arc_buf_t*, cached_page_arc*> cached_page_arc::arc_cache_map;
 //Map used to store read cache pages for ZFS filesystem interacting with ARC
 static std::unordered_map<hashkey, cached_page_arc*> arc_read_cache;
-//Map used to store read cache pages for non-ZFS filesystems
-static std::unordered_map<hashkey, cached_page*> read_cache;
-static std::unordered_map<hashkey, cached_page_write*> write_cache;
-static std::deque<cached_page_write*> write_lru;
 static mutex arc_read_lock; // protects against parallel access to the ARC read cache
-static mutex read_lock; // protects against parallel access to the read cache
-static mutex write_lock; // protect against parallel access to the write cache
+
+template<typename T>
+struct cache_shard {
+    mutex lock; // protects against parallel access to this part of the cache
+    std::unordered_map<hashkey, T> pages;
+} CACHELINE_ALIGNED;
+
+struct write_cache_shard : cache_shard<cached_page_write*> {
+    std::deque<cached_page_write*> lru;
+};
+
+//Shards used to store read cache pages for non-ZFS filesystems
+static cache_shard<cached_page*> read_cache[nr_shards];
+static write_cache_shard write_cache[nr_shards];
+
+static unsigned shard_index(const hashkey& key)
+{
+    uint64_t file = (key.ino * 0x9e3779b97f4a7c15ULL) ^ key.dev;
+    return (file + (key.offset >> (mmu::page_size_shift + shard_run_shift))) % nr_shards;
+}
+
+static cache_shard<cached_page*>& read_shard(const hashkey& key)
+{
+    return read_cache[shard_index(key)];
+}
+
+static write_cache_shard& write_shard(const hashkey& key)
+{
+    return write_cache[shard_index(key)];
+}
 
 template<typename T>
 static T find_in_cache(std::unordered_map<hashkey, T>& cache, hashkey& key)
@@ -350,7 +417,7 @@ static void add_arc_read_mapping(cached_page_arc *cp, mmu::hw_ptep<0> ptep)
 template<typename T>
 static void remove_read_mapping(std::unordered_map<hashkey, T>& cache, cached_page* cp, mmu::hw_ptep<0> ptep)
 {
-    if (cp->unmap(ptep) == 0) {
+    if (cp->unmap(ptep) == 0 && !cp->pinned()) {
         cache.erase(cp->key());
         delete cp;
     }
@@ -365,10 +432,11 @@ static void remove_arc_read_mapping(cached_page_arc* cp, mmu::hw_ptep<0> ptep)
 
 void remove_read_mapping(hashkey& key, mmu::hw_ptep<0> ptep)
 {
-    SCOPE_LOCK(read_lock);
-    cached_page* cp = find_in_cache(read_cache, key);
+    auto& shard = read_shard(key);
+    SCOPE_LOCK(shard.lock);
+    cached_page* cp = find_in_cache(shard.pages, key);
     if (cp) {
-        remove_read_mapping(read_cache, cp, ptep);
+        remove_read_mapping(shard.pages, cp, ptep);
         // The method remove_read_mapping() is called by pagecache::get()
         // to handle MAP_PRIVATE COW (Copy-On-Write) scenario triggered by an attempt to write
         // to read-only page in read_cache (write protection page-fault). To handle it properly
@@ -410,7 +478,12 @@ static unsigned drop_read_cached_page(std::unordered_map<hashkey, T>& cache, cac
         mmu::flush_tlb_all();
     }
 
-    delete cp;
+    if (cp->pinned()) {
+        // the last unpin() will free it
+        cp->mark_dropped();
+    } else {
+        delete cp;
+    }
 
     return flushed;
 }
@@ -422,10 +495,11 @@ static unsigned drop_arc_read_cached_page(cached_page_arc* cp, bool flush)
 
 static void drop_read_cached_page(hashkey& key)
 {
-    SCOPE_LOCK(read_lock);
-    cached_page* cp = find_in_cache(read_cache, key);
+    auto& shard = read_shard(key);
+    SCOPE_LOCK(shard.lock);
+    cached_page* cp = find_in_cache(shard.pages, key);
     if (cp) {
-        drop_read_cached_page(read_cache, cp, true);
+        drop_read_cached_page(shard.pages, cp, true);
     }
 }
 
@@ -460,9 +534,65 @@ void map_arc_buf(hashkey *key, arc_buf_t* ab, void *page)
 
 void map_read_cached_page(hashkey *key, void *page)
 {
-    SCOPE_LOCK(read_lock);
+    auto& shard = read_shard(*key);
+    SCOPE_LOCK(shard.lock);
     cached_page* pc = new cached_page(*key, page);
-    read_cache.emplace(*key, pc);
+    shard.pages.emplace(*key, pc);
+}
+
+void map_owned_read_cached_page(hashkey *key, void *page)
+{
+    auto& shard = read_shard(*key);
+    SCOPE_LOCK(shard.lock);
+    cached_page* pc = new cached_page_owned(*key, page);
+    if (!shard.pages.emplace(*key, pc).second) {
+        // another fault read the page in meanwhile
+        delete pc;
+    }
+}
+
+void invalidate_read_cached_pages(hashkey key, unsigned n)
+{
+    unsigned flushed = 0;
+    for (unsigned i = 0; i < n; i++, key.offset += mmu::page_size) {
+        auto& shard = read_shard(key);
+        SCOPE_LOCK(shard.lock);
+        cached_page* cp = find_in_cache(shard.pages, key);
+        if (cp) {
+            flushed += drop_read_cached_page(shard.pages, cp, false);
+        }
+    }
+    if (flushed) {
+        mmu::flush_tlb_all();
+    }
+}
+
+bool drop_read_cached_pages(hashkey key, unsigned n)
+{
+    bool dropped = true;
+    unsigned flushed = 0;
+    for (unsigned i = 0; i < n; i++, key.offset += mmu::page_size) {
+        auto& shard = read_shard(key);
+        // The caller may be the reclaimer, which must not wait for a thread
+        // holding the lock while it allocates memory
+        if (!shard.lock.try_lock()) {
+            dropped = false;
+            break;
+        }
+        SCOPE_ADOPT_LOCK(shard.lock);
+        cached_page* cp = find_in_cache(shard.pages, key);
+        if (cp) {
+            if (cp->pinned()) {
+                dropped = false;
+                break;
+            }
+            flushed += drop_read_cached_page(shard.pages, cp, false);
+        }
+    }
+    if (flushed) {
+        mmu::flush_tlb_all();
+    }
+    return dropped;
 }
 
 static int create_read_cached_page(vfs_file* fp, hashkey& key)
@@ -481,25 +611,25 @@ static std::unique_ptr<cached_page_write> create_write_cached_page(vfs_file* fp,
 }
 
 TRACEPOINT(trace_drop_write_cached_page, "addr=%p", void*);
-static void insert(cached_page_write* cp) {
-    static cached_page_write* tofree[max_lru_free_count];
-    write_cache.emplace(cp->key(), cp);
-    write_lru.push_front(cp);
+static void insert(write_cache_shard& shard, cached_page_write* cp) {
+    cached_page_write* tofree[max_lru_free_count];
+    shard.pages.emplace(cp->key(), cp);
+    shard.lru.push_front(cp);
 
-    if (write_lru.size() > lru_max_length) {
+    if (shard.lru.size() > lru_max_length) {
         for (unsigned i = 0; i < lru_free_count; i++) {
-            cached_page_write *p = write_lru.back();
-            write_lru.pop_back();
+            cached_page_write *p = shard.lru.back();
+            shard.lru.pop_back();
             trace_drop_write_cached_page(p->addr());
-            write_cache.erase(p->key());
+            shard.pages.erase(p->key());
             if (p->flush_check_dirty()) {
                 p->mark_dirty();
             }
             tofree[i] = p;
         }
         mmu::flush_tlb_all();
-        for (auto p: tofree) {
-            delete p;
+        for (unsigned i = 0; i < lru_free_count; i++) {
+            delete tofree[i];
         }
     }
 }
@@ -511,8 +641,9 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
     struct stat st;
     fp->stat(&st);
     hashkey key {st.st_dev, st.st_ino, offset};
-    SCOPE_LOCK(write_lock);
-    cached_page_write* wcp = find_in_cache(write_cache, key);
+    auto& wshard = write_shard(key);
+    SCOPE_LOCK(wshard.lock);
+    cached_page_write* wcp = find_in_cache(wshard.pages, key);
 
     if (write) {
         if (!wcp) {
@@ -520,13 +651,13 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
             if (shared) {
                 // write fault into shared mapping, there page is not in write cache yet, add it.
                 wcp = newcp.release();
-                insert(wcp);
+                insert(wshard, wcp);
                 // page is moved from read cache to write cache
                 // drop read page if exists, removing all mappings
                 if (IS_ZFS(st.st_dev)) {
                     drop_arc_read_cached_page(key);
                 } else {
-                    // ROFS (at least for now)
+                    // ROFS and ext
                     drop_read_cached_page(key);
                 }
             } else {
@@ -534,7 +665,7 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 if (IS_ZFS(st.st_dev)) {
                     remove_arc_read_mapping(key, ptep);
                 } else {
-                    // ROFS (at least for now)
+                    // ROFS and ext
                     remove_read_mapping(key, ptep);
                 }
                 // cow (copy-on-write) of private page from read cache
@@ -560,9 +691,10 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 }
             }
             else {
-                // ROFS (at least for now)
-                WITH_LOCK(read_lock) {
-                    cached_page* cp = find_in_cache(read_cache, key);
+                // ROFS and ext
+                auto& rshard = read_shard(key);
+                WITH_LOCK(rshard.lock) {
+                    cached_page* cp = find_in_cache(rshard.pages, key);
                     if (cp) {
                         add_read_mapping(cp, ptep);
                         return mmu::write_pte(cp->addr(), ptep, mmu::pte_mark_cow(pte, true));
@@ -570,14 +702,14 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 }
             }
 
-            DROP_LOCK(write_lock) {
+            DROP_LOCK(wshard.lock) {
                 // page is not in cache yet, create and try again
                 // function may sleep so drop write lock while executing it
                 ret = create_read_cached_page(fp, key);
             }
 
             // we dropped write lock, need to re-check write cache again
-            wcp = find_in_cache(write_cache, key);
+            wcp = find_in_cache(wshard.pages, key);
             if (wcp) {
                 // write cache page appeared while we were creating a read cache page from ARC
                 // return will cause faulting thread to re-fault and we will try again
@@ -605,8 +737,9 @@ bool release(vfs_file* fp, void *addr, off_t offset, mmu::hw_ptep<0> ptep)
 
     // page is either in ARC cache or write cache or zero page or private page
 
-    WITH_LOCK(write_lock) {
-        cached_page_write* wcp = find_in_cache(write_cache, key);
+    auto& wshard = write_shard(key);
+    WITH_LOCK(wshard.lock) {
+        cached_page_write* wcp = find_in_cache(wshard.pages, key);
 
         if (wcp && mmu::virt_to_phys(wcp->addr()) == old.addr()) {
             // page is in write cache
@@ -629,12 +762,13 @@ bool release(vfs_file* fp, void *addr, off_t offset, mmu::hw_ptep<0> ptep)
             }
         }
     } else {
-        // ROFS (at least for now)
-        WITH_LOCK(read_lock) {
-            cached_page* rcp = find_in_cache(read_cache, key);
+        // ROFS and ext
+        auto& rshard = read_shard(key);
+        WITH_LOCK(rshard.lock) {
+            cached_page* rcp = find_in_cache(rshard.pages, key);
             if (rcp && mmu::virt_to_phys(rcp->addr()) == old.addr()) {
                 // page is in regular read cache
-                remove_read_mapping(read_cache, rcp, ptep);
+                remove_read_mapping(rshard.pages, rcp, ptep);
                 return false;
             }
         }
@@ -644,30 +778,147 @@ bool release(vfs_file* fp, void *addr, off_t offset, mmu::hw_ptep<0> ptep)
     return addr != zero_page;
 }
 
+TRACEPOINT(trace_pagecache_map_cached, "offset=%d, n=%d, mapped=%d", off_t, unsigned, unsigned);
+unsigned map_cached(vfs_file* fp, off_t offset, unsigned n, mmu::pt_element<0>* pteps[], mmu::pt_element<0> pte, bool shared)
+{
+    struct stat st;
+    fp->stat(&st);
+    // ARC buffers come and go under the ARC's control, map them one at a time
+    if (IS_ZFS(st.st_dev)) {
+        return 0;
+    }
+
+    hashkey key {st.st_dev, st.st_ino, offset};
+    unsigned mapped = 0;
+    unsigned i = 0;
+    while (i < n) {
+        auto& wshard = write_shard(key);
+        auto& rshard = read_shard(key);
+        SCOPE_LOCK(wshard.lock);
+        SCOPE_LOCK(rshard.lock);
+        auto shard = shard_index(key);
+        // pages in the same run share the shards, map all of them at once
+        for (; i < n && shard_index(key) == shard; i++, key.offset += mmu::page_size) {
+            if (!pteps[i]) {
+                continue;
+            }
+            auto ptep = mmu::hw_ptep<0>::force(pteps[i]);
+            auto empty = mmu::make_empty_pte<0>();
+            cached_page_write* wcp = find_in_cache(wshard.pages, key);
+            if (wcp) {
+                if (mmu::write_pte(wcp->addr(), ptep, empty, mmu::pte_mark_cow(pte, !shared))) {
+                    wcp->map(ptep);
+                    mapped++;
+                }
+                continue;
+            }
+            cached_page* cp = find_in_cache(rshard.pages, key);
+            if (cp && mmu::write_pte(cp->addr(), ptep, empty, mmu::pte_mark_cow(pte, true))) {
+                add_read_mapping(cp, ptep);
+                mapped++;
+            }
+        }
+    }
+    trace_pagecache_map_cached(offset, n, mapped);
+    return mapped;
+}
+
+unsigned pin(vfs_file* fp, off_t offset, unsigned n, void* pages[], void* handles[])
+{
+    struct vnode* vp = fp->f_dentry->d_vnode;
+    if (!vp->v_op->vop_cache) {
+        return 0;
+    }
+    struct stat st;
+    fp->stat(&st);
+    // ARC frees its buffers whenever it wants to (see unmap_arc_buf()),
+    // so pages of ZFS files cannot be held on to
+    if (IS_ZFS(st.st_dev)) {
+        return 0;
+    }
+
+    hashkey key {st.st_dev, st.st_ino, offset};
+    unsigned i;
+    for (i = 0; i < n && key.offset < st.st_size; i++, key.offset += mmu::page_size) {
+        auto& wshard = write_shard(key);
+        WITH_LOCK(wshard.lock) {
+            // the page is being modified through a shared mapping,
+            // let the caller read the file instead
+            if (find_in_cache(wshard.pages, key)) {
+                return i;
+            }
+        }
+        auto& rshard = read_shard(key);
+        cached_page* cp;
+        while (true) {
+            WITH_LOCK(rshard.lock) {
+                cp = find_in_cache(rshard.pages, key);
+                if (cp) {
+                    cp->pin();
+                }
+            }
+            if (cp) {
+                break;
+            }
+            if (create_read_cached_page(fp, key) == -1) {
+                return i;
+            }
+        }
+        pages[i] = cp->addr();
+        handles[i] = cp;
+    }
+    return i;
+}
+
+void unpin(void* handle)
+{
+    auto cp = static_cast<cached_page*>(handle);
+    auto& shard = read_shard(cp->key());
+    SCOPE_LOCK(shard.lock);
+    if (cp->unpin() && (cp->dropped() || !cp->mapped())) {
+        if (!cp->dropped()) {
+            shard.pages.erase(cp->key());
+        }
+        delete cp;
+    }
+}
+
 void sync(vfs_file* fp, off_t start, off_t end)
 {
-    static std::stack<cached_page_write*> dirty; // protected by write_lock
+    std::vector<off_t> dirty;
     struct stat st;
     fp->stat(&st);
     hashkey key {st.st_dev, st.st_ino, 0};
-    SCOPE_LOCK(write_lock);
 
     for (key.offset = start; key.offset < end; key.offset += mmu::page_size) {
-        cached_page_write* cp = find_in_cache(write_cache, key);
+        auto& shard = write_shard(key);
+        SCOPE_LOCK(shard.lock);
+        cached_page_write* cp = find_in_cache(shard.pages, key);
         if (cp && cp->clear_dirty()) {
-            dirty.push(cp);
+            // the shard lock is dropped before the write back, so record it
+            // in the page in case it gets evicted (and written back) meanwhile
+            cp->mark_dirty();
+            dirty.push_back(key.offset);
         }
     }
 
+    if (dirty.empty()) {
+        return;
+    }
+
     mmu::flush_tlb_all();
 
-    while(!dirty.empty()) {
-        auto cp = dirty.top();
-        auto err = cp->writeback();
-        if (err) {
-            throw make_error(err);
+    for (auto offset : dirty) {
+        key.offset = offset;
+        auto& shard = write_shard(key);
+        SCOPE_LOCK(shard.lock);
+        cached_page_write* cp = find_in_cache(shard.pages, key);
+        if (cp && cp->dirty()) {
+            auto err = cp->writeback();
+            if (err) {
+                throw make_error(err);
+            }
         }
-        dirty.pop();
     }
 }
 
@@ -771,6 +1022,31 @@ constexpr double access_scanner::_min_cpu;
 
 }
 
+//The functions below let file systems built as modules, which have
+//no cache of their own (libext.so), map their files through the page cache.
+extern "C" OSV_MODULE_API void* osv_pagecache_alloc_page()
+{
+    return memory::alloc_page();
+}
+
+extern "C" OSV_MODULE_API void osv_pagecache_free_page(void* page)
+{
+    memory::free_page(page);
+}
+
+//The page must come from osv_pagecache_alloc_page(), the page cache frees it
+extern "C" OSV_MODULE_API void osv_pagecache_map_page(void* key, void* page)
+{
+    pagecache::map_owned_read_cached_page(static_cast<pagecache::hashkey*>(key), page);
+}
+
+extern "C" OSV_MODULE_API void osv_pagecache_invalidate(dev_t dev, ino_t ino, off_t offset, off_t size)
+{
+    auto start = align_down(offset, off_t(mmu::page_size));
+    auto end = align_up(offset + size, off_t(mmu::page_size));
+    pagecache::invalidate_read_cached_pages(pagecache::hashkey{dev, ino, start}, (end - start) / mmu::page_size);
+}
+
 //The access_scanner thread is ZFS specific so it
 //is initialized by calling the function below if libsolaris.so
 //is loaded.
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/rx_gro.hh>
+#include <osv/net_channel.hh>
+#include <osv/trace.hh>
+#include <osv/net_trace.hh>
+
+#include <bsd/porting/netport.h>
+#include <bsd/sys/sys/param.h>
+#include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/net/if.h>
+#include <bsd/sys/net/if_var.h>
+#include <bsd/sys/netinet/in.h>
+#include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/tcp_lro.h>
+#include <bsd/sys/netinet/tcp_var.h>
+#include <bsd/sys/net/netisr.h>
+
+TRACEPOINT(trace_rx_gro_flush, "if=%d, segments=%d, packets=%d", int, int, int);
+
+namespace osv {
+
+rx_gro::rx_gro(struct ifnet* ifn)
+    : _ifn(ifn), _lro(new lro_ctrl)
+{
+    // On failure lro_cnt stays 0 and every packet takes the regular path
+    tcp_lro_init(_lro.get());
+    _lro->ifp = ifn;
+}
+
+rx_gro::~rx_gro()
+{
+    flush();
+    tcp_lro_free(_lro.get());
+}
+
+void rx_gro::input(struct mbuf* m)
+{
+    if (_ifn->if_classifier.post_packet(m)) {
+        return;
+    }
+    if (_ifn->if_classifier.classify_listen_syn(m)) {
+        log_packet_in(m, NETISR_ETHER);
+        _syns.push_back(m);
+        return;
+    }
+    if (_ifn->if_capenable & IFCAP_LRO) {
+        if (_lro->lro_cnt &&
+            (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_VALID) &&
+            tcp_lro_rx(_lro.get(), m, 0) == 0) {
+            return;
+        }
+    } else if (!SLIST_EMPTY(&_lro->lro_active)) {
+        // LRO was turned off in the middle of a batch; push what is held
+        // back first so that this packet does not overtake it
+        flush_lro();
+    }
+    (*_ifn->if_input)(_ifn, m);
+}
+
+void rx_gro::flush()
+{
+    if (!_syns.empty()) {
+        tcp_syn_batch_input(_ifn, _syns.data(), _syns.size());
+        _syns.clear();
+    }
+    flush_lro();
+}
+
+void rx_gro::flush_lro()
+{
+    auto lc = _lro.get();
+    while (!SLIST_EMPTY(&lc->lro_active)) {
+        auto le = SLIST_FIRST(&lc->lro_active);
+        SLIST_REMOVE_HEAD(&lc->lro_active, next);
+        tcp_lro_flush(lc, le);
+    }
+    // tcp_lro_rx() may also have flushed entries on its own, e.g. when a
+    // flow reached 64K or went out of order, so account for all of them.
+    if (lc->lro_flushed) {
+        trace_rx_gro_flush(_ifn->if_index, lc->lro_queued, lc->lro_flushed);
+        _merged += lc->lro_queued - lc->lro_flushed;
+        _flushed += lc->lro_flushed;
+        lc->lro_queued = lc->lro_flushed = 0;
+    }
+}
+
+}
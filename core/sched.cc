@@ -58,6 +58,9 @@ TRACEPOINT(trace_sched_wait, "");
 TRACEPOINT(trace_sched_wait_ret, "");
 TRACEPOINT(trace_sched_wake, "wake %p", thread*);
 TRACEPOINT(trace_sched_migrate, "thread=%p cpu=%d", thread*, unsigned);
+TRACEPOINT(trace_sched_balance, "load=%g target=%d target_load=%g", float, unsigned, float);
+TRACEPOINT(trace_sched_steal_request, "victim=%d", unsigned);
+TRACEPOINT(trace_sched_steal, "thief=%d migrated=%d latency=%d ns", unsigned, bool, s64);
 TRACEPOINT(trace_sched_queue, "thread=%p", thread*);
 TRACEPOINT(trace_sched_load, "load=%d", size_t);
 TRACEPOINT(trace_sched_preempt, "");
@@ -151,6 +154,9 @@ cpu::cpu(unsigned _id)
     , preemption_timer(*this)
     , idle_thread()
     , terminating_thread(nullptr)
+    , core_id(_id)
+    , llc_id(0)
+    , balancer_thread(nullptr)
     , c(cinitial)
     , renormalize_count(0)
 {
@@ -475,13 +481,16 @@ void cpu::do_idle()
         WITH_LOCK(idle_poll_lock) {
             // spin for a bit before halting
             for (unsigned ctr = 0; ctr < 10000; ++ctr) {
-                // FIXME: can we pull threads from loaded cpus?
                 handle_incoming_wakeups();
                 if (!runqueue.empty()) {
                     return;
                 }
             }
         }
+        // Before halting, ask a busy cpu to push us one of its runnable
+        // threads instead of waiting for the next load balancer tick. The
+        // thread will arrive through incoming_wakeups with a wakeup IPI.
+        try_steal();
 #if CONF_lazy_stack_invariant
         assert(!thread::current()->is_app());
 #endif
@@ -793,55 +802,187 @@ void thread::unpin()
     helper->join();
 }
 
+// The load balancer runs periodically on every cpu, and also on demand when
+// an idle cpu asks it for work (see try_steal()). Load is measured as the
+// priority-weighted number of runnable threads, averaged over ticks so that
+// short bursts do not cause migrations which idle stealing handles better.
+// Targets sharing our last level cache are preferred, and require a smaller
+// imbalance than remote ones, since a thread migrated there keeps most of
+// its cache footprint.
+constexpr auto balance_period = 100_ms;
+// A thread migrated by the balancer is not migrated again for this long
+constexpr auto migration_cooldown = 500_ms;
+// An idle cpu does not ask for work more often than this
+constexpr auto steal_interval = 1_ms;
+constexpr float load_avg_decay = 0.5;
+constexpr float llc_imbalance = 1.5;
+constexpr float remote_imbalance = 2.5;
+
+static inline float load_weight(float priority)
+{
+    return 1 / priority;
+}
+
+float cpu::update_load_avg()
+{
+    float load = 0;
+    WITH_LOCK(irq_lock) {
+        for (auto& t : runqueue) {
+            load += load_weight(t._runtime.priority());
+        }
+    }
+    auto avg = load_avg.load(std::memory_order_relaxed);
+    avg = avg * load_avg_decay + load * (1 - load_avg_decay);
+    load_avg.store(avg, std::memory_order_relaxed);
+    return avg;
+}
+
+cpu* cpu::find_balance_target(float my_load)
+{
+    cpu* target = nullptr;
+    float target_score = 0;
+    for (auto c : cpus) {
+        if (c == this) {
+            continue;
+        }
+        auto l = c->load_avg.load(std::memory_order_relaxed);
+        bool near = c->llc_id == llc_id;
+        if (my_load - l < (near ? llc_imbalance : remote_imbalance)) {
+            continue;
+        }
+        // Prefer a target sharing the cache, then one not sharing our core
+        float score = l + (near ? 0 : remote_imbalance - llc_imbalance)
+                        + (c->core_id == core_id ? 0.5 : 0);
+        if (!target || score < target_score) {
+            target = c;
+            target_score = score;
+        }
+    }
+    return target;
+}
+
+// Move one runnable thread from this cpu's runqueue to target. Must run on
+// this cpu. If cache_cold_only, threads which were recently migrated are
+// left alone.
+bool cpu::migrate_one(cpu* target, bool cache_cold_only)
+{
+#if CONF_lazy_stack_invariant
+    assert(!thread::current()->is_app());
+#endif
+    auto now = osv::clock::uptime::now();
+    WITH_LOCK(irq_lock) {
+        // The tail of the runqueue holds the threads which ran most recently
+        // relative to their priority, which are the least urgent to run here.
+        auto i = std::find_if(runqueue.rbegin(), runqueue.rend(),
+                [&](thread& t) {
+                    return t._migration_lock_counter == 0 &&
+                        (!cache_cold_only || now - t._last_migration > migration_cooldown);
+                });
+        if (i == runqueue.rend()) {
+            return false;
+        }
+        auto& mig = *i;
+        trace_sched_migrate(&mig, target->id);
+        runqueue.erase(std::prev(i.base()));  // i.base() returns off-by-one
+        // we won't race with wake(), since we're not thread::waiting
+        assert(mig._detached_state->st.load() == thread::status::queued);
+        mig._detached_state->st.store(thread::status::waking);
+        mig.suspend_timers();
+        mig._detached_state->_cpu = target;
+        // Convert the CPU-local runtime measure to a globally meaningful
+        // measure
+        mig._runtime.export_runtime();
+        mig.remote_thread_local_var(::percpu_base) = target->percpu_base;
+        mig.remote_thread_local_var(current_cpu) = target;
+        mig.stat_migrations.incr();
+        mig._last_migration = now;
+        auto w = load_weight(mig._runtime.priority());
+        load_avg.store(std::max(0.0f, load_avg.load(std::memory_order_relaxed) - w),
+                       std::memory_order_relaxed);
+        target->incoming_wakeups[id].push_back(mig);
+        target->incoming_wakeups_mask.set(id);
+        // FIXME: avoid if the cpu is alive and if the priority does not
+        // FIXME: warrant an interruption
+        target->send_wakeup_ipi();
+    }
+    return true;
+}
+
+// Called by an idle cpu: find a cpu with runnable threads waiting, preferably
+// one sharing our last level cache, and ask its load balancer to push one of
+// them to us. Returns true if a request was posted.
+bool cpu::try_steal()
+{
+    auto now = osv::clock::uptime::now();
+    if (now - last_steal_attempt < steal_interval) {
+        return false;
+    }
+    last_steal_attempt = now;
+    cpu* victim = nullptr;
+    unsigned victim_load = 0;
+    for (auto c : cpus) {
+        if (c == this || !c->balancer_thread) {
+            continue;
+        }
+        // Reading another cpu's runqueue size without its lock only gives
+        // a hint, which is all we need. A remote cpu needs at least two
+        // waiting threads to be worth the cache misses.
+        auto l = c->load();
+        if (c->llc_id != llc_id) {
+            l = l > 0 ? l - 1 : 0;
+        }
+        if (l > victim_load) {
+            victim = c;
+            victim_load = l;
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+    steal_requested_at.store(now, std::memory_order_relaxed);
+    cpu* expected = nullptr;
+    if (!victim->steal_request.compare_exchange_strong(expected, this,
+            std::memory_order_release, std::memory_order_relaxed)) {
+        return false;
+    }
+    trace_sched_steal_request(victim->id);
+    victim->balancer_thread->wake();
+    return true;
+}
+
 void cpu::load_balance()
 {
     notifier::fire();
+    balancer_thread = thread::current();
     timer tmr(*thread::current());
+    tmr.set(osv::clock::uptime::now() + balance_period);
     while (true) {
-        tmr.set(osv::clock::uptime::now() + 100_ms);
-        thread::wait_until([&] { return tmr.expired(); });
-        if (runqueue.empty()) {
-            continue;
+        thread::wait_until([&] {
+            return tmr.expired() || steal_request.load(std::memory_order_relaxed);
+        });
+        auto thief = steal_request.exchange(nullptr, std::memory_order_acquire);
+        if (thief) {
+            // The thief may have found work in the meantime
+            bool migrated = thief->load() == 0 && migrate_one(thief, false);
+            trace_sched_steal(thief->id, migrated,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    osv::clock::uptime::now() - thief->steal_requested_at.load(std::memory_order_relaxed)).count());
         }
-        auto min = *std::min_element(cpus.begin(), cpus.end(),
-                [](cpu* c1, cpu* c2) { return c1->load() < c2->load(); });
-        if (min == this) {
+        if (!tmr.expired()) {
             continue;
         }
-        // This CPU is temporarily running one extra thread (this thread),
-        // so don't migrate a thread away if the difference is only 1.
-        if (min->load() >= (load() - 1)) {
+        tmr.set(osv::clock::uptime::now() + balance_period);
+        auto my_load = update_load_avg();
+        if (runqueue.empty()) {
             continue;
         }
-#if CONF_lazy_stack_invariant
-        assert(!thread::current()->is_app());
-#endif
-        WITH_LOCK(irq_lock) {
-            auto i = std::find_if(runqueue.rbegin(), runqueue.rend(),
-                    [](thread& t) { return t._migration_lock_counter == 0; });
-            if (i == runqueue.rend()) {
-                continue;
-            }
-            auto& mig = *i;
-            trace_sched_migrate(&mig, min->id);
-            runqueue.erase(std::prev(i.base()));  // i.base() returns off-by-one
-            // we won't race with wake(), since we're not thread::waiting
-            assert(mig._detached_state->st.load() == thread::status::queued);
-            mig._detached_state->st.store(thread::status::waking);
-            mig.suspend_timers();
-            mig._detached_state->_cpu = min;
-            // Convert the CPU-local runtime measure to a globally meaningful
-            // measure
-            mig._runtime.export_runtime();
-            mig.remote_thread_local_var(::percpu_base) = min->percpu_base;
-            mig.remote_thread_local_var(current_cpu) = min;
-            mig.stat_migrations.incr();
-            min->incoming_wakeups[id].push_back(mig);
-            min->incoming_wakeups_mask.set(id);
-            // FIXME: avoid if the cpu is alive and if the priority does not
-            // FIXME: warrant an interruption
-            min->send_wakeup_ipi();
+        auto target = find_balance_target(my_load);
+        if (!target) {
+            continue;
         }
+        trace_sched_balance(my_load, target->id,
+                            target->load_avg.load(std::memory_order_relaxed));
+        migrate_one(target, true);
     }
 }
 
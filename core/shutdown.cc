@@ -4,7 +4,9 @@
 #include <osv/sched.hh>
 #include <osv/dhcp.hh>
 #include <osv/strace.hh>
+#include <osv/tracecontrol.hh>
 #include <osv/kernel_config_tracepoints_strace.h>
+#include <osv/kernel_config_tracepoints_stream.h>
 #include <osv/kernel_config_networking_dhcp.h>
 
 extern void vfs_exit(void);
@@ -16,6 +18,9 @@ void shutdown()
 #if CONF_tracepoints_strace
     wait_strace_complete();
 #endif
+#if CONF_tracepoints_stream
+    trace::stop_trace_stream();
+#endif
 #if CONF_networking_dhcp
     dhcp_release();
 #endif
@@ -17,6 +17,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <osv/debug.hh>
 #include <osv/prio.hh>
 #include <osv/execinfo.hh>
@@ -29,6 +30,7 @@
 #include "drivers/console.hh"
 #include <osv/kernel_config_lazy_stack.h>
 #include <osv/kernel_config_lazy_stack_invariant.h>
+#include <osv/kernel_config_tracepoints_stream.h>
 
 using namespace std;
 
@@ -60,6 +62,15 @@ tracepoint_patch_sites_type tracepoint_patch_sites;
 
 constexpr size_t trace_page_size = 4096;  // need not match arch page size
 
+// While the trace buffer of a cpu is streamed, the writer must not overwrite
+// what the stream did not drain yet, and drops new records instead
+struct trace_stream_state {
+    std::atomic<size_t> drained { 0 };
+    std::atomic<u64> dropped { 0 };
+    // Dropped records are written here, nobody reads them
+    alignas(long) char scratch[trace_page_size];
+};
+
 // Having a struct is more complex than it need be for just per-vcpu buffers,
 // _but_ it is in line with later on having rotating buffers, thus wwhy not do it already
 struct trace_buf {
@@ -67,6 +78,7 @@ struct trace_buf {
            _base;
     size_t _last;
     size_t _size;
+    trace_stream_state* _stream = nullptr;
 
     trace_buf() :
             _base(nullptr, free), _last(0), _size(0) {
@@ -107,21 +119,25 @@ struct trace_buf {
             // crossed page boundary
             pn = align_up(p, trace_page_size) + size;
         }
+        if (_stream && pn - _stream->drained.load(std::memory_order_acquire) > _size) {
+            _stream->dropped.fetch_add(1, std::memory_order_relaxed);
+            return reinterpret_cast<trace_record*>(_stream->scratch);
+        }
         auto * tr0 = reinterpret_cast<trace_record*>(&_base.get()[index(p)]);
         auto * tr1 = reinterpret_cast<trace_record*>(&_base.get()[index(pn - size)]);
         // Put an "end-marker" on the record being written to signify this is yet incomplete.
-        // Reader is only this vcpu or attached debugger -> no fence needed.
+        // The trace stream may read records from another cpu, up to _last: the release
+        // store of _last below publishes the markers before the space they are in.
         tr1->tp = invalid_trace_point;
         if (tr0 != tr1) {
             // clear the prev word, do indicate padding at the end of the page
             tr0->tp = nullptr;
         }
         barrier();
-        _last = pn;
+        __atomic_store_n(&_last, pn, __ATOMIC_RELEASE);
         return tr1;
 
     }
-private:
     inline size_t index(size_t s) const {
         return s & (_size - 1);
     }
@@ -548,6 +564,84 @@ trace::remove_symbol_callback(generator_id id) {
     }
 }
 
+// Writes the definition of a trace point for the trace dictionary, see the
+// file format description below
+template<typename Out>
+static void write_tracepoint_definition(Out& out, const tracepoint_base& tp)
+{
+    out.write(reinterpret_cast<uint64_t>(&tp)); // tag/ptr
+    out.swrite(tp.name); // id
+    out.swrite(tp.name); // name (TODO: useful names)
+    out.swrite("OSv"); // provider
+    out.swrite(tp.format); // print format (?)
+    out.template write<uint32_t>(strlen(tp.sig));
+    int n = 0;
+    auto s = tp.sig;
+    while (*s) {
+        out.swrite(std::to_string(n++)); // no arg names
+        out.write(*s);
+        ++s;
+    }
+}
+
+// Copies the complete trace record at s to out, and moves s past it
+template<typename Out>
+static void copy_trace_record(Out& out, const char*& s)
+{
+    auto * tr = reinterpret_cast<const trace_record*>(s);
+    out.template twrite<trace_record>(s);
+
+    if (tr->backtrace) {
+        out.template twrite<void *>(s, tracepoint_base::backtrace_len);
+    }
+    auto sig = tr->tp->sig;
+    while (*sig != 0) {
+        switch (*sig++) {
+        case 'c':
+            out.template twrite<char>(s);
+            break;
+        case 'b':
+        case 'B':
+            out.template twrite<u8>(s);
+            break;
+        case 'h':
+        case 'H':
+            out.template twrite<u16>(s);
+            break;
+        case 'i':
+        case 'I':
+        case 'f':
+            out.template twrite<u32>(s);
+            break;
+        case 'q':
+        case 'Q':
+        case 'd':
+        case 'P':
+            out.template twrite<u64>(s);
+            break;
+        case '?':
+            out.template twrite<bool>(s);
+            break;
+        case 'p': {
+            out.template twrite<char>(s,
+                    object_serializer<const char*>::max_len);
+            break;
+        }
+        case '*': {
+            s = align_up(s, sizeof(u16));
+            auto len = *reinterpret_cast<const u16*>(s);
+            s += 2;
+            out.write(len);
+            out.template twrite<char>(s, len);
+            break;
+        }
+        default:
+            assert(0 && "should not reach");
+        }
+    }
+    s = align_up(s, sizeof(long));
+}
+
 //The code below will be compiled out with conf_hide_symbols=1 as create_trace_dump() is
 //not in the list of the symbols to be exported and is ONLY used
 //by full API httpserver-api module
@@ -820,19 +914,7 @@ trace::create_trace_dump()
             out.write(uint32_t(tracepoint_base::tp_list.size()));
 
             for (auto & tp : tracepoint_base::tp_list) {
-                out.write(reinterpret_cast<uint64_t>(&tp)); // tag/ptr
-                out.swrite(tp.name); // id
-                out.swrite(tp.name); // name (TODO: useful names)
-                out.swrite("OSv"); // provider
-                out.swrite(tp.format); // print format (?)
-                out.write<uint32_t>(strlen(tp.sig));
-                int n = 0;
-                auto s = tp.sig;
-                while (*s) {
-                    out.swrite(std::to_string(n++)); // no arg names
-                    out.write(*s);
-                    ++s;
-                }
+                write_tracepoint_definition(out, tp);
             }
         }
 
@@ -975,57 +1057,7 @@ trace::create_trace_dump()
 
                     assert(is_valid_tracepoint(tr->tp));
 
-                    out.twrite<trace_record>(s);
-
-                    if (tr->backtrace) {
-                        out.twrite<void *>(s, tracepoint_base::backtrace_len);
-                    }
-                    auto sig = tr->tp->sig;
-                    while (*sig != 0) {
-                        switch (*sig++) {
-                        case 'c':
-                            out.twrite<char>(s);
-                            break;
-                        case 'b':
-                        case 'B':
-                            out.twrite<u8>(s);
-                            break;
-                        case 'h':
-                        case 'H':
-                            out.twrite<u16>(s);
-                            break;
-                        case 'i':
-                        case 'I':
-                        case 'f':
-                            out.twrite<u32>(s);
-                            break;
-                        case 'q':
-                        case 'Q':
-                        case 'd':
-                        case 'P':
-                            out.twrite<u64>(s);
-                            break;
-                        case '?':
-                            out.twrite<bool>(s);
-                            break;
-                        case 'p': {
-                            out.twrite<char>(s,
-                                    object_serializer<const char*>::max_len);
-                            break;
-                        }
-                        case '*': {
-                            s = align_up(s, sizeof(u16));
-                            auto len = *reinterpret_cast<const u16*>(s);
-                            s += 2;
-                            out.write(len);
-                            out.twrite<char>(s, len);
-                            break;
-                        }
-                        default:
-                            assert(0 && "should not reach");
-                        }
-                    }
-                    s = align_up(s, sizeof(long));
+                    copy_trace_record(out, s);
                 }
             }
         }
@@ -1037,3 +1069,392 @@ trace::create_trace_dump()
     return std::move(out.path);
 }
 #endif
+
+#if CONF_tracepoints_stream
+// Streaming: a low priority thread drains the trace buffers of all cpus
+// while the tracepoints keep logging, and appends what it drained to a file
+// or the console. The stream has the format of a trace dump (see above),
+// except that the size of the 'OSVT' chunk is 0 as it is not known up
+// front, and that it is made of many 'TRCS' chunks (one per cpu buffer and
+// drain), a 'TRCD' chunk whenever trace points not described so far show up,
+// and 'DROP' chunks with the number of records dropped on each cpu so far:
+//
+//  dropped = <chunk, align 8> {
+//    uint32_t tag = 'DROP';
+//    uint64_t size = <chunk size>;
+//    uint32_t n_cpus;
+//    uint64_t dropped[n_cpus];
+//  } *;
+//
+// On the console every line carrying the stream starts with
+// trace_stream_console_prefix and has a piece of it, base64 encoded.
+namespace {
+
+static constexpr uint32_t fourcc(const char (&s)[5])
+{
+    return (s[0] << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
+}
+
+static constexpr const char* trace_stream_console_prefix = "OSVTRACE ";
+
+// A piece of the stream collected in memory, written out in one go. It has
+// the interface of trace_out, to share the serialization of trace dumps.
+// Pieces are padded to 8 bytes, so the alignment of the data in a piece
+// matches the one in the stream.
+class stream_out {
+public:
+    std::vector<char> buf;
+
+    stream_out & align(size_t a) {
+        buf.resize(align_up(buf.size(), a));
+        return *this;
+    }
+    template<typename T> stream_out & align() {
+        return align(std::alignment_of<T>::value);
+    }
+    stream_out & write(const char* s, size_t n) {
+        buf.insert(buf.end(), s, s + n);
+        return *this;
+    }
+    template<typename T> stream_out & write(T && t) {
+        align<T>();
+        return write(reinterpret_cast<const char*>(&t), sizeof(t));
+    }
+    template<typename T> stream_out & twrite(const char *& s) {
+        const auto a = object_serializer<T>().alignment();
+        s = align_up(s, a);
+        align(a);
+        write(s, sizeof(T));
+        s += sizeof(T);
+        return *this;
+    }
+    template<typename T> stream_out & twrite(const char *& s, size_t n) {
+        while (n-- > 0) {
+            twrite<T>(s);
+        }
+        return *this;
+    }
+    stream_out & swrite(const char * s) {
+        size_t len = s != nullptr ? strlen(s) : 0;
+        write(u16(len));
+        return write(s, len);
+    }
+    stream_out & swrite(const std::string & s) {
+        return swrite(s.c_str());
+    }
+    // Returns where the size of the chunk goes, for end_chunk()
+    size_t begin_chunk(uint32_t tag) {
+        align(8);
+        write(tag);
+        align(8);
+        auto pos = buf.size();
+        write(uint64_t(0));
+        return pos;
+    }
+    void end_chunk(size_t pos) {
+        uint64_t size = buf.size() - pos - sizeof(uint64_t);
+        memcpy(&buf[pos], &size, sizeof(size));
+    }
+};
+
+class trace_stream {
+public:
+    // fd < 0 streams to the console
+    explicit trace_stream(int fd);
+    ~trace_stream();
+    trace::stream_stats stats() const;
+private:
+    void run();
+    void drain();
+    void drain_cpu(sched::cpu* cpu, stream_out& out);
+    void write_dropped(stream_out& out);
+    bool flush(stream_out& out);
+    void fail();
+    void attach(sched::cpu* cpu, bool on);
+
+    int _fd;
+    std::vector<std::unique_ptr<trace_stream_state>> _states;
+    // Trace points the stream described so far
+    std::unordered_set<const tracepoint_base*> _described;
+    std::vector<u64> _dropped;
+    std::atomic<bool> _stop { false };
+    std::atomic<int> _error { 0 };
+    std::atomic<u64> _records { 0 };
+    std::atomic<u64> _bytes { 0 };
+    std::atomic<u64> _total_dropped { 0 };
+    std::unique_ptr<sched::thread> _thread;
+};
+
+trace_stream::trace_stream(int fd)
+    : _fd(fd)
+    , _dropped(sched::cpus.size())
+{
+    ensure_log_initialized();
+
+    stream_out out;
+    out.write(fourcc("OSVT"));
+    out.align(8);
+    out.write(uint64_t(0)); // size, not known
+    out.write(uint32_t(1)); // endian (verify)
+    out.write(uint32_t((0 << 16) | 1)); // version, like create_trace_dump()
+    bool ok = flush(out);
+
+    for (auto cpu : sched::cpus) {
+        _states.emplace_back(new trace_stream_state);
+        if (ok) {
+            attach(cpu, true);
+        }
+    }
+    if (!ok) {
+        _stop.store(true);
+    }
+    _thread.reset(sched::thread::make([this] { run(); },
+        sched::thread::attr().name("trace-stream")));
+    _thread->set_priority(sched::thread::priority_idle);
+    _thread->start();
+}
+
+trace_stream::~trace_stream()
+{
+    // The thread drains the buffers one last time before it stops
+    _stop.store(true);
+    _thread->join();
+    for (auto cpu : sched::cpus) {
+        attach(cpu, false);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+// Starts or stops streaming the buffer of the cpu. This has to happen on
+// the cpu with interrupts disabled, like writing a trace record.
+void trace_stream::attach(sched::cpu* cpu, bool on)
+{
+    auto state = _states[cpu->id].get();
+    std::unique_ptr<sched::thread> t(sched::thread::make([=] {
+        arch::irq_flag_notrace irq;
+        irq.save();
+        arch::irq_disable_notrace();
+        auto * tbp = percpu_trace_buffer.for_cpu(cpu);
+        if (on) {
+            // Only what is logged from now on is streamed
+            state->drained.store(tbp->_last, std::memory_order_relaxed);
+            tbp->_stream = state;
+        } else {
+            tbp->_stream = nullptr;
+        }
+        irq.restore();
+    }, sched::thread::attr().pin(cpu)));
+    t->start();
+    t->join();
+}
+
+void trace_stream::run()
+{
+    while (!_stop.load()) {
+        sched::thread::sleep(std::chrono::milliseconds(10));
+        drain();
+    }
+    if (!_error.load()) {
+        drain();
+    }
+}
+
+void trace_stream::drain()
+{
+    stream_out out;
+    for (auto cpu : sched::cpus) {
+        drain_cpu(cpu, out);
+    }
+    write_dropped(out);
+    if (!flush(out)) {
+        fail();
+    }
+}
+
+// The stream cannot be written anymore. Stop streaming the buffers, so
+// that they keep the most recent records as they do without a stream,
+// instead of dropping everything from now on.
+void trace_stream::fail()
+{
+    for (auto cpu : sched::cpus) {
+        attach(cpu, false);
+    }
+    _stop.store(true);
+}
+
+void trace_stream::drain_cpu(sched::cpu* cpu, stream_out& out)
+{
+    auto * tbp = percpu_trace_buffer.for_cpu(cpu);
+    auto & state = *_states[cpu->id];
+    auto pos = state.drained.load(std::memory_order_relaxed);
+    auto last = __atomic_load_n(&tbp->_last, __ATOMIC_ACQUIRE);
+    if (pos == last) {
+        return;
+    }
+
+    // Records are copied to a chunk of their own first, as the trace
+    // points they use may have to be described before
+    stream_out records;
+    auto chunk = records.begin_chunk(fourcc("TRCS"));
+    records.align(8);
+    std::vector<const tracepoint_base*> undescribed;
+    u64 n = 0;
+    while (pos < last) {
+        const char * s = tbp->_base.get() + tbp->index(pos);
+        auto * tr = reinterpret_cast<const trace_record*>(s);
+        auto tp = __atomic_load_n(&tr->tp, __ATOMIC_ACQUIRE);
+        if (tp == nullptr) {
+            // The rest of the page is padding
+            pos = align_up(pos + 1, trace_page_size);
+            continue;
+        }
+        if (tp == trace_buf::invalid_trace_point) {
+            // Still being written, next time
+            break;
+        }
+        if (!_described.count(tp)) {
+            _described.insert(tp);
+            undescribed.push_back(tp);
+        }
+        auto start = s;
+        copy_trace_record(records, s);
+        pos += s - start;
+        n++;
+    }
+    records.end_chunk(chunk);
+    // Let the writer reuse the space
+    state.drained.store(pos, std::memory_order_release);
+    if (!n) {
+        return;
+    }
+
+    if (!undescribed.empty()) {
+        auto dict = out.begin_chunk(fourcc("TRCD"));
+        out.write(uint32_t(tracepoint_base::backtrace_len));
+        out.write(uint32_t(undescribed.size()));
+        for (auto tp : undescribed) {
+            write_tracepoint_definition(out, *tp);
+        }
+        out.end_chunk(dict);
+    }
+    out.align(8);
+    out.write(records.buf.data(), records.buf.size());
+    _records.fetch_add(n, std::memory_order_relaxed);
+}
+
+void trace_stream::write_dropped(stream_out& out)
+{
+    bool changed = false;
+    u64 total = 0;
+    for (auto cpu : sched::cpus) {
+        auto dropped = _states[cpu->id]->dropped.load(std::memory_order_relaxed);
+        changed |= dropped != _dropped[cpu->id];
+        _dropped[cpu->id] = dropped;
+        total += dropped;
+    }
+    if (!changed) {
+        return;
+    }
+    auto chunk = out.begin_chunk(fourcc("DROP"));
+    out.write(uint32_t(_dropped.size()));
+    for (auto dropped : _dropped) {
+        out.write(uint64_t(dropped));
+    }
+    out.end_chunk(chunk);
+    _total_dropped.store(total, std::memory_order_relaxed);
+}
+
+// Returns false if the stream cannot be written anymore
+bool trace_stream::flush(stream_out& out)
+{
+    out.align(8);
+    if (out.buf.empty()) {
+        return true;
+    }
+    _bytes.fetch_add(out.buf.size(), std::memory_order_relaxed);
+    if (_fd >= 0) {
+        const char* p = out.buf.data();
+        size_t left = out.buf.size();
+        while (left) {
+            auto n = ::write(_fd, p, left);
+            if (n < 0) {
+                _error.store(errno);
+                debugf("trace stream: write failed, errno=%d, stopped streaming\n", errno);
+                return false;
+            }
+            p += n;
+            left -= n;
+        }
+        return true;
+    }
+
+    // Lines of 76 base64 characters, each for 57 bytes of the stream
+    static const char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const auto* p = reinterpret_cast<const u8*>(out.buf.data());
+    const auto* end = p + out.buf.size();
+    std::string line;
+    while (p < end) {
+        line = trace_stream_console_prefix;
+        for (auto line_end = std::min(p + 57, end); p < line_end; p += 3) {
+            u32 v = p[0] << 16;
+            v |= p + 1 < line_end ? p[1] << 8 : 0;
+            v |= p + 2 < line_end ? p[2] : 0;
+            line += table[(v >> 18) & 63];
+            line += table[(v >> 12) & 63];
+            line += p + 1 < line_end ? table[(v >> 6) & 63] : '=';
+            line += p + 2 < line_end ? table[v & 63] : '=';
+        }
+        line += '\n';
+        console::write(line.c_str(), line.size());
+    }
+    return true;
+}
+
+trace::stream_stats trace_stream::stats() const
+{
+    trace::stream_stats stats;
+    stats.records = _records.load(std::memory_order_relaxed);
+    stats.dropped = _total_dropped.load(std::memory_order_relaxed);
+    stats.bytes = _bytes.load(std::memory_order_relaxed);
+    stats.error = _error.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}
+
+static std::mutex trace_stream_mutex;
+static std::unique_ptr<trace_stream> the_trace_stream;
+
+bool trace::start_trace_stream(const std::string& path)
+{
+    SCOPE_LOCK(trace_stream_mutex);
+    if (the_trace_stream) {
+        return false;
+    }
+    int fd = -1;
+    if (path != "console") {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            debugf("trace stream: cannot open %s, errno=%d\n", path.c_str(), errno);
+            return false;
+        }
+    }
+    the_trace_stream.reset(new trace_stream(fd));
+    return true;
+}
+
+void trace::stop_trace_stream()
+{
+    SCOPE_LOCK(trace_stream_mutex);
+    the_trace_stream.reset();
+}
+
+trace::stream_stats trace::get_stream_stats()
+{
+    SCOPE_LOCK(trace_stream_mutex);
+    return the_trace_stream ? the_trace_stream->stats() : stream_stats();
+}
+#endif
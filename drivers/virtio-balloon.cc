@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/drivers_config.h>
+#include <stddef.h>
+#include <algorithm>
+
+#include <osv/debug.h>
+#include <osv/interrupt.hh>
+#include <osv/mmu.hh>
+#include <osv/msi.hh>
+#include <osv/trace.hh>
+
+#include "drivers/pci-device.hh"
+#include "drivers/virtio.hh"
+#include "drivers/virtio-vring.hh"
+#include "drivers/virtio-balloon.hh"
+
+TRACEPOINT(trace_virtio_balloon_inflate, "pages=%d, size=%d", unsigned, size_t);
+TRACEPOINT(trace_virtio_balloon_deflate, "pages=%d, size=%d", unsigned, size_t);
+TRACEPOINT(trace_virtio_balloon_deflate_on_oom, "requested=%d, freed=%d", size_t, size_t);
+TRACEPOINT(trace_virtio_balloon_report, "ranges=%d, bytes=%d", unsigned, size_t);
+
+using namespace memory;
+
+namespace virtio {
+
+#define balloon_tag "virtio-balloon"
+#define balloon_i(...)   tprintf_i(balloon_tag, __VA_ARGS__)
+
+class balloon_shrinker : public shrinker {
+public:
+    explicit balloon_shrinker(balloon* drv) : shrinker("balloon"), _drv(drv) {}
+    size_t request_memory(size_t n, bool hard) { return _drv->deflate_on_oom(n); }
+private:
+    balloon* _drv;
+};
+
+// Inflating the balloon stops this far above the point where the reclaimer
+// starts to free memory, so the balloon itself never causes pressure
+static size_t inflate_headroom()
+{
+    return 2 * (stats::total() - stats::max_no_reclaim());
+}
+
+bool balloon::ack_irq()
+{
+    return _dev.read_and_ack_isr();
+}
+
+balloon::balloon(virtio_device& dev)
+    : virtio_driver(dev)
+{
+    // Steps 4, 5 & 6 - negotiate and confirm features
+    setup_features();
+    _deflate_on_oom = get_guest_feature_bit(VIRTIO_BALLOON_F_DEFLATE_ON_OOM);
+
+    // Step 7 - generic init of virtqueues. The stats and reporting queues
+    // only exist if their features were negotiated and take the next free
+    // indexes.
+    probe_virt_queues();
+    _inflate_vq = get_virt_queue(0);
+    _deflate_vq = get_virt_queue(1);
+    int idx = 2;
+    if (get_guest_feature_bit(VIRTIO_BALLOON_F_STATS_VQ)) {
+        _stats_vq = get_virt_queue(idx++);
+    }
+    if (get_guest_feature_bit(VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+        idx++;
+    }
+    if (get_guest_feature_bit(VIRTIO_BALLOON_F_REPORTING)) {
+        _reporting_vq = get_virt_queue(idx);
+        _reporting_vq->set_use_indirect(true);
+    }
+
+    _thread.reset(sched::thread::make([this] { this->worker(); },
+        sched::thread::attr().name("virtio-balloon")));
+    auto t = _thread.get();
+
+    interrupt_factory int_factory;
+#if CONF_drivers_pci
+    int_factory.register_msi_bindings = [this, t](interrupt_manager& msi) {
+        std::vector<msix_binding> bindings;
+        for (unsigned i = 0; i < _num_queues; i++) {
+            auto q = get_virt_queue(i);
+            bindings.push_back({i, [=] { q->disable_interrupts(); }, t});
+        }
+        msi.easy_register(bindings);
+    };
+
+    int_factory.create_pci_interrupt = [this, t](pci::device& pci_dev) {
+        return new pci_interrupt(
+            pci_dev,
+            [=] { return this->ack_irq(); },
+            [=] { t->wake_with_irq_disabled(); });
+    };
+#endif
+
+#if CONF_drivers_mmio
+#ifdef __aarch64__
+    int_factory.create_spi_edge_interrupt = [this, t]() {
+        return new spi_interrupt(
+            gic::irq_type::IRQ_TYPE_EDGE,
+            _dev.get_irq(),
+            [=] { return this->ack_irq(); },
+            [=] { t->wake_with_irq_disabled(); });
+    };
+#else
+    int_factory.create_gsi_edge_interrupt = [this, t]() {
+        return new gsi_edge_interrupt(
+            _dev.get_irq(),
+            [=] { if (this->ack_irq()) t->wake_with_irq_disabled(); });
+    };
+#endif
+#endif
+
+    _dev.register_interrupt(int_factory);
+
+    // Step 8
+    add_dev_status(VIRTIO_CONFIG_S_DRIVER_OK);
+
+    if (_stats_vq) {
+        // The host returns the buffer whenever it wants fresh numbers
+        update_stats();
+    }
+    if (_reporting_vq) {
+        enable_page_reporting();
+    }
+    if (_deflate_on_oom) {
+        _shrinker.reset(new balloon_shrinker(this));
+    }
+
+    _thread->start();
+
+    balloon_i("Ready, deflate on OOM %s, free page reporting %s",
+        _deflate_on_oom ? "on" : "off", _reporting_vq ? "on" : "off");
+}
+
+balloon::~balloon()
+{
+    // Like the other virtio drivers, this one is never unloaded
+}
+
+void balloon::worker()
+{
+    unsigned ticks = 0;
+    auto deadline = osv::clock::uptime::now() + std::chrono::seconds(1);
+    for (;;) {
+        sched::timer tmr(*sched::thread::current());
+        tmr.set(deadline);
+        sched::thread::wait_until([&] {
+            if (tmr.expired() || _oom_pending.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            if (!_stats_vq) {
+                return false;
+            }
+            // Check again after enabling interrupts, see wait_for_queue()
+            if (_stats_vq->used_ring_not_empty()) {
+                return true;
+            }
+            _stats_vq->enable_interrupts();
+            return _stats_vq->used_ring_not_empty();
+        });
+
+        flush_oom_deflated();
+        if (_stats_vq && _stats_vq->used_ring_not_empty()) {
+            update_stats();
+        }
+        if (!tmr.expired()) {
+            continue;
+        }
+        adjust();
+        if (_reporting_vq && ++ticks % report_interval == 0) {
+            report_free_pages();
+        }
+        deadline = osv::clock::uptime::now() + std::chrono::seconds(1);
+    }
+}
+
+void balloon::tell_host(vring* queue, unsigned n)
+{
+    queue->init_sg();
+    queue->add_out_sg(_pfns, n * sizeof(_pfns[0]));
+    queue->add_buf_wait(_pfns);
+    queue->kick();
+    wait_for_queue(queue, &vring::used_ring_not_empty);
+    u32 len;
+    queue->get_buf_elem(&len);
+    queue->get_buf_finalize();
+}
+
+void balloon::adjust()
+{
+    u32 target;
+    virtio_conf_read(offsetof(balloon_config, num_pages), &target, sizeof(target));
+    size_t size;
+    WITH_LOCK(_lock) {
+        size = _pages.size();
+    }
+
+    bool changed = false;
+    if (target > size && osv::clock::uptime::now() >= _inflate_after) {
+        while (size < target) {
+            auto n = inflate(std::min<size_t>(target - size, pfns_per_batch));
+            if (!n) {
+                break;
+            }
+            size += n;
+            changed = true;
+        }
+    } else if (target < size) {
+        while (size > target) {
+            auto n = deflate(std::min<size_t>(size - target, pfns_per_batch));
+            if (!n) {
+                break;
+            }
+            size -= n;
+            changed = true;
+        }
+    }
+    if (changed) {
+        update_actual();
+    }
+}
+
+unsigned balloon::inflate(unsigned n)
+{
+    void* pages[pfns_per_batch];
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        if (stats::free() < inflate_headroom()) {
+            break;
+        }
+        pages[i] = alloc_page();
+        _pfns[i] = mmu::virt_to_phys(pages[i]) >> pfn_shift;
+    }
+    if (!i) {
+        return 0;
+    }
+    tell_host(_inflate_vq, i);
+
+    // The lists may grow here, don't wait for the reclaimer while holding
+    // the lock it needs
+    WITH_LOCK(reclaimer_lock) {
+        WITH_LOCK(_lock) {
+            _pages.insert(_pages.end(), pages, pages + i);
+            _oom_deflated.reserve(_oom_deflated.size() + _pages.size());
+        }
+    }
+    trace_virtio_balloon_inflate(i, i * page_size);
+    return i;
+}
+
+unsigned balloon::deflate(unsigned n)
+{
+    void* pages[pfns_per_batch];
+    unsigned i = 0;
+    WITH_LOCK(_lock) {
+        for (; i < n && !_pages.empty(); i++) {
+            pages[i] = _pages.back();
+            _pages.pop_back();
+            _pfns[i] = mmu::virt_to_phys(pages[i]) >> pfn_shift;
+        }
+    }
+    if (!i) {
+        return 0;
+    }
+    tell_host(_deflate_vq, i);
+    for (unsigned j = 0; j < i; j++) {
+        free_page(pages[j]);
+    }
+    trace_virtio_balloon_deflate(i, i * page_size);
+    return i;
+}
+
+// Runs in the reclaimer thread. Without MUST_TELL_HOST the pages may be
+// used before the host is told about them, which the worker does later.
+size_t balloon::deflate_on_oom(size_t n)
+{
+    size_t freed = 0;
+    WITH_LOCK(_lock) {
+        while (freed < n && !_pages.empty()) {
+            auto page = _pages.back();
+            _pages.pop_back();
+            // Does not allocate, inflate() reserved room for every page
+            _oom_deflated.push_back(mmu::virt_to_phys(page) >> pfn_shift);
+            free_page(page);
+            freed += page_size;
+        }
+    }
+    trace_virtio_balloon_deflate_on_oom(n, freed);
+    if (freed) {
+        _oom_pending.store(true);
+        _thread->wake();
+    }
+    return freed;
+}
+
+void balloon::flush_oom_deflated()
+{
+    if (!_oom_pending.exchange(false)) {
+        return;
+    }
+    // Copy rather than swap, _oom_deflated must keep its capacity
+    std::vector<u32> pfns;
+    WITH_LOCK(reclaimer_lock) {
+        WITH_LOCK(_lock) {
+            pfns.assign(_oom_deflated.begin(), _oom_deflated.end());
+            _oom_deflated.clear();
+        }
+    }
+    for (size_t i = 0; i < pfns.size(); i += pfns_per_batch) {
+        auto n = std::min<size_t>(pfns.size() - i, pfns_per_batch);
+        std::copy(pfns.begin() + i, pfns.begin() + i + n, _pfns);
+        tell_host(_deflate_vq, n);
+    }
+    update_actual();
+    // The guest needed that memory, so give it a while before taking
+    // memory away again
+    _inflate_after = osv::clock::uptime::now() + std::chrono::seconds(30);
+}
+
+void balloon::update_actual()
+{
+    u32 actual;
+    WITH_LOCK(_lock) {
+        actual = _pages.size();
+    }
+    virtio_conf_write(offsetof(balloon_config, actual), &actual, sizeof(actual));
+}
+
+void balloon::update_stats()
+{
+    u32 len;
+    if (_stats_vq->get_buf_elem(&len)) {
+        _stats_vq->get_buf_finalize();
+    }
+    _stats[0] = {VIRTIO_BALLOON_S_MEMFREE, stats::free()};
+    _stats[1] = {VIRTIO_BALLOON_S_MEMTOT, stats::total()};
+    _stats[2] = {VIRTIO_BALLOON_S_AVAIL, stats::free()};
+    _stats_vq->init_sg();
+    _stats_vq->add_out_sg(_stats, sizeof(_stats));
+    _stats_vq->add_buf(_stats);
+    _stats_vq->kick();
+}
+
+void balloon::report_free_pages()
+{
+    void* addr[report_ranges];
+    size_t size[report_ranges];
+    unsigned n = 0;
+    while (n < report_ranges && take_unreported_range(report_range_size, addr[n], size[n])) {
+        n++;
+    }
+    if (!n) {
+        return;
+    }
+
+    size_t bytes = 0;
+    _reporting_vq->init_sg();
+    for (unsigned i = 0; i < n; i++) {
+        _reporting_vq->add_in_sg(addr[i], size[i]);
+        bytes += size[i];
+    }
+    _reporting_vq->add_buf_wait(addr);
+    _reporting_vq->kick();
+    wait_for_queue(_reporting_vq, &vring::used_ring_not_empty);
+    u32 len;
+    _reporting_vq->get_buf_elem(&len);
+    _reporting_vq->get_buf_finalize();
+
+    for (unsigned i = 0; i < n; i++) {
+        return_reported_range(addr[i], size[i]);
+    }
+    trace_virtio_balloon_report(n, bytes);
+}
+
+u64 balloon::get_driver_features()
+{
+    auto base = virtio_driver::get_driver_features();
+    return base | ((u64)1 << VIRTIO_F_VERSION_1)
+                | (1 << VIRTIO_BALLOON_F_STATS_VQ)
+                | (1 << VIRTIO_BALLOON_F_DEFLATE_ON_OOM)
+                | (1 << VIRTIO_BALLOON_F_REPORTING);
+}
+
+hw_driver* balloon::probe(hw_device* dev)
+{
+    return virtio::probe<balloon, VIRTIO_ID_BALLOON>(dev);
+}
+
+}
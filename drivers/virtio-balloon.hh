@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef VIRTIO_BALLOON_DRIVER_H
+#define VIRTIO_BALLOON_DRIVER_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <osv/clock.hh>
+#include <osv/mempool.hh>
+#include <osv/mutex.h>
+#include <osv/sched.hh>
+
+#include "drivers/driver.hh"
+#include "drivers/virtio.hh"
+#include "drivers/virtio-device.hh"
+
+namespace virtio {
+
+/**
+ * Memory balloon, lets the host take back memory the guest does not use.
+ *
+ * The host sets a target balloon size in the config space; the driver
+ * inflates the balloon by allocating pages and telling the host their
+ * addresses, so it can discard them, and deflates it by telling the host it
+ * takes pages back and freeing them. Inflating stops short of pushing the
+ * guest into memory pressure, and if the host allows it (DEFLATE_ON_OOM) the
+ * balloon is a shrinker the reclaimer deflates when memory runs low.
+ *
+ * With free page reporting the driver also tells the host about large free
+ * ranges of the page allocator, so memory the guest freed after a load
+ * spike goes back to the host without anybody setting a balloon target.
+ *
+ * The config space is polled once a second, since the config change
+ * interrupt is not delivered to drivers.
+ */
+class balloon : public virtio_driver {
+public:
+    enum {
+        VIRTIO_BALLOON_F_MUST_TELL_HOST = 0,
+        VIRTIO_BALLOON_F_STATS_VQ = 1,
+        VIRTIO_BALLOON_F_DEFLATE_ON_OOM = 2,
+        VIRTIO_BALLOON_F_FREE_PAGE_HINT = 3,
+        VIRTIO_BALLOON_F_PAGE_POISON = 4,
+        VIRTIO_BALLOON_F_REPORTING = 5,
+    };
+
+    enum {
+        VIRTIO_BALLOON_S_MEMFREE = 4,
+        VIRTIO_BALLOON_S_MEMTOT = 5,
+        VIRTIO_BALLOON_S_AVAIL = 6,
+    };
+
+    struct balloon_config {
+        u32 num_pages;
+        u32 actual;
+        u32 free_page_hint_cmd_id;
+        u32 poison_val;
+    } __attribute__((packed));
+
+    struct balloon_stat {
+        u16 tag;
+        u64 val;
+    } __attribute__((packed));
+
+    explicit balloon(virtio_device& dev);
+    virtual ~balloon();
+
+    virtual std::string get_name() const { return "virtio-balloon"; }
+
+    static hw_driver* probe(hw_device* dev);
+
+    // Called by the reclaimer, frees up to n bytes of the balloon
+    size_t deflate_on_oom(size_t n);
+
+protected:
+    virtual u64 get_driver_features();
+
+private:
+    // The host addresses balloon pages in units of 4K
+    static constexpr unsigned pfn_shift = 12;
+    static constexpr unsigned pfns_per_batch = 256;
+    // Free page reporting hands the host at most this many ranges of at
+    // most report_range_size bytes at once, every report_interval seconds
+    static constexpr unsigned report_ranges = 16;
+    static constexpr size_t report_range_size = 32 << 20;
+    static constexpr unsigned report_interval = 2;
+
+    bool ack_irq();
+    void worker();
+    void adjust();
+    unsigned inflate(unsigned n);
+    unsigned deflate(unsigned n);
+    void tell_host(vring* queue, unsigned n);
+    void flush_oom_deflated();
+    void update_actual();
+    void report_free_pages();
+    void update_stats();
+
+    vring* _inflate_vq;
+    vring* _deflate_vq;
+    vring* _stats_vq = nullptr;
+    vring* _reporting_vq = nullptr;
+    bool _deflate_on_oom;
+    std::unique_ptr<sched::thread> _thread;
+    std::unique_ptr<memory::shrinker> _shrinker;
+    // Only used by the worker thread
+    u32 _pfns[pfns_per_batch];
+    balloon_stat _stats[3];
+    osv::clock::uptime::time_point _inflate_after;
+
+    // Protects the two lists below, which the reclaimer changes too. Never
+    // held while waiting for the host.
+    mutex _lock;
+    std::vector<void*> _pages;
+    // Freed by deflate_on_oom(), the host was not told yet. Its capacity
+    // covers all of _pages, so the reclaimer never has to allocate.
+    std::vector<u32> _oom_deflated;
+    std::atomic<bool> _oom_pending { false };
+};
+
+}
+
+#endif
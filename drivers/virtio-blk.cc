@@ -20,6 +20,7 @@
 #include <string>
 #include <string.h>
 #include <map>
+#include <algorithm>
 #include <errno.h>
 #include <osv/debug.h>
 
@@ -38,9 +39,10 @@ TRACEPOINT(trace_virtio_blk_read_config_blk_size, "blk_size=%u", u32);
 TRACEPOINT(trace_virtio_blk_read_config_topology, "physical_block_exp=%u, alignment_offset=%u, min_io_size=%u, opt_io_size=%u", u32, u32, u32, u32);
 TRACEPOINT(trace_virtio_blk_read_config_wce, "wce=%u", u32);
 TRACEPOINT(trace_virtio_blk_read_config_ro, "readonly=true");
+TRACEPOINT(trace_virtio_blk_read_config_num_queues, "num_queues=%u", u32);
 TRACEPOINT(trace_virtio_blk_make_request_seg_max, "request of size %d needs more segment than the max %d", size_t, u32);
 TRACEPOINT(trace_virtio_blk_make_request_readonly, "write on readonly device");
-TRACEPOINT(trace_virtio_blk_wake, "");
+TRACEPOINT(trace_virtio_blk_wake, "queue=%u", unsigned);
 TRACEPOINT(trace_virtio_blk_strategy, "write=%u, offset=%lu, bcount=%lu", bool, off_t, size_t);
 TRACEPOINT(trace_virtio_blk_strategy_ret, "%d", int);
 TRACEPOINT(trace_virtio_blk_req_ok, "bio=%p, sector=%lu, len=%lu, type=%x", struct bio*, u64, size_t, u32);
@@ -105,10 +107,12 @@ struct driver blk_driver = {
 bool blk::ack_irq()
 {
     auto isr = _dev.read_and_ack_isr();
-    auto queue = get_virt_queue(0);
 
     if (isr) {
-        queue->disable_interrupts();
+        // Without MSI-X all queues share a single interrupt
+        for (auto& rq : _request_queues) {
+            rq->queue->disable_interrupts();
+        }
         return true;
     } else {
         return false;
@@ -130,49 +134,73 @@ blk::blk(virtio_device& virtio_dev)
     // Step 7 - generic init of virtqueues
     probe_virt_queues();
 
-    //register the single irq callback for the block
-    sched::thread* t = sched::thread::make([this] { this->req_done(); },
-            sched::thread::attr().name("virtio-blk"));
-    t->start();
-    auto queue = get_virt_queue(0);
+    // With VIRTIO_BLK_F_MQ use one request queue per cpu, each with its own
+    // completion thread pinned to that cpu, like the NVMe driver does.
+    unsigned nr_queues = 1;
+    if (get_guest_feature_bit(VIRTIO_BLK_F_MQ)) {
+        nr_queues = std::min<unsigned>({_config.num_queues, _num_queues,
+                                        (unsigned)sched::cpus.size()});
+        nr_queues = std::max(nr_queues, 1u);
+    }
+
+    // Completion threads index this vector, so it must not reallocate
+    _request_queues.reserve(nr_queues);
+    for (unsigned i = 0; i < nr_queues; i++) {
+        auto* rq = aligned_new<request_queue>(get_virt_queue(i));
+        _request_queues.emplace_back(rq);
+
+        auto attr = sched::thread::attr().name(nr_queues > 1 ?
+                "virtio-blk-q" + std::to_string(i) : "virtio-blk");
+        if (nr_queues > 1) {
+            attr.pin(sched::cpus[i]);
+        }
+        rq->completion_thread = sched::thread::make([this, i] { this->req_done(i); }, attr);
+        rq->completion_thread->start();
+
+        // Enable indirect descriptor
+        rq->queue->set_use_indirect(true);
+    }
 
     interrupt_factory int_factory;
 #if CONF_drivers_pci
-    int_factory.register_msi_bindings = [queue, t](interrupt_manager &msi) {
-        msi.easy_register( {{ 0, [=] { queue->disable_interrupts(); }, t }});
+    // The virtio PCI transport assigns MSI-X entry N to virtqueue N
+    int_factory.register_msi_bindings = [this](interrupt_manager &msi) {
+        std::vector<msix_binding> bindings;
+        for (unsigned i = 0; i < _request_queues.size(); i++) {
+            auto* rq = _request_queues[i].get();
+            bindings.push_back({ i, [rq] { rq->queue->disable_interrupts(); }, rq->completion_thread });
+        }
+        msi.easy_register(bindings);
     };
 
-    int_factory.create_pci_interrupt = [this,t](pci::device &pci_dev) {
+    int_factory.create_pci_interrupt = [this](pci::device &pci_dev) {
         return new pci_interrupt(
             pci_dev,
             [=] { return this->ack_irq(); },
-            [=] { t->wake_with_irq_disabled(); });
+            [=] { this->wake_completion_threads(); });
     };
 #endif
 
 #if CONF_drivers_mmio
 #ifdef __aarch64__
-    int_factory.create_spi_edge_interrupt = [this,t]() {
+    int_factory.create_spi_edge_interrupt = [this]() {
         return new spi_interrupt(
             gic::irq_type::IRQ_TYPE_EDGE,
             _dev.get_irq(),
             [=] { return this->ack_irq(); },
-            [=] { t->wake_with_irq_disabled(); });
+            [=] { this->wake_completion_threads(); });
     };
 #else
-    int_factory.create_gsi_edge_interrupt = [this,t]() {
+    int_factory.create_gsi_edge_interrupt = [this]() {
         return new gsi_edge_interrupt(
             _dev.get_irq(),
-            [=] { if (this->ack_irq()) t->wake_with_irq_disabled(); });
+            [=] { if (this->ack_irq()) this->wake_completion_threads(); });
     };
 #endif
 #endif
 
     _dev.register_interrupt(int_factory);
 
-    // Enable indirect descriptor
-    queue->set_use_indirect(true);
-
     // Step 8
     add_dev_status(VIRTIO_CONFIG_S_DRIVER_OK);
 
@@ -189,7 +217,8 @@ blk::blk(virtio_device& virtio_dev)
     dev->max_io_size = _config.seg_max ? (_config.seg_max - 1) * mmu::page_size : UINT_MAX;
     read_partition_table(dev);
 
-    debugf("virtio-blk: Add blk device instances %d as %s, devsize=%lld\n", _id, dev_name.c_str(), dev->size);
+    debugf("virtio-blk: Add blk device instances %d as %s, devsize=%lld, %s ring\n", _id, dev_name.c_str(), dev->size,
+        get_guest_feature_bit(VIRTIO_F_RING_PACKED) ? "packed" : "split");
 }
 
 blk::~blk()
@@ -235,17 +264,30 @@ void blk::read_config()
         set_readonly();
         trace_virtio_blk_read_config_ro();
     }
+    if (get_guest_feature_bit(VIRTIO_BLK_F_MQ)) {
+        READ_CONFIGURATION_FIELD(blk_config,num_queues,_config.num_queues)
+        trace_virtio_blk_read_config_num_queues(_config.num_queues);
+    } else {
+        _config.num_queues = 1;
+    }
+}
+
+void blk::wake_completion_threads()
+{
+    for (auto& rq : _request_queues) {
+        rq->completion_thread->wake_with_irq_disabled();
+    }
 }
 
-void blk::req_done()
+void blk::req_done(unsigned qidx)
 {
-    auto* queue = get_virt_queue(0);
+    auto* queue = _request_queues[qidx]->queue;
     blk_req* req;
 
     while (1) {
 
         virtio_driver::wait_for_queue(queue, &vring::used_ring_not_empty);
-        trace_virtio_blk_wake();
+        trace_virtio_blk_wake(qidx);
 
         u32 len;
         while((req = static_cast<blk_req*>(queue->get_buf_elem(&len))) != nullptr) {
@@ -282,47 +324,56 @@ int64_t blk::size()
     return _config.capacity * sector_size;
 }
 
-int blk::make_request(struct bio* bio)
+blk::request_queue& blk::current_queue()
 {
-    // The lock is here for parallel requests protection
-    WITH_LOCK(_lock) {
+    return *_request_queues[sched::current_cpu->id % _request_queues.size()];
+}
 
-        if (!bio) return EIO;
+int blk::make_request(struct bio* bio)
+{
+    if (!bio) return EIO;
 
-        if (get_guest_feature_bit(VIRTIO_BLK_F_SEG_MAX)) {
-            if (bio->bio_bcount/mmu::page_size + 1 > _config.seg_max) {
-                trace_virtio_blk_make_request_seg_max(bio->bio_bcount, _config.seg_max);
-                return EIO;
-            }
+    if (get_guest_feature_bit(VIRTIO_BLK_F_SEG_MAX)) {
+        if (bio->bio_bcount/mmu::page_size + 1 > _config.seg_max) {
+            trace_virtio_blk_make_request_seg_max(bio->bio_bcount, _config.seg_max);
+            return EIO;
         }
+    }
 
-        auto* queue = get_virt_queue(0);
-        blk_request_type type;
-
-        switch (bio->bio_cmd) {
-        case BIO_READ:
-            type = VIRTIO_BLK_T_IN;
-            break;
-        case BIO_WRITE:
-            if (is_readonly()) {
-                trace_virtio_blk_make_request_readonly();
-                biodone(bio, false);
-                return EROFS;
-            }
-            type = VIRTIO_BLK_T_OUT;
-            break;
-        case BIO_FLUSH:
-            type = VIRTIO_BLK_T_FLUSH;
-            break;
-        default:
-            return ENOTBLK;
+    blk_request_type type;
+
+    switch (bio->bio_cmd) {
+    case BIO_READ:
+        type = VIRTIO_BLK_T_IN;
+        break;
+    case BIO_WRITE:
+        if (is_readonly()) {
+            trace_virtio_blk_make_request_readonly();
+            biodone(bio, false);
+            return EROFS;
         }
+        type = VIRTIO_BLK_T_OUT;
+        break;
+    case BIO_FLUSH:
+        type = VIRTIO_BLK_T_FLUSH;
+        break;
+    default:
+        return ENOTBLK;
+    }
+
+    auto* req = new blk_req(bio);
+    blk_outhdr* hdr = &req->hdr;
+    hdr->type = type;
+    hdr->ioprio = 0;
+    hdr->sector = bio->bio_offset / sector_size;
+    req->res.status = 0;
 
-        auto* req = new blk_req(bio);
-        blk_outhdr* hdr = &req->hdr;
-        hdr->type = type;
-        hdr->ioprio = 0;
-        hdr->sector = bio->bio_offset / sector_size;
+    auto& rq = current_queue();
+    rq.submitters.fetch_add(1, std::memory_order_relaxed);
+
+    // The lock is here for parallel requests protection
+    WITH_LOCK(rq.lock) {
+        auto* queue = rq.queue;
 
         queue->init_sg();
         queue->add_out_sg(hdr, sizeof(struct blk_outhdr));
@@ -334,27 +385,32 @@ int blk::make_request(struct bio* bio)
                 queue->add_in_sg(bio->bio_data, bio->bio_bcount);
         }
 
-        req->res.status = 0;
         queue->add_in_sg(&req->res, sizeof (struct blk_res));
 
         queue->add_buf_wait(req);
 
-        queue->kick();
-
-        return 0;
+        // Threads waiting for the lock will add their requests right after
+        // us, so leave the kick to the last of them. add_buf() kicks by
+        // itself if the ring fills up in the meantime.
+        if (rq.submitters.fetch_sub(1, std::memory_order_relaxed) == 1) {
+            queue->kick();
+        }
     }
+
+    return 0;
 }
 
 u64 blk::get_driver_features()
 {
-    auto base = virtio_driver::get_driver_features();
+    auto base = virtio_driver::get_driver_features() | get_packed_ring_features();
     return (base | ( 1 << VIRTIO_BLK_F_SIZE_MAX)
                  | ( 1 << VIRTIO_BLK_F_SEG_MAX)
                  | ( 1 << VIRTIO_BLK_F_GEOMETRY)
                  | ( 1 << VIRTIO_BLK_F_RO)
                  | ( 1 << VIRTIO_BLK_F_BLK_SIZE)
                  | ( 1 << VIRTIO_BLK_F_CONFIG_WCE)
-                 | ( 1 << VIRTIO_BLK_F_WCE));
+                 | ( 1 << VIRTIO_BLK_F_WCE)
+                 | ( 1 << VIRTIO_BLK_F_MQ));
 }
 
 hw_driver* blk::probe(hw_device* dev)
@@ -10,6 +10,12 @@
 #include "drivers/virtio.hh"
 #include "drivers/virtio-device.hh"
 #include <osv/bio.h>
+#include <osv/mutex.h>
+#include "arch.hh"
+#include <osv/aligned_new.hh>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace virtio {
 
@@ -28,6 +34,7 @@ public:
         VIRTIO_BLK_F_WCE        = 9,  /* Writeback mode enabled after reset */
         VIRTIO_BLK_F_TOPOLOGY   = 10, /* Topology information is available */
         VIRTIO_BLK_F_CONFIG_WCE = 11, /* Writeback mode available in config */
+        VIRTIO_BLK_F_MQ         = 12, /* Support more than one vq */
     };
 
     enum {
@@ -96,6 +103,10 @@ public:
 
             /* writeback mode (if VIRTIO_BLK_F_CONFIG_WCE) */
             u8 wce;
+            u8 unused;
+
+            /* number of vqs, only available when VIRTIO_BLK_F_MQ is set */
+            u16 num_queues;
     } __attribute__((packed));
 
     /* This is the first element of the read scatter-gather list. */
@@ -129,7 +140,7 @@ public:
 
     int make_request(struct bio*);
 
-    void req_done();
+    void req_done(unsigned qidx);
     int64_t size();
 
     void set_readonly() {_ro = true;}
@@ -149,15 +160,34 @@ private:
         struct bio* bio;
     };
 
+    // Each request queue is served by its own virtqueue and completion
+    // thread. With VIRTIO_BLK_F_MQ there is one per cpu (up to the number
+    // of queues offered by the device), so that submitters on different
+    // cpus do not contend on a single ring.
+    struct request_queue {
+        request_queue(vring* q) : queue(q) {}
+
+        vring* queue;
+        sched::thread* completion_thread = nullptr;
+        // Number of threads inside make_request() for this queue. Only the
+        // last one to add its buffer kicks the host, so a burst of requests
+        // results in a single notification.
+        std::atomic<unsigned> submitters {0};
+        // This mutex protects parallel make_request invocations
+        mutex lock;
+    } CACHELINE_ALIGNED;
+
+    request_queue& current_queue();
+    void wake_completion_threads();
+
     std::string _driver_name;
     blk_config _config;
+    std::vector<std::unique_ptr<request_queue, aligned_new_deleter<request_queue>>> _request_queues;
 
     //maintains the virtio instance number for multiple drives
     static int _instance;
     int _id;
     bool _ro;
-    // This mutex protects parallel make_request invocations
-    mutex _lock;
 };
 
 }
@@ -62,7 +62,8 @@ public:
 
     virtual void select_queue(int queue) = 0;
     virtual u16 get_queue_size() = 0;
-    virtual void setup_queue(vring *queue) = 0;
+    // Returns false if the device did not accept the queue
+    virtual bool setup_queue(vring *queue) = 0;
     virtual void activate_queue(int queue) = 0;
     virtual void kick_queue(int queue) = 0;
 
@@ -76,12 +77,17 @@ public:
     virtual void set_status(u8 status) = 0;
 
     virtual u8 read_config(u32 offset) = 0;
+    virtual void write_config(u32 offset, u8 val) = 0;
     virtual void dump_config() = 0;
 
     virtual bool get_shm(u8 id, mmioaddr_t &addr, u64 &length) = 0;
 
     virtual bool is_modern() = 0;
     virtual size_t get_vring_alignment() = 0;
+
+    // Number of interrupt vectors the queues can be spread over, one per
+    // queue, or 0 if all queues share a single interrupt
+    virtual unsigned get_queue_vectors() { return 0; }
 };
 
 }
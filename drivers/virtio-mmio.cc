@@ -67,7 +67,7 @@ u16 mmio_device::get_queue_size()
     return mmio_getl(_addr_mmio + VIRTIO_MMIO_QUEUE_NUM_MAX) & 0xffff;
 }
 
-void mmio_device::setup_queue(vring* queue)
+bool mmio_device::setup_queue(vring* queue)
 {
     // Set size
     mmio_setl(_addr_mmio + VIRTIO_MMIO_QUEUE_NUM, queue->size());
@@ -81,6 +81,7 @@ void mmio_device::setup_queue(vring* queue)
 
     mmio_setl(_addr_mmio + VIRTIO_MMIO_QUEUE_USED_LOW, (u32)queue->get_used_addr());
     mmio_setl(_addr_mmio + VIRTIO_MMIO_QUEUE_USED_HIGH, (u32)(queue->get_used_addr() >> 32));
+    return true;
 }
 
 void mmio_device::activate_queue(int queue)
@@ -101,6 +102,11 @@ u8 mmio_device::read_config(u32 offset)
     return mmio_getb(_addr_mmio + VIRTIO_MMIO_CONFIG + offset);
 }
 
+void mmio_device::write_config(u32 offset, u8 val)
+{
+    mmio_setb(_addr_mmio + VIRTIO_MMIO_CONFIG + offset, val);
+}
+
 void mmio_device::register_interrupt(interrupt_factory irq_factory)
 {
 #ifdef __aarch64__
@@ -119,7 +119,7 @@ public:
 
     virtual void select_queue(int queue);
     virtual u16 get_queue_size();
-    virtual void setup_queue(vring *queue);
+    virtual bool setup_queue(vring *queue);
     virtual void activate_queue(int queue);
     virtual void kick_queue(int queue);
 
@@ -130,6 +130,7 @@ public:
     virtual void set_status(u8 status);
 
     virtual u8 read_config(u32 offset);
+    virtual void write_config(u32 offset, u8 val);
 
     virtual void dump_config() {}
 
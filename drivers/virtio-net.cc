@@ -23,6 +23,7 @@
 #include <osv/debug.h>
 
 #include <osv/sched.hh>
+#include <osv/clock.hh>
 #include <osv/trace.hh>
 #include <osv/net_trace.hh>
 
@@ -54,7 +55,6 @@ TRACEPOINT(trace_virtio_net_tx_xmit_one_failed_to_post, "vring %p vec_sz %d",
 using namespace memory;
 
 // TODO list
-// irq thread affinity and tx affinity
 // tx zero copy
 // vlans?
 
@@ -88,6 +88,16 @@ static int if_ioctl(struct ifnet* ifp, u_long command, caddr_t data)
             net_d("if_down");
         }
         break;
+    case SIOCSIFCAP: {
+        net_d("SIOCSIFCAP");
+        auto ifr = reinterpret_cast<struct bsd_ifreq*>(data);
+        // Only the software receive coalescing can be switched at runtime.
+        // The Rx threads see the change on their next packet.
+        if ((ifr->ifr_reqcap ^ ifp->if_capenable) & IFCAP_LRO) {
+            ifp->if_capenable ^= IFCAP_LRO;
+        }
+        break;
+    }
     case SIOCADDMULTI:
         net_d("SIOCADDMULTI");
         break;
@@ -136,10 +146,10 @@ static int if_transmit(struct ifnet* ifp, struct mbuf* m_head)
 inline int net::xmit(struct mbuf* buff)
 {
     //
-    // We currently have only a single TX queue. Select a proper TXq here when
-    // we implement a multi-queue.
+    // Use the Tx queue of the current cpu so that the host steers the replies
+    // to the Rx queue polled on this cpu.
     //
-    return _txq.xmit(buff);
+    return _txqs[sched::cpu::current()->id % _active_pairs]->xmit(buff);
 }
 
 inline int net::txq::xmit(mbuf* buff)
@@ -186,33 +196,57 @@ static void if_getinfo(struct ifnet* ifp, struct if_data* out_data)
 
 void net::fill_stats(struct if_data* out_data) const
 {
-    // We currently support only a single Tx/Rx queue so no iteration so far
-    fill_qstats(_rxq, out_data);
-    fill_qstats(_txq, out_data);
+    assert(!out_data->ifi_oerrors && !out_data->ifi_obytes && !out_data->ifi_opackets);
+    out_data->ifi_ibh_wakeups = 0;
+    out_data->ifi_oworker_kicks = 0;
+    out_data->ifi_oworker_wakeups = 0;
+    out_data->ifi_oworker_packets = 0;
+    out_data->ifi_okicks = 0;
+    out_data->ifi_oqueue_is_full = 0;
+    out_data->ifi_ilro_merged = 0;
+    out_data->ifi_iwakeup_stats = {};
+    out_data->ifi_owakeup_stats = {};
+
+    for (auto& rxq : _rxqs) {
+        fill_qstats(*rxq, out_data);
+    }
+    for (auto& txq : _txqs) {
+        fill_qstats(*txq, out_data);
+    }
+}
+
+static void add_wakeup_stats(wakeup_stats& to, const wakeup_stats& from)
+{
+    to.packets_8   += from.packets_8;
+    to.packets_16  += from.packets_16;
+    to.packets_32  += from.packets_32;
+    to.packets_64  += from.packets_64;
+    to.packets_128 += from.packets_128;
+    to.packets_256 += from.packets_256;
 }
 
 void net::fill_qstats(const struct rxq& rxq, struct if_data* out_data) const
 {
-    out_data->ifi_ipackets   += rxq.stats.rx_packets;
-    out_data->ifi_ibytes     += rxq.stats.rx_bytes;
-    out_data->ifi_iqdrops    += rxq.stats.rx_drops;
-    out_data->ifi_ierrors    += rxq.stats.rx_csum_err;
-    out_data->ifi_ibh_wakeups = rxq.stats.rx_bh_wakeups;
-    out_data->ifi_iwakeup_stats = rxq.stats.rx_wakeup_stats;
+    out_data->ifi_ipackets    += rxq.stats.rx_packets;
+    out_data->ifi_ibytes      += rxq.stats.rx_bytes;
+    out_data->ifi_iqdrops     += rxq.stats.rx_drops;
+    out_data->ifi_ierrors     += rxq.stats.rx_csum_err;
+    out_data->ifi_ibh_wakeups += rxq.stats.rx_bh_wakeups;
+    out_data->ifi_ilro_merged += rxq.gro->merged();
+    add_wakeup_stats(out_data->ifi_iwakeup_stats, rxq.stats.rx_wakeup_stats);
 }
 
 void net::fill_qstats(const struct txq& txq, struct if_data* out_data) const
 {
-    assert(!out_data->ifi_oerrors && !out_data->ifi_obytes && !out_data->ifi_opackets);
-    out_data->ifi_opackets       += txq.stats.tx_packets;
-    out_data->ifi_obytes         += txq.stats.tx_bytes;
-    out_data->ifi_oerrors        += txq.stats.tx_err + txq.stats.tx_drops;
-    out_data->ifi_oworker_kicks   = txq.stats.tx_worker_kicks;
-    out_data->ifi_oworker_wakeups = txq.stats.tx_worker_wakeups;
-    out_data->ifi_oworker_packets = txq.stats.tx_worker_packets;
-    out_data->ifi_okicks          = txq.stats.tx_kicks;
-    out_data->ifi_oqueue_is_full  = txq.stats.tx_hw_queue_is_full;
-    out_data->ifi_owakeup_stats   = txq.stats.tx_wakeup_stats;
+    out_data->ifi_opackets        += txq.stats.tx_packets;
+    out_data->ifi_obytes          += txq.stats.tx_bytes;
+    out_data->ifi_oerrors         += txq.stats.tx_err + txq.stats.tx_drops;
+    out_data->ifi_oworker_kicks   += txq.stats.tx_worker_kicks;
+    out_data->ifi_oworker_wakeups += txq.stats.tx_worker_wakeups;
+    out_data->ifi_oworker_packets += txq.stats.tx_worker_packets;
+    out_data->ifi_okicks          += txq.stats.tx_kicks;
+    out_data->ifi_oqueue_is_full  += txq.stats.tx_hw_queue_is_full;
+    add_wakeup_stats(out_data->ifi_owakeup_stats, txq.stats.tx_wakeup_stats);
 }
 
 bool net::ack_irq()
@@ -220,36 +254,92 @@ bool net::ack_irq()
     auto isr = _dev.read_and_ack_isr();
 
     if (isr) {
-        _rxq.vqueue->disable_interrupts();
+        // Without MSI-X all queues share a single interrupt
+        for (auto& rxq : _rxqs) {
+            rxq->vqueue->disable_interrupts();
+        }
         return true;
     } else {
         return false;
     }
 }
 
+void net::wake_rx_threads()
+{
+    for (auto& rxq : _rxqs) {
+        rxq->poll_task->wake_with_irq_disabled();
+    }
+}
+
 void net::init()
 {
     // Steps 4, 5 & 6 - negotiate and confirm features
     setup_features();
     read_config();
 
-    // Step 7 - generic init of virtqueues
-    probe_virt_queues();
+    // Step 7 - init of virtqueues. Only set up the queue pairs we are going
+    // to use, and with multiqueue the control queue, which comes after all
+    // the pairs the device has. If the extra queues cannot be set up, fall
+    // back to the first queue pair, which the device uses until told
+    // otherwise.
+    if (_mq) {
+        _ctrl_vq = probe_virt_queue(2 * _config.max_virtqueue_pairs);
+        if (!_ctrl_vq) {
+            net_w("Failed to set up the control queue, using one queue pair");
+            _mq = false;
+        }
+    }
+    for (unsigned i = 0; i < 2 * nr_queue_pairs(); i++) {
+        if (!probe_virt_queue(i)) {
+            if (i < 2) {
+                abort("virtio-net: failed to set up queue %d\n", i);
+            }
+            net_w("Failed to set up queue %d, using one queue pair", i);
+            _mq = false;
+            break;
+        }
+    }
+}
+
+unsigned net::nr_queue_pairs() const
+{
+    if (!_mq) {
+        return 1;
+    }
+    unsigned pairs = std::min<unsigned>(_config.max_virtqueue_pairs, sched::cpus.size());
+    // With MSI-X each queue needs its own vector, and the control queue
+    // one more
+    auto vectors = _dev.get_queue_vectors();
+    if (vectors) {
+        pairs = std::min(pairs, (vectors - 1) / 2);
+    }
+    return std::max(pairs, 1u);
 }
 
 net::net(virtio_device& dev)
     : virtio_driver(dev),
-    _pre_init(this),
-    _rxq(get_virt_queue(0), [this] { this->receiver(); }),
-    _txq(this, get_virt_queue(1))
+    _pre_init(this)
 {
     _driver_name = "virtio-net";
     virtio_i("VIRTIO NET INSTANCE");
     _id = _instance++;
 
-    sched::thread* poll_task = _rxq.poll_task.get();
-
-    poll_task->set_priority(sched::thread::priority_infinity);
+    // Rx threads and the xmit path index these vectors, so they must not
+    // reallocate
+    unsigned nr_pairs = nr_queue_pairs();
+    _rxqs.reserve(nr_pairs);
+    _txqs.reserve(nr_pairs);
+    for (unsigned i = 0; i < nr_pairs; i++) {
+        auto attr = sched::thread::attr().name(nr_pairs > 1 ?
+                "virtio-net-rx" + std::to_string(i) : "virtio-net-rx");
+        if (nr_pairs > 1) {
+            attr.pin(sched::cpus[i]);
+        }
+        _rxqs.emplace_back(aligned_new<rxq>(get_virt_queue(2 * i),
+                                            [this, i] { this->receiver(i); }, attr));
+        _rxqs[i]->poll_task->set_priority(sched::thread::priority_infinity);
+        _txqs.emplace_back(aligned_new<txq>(this, get_virt_queue(2 * i + 1)));
+    }
 
     // Please look at the section 5.1.6.1 of virtio specification for explanation
     if (_dev.is_modern()) {
@@ -277,7 +367,7 @@ net::net(virtio_device& dev)
     _ifn->if_qflush = if_qflush;
     _ifn->if_init = if_init;
     _ifn->if_getinfo = if_getinfo;
-    IFQ_SET_MAXLEN(&_ifn->if_snd, _txq.vqueue->size());
+    IFQ_SET_MAXLEN(&_ifn->if_snd, _txqs[0]->vqueue->size());
 
     _ifn->if_capabilities = 0;
 
@@ -291,59 +381,128 @@ net::net(virtio_device& dev)
 
     if (_guest_csum) {
         _ifn->if_capabilities |= IFCAP_RXCSUM;
-        if (_guest_tso4)
-            _ifn->if_capabilities |= IFCAP_LRO;
     }
+    // Coalescing is done in software (see osv::rx_gro), on top of whatever
+    // the host already merged when VIRTIO_NET_F_GUEST_TSO4 was negotiated
+    _ifn->if_capabilities |= IFCAP_LRO;
 
     _ifn->if_capenable = _ifn->if_capabilities | IFCAP_HWSTATS;
 
-    //Start the polling thread before attaching it to the Rx interrupt
-    poll_task->start();
-    _txq.start();
+    //Start the polling threads before attaching them to the Rx interrupts
+    for (auto& rxq : _rxqs) {
+        rxq->gro.reset(new osv::rx_gro(_ifn));
+        rxq->poll_task->start();
+    }
+    for (auto& txq : _txqs) {
+        txq->start();
+    }
 
     ether_ifattach(_ifn, _config.mac);
 
     interrupt_factory int_factory;
 #if CONF_drivers_pci
-    int_factory.register_msi_bindings = [this,poll_task](interrupt_manager &msi) {
-       msi.easy_register({
-           { 0, [&] { this->_rxq.vqueue->disable_interrupts(); }, poll_task },
-           { 1, [&] { this->_txq.vqueue->disable_interrupts(); }, nullptr }
-       });
+    // The virtio PCI transport assigns MSI-X entry N to virtqueue N. The
+    // vector of each Rx queue follows its (pinned) poll thread.
+    int_factory.register_msi_bindings = [this](interrupt_manager &msi) {
+        std::vector<msix_binding> bindings;
+        for (unsigned i = 0; i < _rxqs.size(); i++) {
+            auto* rxq = _rxqs[i].get();
+            auto* txq = _txqs[i].get();
+            bindings.push_back({ 2 * i, [rxq] { rxq->vqueue->disable_interrupts(); },
+                                 rxq->poll_task.get() });
+            bindings.push_back({ 2 * i + 1, [txq] { txq->vqueue->disable_interrupts(); },
+                                 nullptr });
+        }
+        msi.easy_register(bindings);
     };
 
-    int_factory.create_pci_interrupt = [this,poll_task](pci::device &pci_dev) {
+    int_factory.create_pci_interrupt = [this](pci::device &pci_dev) {
         return new pci_interrupt(
             pci_dev,
             [=] { return this->ack_irq(); },
-            [=] { poll_task->wake_with_irq_disabled(); });
+            [=] { this->wake_rx_threads(); });
     };
 #endif
 
 #if CONF_drivers_mmio
 #ifdef __aarch64__
-    int_factory.create_spi_edge_interrupt = [this,poll_task]() {
+    int_factory.create_spi_edge_interrupt = [this]() {
         return new spi_interrupt(
             gic::irq_type::IRQ_TYPE_EDGE,
             _dev.get_irq(),
             [=] { return this->ack_irq(); },
-            [=] { poll_task->wake_with_irq_disabled(); });
+            [=] { this->wake_rx_threads(); });
     };
 #else
-    int_factory.create_gsi_edge_interrupt = [this,poll_task]() {
+    int_factory.create_gsi_edge_interrupt = [this]() {
         return new gsi_edge_interrupt(
             _dev.get_irq(),
-            [=] { if (this->ack_irq()) poll_task->wake_with_irq_disabled(); });
+            [=] { if (this->ack_irq()) this->wake_rx_threads(); });
     };
 #endif
 #endif
 
     _dev.register_interrupt(int_factory);
 
-    fill_rx_ring();
+    for (unsigned i = 0; i < _rxqs.size(); i++) {
+        fill_rx_ring(i);
+    }
 
     // Step 8
     add_dev_status(VIRTIO_CONFIG_S_DRIVER_OK);
+
+    // Until told otherwise the device only uses the first queue pair
+    if (_mq) {
+        _ctrl_vq->disable_interrupts();
+        net_ctrl_mq mq = { static_cast<u16>(nr_pairs) };
+        if (ctrl_cmd(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &mq, sizeof(mq))) {
+            _active_pairs = nr_pairs;
+            net_i("Using %d queue pairs", nr_pairs);
+        } else {
+            net_w("Failed to enable %d queue pairs, using one", nr_pairs);
+        }
+    }
+}
+
+bool net::ctrl_cmd(u8 class_t, u8 cmd, const void* data, u32 len)
+{
+    // The device accesses the command by its physical address, so it
+    // must not live on the (possibly not physically contiguous) stack.
+    auto size = sizeof(net_ctrl_hdr) + len + sizeof(net_ctrl_ack);
+    std::unique_ptr<u8[]> buf(new u8[size]);
+    auto hdr = reinterpret_cast<net_ctrl_hdr*>(buf.get());
+    auto ack = reinterpret_cast<net_ctrl_ack*>(buf.get() + size - sizeof(net_ctrl_ack));
+    hdr->class_t = class_t;
+    hdr->cmd = cmd;
+    memcpy(hdr + 1, data, len);
+    *ack = VIRTIO_NET_ERR;
+
+    vring* vq = _ctrl_vq;
+    vq->init_sg();
+    vq->add_out_sg(hdr, sizeof(*hdr));
+    vq->add_out_sg(hdr + 1, len);
+    vq->add_in_sg(ack, sizeof(*ack));
+    if (!vq->add_buf(buf.get())) {
+        return false;
+    }
+    vq->kick();
+
+    // Commands are rare (only sent during initialization), so just poll,
+    // but do not wait forever for a device that ignores the queue
+    auto deadline = osv::clock::uptime::now() + std::chrono::seconds(1);
+    u32 used;
+    while (!vq->get_buf_elem(&used)) {
+        if (osv::clock::uptime::now() >= deadline) {
+            net_w("Control command %d/%d timed out", class_t, cmd);
+            // The device still owns the buffer and may write the ack later
+            buf.release();
+            return false;
+        }
+        sched::thread::yield();
+    }
+    vq->get_buf_finalize();
+
+    return *ack == VIRTIO_NET_OK;
 }
 
 net::~net()
@@ -384,6 +543,18 @@ void net::read_config()
     _host_tso4 = get_guest_feature_bit(VIRTIO_NET_F_HOST_TSO4);
     _guest_ufo = get_guest_feature_bit(VIRTIO_NET_F_GUEST_UFO);
 
+    // Multiqueue needs the control queue to enable the extra queue pairs.
+    // That queue follows all the pairs, so it must be within the queues we
+    // can set up.
+    if (get_guest_feature_bit(VIRTIO_NET_F_MQ) && get_guest_feature_bit(VIRTIO_NET_F_CTRL_VQ)) {
+        virtio_conf_read(offsetof(net_config, max_virtqueue_pairs),
+                         &_config.max_virtqueue_pairs, sizeof(_config.max_virtqueue_pairs));
+        net_i("Device supports %d queue pairs", _config.max_virtqueue_pairs);
+        _mq = _config.max_virtqueue_pairs > 1 && sched::cpus.size() > 1 &&
+              2u * _config.max_virtqueue_pairs < max_virtqueues_nr;
+        _mq = _mq && nr_queue_pairs() > 1;
+    }
+
     net_i("Features: %s=%d,%s=%d", "Status", _status, "TSO_ECN", _tso_ecn);
     net_i("Features: %s=%d,%s=%d", "Host TSO ECN", _host_tso_ecn, "CSUM", _csum);
     net_i("Features: %s=%d,%s=%d", "Guest_csum", _guest_csum, "guest tso4", _guest_tso4);
@@ -459,9 +630,10 @@ bool net::bad_rx_csum(struct mbuf* m, struct net_hdr* hdr)
     return false;
 }
 
-void net::receiver()
+void net::receiver(unsigned qid)
 {
-    vring* vq = _rxq.vqueue;
+    auto& rxq = *_rxqs[qid];
+    vring* vq = rxq.vqueue;
     std::vector<iovec> packet;
     u64 rx_drops = 0, rx_packets = 0, csum_ok = 0;
     u64 csum_err = 0, rx_bytes = 0;
@@ -473,8 +645,8 @@ void net::receiver()
         virtio_driver::wait_for_queue(vq, &vring::used_ring_not_empty);
         trace_virtio_net_rx_wake();
 
-        _rxq.stats.rx_bh_wakeups++;
-        _rxq.update_wakeup_stats(rx_packets);
+        rxq.stats.rx_bh_wakeups++;
+        rxq.update_wakeup_stats(rx_packets);
 
         u32 len;
         int nbufs;
@@ -490,7 +662,7 @@ void net::receiver()
             vq->get_buf_finalize();
 
             if (vq->effective_avail_ring_count() >= refill_thresh)
-                fill_rx_ring();
+                fill_rx_ring(qid);
 
             // Bad packet/buffer - discard and continue to the next one
             if (len < _hdr_size + ETHER_HDR_LEN) {
@@ -534,15 +706,19 @@ void net::receiver()
                 else
                     csum_ok++;
 
+            } else if ((_ifn->if_capenable & IFCAP_RXCSUM) &&
+                       (mhdr->hdr.flags &
+                        net_hdr::VIRTIO_NET_HDR_F_DATA_VALID)) {
+                // The device has already validated the checksum
+                m_head->M_dat.MH.MH_pkthdr.csum_flags |= CSUM_DATA_VALID | CSUM_PSEUDO_HDR;
+                m_head->M_dat.MH.MH_pkthdr.csum_data = 0xFFFF;
+                csum_ok++;
             }
 
             rx_packets++;
             rx_bytes += m_head->M_dat.MH.MH_pkthdr.len;
 
-            bool fast_path = _ifn->if_classifier.post_packet(m_head);
-            if (!fast_path) {
-                (*_ifn->if_input)(_ifn, m_head);
-            }
+            rxq.gro->input(m_head);
 
             trace_virtio_net_rx_packet(_ifn->if_index, rx_bytes);
 
@@ -552,12 +728,15 @@ void net::receiver()
                 break;
         }
 
+        // Pass the segments coalesced in this batch up the stack
+        rxq.gro->flush();
+
         // Update the stats
-        _rxq.stats.rx_drops      += rx_drops;
-        _rxq.stats.rx_packets    += rx_packets;
-        _rxq.stats.rx_csum       += csum_ok;
-        _rxq.stats.rx_csum_err   += csum_err;
-        _rxq.stats.rx_bytes      += rx_bytes;
+        rxq.stats.rx_drops      += rx_drops;
+        rxq.stats.rx_packets    += rx_packets;
+        rxq.stats.rx_csum       += csum_ok;
+        rxq.stats.rx_csum_err   += csum_err;
+        rxq.stats.rx_bytes      += rx_bytes;
     }
 }
 
@@ -619,11 +798,11 @@ void net::do_free_large_buffer(void* buffer)
     memory::free_phys_contiguous_aligned(buffer);
 }
 
-void net::fill_rx_ring()
+void net::fill_rx_ring(unsigned qid)
 {
     trace_virtio_net_fill_rx_ring(_ifn->if_index);
     int added = 0;
-    vring* vq = _rxq.vqueue;
+    vring* vq = _rxqs[qid]->vqueue;
 
     int size_in_pages = _use_large_buffers ? LARGE_BUFFER_SIZE_IN_PAGES : 1;
     while (vq->avail_ring_not_empty()) {
@@ -918,6 +1097,8 @@ u64 net::get_driver_features()
                  | (1 << VIRTIO_NET_F_HOST_TSO4)  \
                  | (1 << VIRTIO_NET_F_GUEST_ECN)
                  | (1 << VIRTIO_NET_F_GUEST_UFO)
+                 | (1 << VIRTIO_NET_F_CTRL_VQ)
+                 | (1 << VIRTIO_NET_F_MQ)
             );
 }
 
@@ -14,6 +14,8 @@
 #include <bsd/sys/sys/mbuf.h>
 
 #include <osv/percpu_xmit.hh>
+#include <osv/aligned_new.hh>
+#include <osv/rx_gro.hh>
 #include <osv/contiguous_alloc.hh>
 
 #include "drivers/virtio.hh"
@@ -220,8 +222,8 @@ public:
 
     void wait_for_queue(vring* queue);
     bool bad_rx_csum(struct mbuf* m, struct net_hdr* hdr);
-    void receiver();
-    void fill_rx_ring();
+    void receiver(unsigned qid);
+    void fill_rx_ring(unsigned qid);
     mbuf* packet_to_mbuf(const std::vector<iovec>& iovec);
     static void free_buffer_and_refcnt(void* buffer, void* refcnt);
     static void free_large_buffer_and_refcnt(void* buffer, void* refcnt);
@@ -230,6 +232,7 @@ public:
     static void do_free_large_buffer(void* buffer);
 
     bool ack_irq();
+    void wake_rx_threads();
 
     static hw_driver* probe(hw_device* dev);
 
@@ -275,6 +278,11 @@ private:
     bool _host_tso4 = false;
     bool _guest_ufo = false;
     bool _use_large_buffers = false;
+    bool _mq = false;
+    // Number of queue pairs the device has been told to use
+    unsigned _active_pairs = 1;
+    // Set up by init(), so declared before _pre_init
+    vring* _ctrl_vq = nullptr;
 
     u32 _hdr_size;
 
@@ -314,17 +322,18 @@ private:
 
     /* Single Rx queue object */
     struct rxq {
-        rxq(vring* vq, std::function<void ()> poll_func)
-            : vqueue(vq), poll_task(sched::thread::make(poll_func, sched::thread::attr().
-                                    name("virtio-net-rx"))) {};
+        rxq(vring* vq, std::function<void ()> poll_func, sched::thread::attr attr)
+            : vqueue(vq), poll_task(sched::thread::make(poll_func, attr)) {};
         vring* vqueue;
         std::unique_ptr<sched::thread> poll_task;
+        // Created once the ifnet exists, before poll_task is started
+        std::unique_ptr<osv::rx_gro> gro;
         struct rxq_stats stats = { 0 };
 
         void update_wakeup_stats(const u64 wakeup_packets) {
             if_update_wakeup_stats(stats.rx_wakeup_stats, wakeup_packets);
         }
-    };
+    } CACHELINE_ALIGNED;
 
     /**
      * @class txq
@@ -487,6 +496,20 @@ private:
      */
     void fill_qstats(const struct txq& txq, struct if_data* out_data) const;
 
+    /**
+     * Send a command on the control virtqueue and wait for the device to
+     * process it.
+     * @param class_t command class (VIRTIO_NET_CTRL_*)
+     * @param cmd command within the class
+     * @param data command specific data
+     * @param len length of data
+     *
+     * @return true if the device has acknowledged the command in time
+     */
+    bool ctrl_cmd(u8 class_t, u8 cmd, const void* data, u32 len);
+
+    unsigned nr_queue_pairs() const;
+
     void free_buffer(void *buffer)
     {
         if (_use_large_buffers) {
@@ -496,9 +519,13 @@ private:
         }
     }
 
-    /* We currently support only a single Rx+Tx queue */
-    struct rxq _rxq;
-    struct txq _txq;
+    // One Rx+Tx queue pair per cpu when VIRTIO_NET_F_MQ is negotiated (up
+    // to max_virtqueue_pairs), otherwise a single pair. Queue pair i is
+    // made of virtqueues 2i (Rx) and 2i+1 (Tx); its Rx thread is pinned to
+    // cpu i and packets sent from cpu i go to its Tx queue, so a flow the
+    // host steers to queue i stays on cpu i.
+    std::vector<std::unique_ptr<rxq, aligned_new_deleter<rxq>>> _rxqs;
+    std::vector<std::unique_ptr<txq, aligned_new_deleter<txq>>> _txqs;
 
     //maintains the virtio instance number for multiple drives
     static int _instance;
@@ -62,20 +62,21 @@ void virtio_legacy_pci_device::kick_queue(int queue)
     virtio_conf_writew(VIRTIO_PCI_QUEUE_NOTIFY, queue);
 }
 
-void virtio_legacy_pci_device::setup_queue(vring *queue)
+bool virtio_legacy_pci_device::setup_queue(vring *queue)
 {
     if (_dev->is_msix()) {
         // Setup queue_id:entry_id 1:1 correlation...
         virtio_conf_writew(VIRTIO_MSI_QUEUE_VECTOR, queue->index());
         if (virtio_conf_readw(VIRTIO_MSI_QUEUE_VECTOR) != queue->index()) {
             virtio_e("Setting MSIx entry for queue %d failed.", queue->index());
-            return;
+            return false;
         }
     }
     // Tell host about pfn
     // TODO: Yak, this is a bug in the design, on large memory we'll have PFNs > 32 bit
     // Dor to notify Rusty
     virtio_conf_writel(VIRTIO_PCI_QUEUE_PFN, (u32)(queue->get_paddr() >> VIRTIO_PCI_QUEUE_ADDR_SHIFT));
+    return true;
 }
 
 void virtio_legacy_pci_device::select_queue(int queue)
@@ -119,6 +120,12 @@ u8 virtio_legacy_pci_device::read_config(u32 offset)
     return _bar1->readb(conf_start + offset);
 }
 
+void virtio_legacy_pci_device::write_config(u32 offset, u8 val)
+{
+    auto conf_start = _dev->is_msix_enabled()? 24 : 20;
+    _bar1->writeb(conf_start + offset, val);
+}
+
 u8 virtio_legacy_pci_device::read_and_ack_isr()
 {
     return virtio_conf_readb(VIRTIO_PCI_ISR);
@@ -170,7 +177,7 @@ void virtio_modern_pci_device::kick_queue(int queue)
     _notify_cfg->virtio_conf_writew(offset, queue);
 }
 
-void virtio_modern_pci_device::setup_queue(vring *queue)
+bool virtio_modern_pci_device::setup_queue(vring *queue)
 {
     auto queue_index = queue->index();
 
@@ -179,7 +186,7 @@ void virtio_modern_pci_device::setup_queue(vring *queue)
         _common_cfg->virtio_conf_writew(COMMON_CFG_OFFSET_OF(queue_msix_vector), queue_index);
         if (_common_cfg->virtio_conf_readw(COMMON_CFG_OFFSET_OF(queue_msix_vector)) != queue_index) {
             virtio_e("Setting MSIx entry for queue %d failed.", queue_index);
-            return;
+            return false;
         }
     }
 
@@ -197,6 +204,7 @@ void virtio_modern_pci_device::setup_queue(vring *queue)
 
     _common_cfg->virtio_conf_writel(COMMON_CFG_OFFSET_OF(queue_used_lo), (u32)queue->get_used_addr());
     _common_cfg->virtio_conf_writel(COMMON_CFG_OFFSET_OF(queue_used_hi), (u32)(queue->get_used_addr() >> 32));
+    return true;
 }
 
 void virtio_modern_pci_device::activate_queue(int queue)
@@ -249,6 +257,11 @@ u8 virtio_modern_pci_device::read_config(u32 offset)
     return _device_cfg->virtio_conf_readb(offset);
 }
 
+void virtio_modern_pci_device::write_config(u32 offset, u8 val)
+{
+    _device_cfg->virtio_conf_writeb(offset, val);
+}
+
 u8 virtio_modern_pci_device::read_and_ack_isr()
 {
     return _isr_cfg->virtio_conf_readb(0);
@@ -84,6 +84,7 @@ public:
 
     virtual unsigned get_irq() { return 0; }
     size_t get_vring_alignment() { return VIRTIO_PCI_VRING_ALIGN; }
+    virtual unsigned get_queue_vectors() { return _dev->is_msix() ? _dev->msix_get_num_entries() : 0; }
 
     pci::device *get_pci_device() { return _dev; }
 
@@ -105,7 +106,7 @@ public:
 
     virtual void select_queue(int queue);
     virtual u16 get_queue_size();
-    virtual void setup_queue(vring *queue);
+    virtual bool setup_queue(vring *queue);
     virtual void activate_queue(int queue) {}
     virtual void kick_queue(int queue);
 
@@ -116,6 +117,7 @@ public:
     virtual void set_status(u8 status);
 
     virtual u8 read_config(u32 offset);
+    virtual void write_config(u32 offset, u8 val);
     virtual u8 read_and_ack_isr();
 
     virtual bool is_modern() { return false; }
@@ -275,7 +277,7 @@ public:
 
     virtual void select_queue(int queue);
     virtual u16 get_queue_size();
-    virtual void setup_queue(vring *queue);
+    virtual bool setup_queue(vring *queue);
     virtual void activate_queue(int queue);
     virtual void kick_queue(int queue);
 
@@ -286,6 +288,7 @@ public:
     virtual void set_status(u8 status);
 
     virtual u8 read_config(u32 offset);
+    virtual void write_config(u32 offset, u8 val);
     virtual u8 read_and_ack_isr();
 
     virtual bool is_modern() { return true; };
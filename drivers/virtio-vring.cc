@@ -42,6 +42,14 @@ namespace virtio {
     {
         _driver = driver;
         _q_index = q_index;
+        _packed = driver->get_guest_feature_bit(VIRTIO_F_RING_PACKED);
+        if (_packed) {
+            _num = num;
+            init_packed();
+            return;
+        }
+        _packed_desc = nullptr;
+        _packed_bufs = nullptr;
         // Alloc enough pages for the vring...
         size_t alignment = driver->get_vring_alignment();
         size_t sz = VIRTIO_ALIGN(vring::get_size(num, alignment), alignment);
@@ -76,10 +84,53 @@ namespace virtio {
         _use_indirect = false;
     }
 
+    void vring::init_packed()
+    {
+        size_t sz = _num * sizeof(vring_packed_desc) + 2 * sizeof(vring_packed_event);
+        _vring_ptr = memory::alloc_phys_contiguous_aligned(sz, 4096);
+        memset(_vring_ptr, 0, sz);
+
+        _packed_desc = (vring_packed_desc*)_vring_ptr;
+        _driver_event = (vring_packed_event*)&_packed_desc[_num];
+        _device_event = _driver_event + 1;
+
+        _desc = nullptr;
+        _avail = nullptr;
+        _used = nullptr;
+        _avail_event = nullptr;
+        _used_event = nullptr;
+
+        _cookie = new void*[_num];
+        _packed_bufs = new packed_buf[_num];
+        for (unsigned i = 0; i < _num; i++) {
+            _packed_bufs[i]._next = i + 1;
+            _packed_bufs[i]._indirect = nullptr;
+        }
+        _free_head = 0;
+
+        // Both wrap counters start at 1 per the specification
+        _avail_head = 0;
+        _avail_wrap_counter = true;
+        _used_idx = 0;
+        _used_wrap_counter = true;
+        _last_used_id = 0;
+        _gc_idx = 0;
+
+        _used_ring_guest_head = 0;
+        _used_ring_host_head = 0;
+        _avail_added_since_kick = 0;
+        _avail_count = _num;
+
+        _sg_vec.reserve(max_sgs);
+
+        _use_indirect = false;
+    }
+
     vring::~vring()
     {
         memory::free_phys_contiguous_aligned(_vring_ptr);
         delete [] _cookie;
+        delete [] _packed_bufs;
     }
 
     u64 vring::get_paddr()
@@ -87,19 +138,22 @@ namespace virtio {
         return mmu::virt_to_phys(_vring_ptr);
     }
 
+    // For a packed virtqueue the transports pass the descriptor ring and
+    // the driver and device event suppression structures in place of the
+    // descriptor table, available and used rings.
     u64 vring::get_desc_addr()
     {
-        return mmu::virt_to_phys(_desc);
+        return mmu::virt_to_phys(_packed ? (void*)_packed_desc : (void*)_desc);
     }
 
     u64 vring::get_avail_addr()
     {
-        return mmu::virt_to_phys(_avail);
+        return mmu::virt_to_phys(_packed ? (void*)_driver_event : (void*)_avail);
     }
 
     u64 vring::get_used_addr()
     {
-        return mmu::virt_to_phys(_used);
+        return mmu::virt_to_phys(_packed ? (void*)_device_event : (void*)_used);
     }
 
     unsigned vring::get_size(unsigned int num, unsigned long align)
@@ -112,6 +166,11 @@ namespace virtio {
     void vring::disable_interrupts()
     {
         trace_virtio_disable_interrupts(this);
+        if (_packed) {
+            _driver_event->_flags.store(vring_packed_event::VRING_PACKED_EVENT_FLAG_DISABLE,
+                                        std::memory_order_relaxed);
+            return;
+        }
         _avail->disable_interrupt();
     }
 
@@ -130,6 +189,19 @@ namespace virtio {
     void vring::enable_interrupts()
     {
         trace_virtio_enable_interrupts(this);
+        if (_packed) {
+            if (_driver->get_event_idx_cap()) {
+                _driver_event->_off_wrap.store(_used_idx | (_used_wrap_counter << 15),
+                                               std::memory_order_relaxed);
+                _driver_event->_flags.store(vring_packed_event::VRING_PACKED_EVENT_FLAG_DESC,
+                                            std::memory_order_relaxed);
+            } else {
+                _driver_event->_flags.store(vring_packed_event::VRING_PACKED_EVENT_FLAG_ENABLE,
+                                            std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return;
+        }
         _avail->enable_interrupt();
         set_used_event(_used_ring_host_head, std::memory_order_relaxed);
         std::atomic_thread_fence(std::memory_order_seq_cst);
@@ -138,6 +210,10 @@ namespace virtio {
     bool
     vring::add_buf(void* cookie) {
 
+            if (_packed) {
+                return add_buf_packed(cookie);
+            }
+
             get_buf_gc();
 
             trace_virtio_add_buf(this, _q_index, _avail_count);
@@ -204,6 +280,11 @@ namespace virtio {
     void
     vring::get_buf_gc()
     {
+            if (_packed) {
+                get_buf_gc_packed();
+                return;
+            }
+
             vring_used_elem elem;
 
             trace_vring_get_buf_gc(this, _used_ring_guest_head,
@@ -240,6 +321,10 @@ namespace virtio {
     void*
     vring::get_buf_elem(u32* len)
     {
+            if (_packed) {
+                return get_buf_elem_packed(len);
+            }
+
             vring_used_elem elem;
             void* cookie = nullptr;
 
@@ -279,11 +364,15 @@ namespace virtio {
 
     bool vring::used_ring_not_empty() const
     {
+        if (_packed) {
+            return used_ring_not_empty_packed();
+        }
         return _used_ring_host_head != _used->_idx.load(std::memory_order_relaxed);
     }
 
     bool vring::used_ring_is_half_empty() const
     {
+        assert(!_packed);
         return _used->_idx.load(std::memory_order_relaxed) - _used_ring_host_head > (u16)(_num / 2);
     }
 
@@ -296,7 +385,9 @@ namespace virtio {
     vring::kick() {
         bool kicked = true;
 
-        if (_driver->get_event_idx_cap()) {
+        if (_packed) {
+            kicked = kick_needed_packed();
+        } else if (_driver->get_event_idx_cap()) {
 
             std::atomic_thread_fence(std::memory_order_seq_cst);
 
@@ -347,4 +438,195 @@ namespace virtio {
         }
     }
 
+    bool
+    vring::add_buf_packed(void* cookie)
+    {
+        get_buf_gc_packed();
+
+        trace_virtio_add_buf(this, _q_index, _avail_count);
+
+        int desc_needed = _sg_vec.size();
+        bool indirect = false;
+        if (use_indirect(desc_needed)) {
+            desc_needed = 1;
+            indirect = true;
+        }
+
+        if (_avail_count < desc_needed) {
+            //make sure the interrupts get there
+            kick();
+
+            return false;
+        }
+
+        vring_packed_desc* table = nullptr;
+        if (indirect) {
+            table = reinterpret_cast<vring_packed_desc*>(alloc_phys_contiguous_aligned(_sg_vec.size() * sizeof(vring_packed_desc), 16));
+            if (!table)
+                return false;
+            // Descriptors of an indirect table are implicitly chained
+            for (unsigned i = 0; i < _sg_vec.size(); i++) {
+                table[i]._paddr = _sg_vec[i]._paddr;
+                table[i]._len = _sg_vec[i]._len;
+                table[i]._id = 0;
+                table[i]._flags.store(_sg_vec[i]._flags, std::memory_order_relaxed);
+            }
+        }
+
+        u16 id = _free_head;
+        _free_head = _packed_bufs[id]._next;
+        _packed_bufs[id]._ndescs = desc_needed;
+        _packed_bufs[id]._indirect = table;
+        _cookie[id] = cookie;
+
+        // The flags of the first descriptor are written last, so that the
+        // device does not see a partially written chain
+        u16 head = _avail_head;
+        u16 head_flags = 0;
+        u16 idx = head;
+        for (int i = 0; i < desc_needed; i++) {
+            vring_packed_desc* descp = &_packed_desc[idx];
+            u16 flags = avail_flags_packed();
+            if (indirect) {
+                descp->_paddr = mmu::virt_to_phys(table);
+                descp->_len = _sg_vec.size() * sizeof(vring_packed_desc);
+                flags |= vring_desc::VRING_DESC_F_INDIRECT;
+            } else {
+                descp->_paddr = _sg_vec[i]._paddr;
+                descp->_len = _sg_vec[i]._len;
+                flags |= _sg_vec[i]._flags;
+                if (i + 1 < desc_needed) {
+                    flags |= vring_desc::VRING_DESC_F_NEXT;
+                }
+            }
+            descp->_id = id;
+            if (i == 0) {
+                head_flags = flags;
+            } else {
+                descp->_flags.store(flags, std::memory_order_relaxed);
+            }
+            if (++idx == _num) {
+                idx = 0;
+                _avail_wrap_counter = !_avail_wrap_counter;
+            }
+        }
+
+        // Unlike the split ring, kick() of a packed ring needs the number
+        // of descriptors rather than buffers added since the last kick
+        _avail_added_since_kick += desc_needed;
+        _avail_count -= desc_needed;
+        _avail_head = idx;
+
+        _packed_desc[head]._flags.store(head_flags, std::memory_order_release);
+
+        return true;
+    }
+
+    void
+    vring::get_buf_gc_packed()
+    {
+        trace_vring_get_buf_gc(this, _used_ring_guest_head,
+                               _used_ring_host_head);
+
+        // The device writes a single used descriptor per buffer, at the
+        // position of the buffer's first descriptor, and skips the rest of
+        // the buffer's descriptors. So walk the ring the same way the
+        // consumer did and return the descriptors and ids to the free pool.
+        while (_used_ring_guest_head != _used_ring_host_head) {
+            u16 id = _packed_desc[_gc_idx]._id;
+            packed_buf& buf = _packed_bufs[id];
+
+            if (buf._indirect) {
+                free_phys_contiguous_aligned(buf._indirect);
+                buf._indirect = nullptr;
+            }
+
+            _gc_idx += buf._ndescs;
+            if (_gc_idx >= _num) {
+                _gc_idx -= _num;
+            }
+            _avail_count += buf._ndescs;
+            buf._next = _free_head;
+            _free_head = id;
+            _used_ring_guest_head++;
+        }
+
+        trace_vring_get_buf_ret(this, _avail_count);
+    }
+
+    bool vring::used_ring_not_empty_packed() const
+    {
+        u16 flags = _packed_desc[_used_idx]._flags.load(std::memory_order_relaxed);
+        bool avail = flags & vring_packed_desc::VRING_PACKED_DESC_F_AVAIL;
+        bool used = flags & vring_packed_desc::VRING_PACKED_DESC_F_USED;
+        return avail == used && used == _used_wrap_counter;
+    }
+
+    void*
+    vring::get_buf_elem_packed(u32* len)
+    {
+        trace_vring_get_buf_elem(this, _used_ring_host_head, _used_idx);
+
+        if (!used_ring_not_empty_packed()) {
+            return nullptr;
+        }
+        // Pairs with the device's write barrier before it updates the flags
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        vring_packed_desc* descp = &_packed_desc[_used_idx];
+        _last_used_id = descp->_id;
+        *len = descp->_len;
+
+        void* cookie = _cookie[_last_used_id];
+        _cookie[_last_used_id] = nullptr;
+
+        return cookie;
+    }
+
+    void vring::advance_used_packed()
+    {
+        _used_idx += _packed_bufs[_last_used_id]._ndescs;
+        if (_used_idx >= _num) {
+            _used_idx -= _num;
+            _used_wrap_counter = !_used_wrap_counter;
+        }
+    }
+
+    void vring::update_driver_event_packed()
+    {
+        // only let the host know about our used position in case it was
+        // asked to interrupt us at a specific descriptor
+        if (_driver_event->_flags.load(std::memory_order_relaxed) ==
+                vring_packed_event::VRING_PACKED_EVENT_FLAG_DESC) {
+            trace_vring_update_used_event(this, _used_idx);
+            _driver_event->_off_wrap.store(_used_idx | (_used_wrap_counter << 15),
+                                           std::memory_order_release);
+        }
+    }
+
+    bool vring::kick_needed_packed()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        u16 flags = _device_event->_flags.load(std::memory_order_relaxed);
+        if (flags != vring_packed_event::VRING_PACKED_EVENT_FLAG_DESC) {
+            return flags != vring_packed_event::VRING_PACKED_EVENT_FLAG_DISABLE;
+        }
+
+        // Same as the split ring event index check, except that the event
+        // position may belong to the previous lap of the ring
+        u16 off_wrap = _device_event->_off_wrap.load(std::memory_order_relaxed);
+        u16 event_idx = off_wrap & ~(1 << 15);
+        if ((bool)(off_wrap >> 15) != _avail_wrap_counter) {
+            event_idx -= _num;
+        }
+        u16 new_idx = _avail_head;
+        u16 old_idx = new_idx - _avail_added_since_kick;
+        bool kicked = (u16)(new_idx - event_idx - 1) < (u16)(new_idx - old_idx);
+
+        trace_virtio_kicked_event_idx(this, kicked, _q_index,
+                new_idx, event_idx, _avail_added_since_kick);
+        return kicked;
+    }
+
 };
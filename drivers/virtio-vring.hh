@@ -119,6 +119,47 @@ class virtio_driver;
         //std::atomic<u16> avail_event;
     };
 
+    // Descriptor of a packed virtqueue. A packed ring is a single array of
+    // these, written by the driver when buffers are made available and
+    // overwritten by the device when they are used, in place of the
+    // descriptor table, available and used rings of a split virtqueue.
+    // The _flags field uses the vring_desc flags plus the two below.
+    class vring_packed_desc {
+    public:
+        enum flags {
+            // Set to the driver wrap counter when the descriptor is made
+            // available, and to the device wrap counter when it is used
+            VRING_PACKED_DESC_F_AVAIL=1 << 7,
+            // Set to the inverse of the driver wrap counter when the
+            // descriptor is made available, and to the device wrap counter
+            // when it is used
+            VRING_PACKED_DESC_F_USED=1 << 15
+        };
+
+        u64 _paddr;
+        u32 _len;
+        u16 _id;
+        std::atomic<u16> _flags;
+    };
+
+    // Event suppression structure of a packed virtqueue. The driver one
+    // tells the device when to send interrupts, the device one tells the
+    // driver when to kick.
+    class vring_packed_event {
+    public:
+        enum {
+            VRING_PACKED_EVENT_FLAG_ENABLE=0,
+            VRING_PACKED_EVENT_FLAG_DISABLE=1,
+            // Only notify when the descriptor at _off_wrap is reached,
+            // requires VIRTIO_RING_F_EVENT_IDX
+            VRING_PACKED_EVENT_FLAG_DESC=2
+        };
+
+        // Descriptor ring offset in bits 0-14, wrap counter in bit 15
+        std::atomic<u16> _off_wrap;
+        std::atomic<u16> _flags;
+    };
+
     class vring {
     public:
 
@@ -149,6 +190,9 @@ class virtio_driver;
          */
         __attribute__((always_inline)) inline // Necessary because of issue #1029
         void get_buf_finalize(bool update_host = true) {
+            if (_packed) {
+                advance_used_packed();
+            }
             _used_ring_host_head++;
 
             trace_vring_get_buf_finalize(this, _used_ring_host_head);
@@ -160,6 +204,10 @@ class virtio_driver;
 
         __attribute__((always_inline)) inline // Necessary because of issue #1029
         void update_used_event() {
+            if (_packed) {
+                update_driver_event_packed();
+                return;
+            }
             // only let the host know about our used idx in case irq are enabled
             if (_avail->interrupt_on()) {
                 trace_vring_update_used_event(this, _used_ring_host_head);
@@ -188,6 +236,7 @@ class virtio_driver;
         bool kick();
         // Total number of descriptors in ring
         int size() {return _num;}
+        bool is_packed() const {return _packed;}
 
         u16 index() {return _q_index; }
 
@@ -247,6 +296,22 @@ class virtio_driver;
 
     private:
 
+        // Packed virtqueue variants of the ring operations
+        void init_packed();
+        bool add_buf_packed(void* cookie);
+        void* get_buf_elem_packed(u32* len);
+        void get_buf_gc_packed();
+        void advance_used_packed();
+        void update_driver_event_packed();
+        bool kick_needed_packed();
+        bool used_ring_not_empty_packed() const;
+
+        u16 avail_flags_packed() const
+        {
+            return _avail_wrap_counter ? vring_packed_desc::VRING_PACKED_DESC_F_AVAIL :
+                                         vring_packed_desc::VRING_PACKED_DESC_F_USED;
+        }
+
         // Up pointer
         virtio_driver* _driver;
         u16 _q_index;
@@ -283,6 +348,30 @@ class virtio_driver;
         std::atomic<u16>* _used_event;
         // A flag set by driver to turn on/off indirect descriptor
         bool _use_indirect;
+
+        // Whether VIRTIO_F_RING_PACKED was negotiated, in which case the
+        // split ring pointers above are unused and _avail_head is the
+        // position of the next descriptor to make available
+        bool _packed;
+        vring_packed_desc* _packed_desc;
+        vring_packed_event* _driver_event;
+        vring_packed_event* _device_event;
+        bool _avail_wrap_counter;
+        // Position and wrap counter of the next used descriptor we expect
+        u16 _used_idx;
+        bool _used_wrap_counter;
+        // Buffer id returned by the last get_buf_elem()
+        u16 _last_used_id;
+        // Position of the next used descriptor to garbage collect
+        u16 _gc_idx;
+        // Per buffer id state, the ids of free buffers are linked by _next
+        struct packed_buf {
+            u16 _ndescs;
+            u16 _next;
+            vring_packed_desc* _indirect;
+        };
+        packed_buf* _packed_bufs;
+        u16 _free_head;
     };
 
 
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/drivers_config.h>
+#include <string.h>
+
+#include <osv/debug.h>
+#include <osv/interrupt.hh>
+#include <osv/msi.hh>
+#include <osv/sched.hh>
+#include <osv/trace.hh>
+
+#include "drivers/pci-device.hh"
+#include "drivers/virtio.hh"
+#include "drivers/virtio-vring.hh"
+#include "drivers/virtio-vsock.hh"
+
+#include <bsd/porting/netport.h>
+#include <bsd/sys/sys/param.h>
+#include <bsd/sys/sys/mbuf.h>
+
+TRACEPOINT(trace_virtio_vsock_rx, "op=%d, len=%d", int, u32);
+TRACEPOINT(trace_virtio_vsock_tx, "op=%d, len=%d", int, u32);
+TRACEPOINT(trace_virtio_vsock_tx_backlog, "backlog=%d", int);
+TRACEPOINT(trace_virtio_vsock_transport_reset, "cid=%d", u64);
+
+namespace virtio {
+
+#define vsock_tag "virtio-vsock"
+#define vsock_i(...)   tprintf_i(vsock_tag, __VA_ARGS__)
+
+bool vsock::ack_irq()
+{
+    return _dev.read_and_ack_isr();
+}
+
+vsock::vsock(virtio_device& dev)
+    : virtio_driver(dev)
+{
+    // Steps 4, 5 & 6 - negotiate and confirm features
+    setup_features();
+    virtio_conf_read(0, &_cid, sizeof(_cid));
+
+    // Step 7 - generic init of virtqueues
+    probe_virt_queues();
+    _rxq = get_virt_queue(VQ_RX);
+    _txq = get_virt_queue(VQ_TX);
+    _eventq = get_virt_queue(VQ_EVENT);
+
+    // A packet is a header followed by its payload, let a single descriptor
+    // hold a chain of mbufs of any length
+    _txq->set_use_indirect(true);
+
+    _rx_thread.reset(sched::thread::make([this] { this->receiver(); },
+        sched::thread::attr().name("virtio-vsock-rx")));
+    _tx_thread.reset(sched::thread::make([this] { this->transmitter(); },
+        sched::thread::attr().name("virtio-vsock-tx")));
+    auto rx = _rx_thread.get();
+    auto tx = _tx_thread.get();
+
+    interrupt_factory int_factory;
+#if CONF_drivers_pci
+    int_factory.register_msi_bindings = [this, rx, tx](interrupt_manager& msi) {
+        msi.easy_register({
+            {VQ_RX, [=] { this->_rxq->disable_interrupts(); }, rx},
+            {VQ_TX, [=] { this->_txq->disable_interrupts(); }, tx},
+            {VQ_EVENT, [=] { this->_eventq->disable_interrupts(); }, rx}
+        });
+    };
+
+    int_factory.create_pci_interrupt = [this, rx, tx](pci::device& pci_dev) {
+        return new pci_interrupt(
+            pci_dev,
+            [=] { return this->ack_irq(); },
+            [=] { rx->wake_with_irq_disabled(); tx->wake_with_irq_disabled(); });
+    };
+#endif
+
+#if CONF_drivers_mmio
+#ifdef __aarch64__
+    int_factory.create_spi_edge_interrupt = [this, rx, tx]() {
+        return new spi_interrupt(
+            gic::irq_type::IRQ_TYPE_EDGE,
+            _dev.get_irq(),
+            [=] { return this->ack_irq(); },
+            [=] { rx->wake_with_irq_disabled(); tx->wake_with_irq_disabled(); });
+    };
+#else
+    int_factory.create_gsi_edge_interrupt = [this, rx, tx]() {
+        return new gsi_edge_interrupt(
+            _dev.get_irq(),
+            [=] { if (this->ack_irq()) { rx->wake_with_irq_disabled(); tx->wake_with_irq_disabled(); } });
+    };
+#endif
+#endif
+
+    _dev.register_interrupt(int_factory);
+
+    fill_rx_ring();
+    for (auto& ev : _events) {
+        _idle_events[_nr_idle_events++] = &ev;
+    }
+    fill_event_ring();
+
+    // Step 8
+    add_dev_status(VIRTIO_CONFIG_S_DRIVER_OK);
+
+    _rx_thread->start();
+    _tx_thread->start();
+
+    vsock_i("Guest CID %d", _cid);
+    vsock_register_transport(this);
+}
+
+vsock::~vsock()
+{
+    // Like the other virtio drivers, this one is never unloaded
+}
+
+void vsock::fill_rx_ring()
+{
+    int added = 0;
+    while (_rxq->avail_ring_not_empty()) {
+        // Header and payload of the packet go to the same page sized
+        // cluster, which is then passed up without copying
+        auto m = m_getjcl(M_NOWAIT, MT_DATA, M_PKTHDR, MJUMPAGESIZE);
+        if (!m) {
+            break;
+        }
+        _rxq->init_sg();
+        _rxq->add_in_sg(m->m_hdr.mh_data, MJUMPAGESIZE);
+        if (!_rxq->add_buf(m)) {
+            m_freem(m);
+            break;
+        }
+        added++;
+    }
+    if (added) {
+        _rxq->kick();
+    }
+}
+
+// Hands the event buffers the device does not have back to it. Those that
+// cannot be added now are retried on the next call, so the device does not
+// lose them for good.
+void vsock::fill_event_ring()
+{
+    while (_nr_idle_events) {
+        auto ev = _idle_events[_nr_idle_events - 1];
+        _eventq->init_sg();
+        _eventq->add_in_sg(ev, sizeof(*ev));
+        if (!_eventq->add_buf(ev)) {
+            break;
+        }
+        _nr_idle_events--;
+    }
+    _eventq->kick();
+}
+
+// Returns true if the host reset the transport
+bool vsock::handle_events()
+{
+    bool reset = false;
+    u32 len;
+    while (auto ev = static_cast<vsock_event*>(_eventq->get_buf_elem(&len))) {
+        _eventq->get_buf_finalize();
+        if (len >= sizeof(*ev) && ev->id == VIRTIO_VSOCK_EVENT_TRANSPORT_RESET) {
+            reset = true;
+        }
+        _idle_events[_nr_idle_events++] = ev;
+    }
+    fill_event_ring();
+    return reset;
+}
+
+void vsock::receiver()
+{
+    static const u16 refill_thresh = 16;
+    for (;;) {
+        // Nothing completes on a ring without buffers, so nothing would wake
+        // us up to refill it. Keep retrying until memory is available again.
+        while (_rxq->effective_avail_ring_count() == _rxq->size()) {
+            sched::thread::sleep(std::chrono::milliseconds(10));
+            fill_rx_ring();
+        }
+        sched::thread::wait_until([this] {
+            if (_rxq->used_ring_not_empty() || _eventq->used_ring_not_empty()) {
+                return true;
+            }
+            // Check again after enabling interrupts, see wait_for_queue()
+            _rxq->enable_interrupts();
+            _eventq->enable_interrupts();
+            return _rxq->used_ring_not_empty() || _eventq->used_ring_not_empty();
+        });
+        _rxq->disable_interrupts();
+        _eventq->disable_interrupts();
+
+        if (handle_events()) {
+            // The guest may have a new CID now, e.g. after a migration
+            virtio_conf_read(0, &_cid, sizeof(_cid));
+            trace_virtio_vsock_transport_reset(_cid);
+            vsock_transport_reset();
+        }
+
+        u32 len;
+        while (auto m = static_cast<struct mbuf*>(_rxq->get_buf_elem(&len))) {
+            _rxq->get_buf_finalize();
+            // Keep the device supplied while a long burst is processed
+            if (_rxq->effective_avail_ring_count() >= refill_thresh) {
+                fill_rx_ring();
+            }
+            if (len < sizeof(virtio_vsock_hdr)) {
+                m_freem(m);
+                continue;
+            }
+            virtio_vsock_hdr hdr;
+            memcpy(&hdr, m->m_hdr.mh_data, sizeof(hdr));
+            hdr.len = std::min<u32>(hdr.len, len - sizeof(hdr));
+            trace_virtio_vsock_rx(hdr.op, hdr.len);
+            if (hdr.len) {
+                m->m_hdr.mh_len = m->M_dat.MH.MH_pkthdr.len = len;
+                m_adj(m, sizeof(hdr));
+            } else {
+                m_freem(m);
+                m = nullptr;
+            }
+            vsock_input(hdr, m);
+        }
+        fill_rx_ring();
+    }
+}
+
+void vsock::tx_gc()
+{
+    u32 len;
+    while (auto req = static_cast<tx_req*>(_txq->get_buf_elem(&len))) {
+        m_freem(req->m);
+        delete req;
+        _txq->get_buf_finalize();
+    }
+    _txq->get_buf_gc();
+}
+
+bool vsock::try_xmit(tx_req* req)
+{
+    _txq->init_sg();
+    _txq->add_out_sg(&req->hdr, sizeof(req->hdr));
+    for (auto m = req->m; m != nullptr; m = m->m_hdr.mh_next) {
+        if (m->m_hdr.mh_len) {
+            _txq->add_out_sg(m->m_hdr.mh_data, m->m_hdr.mh_len);
+        }
+    }
+    if (!_txq->add_buf(req)) {
+        if (!_txq->used_ring_not_empty()) {
+            return false;
+        }
+        tx_gc();
+        if (!_txq->avail_ring_has_room(_txq->_sg_vec.size()) || !_txq->add_buf(req)) {
+            return false;
+        }
+    }
+    trace_virtio_vsock_tx(req->hdr.op, req->hdr.len);
+    return true;
+}
+
+void vsock::send(const virtio_vsock_hdr& hdr, struct mbuf* m)
+{
+    auto req = new tx_req{hdr, m};
+    WITH_LOCK(_tx_lock) {
+        // Keep the order of the packets, the host expects it
+        if (!_tx_backlog.empty() || !try_xmit(req)) {
+            _tx_backlog.push_back(req);
+            trace_virtio_vsock_tx_backlog(_tx_backlog.size());
+            return;
+        }
+        _txq->kick();
+    }
+}
+
+void vsock::transmitter()
+{
+    for (;;) {
+        wait_for_queue(_txq, &vring::used_ring_not_empty);
+        WITH_LOCK(_tx_lock) {
+            tx_gc();
+            bool posted = false;
+            while (!_tx_backlog.empty() && try_xmit(_tx_backlog.front())) {
+                _tx_backlog.pop_front();
+                posted = true;
+            }
+            if (posted) {
+                _txq->kick();
+            }
+        }
+    }
+}
+
+u64 vsock::get_driver_features()
+{
+    auto base = virtio_driver::get_driver_features();
+    return base | ((u64)1 << VIRTIO_F_VERSION_1);
+}
+
+hw_driver* vsock::probe(hw_device* dev)
+{
+    return virtio::probe<vsock, VIRTIO_ID_VSOCK>(dev);
+}
+
+}
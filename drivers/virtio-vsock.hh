@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef VIRTIO_VSOCK_DRIVER_H
+#define VIRTIO_VSOCK_DRIVER_H
+
+#include <deque>
+#include <memory>
+
+#include <osv/mutex.h>
+#include <osv/sched.hh>
+
+#include "drivers/driver.hh"
+#include "drivers/virtio.hh"
+#include "drivers/virtio-device.hh"
+
+#include <bsd/sys/compat/linux/linux_vsock.h>
+
+namespace virtio {
+
+/**
+ * Host to guest sockets (AF_VSOCK) transport.
+ *
+ * The device has an Rx queue the host puts packets to, a Tx queue for the
+ * packets to the host and an event queue, on which the host tells the guest
+ * that all connections were reset, e.g. after a live migration. The
+ * connection state lives in the AF_VSOCK protocol (linux_vsock.cc), the
+ * driver only moves packets.
+ */
+class vsock : public virtio_driver, public vsock_transport {
+public:
+    enum {
+        VQ_RX = 0,
+        VQ_TX = 1,
+        VQ_EVENT = 2,
+    };
+
+    enum {
+        VIRTIO_VSOCK_EVENT_TRANSPORT_RESET = 0,
+    };
+
+    struct vsock_config {
+        u64 guest_cid;
+    } __attribute__((packed));
+
+    struct vsock_event {
+        u32 id;
+    } __attribute__((packed));
+
+    explicit vsock(virtio_device& dev);
+    virtual ~vsock();
+
+    virtual std::string get_name() const { return "virtio-vsock"; }
+
+    virtual uint64_t get_local_cid() override { return _cid; }
+    virtual void send(const virtio_vsock_hdr& hdr, struct mbuf* m) override;
+
+    static hw_driver* probe(hw_device* dev);
+
+protected:
+    virtual u64 get_driver_features();
+
+private:
+    struct tx_req {
+        virtio_vsock_hdr hdr;
+        struct mbuf* m;
+    };
+
+    bool ack_irq();
+    void receiver();
+    void transmitter();
+    void fill_rx_ring();
+    void fill_event_ring();
+    bool handle_events();
+    // Both expect _tx_lock to be held
+    bool try_xmit(tx_req* req);
+    void tx_gc();
+
+    static const int event_ring_size = 8;
+
+    vring* _rxq;
+    vring* _txq;
+    vring* _eventq;
+    u64 _cid;
+    vsock_event _events[event_ring_size];
+    // Event buffers not currently in the event ring
+    vsock_event* _idle_events[event_ring_size];
+    int _nr_idle_events = 0;
+    std::unique_ptr<sched::thread> _rx_thread;
+    std::unique_ptr<sched::thread> _tx_thread;
+    mutex _tx_lock;
+    // Packets waiting for room in the Tx ring
+    std::deque<tx_req*> _tx_backlog;
+};
+
+}
+
+#endif
@@ -56,8 +56,13 @@ void virtio_driver::setup_features()
 
     //notify the host about the features in used according
     //to the virtio spec
+    // The packed ring layout is only defined for version 1 devices
+    if (!(subset & ((u64)1 << VIRTIO_F_VERSION_1))) {
+        subset &= ~((u64)1 << VIRTIO_F_RING_PACKED);
+    }
+
     for (int i = 0; i < 64; i++)
-        if (subset & (1 << i))
+        if (subset & ((u64)1 << i))
             virtio_d("%s: found feature intersec of bit %d\n", __FUNCTION__,  i);
 
     if (subset & (1 << VIRTIO_RING_F_INDIRECT_DESC))
@@ -78,6 +83,22 @@ void virtio_driver::setup_features()
     }
 }
 
+u64 virtio_driver::get_driver_features()
+{
+    return (1 << VIRTIO_RING_F_INDIRECT_DESC | 1 << VIRTIO_RING_F_EVENT_IDX);
+}
+
+// The packed virtqueue layout touches fewer cache lines per request than the
+// split one but is only defined for version 1 devices. Drivers opt into it
+// once their use of the vring has been verified against the packed layout.
+u64 virtio_driver::get_packed_ring_features()
+{
+    if (!_dev.is_modern()) {
+        return 0;
+    }
+    return (u64)1 << VIRTIO_F_VERSION_1 | (u64)1 << VIRTIO_F_RING_PACKED;
+}
+
 void virtio_driver::dump_config()
 {
     _dev.dump_config();
@@ -87,7 +108,7 @@ void virtio_driver::dump_config()
     virtio_d("    virtio features: ");
 
     for (int i = 0; i < 64; i++) {
-        virtio_d(" %d ", 0 != (device_features & (1 << i)));
+        virtio_d(" %d ", 0 != (device_features & ((u64)1 << i)));
     }
 #endif
 }
@@ -115,34 +136,43 @@ bool virtio_driver::kick(int queue)
 
 void virtio_driver::probe_virt_queues()
 {
-    u16 qsize = 0;
-
-    do {
+    while (probe_virt_queue(_num_queues)) {
+    }
+}
 
-        if (_num_queues >= max_virtqueues_nr) {
-            return;
-        }
+vring* virtio_driver::probe_virt_queue(unsigned idx)
+{
+    if (idx >= max_virtqueues_nr) {
+        return nullptr;
+    }
+    if (_queues[idx]) {
+        return _queues[idx];
+    }
 
-        // Read queue size
-        _dev.select_queue(_num_queues);
-        qsize = _dev.get_queue_size();
-        if (0 == qsize) {
-            break;
-        }
+    // Read queue size
+    _dev.select_queue(idx);
+    u16 qsize = _dev.get_queue_size();
+    if (0 == qsize) {
+        return nullptr;
+    }
 
-        // Init a new queue
-        vring* queue = new vring(this, qsize, _num_queues);
-        _queues[_num_queues] = queue;
+    // Init a new queue
+    vring* queue = new vring(this, qsize, idx);
+    if (!_dev.setup_queue(queue)) {
+        delete queue;
+        return nullptr;
+    }
+    _queues[idx] = queue;
 
-        // Activate queue
-        _dev.setup_queue(queue);
-        _dev.activate_queue(_num_queues);
-        _num_queues++;
+    // Activate queue
+    _dev.activate_queue(idx);
+    _num_queues = std::max(_num_queues, idx + 1);
 
-        // Debug print
-        virtio_d("Queue[%d] -> size %d, paddr %x\n", (_num_queues-1), qsize, queue->get_paddr());
+    // Debug print
+    virtio_d("Queue[%d] -> size %d, paddr %x%s\n", idx, qsize, queue->get_paddr(),
+             queue->is_packed() ? ", packed" : "");
 
-    } while (true);
+    return queue;
 }
 
 vring* virtio_driver::get_virt_queue(unsigned idx)
@@ -191,7 +221,7 @@ void virtio_driver::set_guest_features(u64 features)
 
 bool virtio_driver::get_guest_feature_bit(int bit)
 {
-    return (_enabled_features & (1 << bit)) != 0;
+    return (_enabled_features & ((u64)1 << bit)) != 0;
 }
 
 u8 virtio_driver::get_dev_status()
@@ -216,4 +246,11 @@ void virtio_driver::virtio_conf_read(u32 offset, void* buf, int length)
         ptr[i] = _dev.read_config(offset + i);
 }
 
+void virtio_driver::virtio_conf_write(u32 offset, const void* buf, int length)
+{
+    auto ptr = reinterpret_cast<const unsigned char*>(buf);
+    for (int i = 0; i < length; i++)
+        _dev.write_config(offset + i, ptr[i]);
+}
+
 }
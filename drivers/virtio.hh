@@ -42,6 +42,8 @@ enum VIRTIO_CONFIG {
     VIRTIO_RING_F_EVENT_IDX = 29,
     /* Version bit that can be used to detect legacy vs modern devices */
     VIRTIO_F_VERSION_1 = 32,
+    /* Support for the packed virtqueue layout */
+    VIRTIO_F_RING_PACKED = 34,
     /* Do we get callbacks when the ring is completely used, even if we've
      * suppressed them? */
     VIRTIO_F_NOTIFY_ON_EMPTY = 24,
@@ -59,6 +61,7 @@ enum {
     VIRTIO_ID_SCSI    = 8,
     VIRTIO_ID_9P      = 9,
     VIRTIO_ID_RPROC_SERIAL = 11,
+    VIRTIO_ID_VSOCK   = 19,
     VIRTIO_ID_FS      = 26,
 };
 
@@ -74,6 +77,10 @@ public:
     virtual void dump_config();
 
     void probe_virt_queues();
+    // Set up a single virtqueue, for drivers which do not use all the
+    // queues a device offers. Returns nullptr if the device lacks it or
+    // cannot set it up.
+    vring* probe_virt_queue(unsigned idx);
     vring* get_virt_queue(unsigned idx);
 
     // block the calling thread until the queue has some used elements in it.
@@ -91,6 +98,7 @@ public:
 
     // Access virtio config space
     void virtio_conf_read(u32 offset, void* buf, int length);
+    void virtio_conf_write(u32 offset, const void* buf, int length);
 
     bool kick(int queue);
     void reset_device();
@@ -105,7 +113,9 @@ public:
 
 protected:
     // Actual drivers should implement this on top of the basic ring features
-    virtual u64 get_driver_features() { return 1 << VIRTIO_RING_F_INDIRECT_DESC | 1 << VIRTIO_RING_F_EVENT_IDX; }
+    virtual u64 get_driver_features();
+    // Version 1 and packed ring bits for drivers verified with that layout
+    u64 get_packed_ring_features();
     void setup_features();
 protected:
     virtio_device& _dev;
@@ -90,6 +90,16 @@ static int if_ioctl(struct ifnet *ifp, u_long command, caddr_t data)
             vmxnet3_d("if_down");
         }
         break;
+    case SIOCSIFCAP: {
+        vmxnet3_d("SIOCSIFCAP");
+        auto ifr = reinterpret_cast<struct bsd_ifreq*>(data);
+        // Only the software receive coalescing can be switched at runtime.
+        // The Rx threads see the change on their next packet.
+        if ((ifr->ifr_reqcap ^ ifp->if_capenable) & IFCAP_LRO) {
+            ifp->if_capenable ^= IFCAP_LRO;
+        }
+        break;
+    }
     case SIOCADDMULTI:
         vmxnet3_d("SIOCADDMULTI");
         break;
@@ -164,6 +174,7 @@ void vmxnet3::fill_stats(struct if_data* out_data) const
     out_data->ifi_ibytes   += _rxq[0].stats.rx_bytes;
     out_data->ifi_iqdrops  += _rxq[0].stats.rx_drops;
     out_data->ifi_ierrors  += _rxq[0].stats.rx_csum_err;
+    out_data->ifi_ilro_merged += _rxq[0].gro->merged();
     out_data->ifi_opackets += _txq[0].stats.tx_packets;
     out_data->ifi_obytes   += _txq[0].stats.tx_bytes;
     out_data->ifi_oerrors  += _txq[0].stats.tx_err + _txq[0].stats.tx_drops;
@@ -206,6 +217,7 @@ void vmxnet3_rxqueue::init(struct ifnet* ifn, pci::bar *bar0)
 {
     _ifn = ifn;
     _bar0 = bar0;
+    gro.reset(new osv::rx_gro(ifn));
     for (unsigned i = 0; i < VMXNET3_RXRINGS_PERQ; i++) {
         layout->cmd_ring[i] = _cmd_rings[i].get_desc_pa();
         layout->cmd_ring_len[i] = _cmd_rings[i].get_desc_num();
@@ -789,6 +801,9 @@ void vmxnet3_rxqueue::receive_work()
         do {
             receive();
         } while(available());
+
+        // Pass the segments coalesced in this batch up the stack
+        gro->flush();
     }
 }
 
@@ -924,10 +939,7 @@ void vmxnet3_rxqueue::input(vmxnet3_rx_compdesc *rxcd, struct mbuf *m)
         checksum(rxcd, m);
     stats.rx_packets++;
     stats.rx_bytes += m->M_dat.MH.MH_pkthdr.len;
-    bool fast_path = _ifn->if_classifier.post_packet(m);
-    if (!fast_path) {
-        (*_ifn->if_input)(_ifn, m);
-    }
+    gro->input(m);
 }
 
 void vmxnet3_rxqueue::enable_interrupt()
@@ -21,6 +21,7 @@
 #include <osv/interrupt.hh>
 #include <osv/msi.hh>
 #include <osv/percpu_xmit.hh>
+#include <osv/rx_gro.hh>
 
 namespace vmw {
 
@@ -236,6 +237,7 @@ public:
         wakeup_stats rx_wakeup_stats;
     } stats = { 0 };
     std::unique_ptr<sched::thread> task;
+    std::unique_ptr<osv::rx_gro> gro;
 
 private:
     void receive_work();
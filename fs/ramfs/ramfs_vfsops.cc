@@ -72,6 +72,7 @@ ramfs_mount(struct mount *mp, const char *dev, int flags, const void *data)
     if (np == NULL)
         return ENOMEM;
     mp->m_root->d_vnode->v_data = np;
+    mp->m_flags |= MNT_LOCAL;
     return 0;
 }
 
@@ -45,9 +45,16 @@
 // than 32K are loaded in full on first read. This simple read-around strategy
 // can achieve 80-90% cache hit ratio in many conducted measurements. Also it can
 // deliver 2-3 increase of read speed over non-cache mode at some cost of
-// too much unneeded data read (15-20%). Lastly the loaded data stays
-// in memory forever as there is no LRU logic implemented that could limit
-// memory used.
+// too much unneeded data read (15-20%). On top of that sequential reads make
+// the cache read the following segments ahead in the background. The loaded
+// data stays in memory until the memory runs low, when the least recently used
+// segments get freed.
+//
+// Optionally the file data can be stored compressed (see ROFS_VERSION_COMPRESSED
+// below). Each file is then split into chunks of the cache segment size that
+// are compressed independently with LZ4, and the cache decompresses a chunk
+// into its segment when the segment is loaded. Compressed images have to be
+// read through the cache, so they ignore '--disable_rofs_cache'.
 //
 // The structure of the data on disk is explained in scripts/gen-rofs-img.py
 
@@ -61,8 +68,16 @@
 #include <osv/buf.h>
 
 #define ROFS_VERSION            1
+// Images with compressed file data have their own version, so that kernels
+// which do not know how to decompress refuse to mount them
+#define ROFS_VERSION_COMPRESSED 2
 #define ROFS_MAGIC              0xDEADBEAD
 
+#define ROFS_COMPRESSION_NONE   0
+#define ROFS_COMPRESSION_LZ4    1
+// Size of the uncompressed chunks, the same as the size of a cache segment
+#define ROFS_CHUNK_SIZE         (32 * 1024)
+
 #define ROFS_INODE_SIZE ((uint64_t)sizeof(struct rofs_inode))
 
 #define ROFS_SUPERBLOCK_SIZE sizeof(struct rofs_super_block)
@@ -101,6 +116,9 @@ struct rofs_super_block {
     uint64_t directory_entries_count;
     uint64_t symlinks_count;
     uint64_t inodes_count;
+    // Only set in images of version ROFS_VERSION_COMPRESSED
+    uint64_t compression;
+    uint64_t chunk_size;
 };
 
 struct rofs_inode {
@@ -129,10 +147,11 @@ namespace rofs {
     int
     cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio);
     int
-    cache_get_page_address(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio, void **addr);
+    cache_map_page(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio);
 }
 
 int rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void* buf);
+int rofs_lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_len);
 void rofs_set_vnode(struct vnode* vnode, struct rofs_inode *inode);
 
 #endif
@@ -7,11 +7,18 @@
  */
 
 #include "rofs.hh"
-#include <list>
+#include <atomic>
+#include <deque>
 #include <unordered_map>
+#include <vector>
+#include <boost/intrusive/list.hpp>
 #include <include/osv/uio.h>
 #include <include/osv/contiguous_alloc.hh>
+#include <osv/align.hh>
+#include <osv/condvar.h>
 #include <osv/debug.h>
+#include <osv/mempool.hh>
+#include <osv/pagecache.hh>
 #include <osv/sched.hh>
 #include <sys/mman.h>
 
@@ -19,27 +26,86 @@
  * From cache perspective let us divide each file into sequence of contiguous 32K segments.
  * The files smaller or equal than 32K get loaded in one read, others get loaded
  * segment by segment.
+ *
+ * The segments of all files are kept in a hash table split into shards, each with its
+ * own lock and list of segments in least recently used order. When memory runs low
+ * the reclaimer calls the cache shrinker, which frees the least recently used segments
+ * nobody is reading from at the moment. Pages of segments mapped by the page cache
+ * are taken back from it first, unless they are pinned.
+ *
+ * Reads that continue where the previous read of the file ended make the cache read
+ * the following segments ahead of time, in the background. The number of segments
+ * read ahead doubles with every sequential read up to CACHE_READAHEAD_MAX_SEGMENTS.
  **/
 //
 //TODO These 2 values can be made configurable
 #define CACHE_SEGMENT_SIZE_IN_BLOCKS 64  // 32K
 #define CACHE_SEGMENT_INDEX(offset) (offset >> 15)
+#define CACHE_READAHEAD_MAX_SEGMENTS 8   // 256K
+#define CACHE_READAHEAD_MAX_QUEUED 64
+#define CACHE_SHARDS 16
+// The most segments the shrinker frees from one shard before moving on to the next
+#define CACHE_EVICT_BATCH 8
 
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
 extern std::atomic<long> rofs_block_allocated;
 extern std::atomic<long> rofs_cache_reads;
 extern std::atomic<long> rofs_cache_misses;
+extern std::atomic<long> rofs_cache_evictions;
+extern std::atomic<long> rofs_cache_readaheads;
+extern std::atomic<long> rofs_decompress_ms;
 #endif
 
 namespace rofs {
 //
-// This structure holds cache information and data of specific file
+// This structure holds cache information of specific file
 struct file_cache {
-    std::unordered_map<uint64_t, struct file_cache_segment *> segments_by_index;
     struct rofs_inode *inode;
     struct rofs_super_block *sb;
+    // Compressed images only: offsets of the file chunks relative to the
+    // beginning of the chunk index, plus the end of the last chunk
+    std::vector<uint64_t> chunk_offsets;
+    std::atomic<bool> chunk_offsets_ready { false };
+    mutex chunk_offsets_lock; // Serializes reading the chunk index from disk
+    // Sequential access detection: where the last read ended, how many segments
+    // to read ahead and the segment following the ones already read ahead
+    std::atomic<uint64_t> next_offset { 0 };
+    std::atomic<uint64_t> readahead_segments { 0 };
+    std::atomic<uint64_t> readahead_end { 0 };
 };
 
+static void *alloc_io_buffer(size_t size)
+{
+    return memory::alloc_phys_contiguous_aligned(align_up(size, mmu::page_size), mmu::page_size);
+}
+
+//
+// Read the chunk index of a file in a compressed image, which is stored on disk
+// in front of its chunks, unless some other thread has already done it
+static int load_chunk_index(struct file_cache *cache, struct device *device)
+{
+    if (cache->chunk_offsets_ready) {
+        return 0;
+    }
+    SCOPE_LOCK(cache->chunk_offsets_lock);
+    if (cache->chunk_offsets_ready) {
+        return 0;
+    }
+    auto block_size = cache->sb->block_size;
+    auto chunks = align_up(cache->inode->file_size, cache->sb->chunk_size) / cache->sb->chunk_size;
+    auto index_size = (chunks + 1) * sizeof(uint64_t);
+    auto blocks = align_up(index_size, block_size) / block_size;
+    void *buf = alloc_io_buffer(blocks * block_size);
+    auto error = rofs_read_blocks(device, cache->inode->data_offset, blocks, buf);
+    if (!error) {
+        auto offsets = static_cast<uint64_t *>(buf);
+        cache->chunk_offsets.assign(offsets, offsets + chunks + 1);
+        cache->chunk_offsets_ready = true;
+    }
+    memory::free_phys_contiguous_aligned(buf);
+    return error;
+}
+
 //
 // Structure used as a key in the global file cache.
 // The entries must be indexed using both inode_no and sb pointer, because
@@ -63,6 +129,25 @@ struct rofs_cache_key_hasher {
     }
 };
 
+//
+// Structure used as a key in the segment cache: the file and the index of
+// the segment in it
+struct segment_key {
+    struct file_cache *cache;
+    uint64_t index;
+
+    bool operator==(const segment_key& o) const {
+        return (cache == o.cache && index == o.index);
+    }
+};
+
+struct segment_key_hasher {
+    std::size_t operator()(const segment_key& k) const
+    {
+        return std::hash<uint64_t>()((uint64_t)k.cache) ^ (std::hash<uint64_t>()(k.index) << 1);
+    }
+};
+
 //
 // This structure holds block_count (typically CACHE_SEGMENT_SIZE_IN_BLOCKS) of 512 blocks
 // of file data starting at starting_block * 512 byte offset relative to the beginning
@@ -73,9 +158,18 @@ private:
     void *data;               // Copy of data on disk
     uint64_t starting_block;  // This is relative to the 512-block of the inode itself
     uint64_t block_count;     // Length of data in 512 blocks
-    bool data_ready;          // Has data been fully read from disk?
+    std::atomic<bool> data_ready; // Has data been fully read from disk?
+    mutex load_lock;          // Serializes reading data from disk
+    // Threads using the segment, which cannot be evicted while they do. New
+    // references are only taken under the lock of the segment's shard.
+    std::atomic<unsigned> refs { 0 };
+    // Set once the page cache got some of the pages of the segment to map
+    std::atomic<bool> mapped { false };
+    pagecache::hashkey mapped_key; // Key of the first page of the segment
 
 public:
+    boost::intrusive::list_member_hook<> lru_link;
+
     file_cache_segment(struct file_cache *_cache, uint64_t _starting_block, uint64_t _block_count) {
         this->cache = _cache;
         this->starting_block = _starting_block;
@@ -103,6 +197,14 @@ public:
         }
     }
 
+    struct file_cache *file() {
+        return this->cache;
+    }
+
+    uint64_t index() {
+        return this->starting_block / CACHE_SEGMENT_SIZE_IN_BLOCKS;
+    }
+
     uint64_t length() {
         return this->block_count * this->cache->sb->block_size;
     }
@@ -115,6 +217,36 @@ public:
         return this->data_ready;
     }
 
+    void get() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void put() {
+        refs.fetch_sub(1, std::memory_order_release);
+    }
+
+    //
+    // Hand the page at offset over to the page cache, to be mapped by key
+    void map_page(pagecache::hashkey *key, uint64_t offset_in_segment) {
+        if (!mapped) {
+            mapped_key = *key;
+            mapped_key.offset -= offset_in_segment;
+            mapped = true;
+        }
+        pagecache::map_read_cached_page(key, memory_address(offset_in_segment));
+    }
+
+    //
+    // Called under the shard lock by the shrinker, which may free the segment
+    // if it returns true
+    bool evictable() {
+        if (refs.load(std::memory_order_acquire)) {
+            return false;
+        }
+        return !mapped || pagecache::drop_read_cached_pages(mapped_key,
+            align_up(length(), mmu::page_size) / mmu::page_size);
+    }
+
     //
     // Read data from memory per uio
     int read(struct uio *uio, uint64_t offset_in_segment, uint64_t bytes_to_read) {
@@ -137,35 +269,172 @@ public:
         print("[rofs] [%d] -> file_cache_segment::read_from_disk() i-node: %d, starting block %d, reading [%d] blocks at disk offset [%d]\n",
               sched::thread::current()->id(), cache->inode->inode_no, starting_block, block_count_to_read, block);
         auto error = rofs_read_blocks(device, block, block_count_to_read, data);
-        this->data_ready = (error == 0);
         if (error) {
             printf("!!!!! Error reading from disk\n");
         } else {
             if (bytes_remaining < this->length()) {
                 memset(data + bytes_remaining, 0, this->length() - bytes_remaining);
             }
+            // Publish only fully initialized data to readers not holding load_lock
+            this->data_ready = true;
+        }
+        return error;
+    }
+
+    //
+    // Read the chunk of a compressed file this segment holds from disk and
+    // decompress it into memory. Chunks that did not compress are stored as is.
+    int read_compressed_from_disk(struct device *device) {
+        auto error = load_chunk_index(cache, device);
+        if (error) {
+            return error;
+        }
+        auto block_size = cache->sb->block_size;
+        auto chunk = starting_block / CACHE_SEGMENT_SIZE_IN_BLOCKS;
+        auto chunk_start = cache->chunk_offsets[chunk];
+        auto chunk_stored = cache->chunk_offsets[chunk + 1] - chunk_start;
+        auto bytes_remaining = cache->inode->file_size - starting_block * block_size;
+        auto chunk_size = std::min(this->length(), bytes_remaining);
+        if (chunk_stored > chunk_size) {
+            return EIO;
+        }
+        auto offset_in_block = chunk_start % block_size;
+        auto block_count_to_read = align_up(offset_in_block + chunk_stored, block_size) / block_size;
+        auto block = cache->inode->data_offset + chunk_start / block_size;
+        print("[rofs] [%d] -> file_cache_segment::read_compressed_from_disk() i-node: %d, chunk %d, reading [%d] blocks at disk offset [%d]\n",
+              sched::thread::current()->id(), cache->inode->inode_no, chunk, block_count_to_read, block);
+        void *buf = alloc_io_buffer(block_count_to_read * block_size);
+        error = rofs_read_blocks(device, block, block_count_to_read, buf);
+        if (!error) {
+            ROFS_STOPWATCH_START
+            auto stored = static_cast<char *>(buf) + offset_in_block;
+            if (chunk_stored == chunk_size) {
+                memcpy(data, stored, chunk_size);
+            } else if (rofs_lz4_decompress(stored, chunk_stored, data, chunk_size) != (int) chunk_size) {
+                printf("!!!!! Error decompressing chunk %ld of i-node %ld\n", chunk, cache->inode->inode_no);
+                error = EIO;
+            }
+            ROFS_STOPWATCH_END(rofs_decompress_ms)
+        } else {
+            printf("!!!!! Error reading from disk\n");
+        }
+        memory::free_phys_contiguous_aligned(buf);
+        if (!error) {
+            if (chunk_size < this->length()) {
+                memset(data + chunk_size, 0, this->length() - chunk_size);
+            }
+            this->data_ready = true;
         }
         return error;
     }
+
+    //
+    // Read segment data from disk unless some other thread has already done it
+    // while we were waiting for the load lock
+    int load(struct device *device, bool readahead = false) {
+        if (data_ready) {
+            return 0;
+        }
+        SCOPE_LOCK(load_lock);
+        if (data_ready) {
+            return 0;
+        }
+#if defined(ROFS_DIAGNOSTICS_ENABLED)
+        if (readahead) {
+            rofs_cache_readaheads += 1;
+        } else {
+            rofs_cache_misses += 1;
+        }
+#endif
+        if (cache->sb->compression != ROFS_COMPRESSION_NONE) {
+            return read_compressed_from_disk(device);
+        }
+        return read_from_disk(device);
+    }
 };
 
-static std::unordered_map<rofs_cache_key, struct file_cache *, rofs_cache_key_hasher> global_file_cache;
-static mutex file_cache_lock;
+typedef boost::intrusive::list<file_cache_segment,
+    boost::intrusive::member_hook<file_cache_segment,
+                                  boost::intrusive::list_member_hook<>,
+                                  &file_cache_segment::lru_link>,
+    boost::intrusive::constant_time_size<false>> segment_lru;
+
+struct file_cache_shard {
+    mutex lock; // Protects files
+    std::unordered_map<rofs_cache_key, struct file_cache *, rofs_cache_key_hasher> files;
+} CACHELINE_ALIGNED;
+
+struct segment_cache_shard {
+    mutex lock; // Protects segments and lru
+    std::unordered_map<segment_key, file_cache_segment *, segment_key_hasher> segments;
+    segment_lru lru; // Least recently used segments first
+} CACHELINE_ALIGNED;
+
+static file_cache_shard file_shards[CACHE_SHARDS];
+static segment_cache_shard segment_shards[CACHE_SHARDS];
+
+static segment_cache_shard& segment_shard(const segment_key& key)
+{
+    return segment_shards[segment_key_hasher()(key) % CACHE_SHARDS];
+}
+
+//
+// Frees up to n bytes of memory held by the least recently used segments
+static size_t evict_segments(size_t n)
+{
+    static unsigned next_shard; // Only used by the reclaimer thread
+    size_t freed = 0;
+    // Stop after going over all shards without freeing anything
+    for (unsigned idle = 0; idle < CACHE_SHARDS && freed < n; ) {
+        auto& shard = segment_shards[next_shard++ % CACHE_SHARDS];
+        unsigned evicted = 0;
+        // The reclaimer must not wait for a thread holding the lock while it
+        // allocates memory
+        if (shard.lock.try_lock()) {
+            SCOPE_ADOPT_LOCK(shard.lock);
+            for (auto it = shard.lru.begin(); it != shard.lru.end() && evicted < CACHE_EVICT_BATCH && freed < n; ) {
+                auto& segment = *it++;
+                if (!segment.evictable()) {
+                    continue;
+                }
+                shard.lru.erase(shard.lru.iterator_to(segment));
+                shard.segments.erase(segment_key{segment.file(), segment.index()});
+                freed += segment.length();
+                evicted++;
+                delete &segment;
+            }
+        }
+#if defined(ROFS_DIAGNOSTICS_ENABLED)
+        rofs_cache_evictions += evicted;
+#endif
+        idle = evicted ? 0 : idle + 1;
+    }
+    return freed;
+}
+
+class cache_shrinker : public memory::shrinker {
+public:
+    cache_shrinker() : shrinker("rofs_cache") {}
+    size_t request_memory(size_t n, bool hard) { return evict_segments(n); }
+};
 
 static struct file_cache *get_or_create_file_cache(struct rofs_inode *inode, struct rofs_super_block *sb) {
+    // Register the shrinker once the cache starts holding memory
+    static cache_shrinker *shrinker __attribute__((unused)) = new cache_shrinker();
+
     struct rofs_cache_key key = {
         .inode_no = inode->inode_no,
         .sb = sb
     };
 
-    // This is the only global mutex
-    WITH_LOCK(file_cache_lock) {
-        auto cache_entry = global_file_cache.find(key);
-        if (cache_entry == global_file_cache.end()) {
+    auto& shard = file_shards[rofs_cache_key_hasher()(key) % CACHE_SHARDS];
+    WITH_LOCK(shard.lock) {
+        auto cache_entry = shard.files.find(key);
+        if (cache_entry == shard.files.end()) {
             struct file_cache *new_cache = new file_cache();
             new_cache->inode = inode;
             new_cache->sb = sb;
-            global_file_cache.emplace(key, new_cache);
+            shard.files.emplace(key, new_cache);
             return new_cache;
         } else {
             return cache_entry->second;
@@ -173,147 +442,176 @@ static struct file_cache *get_or_create_file_cache(struct rofs_inode *inode, str
     }
 }
 
-enum CacheTransactionType {
-    READ_FROM_MEMORY = 1,
-    READ_FROM_DISK
-};
-
-// This represents an operation/transaction to read data from segment memory or/and from disk
-struct cache_segment_transaction {
-    struct file_cache_segment *segment;
-    CacheTransactionType transaction_type;
-    uint64_t segment_offset;
-    uint64_t bytes_to_read;
-
-    cache_segment_transaction(file_cache_segment *_segment, uint64_t file_offset, uint64_t _bytes_to_read) {
-        this->segment = _segment;
-        if (_segment->is_data_ready()) {
-            this->transaction_type = CacheTransactionType::READ_FROM_MEMORY;
-        } else {
-            this->transaction_type = CacheTransactionType::READ_FROM_DISK;
+//
+// Find the segment of the file with given index or create a new one (without data),
+// and take a reference to it, which the caller has to drop with put() when done
+static file_cache_segment *get_segment(struct file_cache *cache, uint64_t index)
+{
+    segment_key key{cache, index};
+    auto& shard = segment_shard(key);
+    WITH_LOCK(shard.lock) {
+        auto it = shard.segments.find(key);
+        if (it != shard.segments.end()) {
+            auto segment = it->second;
+            shard.lru.erase(shard.lru.iterator_to(*segment));
+            shard.lru.push_back(*segment);
+            segment->get();
+            return segment;
         }
-        this->segment_offset = file_offset % segment->length();
-        this->bytes_to_read = std::min(segment->length() - segment_offset, _bytes_to_read);
     }
-};
-
-//
-// This function analyzes uio against existing segments in file_cache
-// and builds a vector of transactions/operation that is used by cache_read to tell it
-// to either read data from memory in cache segment or read data from disk into
-// new segment
-static std::vector<struct cache_segment_transaction>
-plan_cache_transactions(struct file_cache *cache, struct uio *uio) {
-
-    std::vector<struct cache_segment_transaction> transactions;
     //
-    // Check if file is small enough to fit into cache segment
-    if (cache->segments_by_index.empty() &&
-        cache->inode->file_size <= (CACHE_SEGMENT_SIZE_IN_BLOCKS * cache->sb->block_size)) {
-        auto block_count = cache->inode->file_size / cache->sb->block_size;
-        if (cache->inode->file_size % cache->sb->block_size > 0) {
-            block_count++;
+    // Allocate the segment without holding the shard lock, which the shrinker
+    // may need to free memory. Files small enough to fit into a cache segment
+    // get a segment of their own size.
+    auto block_size = cache->sb->block_size;
+    uint64_t block_count = CACHE_SEGMENT_SIZE_IN_BLOCKS;
+    if (cache->inode->file_size <= CACHE_SEGMENT_SIZE_IN_BLOCKS * block_size) {
+        block_count = align_up(cache->inode->file_size, block_size) / block_size;
+    }
+    auto new_segment = new file_cache_segment(cache, index * CACHE_SEGMENT_SIZE_IN_BLOCKS, block_count);
+    file_cache_segment *segment;
+    WITH_LOCK(shard.lock) {
+        auto inserted = shard.segments.emplace(key, new_segment);
+        segment = inserted.first->second;
+        if (!inserted.second) {
+            shard.lru.erase(shard.lru.iterator_to(*segment));
         }
-        auto new_cache_segment = new file_cache_segment(cache, 0, block_count);
-        cache->segments_by_index.emplace(0, new_cache_segment);
-        uint64_t read_amt = std::min<uint64_t>(cache->inode->file_size - uio->uio_offset, uio->uio_resid);
-        transactions.push_back(cache_segment_transaction(new_cache_segment, uio->uio_offset, read_amt));
-        print("[rofs] [%d] -> rofs_cache_get_segment_operations i-node: %d, read FULL file of %d bytes\n",
-              sched::thread::current()->id(), cache->inode->inode_no, uio->uio_resid);
-        return transactions;
+        shard.lru.push_back(*segment);
+        segment->get();
     }
     //
-    // File is larger than cache segment or previous attempt to read from disk failed
-    uint64_t file_offset = uio->uio_offset;
-    uint64_t bytes_to_read = std::min<uint64_t>(cache->inode->file_size - uio->uio_offset, uio->uio_resid);
-    while (bytes_to_read > 0) {
-        //
-        // Next try to see if any cache segment is hit
-        auto cache_segment_index = CACHE_SEGMENT_INDEX(file_offset);
-        auto cache_segment = cache->segments_by_index.find(cache_segment_index);
-        if (cache_segment != cache->segments_by_index.end()) {
-            print("[rofs] [%d] -> rofs_cache_get_segment_operations i-node: %d, cache segment %d HIT at file offset %d\n",
-                  sched::thread::current()->id(), cache->inode->inode_no, cache_segment_index, file_offset);
-
-            auto transaction = cache_segment_transaction(cache_segment->second, file_offset, bytes_to_read);
-            file_offset += transaction.bytes_to_read;
-            bytes_to_read -= transaction.bytes_to_read;
-            transactions.push_back(transaction);
+    // Some other thread created the segment in the meantime
+    if (segment != new_segment) {
+        delete new_segment;
+    }
+    return segment;
+}
+
+struct readahead_request {
+    file_cache_segment *segment;
+    struct device *device;
+};
+
+static mutex readahead_lock; // Protects readahead_queue
+static condvar readahead_cond;
+static std::deque<readahead_request> readahead_queue;
+static sched::thread *readahead_thread;
+
+static void readahead_worker()
+{
+    while (true) {
+        readahead_request request;
+        WITH_LOCK(readahead_lock) {
+            while (readahead_queue.empty()) {
+                readahead_cond.wait(readahead_lock);
+            }
+            request = readahead_queue.front();
+            readahead_queue.pop_front();
         }
-        //
-        // Miss -> read from disk
-        else {
-            print("[rofs] [%d] -> rofs_cache_get_segment_operations i-node: %d, cache segment %d MISS at file offset %d\n",
-                  sched::thread::current()->id(), cache->inode->inode_no, cache_segment_index, file_offset);
-            uint64_t segment_starting_block = cache_segment_index * CACHE_SEGMENT_SIZE_IN_BLOCKS;
-            //
-            // Allocate new cache segment
-            auto new_cache_segment = new file_cache_segment(cache, segment_starting_block,
-                                                            CACHE_SEGMENT_SIZE_IN_BLOCKS);
-            cache->segments_by_index.emplace(cache_segment_index, new_cache_segment);
-
-            auto transaction = cache_segment_transaction(new_cache_segment, file_offset, bytes_to_read);
-            file_offset += transaction.bytes_to_read;;
-            bytes_to_read -= transaction.bytes_to_read;
-            transactions.push_back(transaction);
+        request.segment->load(request.device, true);
+        request.segment->put();
+    }
+}
+
+//
+// Queue the segment to be loaded by the readahead thread, which drops the reference
+// the caller took
+static void queue_readahead(file_cache_segment *segment, struct device *device)
+{
+    WITH_LOCK(readahead_lock) {
+        if (readahead_queue.size() < CACHE_READAHEAD_MAX_QUEUED) {
+            if (!readahead_thread) {
+                readahead_thread = sched::thread::make(readahead_worker,
+                    sched::thread::attr().name("rofs-readahead"));
+                readahead_thread->start();
+            }
+            readahead_queue.push_back(readahead_request{segment, device});
+            readahead_cond.wake_one();
+            return;
         }
     }
+    segment->put();
+}
 
-    return transactions;
+//
+// Detect sequential reads of the file and read the segments following the range
+// of the current read ahead of time
+static void read_ahead(struct file_cache *cache, struct device *device, uint64_t offset, uint64_t bytes)
+{
+    auto previous_end = cache->next_offset.exchange(offset + bytes);
+    if (offset != previous_end || offset == 0) {
+        // A new sequence starts, e.g. the file is read again from the start
+        cache->readahead_segments = 0;
+        cache->readahead_end = 0;
+        return;
+    }
+    // Read ahead only as long as it does not make the reclaimer run
+    auto headroom = 2 * (memory::stats::total() - memory::stats::max_no_reclaim());
+    if (memory::stats::free() < headroom) {
+        return;
+    }
+    auto segments = std::min<uint64_t>(std::max<uint64_t>(cache->readahead_segments * 2, 1),
+                                       CACHE_READAHEAD_MAX_SEGMENTS);
+    cache->readahead_segments = segments;
+
+    auto next = CACHE_SEGMENT_INDEX(offset + bytes - 1) + 1;
+    auto end = std::min(next + segments, CACHE_SEGMENT_INDEX(cache->inode->file_size - 1) + 1);
+    // Skip what was read ahead already, but never start behind this read
+    auto start = std::max(next, cache->readahead_end.load());
+    if (start >= end) {
+        return;
+    }
+    cache->readahead_end = end;
+    for (auto index = start; index < end; index++) {
+        auto segment = get_segment(cache, index);
+        if (segment->is_data_ready()) {
+            segment->put();
+        } else {
+            queue_readahead(segment, device);
+        }
+    }
 }
 
 //
-// This function calls plan_cache_transactions first to identify what part of uio can be
-// read from memory and what needs to be read from disk
-// NOTE: This function is NOT thread-safe and does not need to be because it is called only
-// by rofs_read_with_cache() which in turn is called by vfs_file::read() in a critical section
-// specific to given file. So effectively cache_read() is assumed to be called by one thread
-// at a time and no thread synchronization is needed.
+// This function reads data per uio segment by segment, loading segments missing in
+// cache from disk first.
+// NOTE: Positional reads of the same file may call this function in parallel (ROFS declares
+// VOP_SHARED_READ), so the segments are only looked up under the lock of their shard, and
+// a segment missing data is read from disk under its own load lock. The data of a segment
+// does not change once ready, and the reference held keeps it from being evicted, so the
+// copying needs no lock.
 int
 cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio) {
     //
     // Find existing one or create new file cache
     struct file_cache *cache = get_or_create_file_cache(inode, sb);
 
-    //
-    // Prepare list of cache transactions (copy from memory
-    // or read from disk into cache memory and then copy into memory)
-    auto segment_transactions = plan_cache_transactions(cache, uio);
-    print("[rofs] [%d] rofs_cache_read called for i-node [%d] at %d with %d ops\n",
-          sched::thread::current()->id(), inode->inode_no, uio->uio_offset, segment_transactions.size());
+    uint64_t file_offset = uio->uio_offset;
+    uint64_t bytes_to_read = std::min<uint64_t>(inode->file_size - uio->uio_offset, uio->uio_resid);
+    uint64_t segment_size = CACHE_SEGMENT_SIZE_IN_BLOCKS * sb->block_size;
+    print("[rofs] [%d] rofs_cache_read called for i-node [%d] at %d of %d bytes\n",
+          sched::thread::current()->id(), inode->inode_no, file_offset, bytes_to_read);
 
-    int error = 0;
+    read_ahead(cache, device, file_offset, bytes_to_read);
 
-    // Iterate over the list of cache operation and either copy from memory
-    // or read from disk into cache memory and then copy into memory
-    auto it = segment_transactions.begin();
-    for (; it != segment_transactions.end(); ++it) {
-        auto transaction = *it;
+    int error = 0;
+    while (bytes_to_read > 0 && !error) {
+        auto segment = get_segment(cache, CACHE_SEGMENT_INDEX(file_offset));
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
         rofs_cache_reads += 1;
 #endif
-        if (transaction.transaction_type == CacheTransactionType::READ_FROM_MEMORY) {
-            //
-            // Copy data from segment to target buffer
-            error = transaction.segment->read(uio, transaction.segment_offset, transaction.bytes_to_read);
-        }
-        // Read from disk into segment missing in cache or empty segment that was in cache but had not data because
-        // of failure to read
-        else {
-            error = transaction.segment->read_from_disk(device);
-#if defined(ROFS_DIAGNOSTICS_ENABLED)
-            rofs_cache_misses += 1;
-#endif
-            //
-            // Copy data from segment to target buffer
-            if (!error) {
-                error = transaction.segment->read(uio, transaction.segment_offset, transaction.bytes_to_read);
-            }
-        }
-
-        if (error) {
-            break;
+        //
+        // Read from disk into segment missing in cache or empty segment that was in cache
+        // but had no data because of failure to read, and copy data from segment to target buffer
+        error = segment->load(device);
+        if (!error) {
+            auto segment_offset = file_offset % segment_size;
+            auto bytes = std::min(segment->length() - segment_offset, bytes_to_read);
+            error = segment->read(uio, segment_offset, bytes);
+            file_offset += bytes;
+            bytes_to_read -= bytes;
         }
+        segment->put();
     }
 
     print("[rofs] [%d] rofs_cache_read completed for i-node [%d]\n", sched::thread::current()->id(),
@@ -322,42 +620,32 @@ cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_bl
 }
 
 // Ensure a page (4096 bytes) of a file specified by offset is in memory in cache. Otherwise
-// load it from disk and eventually return address of the page in memory.
+// load it from disk and eventually hand the page over to the page cache to be mapped.
 int
-cache_get_page_address(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio, void **addr)
+cache_map_page(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio)
 {
     // Find existing one or create new file cache
     struct file_cache *cache = get_or_create_file_cache(inode, sb);
 
-    //
-    // Prepare a cache transaction (copy from memory
-    // or read from disk into cache memory and then copy into memory)
-    auto segment_transactions = plan_cache_transactions(cache, uio);
-    print("[rofs] [%d] rofs_get_page_address called for i-node [%d] at %d with %d ops\n",
-          sched::thread::current()->id(), inode->inode_no, offset, segment_transactions.size());
+    uint64_t segment_size = CACHE_SEGMENT_SIZE_IN_BLOCKS * sb->block_size;
+    print("[rofs] [%d] rofs_cache_map_page called for i-node [%d] at %d\n",
+          sched::thread::current()->id(), inode->inode_no, uio->uio_offset);
 
-    int error = 0;
+    read_ahead(cache, device, uio->uio_offset, mmu::page_size);
 
-    assert(segment_transactions.size() == 1);
-    auto transaction = segment_transactions[0];
+    auto segment = get_segment(cache, CACHE_SEGMENT_INDEX(uio->uio_offset));
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
     rofs_cache_reads += 1;
 #endif
-    if (transaction.transaction_type == CacheTransactionType::READ_FROM_DISK) {
-        // Read from disk into segment missing in cache or empty segment that was in cache but had not data because
-        // of failure to read
-        error = transaction.segment->read_from_disk(device);
-#if defined(ROFS_DIAGNOSTICS_ENABLED)
-        rofs_cache_misses += 1;
-#endif
-   }
-
-   if( !error)
-       *addr = transaction.segment->memory_address(transaction.segment_offset);
-   else
-       *addr = nullptr;
+    // Read from disk into segment missing in cache or empty segment that was in cache but had not data because
+    // of failure to read
+    int error = segment->load(device);
+    if (!error) {
+        segment->map_page((pagecache::hashkey *) uio->uio_iov->iov_base, uio->uio_offset % segment_size);
+    }
+    segment->put();
 
-   return error;
+    return error;
 }
 
 }
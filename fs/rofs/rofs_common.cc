@@ -83,3 +83,79 @@ rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks
 
     return error;
 }
+
+//
+// Decodes the LZ4 block in src into dst, which is what gen-rofs-img.py
+// compresses each chunk of file data to in compressed images. Returns the
+// number of bytes decoded, or -1 if the block is corrupted or decodes to more
+// than dst_len bytes.
+static size_t lz4_length(const u8 *&ip, const u8 *iend)
+{
+    size_t length = 0;
+    u8 byte;
+    do {
+        if (ip == iend) {
+            // Large enough to fail the bounds checks, small enough not to wrap
+            return SIZE_MAX / 2;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+int
+rofs_lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+    const u8 *ip = (const u8 *) src;
+    const u8 *iend = ip + src_len;
+    u8 *op = (u8 *) dst;
+    u8 *oend = op + dst_len;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        // Literals
+        size_t length = token >> 4;
+        if (length == 15) {
+            length += lz4_length(ip, iend);
+        }
+        if (length > (size_t)(iend - ip) || length > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, length);
+        ip += length;
+        op += length;
+        // The last sequence has only literals
+        if (ip == iend) {
+            break;
+        }
+        // Match
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (u8 *) dst)) {
+            return -1;
+        }
+        length = token & 15;
+        if (length == 15) {
+            length += lz4_length(ip, iend);
+        }
+        length += 4;
+        if (length > (size_t)(oend - op)) {
+            return -1;
+        }
+        const u8 *match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            // The match overlaps the bytes it produces
+            while (length--) {
+                *op++ = *match++;
+            }
+        }
+    }
+    return op - (u8 *) dst;
+}
@@ -42,6 +42,9 @@ std::atomic<long> rofs_block_read_count(0);
 std::atomic<long> rofs_block_allocated(0);
 std::atomic<long> rofs_cache_reads(0);
 std::atomic<long> rofs_cache_misses(0);
+std::atomic<long> rofs_cache_evictions(0);
+std::atomic<long> rofs_cache_readaheads(0);
+std::atomic<long> rofs_decompress_ms(0);
 #endif
 
 std::atomic<long> rofs_mounts(0);
@@ -89,9 +92,18 @@ rofs_mount(struct mount *mp, const char *dev, int flags, const void *data)
         return -1; // TODO: Proper error code
     }
 
-    if (sb->version != ROFS_VERSION) {
+    if (sb->version != ROFS_VERSION && sb->version != ROFS_VERSION_COMPRESSED) {
         kprintf("[rofs] Found rofs volume but incompatible version!\n");
-        kprintf("[rofs] Expecting %llu but found %llu\n", ROFS_VERSION, sb->version);
+        kprintf("[rofs] Expecting %llu or %llu but found %llu\n", ROFS_VERSION, ROFS_VERSION_COMPRESSED, sb->version);
+        device_close(device);
+        return -1;
+    }
+
+    if (sb->version == ROFS_VERSION) {
+        sb->compression = ROFS_COMPRESSION_NONE;
+    } else if (sb->compression != ROFS_COMPRESSION_LZ4 || sb->chunk_size != ROFS_CHUNK_SIZE) {
+        kprintf("[rofs] Found compressed rofs volume but unsupported compression %llu with chunks of %llu bytes!\n",
+                sb->compression, sb->chunk_size);
         device_close(device);
         return -1;
     }
@@ -104,6 +116,7 @@ rofs_mount(struct mount *mp, const char *dev, int flags, const void *data)
     print("[rofs] Got directory entries count:     %d\n", sb->directory_entries_count);
     print("[rofs] Got symlinks count:              %d\n", sb->symlinks_count);
     print("[rofs] Got inode count:                 %d\n", sb->inodes_count);
+    print("[rofs] Got compression:                 %d\n", sb->compression);
     //
     // Since we have found ROFS, we can copy the superblock now
     sb = new rofs_super_block;
@@ -169,6 +182,7 @@ rofs_mount(struct mount *mp, const char *dev, int flags, const void *data)
     rofs_mounts += 1;
     mp->m_fsid.__val[0] = rofs_mounts.load();
     mp->m_fsid.__val[1] = ROFS_ID >> 32;
+    mp->m_flags |= MNT_LOCAL;
 
     rofs_set_vnode(mp->m_root->d_vnode, rofs->inodes);
 
@@ -220,9 +234,11 @@ rofs_unmount(struct mount *mp, int flags)
     debugff("ROFS: spent %.2f ms reading from disk\n", ((double) rofs_block_read_ms.load()) / 1000);
     debugff("ROFS: read %d 512-byte blocks from disk\n", rofs_block_read_count.load());
     debugff("ROFS: allocated %d 512-byte blocks of cache memory\n", rofs_block_allocated.load());
+    debugff("ROFS: spent %.2f ms decompressing\n", ((double) rofs_decompress_ms.load()) / 1000);
     long total_cache_reads = rofs_cache_reads.load();
     double hit_ratio = total_cache_reads > 0 ? (rofs_cache_reads.load() - rofs_cache_misses.load()) / ((double)total_cache_reads) : 0;
     debugff("ROFS: hit ratio is %.2f%%\n", hit_ratio * 100);
+    debugff("ROFS: read ahead %d segments, evicted %d segments\n", rofs_cache_readaheads.load(), rofs_cache_evictions.load());
 #endif
     return error;
 }
@@ -40,7 +40,6 @@
 #include <sys/types.h>
 #include <osv/device.h>
 #include <osv/sched.hh>
-#include <osv/pagecache.hh>
 
 #include "rofs.hh"
 
@@ -114,6 +113,12 @@ static int rofs_read_without_cache(struct vnode *vnode, struct file *fp, struct
 
     VERIFY_READ_INPUT_ARGUMENTS()
 
+    // Compressed data can only be read a whole chunk at a time, which is what
+    // the cache does
+    if (sb->compression != ROFS_COMPRESSION_NONE) {
+        return rofs::cache_read(inode, device, sb, uio);
+    }
+
     int rv = 0;
     int error = -1;
     uint64_t block = inode->data_offset;
@@ -299,11 +304,9 @@ int rofs_map_cached_page(struct vnode *vnode, struct file* fp, struct uio *uio)
     if (uio->uio_offset % mmu::page_size)
         return EINVAL;
 
-    void *page_address;
-    int ret = rofs::cache_get_page_address(inode, device, sb, uio, &page_address);
+    int ret = rofs::cache_map_page(inode, device, sb, uio);
 
     if (!ret) {
-        pagecache::map_read_cached_page((pagecache::hashkey*)uio->uio_iov->iov_base, page_address);
         uio->uio_resid = 0;
     } else {
         abort("ROFS cache failed!");
@@ -351,7 +354,8 @@ struct vnops rofs_vnops = {
     rofs_map_cached_page,
     rofs_fallocate,          /* fallocate - returns error when called*/
     rofs_readlink,           /* read link */
-    rofs_symlink             /* symbolic link - returns error when called*/
+    rofs_symlink,            /* symbolic link - returns error when called*/
+    VOP_SHARED_READ          /* reads can run in parallel */
 };
 
 extern "C" void rofs_disable_cache() {
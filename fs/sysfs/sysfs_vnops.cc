@@ -9,6 +9,7 @@
 #include <osv/mount.h>
 #include <mntent.h>
 #include <osv/mempool.hh>
+#include <osv/numa.hh>
 
 #include "fs/pseudofs/pseudofs.hh"
 
@@ -21,14 +22,35 @@ static uint64_t inode_count = 1; /* inode 0 is reserved to root */
 
 static mutex_t sysfs_mutex;
 
-static string sysfs_cpumap()
+// Like pseudofs::cpumap(), but only the cpus of the given node
+static string sysfs_cpumap(unsigned node)
 {
-    return pseudofs::cpumap() + "\n";
+    std::vector<uint32_t> sets((sched::cpus.size() + 31) / 32);
+    for (auto cpu : sched::cpus) {
+        if (cpu->numa_node == node) {
+            sets[cpu->id / 32] |= 1u << (cpu->id % 32);
+        }
+    }
+    std::string output;
+    for (auto i = sets.size(); i--; ) {
+        output += osv::sprintf(output.empty() ? "%08x" : ",%08x", sets[i]);
+    }
+    return output + "\n";
+}
+
+static string sysfs_distance(unsigned node)
+{
+    std::string output;
+    for (unsigned to = 0; to < memory::numa_nodes(); to++) {
+        output += (to ? " " : "") + std::to_string(memory::numa_distance(node, to));
+    }
+    return output + "\n";
 }
 
-static string sysfs_distance()
+static string sysfs_meminfo(unsigned node)
 {
-    return std::string("10");
+    return osv::sprintf("Node %d MemTotal:\t%ld kB\nNode %d MemFree: \t%ld kB\n",
+        node, memory::numa_node_memory(node) >> 10, node, memory::numa_node_free(node) >> 10);
 }
 
 using namespace memory;
@@ -68,6 +90,12 @@ static string sysfs_memory_pools()
             cpu->id, stats._max, stats._watermark_lo, stats._watermark_hi, stats._nr);
     }
 
+    stats::zero_pool_stats zstats;
+    stats::get_zero_pool_stats(zstats);
+    output += osv::sprintf("zero pool (in batches) %02d %02d %02d %02d hits %ld misses %ld\n",
+        zstats.pool._max, zstats.pool._watermark_lo, zstats.pool._watermark_hi, zstats.pool._nr,
+        zstats.hits, zstats.misses);
+
     return output;
 }
 
@@ -76,13 +104,18 @@ sysfs_mount(mount* mp, const char *dev, int flags, const void* data)
 {
     auto* vp = mp->m_root->d_vnode;
 
-    auto node0 = make_shared<pseudo_dir_node>(inode_count++);
-    node0->add("meminfo", inode_count++, [] { return pseudofs::meminfo("Node 0 MemTotal:\t%ld kB\nNode 0 MemFree: \t%ld kB\n"); });
-    node0->add("cpumap", inode_count++, sysfs_cpumap);
-    node0->add("distance", inode_count++, sysfs_distance);
-
     auto node = make_shared<pseudo_dir_node>(inode_count++);
-    node->add("node0", node0);
+    for (unsigned n = 0; n < memory::numa_nodes(); n++) {
+        auto noden = make_shared<pseudo_dir_node>(inode_count++);
+        noden->add("meminfo", inode_count++, [n] { return sysfs_meminfo(n); });
+        noden->add("cpumap", inode_count++, [n] { return sysfs_cpumap(n); });
+        noden->add("distance", inode_count++, [n] { return sysfs_distance(n); });
+        node->add("node" + std::to_string(n), noden);
+    }
+    node->add("online", inode_count++, [] {
+       auto last = memory::numa_nodes() - 1;
+       return last ? std::string("0-") + std::to_string(last) : std::string("0");
+    });
 
     auto system = make_shared<pseudo_dir_node>(inode_count++);
     system->add("node", node);
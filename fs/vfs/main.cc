@@ -64,6 +64,7 @@
 #include <osv/trace.hh>
 #include <osv/run.hh>
 #include <osv/mount.h>
+#include <osv/socket.hh>
 #include <drivers/console.hh>
 
 #include "vfs.h"
@@ -2352,6 +2353,24 @@ ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
         }
     }
 
+    // Sockets take the data straight from the page cache, without mapping
+    // the file or copying the data
+    if (out_fp->f_type == DTYPE_SOCKET) {
+        size_t sent;
+        int error = static_cast<socket_file*>(out_fp)->sendfile(in_fp, offset, count, &sent);
+        if (error != EOPNOTSUPP) {
+            if (error && !sent) {
+                return libc_error(error);
+            }
+            if (_offset == nullptr) {
+                lseek(in_fd, sent, SEEK_CUR);
+            } else {
+                *_offset += sent;
+            }
+            return sent;
+        }
+    }
+
     size_t bytes_to_mmap = count + (offset % mmu::page_size);
     off_t offset_for_mmap =  align_down(offset, (off_t)mmu::page_size);
 
@@ -2732,7 +2751,6 @@ vfs_init(void)
     const struct vfssw *fs;
 
     bio_init();
-    lookup_init();
     vnode_init();
     task_alloc(&main_task);
 
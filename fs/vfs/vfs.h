@@ -144,7 +144,6 @@ int     namei(const char *path, struct dentry **dpp);
 int	 namei_last_nofollow(char *path, struct dentry *ddp, struct dentry **dp);
 int	 lookup(char *path, struct dentry **dpp, char **name);
 void	 vnode_init(void);
-void	 lookup_init(void);
 
 int     vfs_findroot(const char *path, struct mount **mp, char **root);
 int	 vfs_dname_copy(char *dest, const char *src, size_t size);
@@ -157,7 +156,10 @@ void dentry_move(struct dentry *dp, struct dentry *parent_dp, char *path);
 void dentry_remove(struct dentry *dp);
 void dref(struct dentry *dp);
 void drele(struct dentry *dp);
-void dentry_init(void);
+bool dentry_negative_lookup(struct mount *mp, const char *path);
+void dentry_negative_add(struct mount *mp, const char *path);
+void dentry_negative_remove(struct dentry *ddp, const char *name);
+void dentry_negative_purge(struct mount *mp);
 
 #ifdef DEBUG_VFS
 void	 vnode_dump(void);
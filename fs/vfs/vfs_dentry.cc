@@ -38,33 +38,131 @@
 #include <stdlib.h>
 #include <sys/param.h>
 
+#include <string>
+#include <vector>
+
 #include <osv/dentry.h>
 #include <osv/vnode.h>
+#include <osv/mount.h>
+#include <osv/rcu.hh>
+#include <osv/rcu-hashtable.hh>
 #include "vfs.h"
 
+/*
+ * The dentry cache is a hash table keyed by mount point and path, which
+ * grows and shrinks with the number of dentries. Lookups are lockless and
+ * protected by RCU, so namei() of an already cached path does not take any
+ * lock. Insertions and removals are serialized by dentry_hash_lock.
+ *
+ * A dentry found by a lockless lookup may concurrently drop its last
+ * reference, so lookups only take a reference if the count is not already
+ * zero, and the memory of a dentry (and of its path, which dentry_move()
+ * can replace) is only freed after an RCU grace period.
+ */
 #define DENTRY_BUCKETS 32
 
-static LIST_HEAD(dentry_hash_head, dentry) dentry_hash_table[DENTRY_BUCKETS];
-static LIST_HEAD(fake, dentry) fake;
-static mutex dentry_hash_lock;
+struct dentry_key {
+    struct mount *mp;
+    const char *path;
+};
 
-/*
- * Get the hash value from the mount point and path name.
- * XXX: replace with a better hash for 64-bit pointers.
- */
-static u_int
+static size_t
 dentry_hash(struct mount *mp, const char *path)
 {
-    u_int val = 0;
+    size_t val = 0;
 
     if (path) {
         while (*path) {
             val = ((val << 5) + val) + *path++;
         }
     }
-    return (val ^ (unsigned long) mp) & (DENTRY_BUCKETS - 1);
+    return val ^ (reinterpret_cast<uintptr_t>(mp) >> 4);
 }
 
+struct dentry_ptr_hash {
+    size_t operator()(struct dentry *dp) const {
+        return dentry_hash(dp->d_mount, dp->d_path);
+    }
+};
+
+struct dentry_key_hash {
+    size_t operator()(const dentry_key& k) const {
+        return dentry_hash(k.mp, k.path);
+    }
+};
+
+struct dentry_key_compare {
+    bool operator()(const dentry_key& k, struct dentry *dp) const {
+        return dp->d_mount == k.mp && !strncmp(dp->d_path, k.path, PATH_MAX);
+    }
+};
+
+static osv::rcu_hashtable<struct dentry *, dentry_ptr_hash> dentry_hash_table(DENTRY_BUCKETS);
+static mutex dentry_hash_lock;
+
+/*
+ * Negative dentries remember paths which were recently looked up and found
+ * not to exist, so that repeated failed lookups (e.g. searching a module
+ * path) do not go to the file system every time. They are only kept for
+ * file systems which are not modified behind our back, which declare this
+ * by setting MNT_LOCAL. Creating a name removes its negative entry, while
+ * renames, directory removals and unmounts drop all of the mount point's
+ * negative entries.
+ */
+#define NEGATIVE_DENTRIES_MAX 4096
+
+struct negative_dentry {
+    struct mount *mp;
+    std::string path;
+};
+
+struct negative_dentry_hash {
+    size_t operator()(const negative_dentry& n) const {
+        return dentry_hash(n.mp, n.path.c_str());
+    }
+};
+
+struct negative_dentry_compare {
+    bool operator()(const dentry_key& k, const negative_dentry& n) const {
+        return n.mp == k.mp && n.path == k.path;
+    }
+};
+
+static osv::rcu_hashtable<negative_dentry, negative_dentry_hash> negative_hash_table(DENTRY_BUCKETS);
+static mutex negative_hash_lock;
+
+static void
+dentry_hash_insert(struct dentry *dp)
+{
+    dentry_hash_table.insert(dp);
+    dp->d_flags |= DF_HASHED;
+}
+
+static void
+dentry_hash_remove(struct dentry *dp)
+{
+    if (dp->d_flags & DF_HASHED) {
+        dentry_hash_table.erase(dentry_hash_table.owner_find(dp));
+        dp->d_flags &= ~DF_HASHED;
+    }
+}
+
+/*
+ * Take a reference to a dentry found by a lockless lookup, unless it is
+ * already on its way to be freed.
+ */
+static bool
+dentry_tryget(struct dentry *dp)
+{
+    int cnt = __atomic_load_n(&dp->d_refcnt, __ATOMIC_RELAXED);
+    while (cnt > 0) {
+        if (__atomic_compare_exchange_n(&dp->d_refcnt, &cnt, cnt + 1, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
 
 struct dentry *
 dentry_alloc(struct dentry *parent_dp, struct vnode *vp, const char *path)
@@ -95,29 +193,29 @@ dentry_alloc(struct dentry *parent_dp, struct vnode *vp, const char *path)
 
     vn_add_name(vp, dp);
 
-    mutex_lock(&dentry_hash_lock);
-    LIST_INSERT_HEAD(&dentry_hash_table[dentry_hash(mp, path)], dp, d_link);
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_hash_insert(dp);
+    }
     return dp;
 };
 
 struct dentry *
 dentry_lookup(struct mount *mp, char *path)
 {
-    struct dentry *dp;
-
-    mutex_lock(&dentry_hash_lock);
-    LIST_FOREACH(dp, &dentry_hash_table[dentry_hash(mp, path)], d_link) {
-        if (dp->d_mount == mp && !strncmp(dp->d_path, path, PATH_MAX)) {
-            dp->d_refcnt++;
-            mutex_unlock(&dentry_hash_lock);
-            return dp;
+    WITH_LOCK(osv::rcu_read_lock) {
+        auto i = dentry_hash_table.reader_find(dentry_key{mp, path},
+                dentry_key_hash(), dentry_key_compare());
+        if (i && dentry_tryget(*i)) {
+            return *i;
         }
     }
-    mutex_unlock(&dentry_hash_lock);
     return nullptr;                /* not found */
 }
 
+/*
+ * Remove all descendants of dp from the hashtable, as their paths
+ * are about to become stale.
+ */
 static void dentry_children_remove(struct dentry *dp)
 {
     struct dentry *entry = nullptr;
@@ -126,7 +224,8 @@ static void dentry_children_remove(struct dentry *dp)
         LIST_FOREACH(entry, &dp->d_children, d_children_link) {
             ASSERT(entry);
             ASSERT(entry->d_refcnt > 0);
-            LIST_REMOVE(entry, d_link);
+            dentry_hash_remove(entry);
+            dentry_children_remove(entry);
         }
     }
 }
@@ -156,30 +255,28 @@ dentry_move(struct dentry *dp, struct dentry *parent_dp, char *path)
         // Remove all dp's child dentries from the hashtable.
         dentry_children_remove(dp);
         // Remove dp with outdated hash info from the hashtable.
-        LIST_REMOVE(dp, d_link);
+        dentry_hash_remove(dp);
         // Update dp.
         dp->d_path = strdup(path);
         dp->d_parent = parent_dp;
         // Insert dp updated hash info into the hashtable.
-        LIST_INSERT_HEAD(&dentry_hash_table[dentry_hash(dp->d_mount, path)],
-            dp, d_link);
+        dentry_hash_insert(dp);
     }
 
     if (old_pdp) {
         drele(old_pdp);
     }
 
-    free(old_path);
+    // A concurrent lockless lookup may still be comparing the old path
+    osv::rcu_defer([=] { free(old_path); });
 }
 
 void
 dentry_remove(struct dentry *dp)
 {
-    mutex_lock(&dentry_hash_lock);
-    LIST_REMOVE(dp, d_link);
-    /* put it on a fake list for drele() to work*/
-    LIST_INSERT_HEAD(&fake, dp, d_link);
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_hash_remove(dp);
+    }
 }
 
 void
@@ -188,9 +285,7 @@ dref(struct dentry *dp)
     ASSERT(dp);
     ASSERT(dp->d_refcnt > 0);
 
-    mutex_lock(&dentry_hash_lock);
-    dp->d_refcnt++;
-    mutex_unlock(&dentry_hash_lock);
+    __atomic_fetch_add(&dp->d_refcnt, 1, __ATOMIC_RELAXED);
 }
 
 void
@@ -199,15 +294,14 @@ drele(struct dentry *dp)
     ASSERT(dp);
     ASSERT(dp->d_refcnt > 0);
 
-    mutex_lock(&dentry_hash_lock);
-    if (--dp->d_refcnt) {
-        mutex_unlock(&dentry_hash_lock);
+    if (__atomic_sub_fetch(&dp->d_refcnt, 1, __ATOMIC_ACQ_REL)) {
         return;
     }
-    LIST_REMOVE(dp, d_link);
-    vn_del_name(dp->d_vnode, dp);
 
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_hash_remove(dp);
+        vn_del_name(dp->d_vnode, dp);
+    }
 
     if (dp->d_parent) {
         WITH_LOCK(dp->d_parent->d_lock) {
@@ -219,16 +313,88 @@ drele(struct dentry *dp)
 
     vrele(dp->d_vnode);
 
-    free(dp->d_path);
-    free(dp);
+    osv::rcu_defer([=] {
+        free(dp->d_path);
+        free(dp);
+    });
+}
+
+bool
+dentry_negative_lookup(struct mount *mp, const char *path)
+{
+    if (!(mp->m_flags & MNT_LOCAL)) {
+        return false;
+    }
+    SCOPE_LOCK(osv::rcu_read_lock);
+    return bool(negative_hash_table.reader_find(dentry_key{mp, path},
+            dentry_key_hash(), negative_dentry_compare()));
+}
+
+static void
+negative_purge_locked(struct mount *mp)
+{
+    std::vector<negative_dentry> victims;
+    negative_hash_table.owner_for_each([&] (const negative_dentry& n) {
+        if (!mp || n.mp == mp) {
+            victims.push_back(n);
+        }
+    });
+    for (auto& n : victims) {
+        negative_hash_table.erase(negative_hash_table.owner_find(
+                dentry_key{n.mp, n.path.c_str()}, dentry_key_hash(),
+                negative_dentry_compare()));
+    }
+}
+
+void
+dentry_negative_add(struct mount *mp, const char *path)
+{
+    if (!(mp->m_flags & MNT_LOCAL)) {
+        return;
+    }
+    WITH_LOCK(negative_hash_lock) {
+        dentry_key key{mp, path};
+        if (negative_hash_table.owner_find(key, dentry_key_hash(), negative_dentry_compare())) {
+            return;
+        }
+        // Keep the cache bounded. Negative entries are cheap to recreate,
+        // so simply start over when it is full.
+        if (negative_hash_table.size() >= NEGATIVE_DENTRIES_MAX) {
+            negative_purge_locked(nullptr);
+        }
+        negative_hash_table.emplace(negative_dentry{mp, path});
+    }
 }
 
 void
-dentry_init(void)
+dentry_negative_remove(struct dentry *ddp, const char *name)
 {
-    int i;
+    struct mount *mp = ddp->d_mount;
 
-    for (i = 0; i < DENTRY_BUCKETS; i++) {
-        LIST_INIT(&dentry_hash_table[i]);
+    if (!(mp->m_flags & MNT_LOCAL)) {
+        return;
+    }
+    std::string path(ddp->d_path);
+    if (path.back() != '/') {
+        path += '/';
+    }
+    path += name;
+    WITH_LOCK(negative_hash_lock) {
+        if (negative_hash_table.empty()) {
+            return;
+        }
+        auto i = negative_hash_table.owner_find(dentry_key{mp, path.c_str()},
+                dentry_key_hash(), negative_dentry_compare());
+        if (i) {
+            negative_hash_table.erase(i);
+        }
+    }
+}
+
+void
+dentry_negative_purge(struct mount *mp)
+{
+    WITH_LOCK(negative_hash_lock) {
+        negative_purge_locked(mp);
     }
 }
@@ -47,6 +47,15 @@ int vfs_file::read(struct uio *uio, int flags)
 
 	bytes = uio->uio_resid;
 
+	// Positional reads do not touch f_offset, so they can run in
+	// parallel if the filesystem allows it.
+	if ((flags & FOF_OFFSET) && (vp->v_op->vop_shared & VOP_SHARED_READ)) {
+		vn_lock_shared(vp);
+		error = VOP_READ(vp, fp, uio, 0);
+		vn_unlock_shared(vp);
+		return error;
+	}
+
 	vn_lock(vp);
 	if ((flags & FOF_OFFSET) == 0)
 		uio->uio_offset = fp->f_offset;
@@ -74,13 +83,30 @@ int vfs_file::write(struct uio *uio, int flags)
 
 	bytes = uio->uio_resid;
 
-	vn_lock(vp);
-
 	if (fp->f_flags & O_APPEND)
 		ioflags |= IO_APPEND;
 	if (fp->f_flags & (O_DSYNC|O_SYNC))
 		ioflags |= IO_SYNC;
 
+	// A positional write that does not extend the file can share the
+	// vnode with other readers and writers if the filesystem allows it.
+	// Filesystems that allow this must keep v_size equal to the file size
+	// (ZFS does so through vnode_pager_setsize() whenever z_size moves),
+	// and the size only changes under the exclusive lock, so it is stable
+	// here.
+	if ((flags & FOF_OFFSET) && !(ioflags & IO_APPEND) &&
+	    (vp->v_op->vop_shared & VOP_SHARED_WRITE)) {
+		vn_lock_shared(vp);
+		if (uio->uio_offset + bytes <= vp->v_size) {
+			error = VOP_WRITE(vp, uio, ioflags);
+			vn_unlock_shared(vp);
+			return error;
+		}
+		vn_unlock_shared(vp);
+	}
+
+	vn_lock(vp);
+
 	if ((flags & FOF_OFFSET) == 0)
 	        uio->uio_offset = fp->f_offset;
 
@@ -148,6 +174,11 @@ bool vfs_file::put_page(void *addr, uintptr_t off, mmu::hw_ptep<0> ptep)
     return pagecache::release(this, addr, off, ptep);
 }
 
+unsigned vfs_file::map_cached_pages(uintptr_t off, unsigned n, mmu::pt_element<0>* pteps[], mmu::pt_element<0> pte, bool shared)
+{
+    return pagecache::map_cached(this, off, n, pteps, pte, shared);
+}
+
 void vfs_file::sync(off_t start, off_t end)
 {
     pagecache::sync(this, start, end);
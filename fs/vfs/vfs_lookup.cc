@@ -136,6 +136,10 @@ namei(const char *path, struct dentry **dpp)
             *dpp = dp;
             return 0;
         }
+        if (dentry_negative_lookup(mp, node)) {
+            /* Recently found not to exist. */
+            return ENOENT;
+        }
         /*
          * Find target vnode, started from root directory.
          * This is done to attach the fs specific data to
@@ -179,7 +183,14 @@ namei(const char *path, struct dentry **dpp)
             dp = dentry_lookup(mp, node);
             if (dp == nullptr) {
                 /* Find a vnode in this directory. */
-                error = VOP_LOOKUP(dvp, name, &vp);
+                if (dentry_negative_lookup(mp, node)) {
+                    error = ENOENT;
+                } else {
+                    error = VOP_LOOKUP(dvp, name, &vp);
+                    if (error == ENOENT) {
+                        dentry_negative_add(mp, node);
+                    }
+                }
                 if (error) {
                     vn_unlock(dvp);
                     drele(ddp);
@@ -284,8 +295,15 @@ namei_last_nofollow(char *path, struct dentry *ddp, struct dentry **dpp)
     vn_lock(dvp);
     dp = dentry_lookup(mp, node.get());
     if (dp == nullptr) {
+        if (dentry_negative_lookup(mp, node.get())) {
+            error = ENOENT;
+            goto out;
+        }
         error = VOP_LOOKUP(dvp, name, &vp);
         if (error != 0) {
+            if (error == ENOENT) {
+                dentry_negative_add(mp, node.get());
+            }
             goto out;
         }
 
@@ -363,13 +381,3 @@ lookup(char *path, struct dentry **dpp, char **name)
     }
     return 0;
 }
-
-/*
- * vnode_init() is called once (from vfs_init)
- * in initialization.
- */
-void
-lookup_init(void)
-{
-    dentry_init();
-}
@@ -271,6 +271,7 @@ found:
     if ((error = VFS_UNMOUNT(mp, flags)) != 0)
         goto out;
     mount_list.remove(mp);
+    dentry_negative_purge(mp);
 
 #ifdef HAVE_BUFFERS
     /* Flush all buffers */
@@ -135,6 +135,8 @@ sys_open(char *path, int flags, mode_t mode, struct file **fpp)
 			mode &= ~S_IFMT;
 			mode |= S_IFREG;
 			error = VOP_CREATE(ddp->d_vnode, filename, mode);
+			if (!error)
+				dentry_negative_remove(ddp, filename);
 			vn_unlock(ddp->d_vnode);
 			drele(ddp);
 
@@ -548,6 +550,8 @@ sys_mkdir(char *path, mode_t mode)
 	mode |= S_IFDIR;
 
 	error = VOP_MKDIR(ddp->d_vnode, name, mode);
+	if (!error)
+		dentry_negative_remove(ddp, name);
  out:
 	vn_unlock(ddp->d_vnode);
 	drele(ddp);
@@ -587,6 +591,9 @@ sys_rmdir(char *path)
 
 	vn_lock(ddp->d_vnode);
 	error = VOP_RMDIR(ddp->d_vnode, vp, name);
+	/* Negative entries below the directory could outlive it */
+	if (!error)
+		dentry_negative_purge(ddp->d_mount);
 	vn_unlock(ddp->d_vnode);
 
 	vn_unlock(vp);
@@ -637,6 +644,8 @@ sys_mknod(char *path, mode_t mode)
 		error = VOP_MKDIR(ddp->d_vnode, name, mode);
 	else
 		error = VOP_CREATE(ddp->d_vnode, name, mode);
+	if (!error)
+		dentry_negative_remove(ddp, name);
  out:
 	vn_unlock(ddp->d_vnode);
 	drele(ddp);
@@ -803,6 +812,9 @@ sys_rename(char *src, char *dest)
 	}
 
 	error = VOP_RENAME(dvp1, vp1, sname, dvp2, vp2, dname);
+	/* A renamed directory can make any path below it valid */
+	if (!error)
+		dentry_negative_purge(dvp2->v_mount);
 
 	dentry_move(dp1, ddp2, dname);
 	if (dp2)
@@ -879,6 +891,8 @@ sys_symlink(const char *oldpath, const char *newpath)
 		goto out;
 	}
 	error = VOP_SYMLINK(newdirdp->d_vnode, name, op);
+	if (!error)
+		dentry_negative_remove(newdirdp, name);
 
 out:
 	if (newdirdp != nullptr) {
@@ -941,6 +955,8 @@ sys_link(char *oldpath, char *newpath)
 	}
 
 	error = VOP_LINK(newdirdp->d_vnode, vp, name);
+	if (!error)
+		dentry_negative_remove(newdirdp, name);
  out1:
 	vn_unlock(newdirdp->d_vnode);
 	drele(newdirdp);
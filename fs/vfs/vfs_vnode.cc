@@ -62,6 +62,8 @@ int vttoif_tab[10] = {
  * ---------- --------- ----------
  * vn_lock     *        Lock
  * vn_unlock   *        Unlock
+ * vn_lock_shared   *   Shared lock
+ * vn_unlock_shared *   Shared unlock
  * vget        1        Lock
  * vput       -1        Unlock
  * vref       +1        *
@@ -98,8 +100,10 @@ vn_hash(struct mount *mp, uint64_t ino)
 }
 
 /*
- * Returns locked vnode for specified mount point and path.
- * vn_lock() will increment the reference count of vnode.
+ * Returns vnode for specified mount point and path with its
+ * reference count incremented, but not locked: vn_lock() may sleep
+ * waiting for shared holders, which take VNODE_LOCK to release their
+ * references, so the caller locks the vnode after dropping VNODE_LOCK.
  *
  * Locking: VNODE_LOCK must be held.
  */
@@ -112,8 +116,6 @@ vn_lookup(struct mount *mp, uint64_t ino)
 	LIST_FOREACH(vp, &vnode_table[vn_hash(mp, ino)], v_link) {
 		if (vp->v_mount == mp && vp->v_ino == ino) {
 			vp->v_refcnt++;
-			mutex_lock(&vp->v_lock);
-			vp->v_nrlocks++;
 			return vp;
 		}
 	}
@@ -136,6 +138,10 @@ vn_path(struct vnode *vp)
 
 /*
  * Lock vnode
+ *
+ * The exclusive lock is v_lock itself, with no shared holders left.
+ * Waiting writers are counted in v_wwait, which holds back new shared
+ * lockers so that a steady stream of readers cannot starve them.
  */
 void
 vn_lock(struct vnode *vp)
@@ -144,6 +150,13 @@ vn_lock(struct vnode *vp)
 	ASSERT(vp->v_refcnt > 0);
 
 	mutex_lock(&vp->v_lock);
+	if (vp->v_nrlocks == 0 && vp->v_readers > 0) {
+		vp->v_wwait++;
+		while (vp->v_readers > 0)
+			vp->v_rdcv.wait(&vp->v_lock);
+		if (--vp->v_wwait == 0)
+			vp->v_rdcv.wake_all();
+	}
 	vp->v_nrlocks++;
 	DPRINTF(VFSDB_VNODE, ("vn_lock:   %s\n", vn_path(vp)));
 }
@@ -163,6 +176,50 @@ vn_unlock(struct vnode *vp)
 	DPRINTF(VFSDB_VNODE, ("vn_lock:   %s\n", vn_path(vp)));
 }
 
+/*
+ * Lock vnode shared. Only operations the filesystem declares in
+ * vop_shared may be called with a shared lock.
+ *
+ * If the caller already holds the exclusive lock, this just takes it
+ * recursively.
+ */
+void
+vn_lock_shared(struct vnode *vp)
+{
+	ASSERT(vp);
+	ASSERT(vp->v_refcnt > 0);
+
+	mutex_lock(&vp->v_lock);
+	if (vp->v_nrlocks > 0) {
+		vp->v_nrlocks++;
+		return;
+	}
+	while (vp->v_wwait > 0)
+		vp->v_rdcv.wait(&vp->v_lock);
+	vp->v_readers++;
+	mutex_unlock(&vp->v_lock);
+}
+
+/*
+ * Unlock vnode locked by vn_lock_shared()
+ */
+void
+vn_unlock_shared(struct vnode *vp)
+{
+	ASSERT(vp);
+	ASSERT(vp->v_refcnt > 0);
+
+	if (mutex_owned(&vp->v_lock)) {
+		vn_unlock(vp);
+		return;
+	}
+	mutex_lock(&vp->v_lock);
+	ASSERT(vp->v_readers > 0);
+	if (--vp->v_readers == 0 && vp->v_wwait > 0)
+		vp->v_rdcv.wake_all();
+	mutex_unlock(&vp->v_lock);
+}
+
 /*
  * Allocate new vnode for specified path.
  * Increment its reference count and lock it.
@@ -178,11 +235,22 @@ vget(struct mount *mp, uint64_t ino, struct vnode **vpp)
 
 	DPRINTF(VFSDB_VNODE, ("vget %LLu\n", ino));
 
+retry:
 	VNODE_LOCK();
 
 	vp = vn_lookup(mp, ino);
 	if (vp) {
 		VNODE_UNLOCK();
+		vn_lock(vp);
+		/*
+		 * The reference kept the vnode alive while we slept, but its
+		 * owner may have renumbered it in the meantime (e.g. the ext
+		 * root vnode, which starts out as inode 0).
+		 */
+		if (vp->v_mount != mp || vp->v_ino != ino) {
+			vput(vp);
+			goto retry;
+		}
 		*vpp = vp;
 		return 1;
 	}
@@ -199,6 +267,8 @@ vget(struct mount *mp, uint64_t ino, struct vnode **vpp)
 	vp->v_op = mp->m_op->vfs_vnops;
 	vp->v_nrlocks = 0;
 	vp->v_data = nullptr;
+	vp->v_readers = 0;
+	vp->v_wwait = 0;
 
 	/*
 	 * Request to allocate fs specific data for vnode.
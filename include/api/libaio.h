@@ -11,12 +11,67 @@
 #ifndef INCLUDED_LIBAIO_H
 #define INCLUDED_LIBAIO_H
 
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct io_context *io_context_t;
 
+typedef enum io_iocb_cmd {
+    IO_CMD_PREAD = 0,
+    IO_CMD_PWRITE = 1,
+    IO_CMD_FSYNC = 2,
+    IO_CMD_FDSYNC = 3,
+    IO_CMD_POLL = 5,
+    IO_CMD_NOOP = 6,
+    IO_CMD_PREADV = 7,
+    IO_CMD_PWRITEV = 8,
+} io_iocb_cmd_t;
+
+// When set in io_iocb_common.flags, completion of the request is also
+// signalled by writing 1 to the eventfd in io_iocb_common.resfd.
+#define IOCB_FLAG_RESFD (1 << 0)
+
+// The layout below is the one used by the kernel (struct iocb and
+// struct io_event in <linux/aio_abi.h>) on 64-bit little-endian targets,
+// so applications issuing the raw system calls work as well.
+struct io_iocb_common {
+    void *buf;
+    unsigned long nbytes;
+    long long offset;
+    long long __pad3;
+    unsigned flags;
+    unsigned resfd;
+};
+
+struct io_iocb_vector {
+    const struct iovec *vec;
+    int nr;
+    long long offset;
+};
+
+struct iocb {
+    void *data;
+    unsigned key;
+    unsigned aio_rw_flags;
+    short aio_lio_opcode;
+    short aio_reqprio;
+    int aio_fildes;
+    union {
+        struct io_iocb_common c;
+        struct io_iocb_vector v;
+    } u;
+};
+
+struct io_event {
+    void *data;
+    struct iocb *obj;
+    unsigned long res;
+    unsigned long res2;
+};
+
 int io_setup(int nr_events, io_context_t *ctxp_idp);
 int io_submit(io_context_t ctx, long nr, struct iocb *ios[]);
 int io_getevents(io_context_t ctx_id, long min_nr, long nr,
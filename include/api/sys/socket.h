@@ -87,7 +87,8 @@ struct ucred
 #define PF_CAIF         37
 #define PF_ALG          38
 #define PF_NFC          39
-#define PF_MAX          40
+#define PF_VSOCK        40
+#define PF_MAX          41
 
 #define AF_UNSPEC       PF_UNSPEC
 #define AF_LOCAL        PF_LOCAL
@@ -130,6 +131,7 @@ struct ucred
 #define AF_CAIF         PF_CAIF
 #define AF_ALG          PF_ALG
 #define AF_NFC          PF_NFC
+#define AF_VSOCK        PF_VSOCK
 #define AF_MAX          PF_MAX
 
 #ifndef SO_DEBUG
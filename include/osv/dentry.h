@@ -14,7 +14,7 @@
 struct vnode;
 
 struct dentry {
-	LIST_ENTRY(dentry) d_link;	/* link for hash list */
+	int		d_flags;	/* DF_* flags */
 	int		d_refcnt;	/* reference count */
 	char		*d_path;	/* pointer to path in fs */
 	struct vnode	*d_vnode;
@@ -26,6 +26,8 @@ struct dentry {
 	LIST_ENTRY(dentry) d_children_link;
 };
 
+#define DF_HASHED	0x0001		/* dentry is in the hash table */
+
 #if defined(__cplusplus) && !defined(USE_C_INTERFACE)
 
 #include <boost/intrusive_ptr.hpp>
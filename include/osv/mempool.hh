@@ -111,6 +111,17 @@ struct page_range {
 void free_initial_memory_range(void* addr, size_t size);
 void enable_debug_allocator();
 
+// Free page reporting lets a balloon device tell the host which free memory
+// it can take back. take_unreported_range() removes from the allocator a
+// free run of whole huge pages, at most max_size bytes long, that was not
+// reported since it was last allocated. Once the host is done with it,
+// return_reported_range() puts it back. The host may discard the contents of
+// the range, so nothing of it may be used in between. Does nothing until
+// enable_page_reporting() is called.
+void enable_page_reporting();
+bool take_unreported_range(size_t max_size, void*& addr, size_t& size);
+void return_reported_range(void* addr, size_t size);
+
 extern bool tracker_enabled;
 
 enum class pressure { RELAXED, NORMAL, PRESSURE, EMERGENCY };
@@ -219,6 +230,15 @@ namespace stats {
 
     void get_global_l2_stats(pool_stats &stats);
     void get_l1_stats(unsigned int cpu_id, stats::pool_stats &stats);
+
+    struct zero_pool_stats {
+        pool_stats pool;
+        // alloc_zeroed_page() calls served from / not served from the pool
+        size_t hits;
+        size_t misses;
+    };
+
+    void get_zero_pool_stats(zero_pool_stats &stats);
 }
 
 class phys_contiguous_memory final {
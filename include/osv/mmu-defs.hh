@@ -101,6 +101,8 @@ enum {
 void flush_tlb_local();
 /* flush tlb for all */
 void flush_tlb_all();
+/* flush tlb entries of a range of virtual addresses on all processors */
+void flush_tlb_range(uintptr_t start, size_t size);
 
 constexpr size_t page_size_level(unsigned level)
 {
@@ -149,6 +151,7 @@ public:
     inline void set_large(bool v);
     inline void set_user(bool v);
     inline void set_accessed(bool v);
+    inline void set_global(bool v);
     inline void set_addr(phys addr, bool large);
     inline void set_pfn(u64 pfn, bool large);
     inline void set_sw_bit(unsigned off, bool v);
@@ -18,6 +18,7 @@
 #include <unordered_map>
 #include <memory>
 #include <osv/mmu-defs.hh>
+#include <osv/numa.hh>
 #include <osv/align.hh>
 #include <osv/trace.hh>
 #include <osv/kernel_config_memory_debug.h>
@@ -78,11 +79,23 @@ public:
     virtual error sync(uintptr_t start, uintptr_t end) = 0;
     virtual int validate_perm(unsigned perm) { return 0; }
     virtual page_allocator* page_ops();
+    // Where the pages of the vma come from; only anonymous memory has a
+    // policy of its own, set_numa_policy() returns false for the rest
+    virtual bool set_numa_policy(const memory::numa_policy& policy);
+    virtual memory::numa_policy numa_policy() const { return memory::numa_policy(); }
     void update_flags(unsigned flag);
     bool has_flags(unsigned flag);
     template<typename T> ulong operate_range(T mapper, void *start, size_t size);
     template<typename T> ulong operate_range(T mapper);
     bool map_dirty();
+    // Page faults on vmas which allow it do not take vma_list_mutex, they
+    // hold a reference to the vma instead. Changes to the vma lock it,
+    // waiting for those faults to finish, see vm_fault().
+    virtual bool lockless_faults() const { return false; }
+    bool get_fault_ref();
+    void put_fault_ref();
+    void lock_faults();
+    void unlock_faults();
     class addr_compare;
 protected:
     addr_range _range;
@@ -90,6 +103,9 @@ protected:
     unsigned _flags;
     bool _map_dirty;
     page_allocator *_page_ops;
+private:
+    static constexpr unsigned faults_locked = 1u << 31;
+    std::atomic<unsigned> _fault_refs { 0 };
 public:
     boost::intrusive::set_member_hook<> _vma_list_hook;
 };
@@ -128,8 +144,15 @@ struct vma_range {
 class anon_vma : public vma {
 public:
     anon_vma(addr_range range, unsigned perm, unsigned flags);
+    ~anon_vma();
     virtual void split(uintptr_t edge) override;
     virtual error sync(uintptr_t start, uintptr_t end) override;
+    virtual bool set_numa_policy(const memory::numa_policy& policy) override;
+    virtual memory::numa_policy numa_policy() const override { return _numa_policy; }
+    virtual bool lockless_faults() const override { return true; }
+private:
+    memory::numa_policy _numa_policy;
+    std::unique_ptr<page_allocator> _numa_page_ops;
 };
 
 class file_vma : public vma {
@@ -205,6 +228,7 @@ public:
 void* map_file(const void* addr, size_t size, unsigned flags, unsigned perm,
               fileref file, f_offset offset);
 void* map_anon(const void* addr, size_t size, unsigned flags, unsigned perm);
+bool extend_anon(const void* addr, size_t old_size, size_t new_size);
 
 error munmap(const void* addr, size_t size);
 error mprotect(const void *addr, size_t size, unsigned int perm);
@@ -363,6 +387,10 @@ void vdepopulate(void* addr, size_t size);
 void vcleanup(void* addr, size_t size);
 
 error  advise(void* addr, size_t size, int advice);
+// Sets the NUMA policy of the anonymous memory in the range (mbind()),
+// pages already there stay where they are
+error set_numa_policy(const void* addr, size_t size, const memory::numa_policy& policy);
+bool get_numa_policy(const void* addr, memory::numa_policy& policy);
 
 void vm_fault(uintptr_t addr, exception_frame* ef);
 
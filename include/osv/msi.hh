@@ -11,6 +11,7 @@
 #include "drivers/pci-function.hh"
 
 #include <list>
+#include <vector>
 
 namespace sched {
 struct cpu;
@@ -65,6 +66,7 @@ public:
     // 3. Setup entries
     // 4. Unmask interrupts
     bool easy_register(std::initializer_list<msix_binding> bindings);
+    bool easy_register(const std::vector<msix_binding>& bindings);
     void easy_unregister();
 
     /////////////////////
@@ -120,10 +120,21 @@ public:
     // consumer side operations
     void add(ipv4_tcp_conn_id id, net_channel* channel);
     void remove(ipv4_tcp_conn_id id);
+    // UDP sockets use the same key; a socket that is not connected has a
+    // zero source address and port, and one bound to INADDR_ANY also has
+    // a zero destination address.
+    void add_udp(ipv4_tcp_conn_id id, net_channel* channel);
+    void remove_udp(ipv4_tcp_conn_id id);
+    // Listening TCP sockets, keyed by local address (or INADDR_ANY) and port
+    void add_listener(ipv4_tcp_conn_id id);
+    void remove_listener(ipv4_tcp_conn_id id);
     // producer side operations
     bool post_packet(mbuf* m);
+    // true if m is a plain IPv4 SYN for a registered listening socket
+    bool classify_listen_syn(mbuf* m);
 private:
     net_channel* classify_ipv4_tcp(mbuf* m);
+    net_channel* classify_ipv4_udp(mbuf* m);
 private:
     struct item {
         item(const ipv4_tcp_conn_id& key, net_channel* chan) : key(key), chan(chan) {}
@@ -139,8 +150,12 @@ private:
         }
     };
     using ipv4_tcp_channels = osv::rcu_hashtable<item, item_hash>;
+    net_channel* find(ipv4_tcp_channels& table, const ipv4_tcp_conn_id& id);
+    void remove(ipv4_tcp_channels& table, const ipv4_tcp_conn_id& id);
     mutex _mtx;
     ipv4_tcp_channels _ipv4_tcp_channels;
+    ipv4_tcp_channels _ipv4_udp_channels;
+    ipv4_tcp_channels _ipv4_tcp_listeners;
 };
 
 #endif /* NETCHANNEL_HH_ */
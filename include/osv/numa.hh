@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef OSV_NUMA_HH_
+#define OSV_NUMA_HH_
+
+#include <stddef.h>
+#include <osv/types.h>
+
+namespace memory {
+
+// NUMA topology. The architecture code describes it while it brings up the
+// cpus (from the ACPI SRAT and SLIT on x64), setting sched::cpu::numa_node,
+// and then calls numa_init(), which hands the free memory over to the page
+// lists of its node. Without a description all memory and cpus are on node 0.
+constexpr unsigned max_numa_nodes = 64;
+
+void numa_add_memory(unsigned node, u64 phys_start, u64 size);
+void numa_set_distance(unsigned from, unsigned to, unsigned distance);
+void numa_init();
+
+unsigned numa_nodes();
+// The node of memory in the linear map of physical memory
+unsigned numa_node_of(const void* addr);
+unsigned numa_distance(unsigned from, unsigned to);
+size_t numa_node_memory(unsigned node);
+size_t numa_node_free(unsigned node);
+// All nodes, ordered by their distance from the given one, which is first
+const unsigned char* numa_fallback_order(unsigned node);
+// The node of the cpu we run on
+unsigned numa_current_node();
+
+// Where anonymous memory gets its pages from, set for a thread with
+// set_mempolicy() or for a range of memory with mbind()
+struct numa_policy {
+    enum class mode : u8 {
+        local,        // the node of the cpu touching the page
+        preferred,    // the node in nodes, if it has free memory
+        bind,         // the nearest node in nodes
+        interleave,   // the nodes in nodes, page by page
+    };
+    mode m = mode::local;
+    u64 nodes = 0;
+
+    // The node for the page_idx'th page of the memory the policy applies
+    // to, or -1 for the local node
+    int node_for(size_t page_idx) const;
+};
+
+numa_policy& thread_numa_policy();
+
+}
+
+#endif /* OSV_NUMA_HH_ */
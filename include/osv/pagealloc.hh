@@ -13,9 +13,16 @@
 namespace memory {
 
 void* alloc_page();
+// Like alloc_page(), but the page is filled with zeros, preferably by
+// taking one that was cleared in advance
+void* alloc_zeroed_page();
 void free_page(void* page);
 void* alloc_huge_page(size_t bytes);
 void free_huge_page(void *page, size_t bytes);
+// Take the memory from the given NUMA node, or the nearest one that has
+// some free. alloc_page() and alloc_huge_page() prefer the local node.
+void* alloc_page_node(unsigned node);
+void* alloc_huge_page_node(size_t bytes, unsigned node);
 
 }
 
@@ -36,4 +36,32 @@ void sync(vfs_file* fp, off_t start, off_t end);
 void unmap_arc_buf(arc_buf_t* ab);
 void map_arc_buf(hashkey* key, arc_buf_t* ab, void* page);
 void map_read_cached_page(hashkey *key, void *page);
+// Drops the n read cache pages of a file starting at key, unmapping them
+// everywhere, so that the file system can free the memory behind them.
+// Returns false if some page is pinned, or its part of the cache is busy;
+// the memory is then still in use and the remaining pages are left alone.
+bool drop_read_cached_pages(hashkey key, unsigned n);
+// Like map_read_cached_page(), but the page cache owns the page (allocated
+// with memory::alloc_page()) and frees it once it is neither mapped nor
+// pinned. For file systems with no cache of their own to keep it in.
+void map_owned_read_cached_page(hashkey *key, void *page);
+// Drops the n read cache pages of a file starting at key, waiting for the
+// parts of the cache they are in, after the file system changed the data
+// behind them.
+void invalidate_read_cached_pages(hashkey key, unsigned n);
+
+// Maps the pages of the file at offset, offset + page_size, ... that are
+// already in the page cache into the corresponding empty ptes (null entries
+// are skipped), without reading anything from the file. Used to fault around
+// a read fault. Returns the number of pages mapped.
+unsigned map_cached(vfs_file* fp, off_t offset, unsigned n, mmu::pt_element<0>* pteps[], mmu::pt_element<0> pte, bool shared);
+
+// Pins up to n consecutive page cache pages of the file starting at the
+// page aligned offset, so that they can be referenced without being mapped
+// (e.g. attached to network buffers) until unpin() is called on each of the
+// returned handles. Returns the number of pages pinned, which is 0 when the
+// file's pages are not managed by the page cache and the caller has to read
+// the data instead.
+unsigned pin(vfs_file* fp, off_t offset, unsigned n, void* pages[], void* handles[]);
+void unpin(void* handle);
 }
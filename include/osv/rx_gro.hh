@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef OSV_RX_GRO_HH_
+#define OSV_RX_GRO_HH_
+
+#include <memory>
+#include <vector>
+#include <osv/types.h>
+
+struct ifnet;
+struct mbuf;
+struct lro_ctrl;
+
+namespace osv {
+
+/**
+ * @class rx_gro
+ * Software receive offload for a single Rx queue.
+ *
+ * A driver hands every received packet to input() and calls flush() once
+ * it has drained its ring. Packets claimed by a net channel are delivered
+ * to it directly, as before. TCP segments that continue an in-order flow
+ * seen earlier in the same batch are chained onto it (tcp_lro_rx()), so
+ * the stack processes one large segment instead of many MTU-sized ones.
+ * SYNs for listen sockets registered with the classifier are held back
+ * and handed to tcp_syn_batch_input() together at flush() time.
+ * Everything else is passed to if_input() immediately.
+ *
+ * Only segments whose checksum has already been validated (CSUM_DATA_VALID)
+ * are coalesced, since the merged segment is marked as validated too.
+ * Coalescing is on while IFCAP_LRO is enabled on the interface (SIOCSIFCAP
+ * toggles it); segments held back when it is turned off are pushed up
+ * before the next packet.
+ *
+ * Not thread safe: each Rx queue (thread) owns its own instance.
+ */
+class rx_gro {
+public:
+    explicit rx_gro(struct ifnet* ifn);
+    ~rx_gro();
+    rx_gro(const rx_gro&) = delete;
+    rx_gro& operator=(const rx_gro&) = delete;
+
+    void input(struct mbuf* m);
+    // Push all the coalesced segments up the stack. Must be called at the
+    // end of every Rx batch, before the queue thread goes to sleep.
+    void flush();
+
+    // Number of segments that were merged into a previous one
+    u64 merged() const { return _merged; }
+    // Number of coalesced segments passed up the stack
+    u64 flushed() const { return _flushed; }
+private:
+    void flush_lro();
+
+    struct ifnet* _ifn;
+    std::unique_ptr<lro_ctrl> _lro;
+    std::vector<struct mbuf*> _syns;
+    u64 _merged = 0;
+    u64 _flushed = 0;
+};
+
+}
+
+#endif /* OSV_RX_GRO_HH_ */
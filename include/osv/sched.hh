@@ -834,6 +834,9 @@ private:
     // sched_setaffinity()), and the load balancer should consult this bitmask
     // to decide to which cpus a thread may migrate.
     bool _pinned;
+    // When the load balancer last moved this thread to another cpu. Used to
+    // avoid bouncing a thread (and its cache footprint) back and forth.
+    osv::clock::uptime::time_point _last_migration {};
     arch_thread _arch;
     unsigned int _id;
     std::atomic<bool> _interrupted;
@@ -1017,6 +1020,22 @@ struct cpu : private timer_base::client {
     thread* terminating_thread;
     osv::clock::uptime::time_point running_since;
     char* percpu_base;
+    // Topology, set up by the architecture's smp_init(): cpus with the same
+    // core_id are SMT siblings, cpus with the same llc_id share the last
+    // level cache, numa_node is the memory node nearest to the cpu.
+    unsigned core_id;
+    unsigned llc_id;
+    unsigned numa_node = 0;
+    // Priority-weighted runqueue length, averaged over load balancer ticks.
+    // Only written by this cpu's load balancer, read by other cpus.
+    std::atomic<float> load_avg = { 0 };
+    // Set by an idle cpu asking this one to push it a runnable thread,
+    // see try_steal().
+    std::atomic<cpu*> steal_request = { nullptr };
+    // Written by the thief, read by the victim for tracing only
+    std::atomic<osv::clock::uptime::time_point> steal_requested_at = { osv::clock::uptime::time_point() };
+    osv::clock::uptime::time_point last_steal_attempt;
+    thread* balancer_thread;
     static cpu* current();
     void init_on_cpu();
     static void schedule();
@@ -1029,6 +1048,10 @@ struct cpu : private timer_base::client {
     void send_wakeup_ipi();
     void load_balance();
     unsigned load();
+    float update_load_avg();
+    cpu* find_balance_target(float my_load);
+    bool migrate_one(cpu* target, bool cache_cold_only);
+    bool try_steal();
     /**
      * Try to reschedule.
      *
@@ -40,6 +40,7 @@ public:
     virtual void poll_install(pollreq& pr) override;
     virtual void poll_uninstall(pollreq& pr) override;
     int bsd_ioctl(u_long cmd, void* data);
+    int sendfile(file* in_fp, off_t offset, size_t count, size_t* sent);
     socket* so;
 };
 
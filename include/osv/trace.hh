@@ -373,8 +373,9 @@ public:
         auto buffer = tr->buffer;
         log_backtrace(tr, buffer);
         serialize(buffer, as);
-        barrier();
-        tr->tp = this; // do this last to indicate the record is complete
+        // Do this last to indicate the record is complete. The release
+        // pairs with the trace stream, which may read it from another cpu.
+        __atomic_store_n(&tr->tp, static_cast<tracepoint_base*>(this), __ATOMIC_RELEASE);
         if (_trace_log) {
             _trace_log->write(tr);
         }
@@ -57,6 +57,28 @@ set_event_state(tracepoint_base &, bool enable, bool stacktrace = false);
 std::string
 create_trace_dump();
 
+// Streams the trace buffers of all cpus to a file, or to the console if
+// path is "console", while the tracepoints keep logging. See core/trace.cc
+// for the format; scripts/trace.py convert-stream reads it.
+// Returns false if a stream is already running or the file cannot be
+// created.
+bool
+start_trace_stream(const std::string & path);
+
+// Drains what is left in the trace buffers and closes the stream
+void
+stop_trace_stream();
+
+struct stream_stats {
+    uint64_t records = 0;
+    uint64_t dropped = 0; // records not logged as the stream fell behind
+    uint64_t bytes = 0;
+    int error = 0; // errno of the write that ended the stream early, if any
+};
+
+stream_stats
+get_stream_stats();
+
 struct symbol {
     std::string name;
     const void * addr;
@@ -24,6 +24,7 @@ public:
     virtual std::unique_ptr<mmu::file_vma> mmap(addr_range range, unsigned flags, unsigned perm, off_t offset) override;
     virtual bool map_page(uintptr_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pte, bool write, bool shared);
     virtual bool put_page(void *addr, uintptr_t offset, mmu::hw_ptep<0> ptep);
+    virtual unsigned map_cached_pages(uintptr_t offset, unsigned n, mmu::pt_element<0>* pteps[], mmu::pt_element<0> pte, bool shared);
     virtual void sync(off_t start, off_t end);
 
     int read_page_from_cache(void *key, off_t offset);
@@ -37,6 +37,7 @@
 #include <osv/prex.h>
 #include <osv/uio.h>
 #include <osv/mutex.h>
+#include <osv/condvar.h>
 #include "file.h"
 #include "dirent.h"
 
@@ -89,6 +90,9 @@ struct vnode {
 	LIST_HEAD(, dentry) v_names;	/* directory entries pointing at this */
 	int		v_nrlocks;	/* lock count (for debug) */
 	void		*v_data;	/* private data for fs */
+	int		v_readers;	/* number of shared lock holders */
+	int		v_wwait;	/* exclusive lockers waiting for readers */
+	condvar_t	v_rdcv;		/* signalled when v_readers or v_wwait drop */
 };
 
 /* flags for vnode */
@@ -186,8 +190,17 @@ struct vnops {
 	vnop_fallocate_t	vop_fallocate;
 	vnop_readlink_t		vop_readlink;
 	vnop_symlink_t		vop_symlink;
+	int			vop_shared;	/* ops safe under vn_lock_shared() */
 };
 
+/*
+ * Flags for vop_shared. A filesystem sets these when it does its own
+ * (range) locking, so that the corresponding operations may run in
+ * parallel on the same vnode while only a shared vnode lock is held.
+ */
+#define VOP_SHARED_READ		0x0001	/* positional reads */
+#define VOP_SHARED_WRITE	0x0002	/* positional writes within v_size */
+
 /*
  * vnode interface
  */
@@ -223,6 +236,8 @@ int	 vop_erofs(void);
 struct vnode *vn_lookup(struct mount *, uint64_t);
 void	 vn_lock(struct vnode *);
 void	 vn_unlock(struct vnode *);
+void	 vn_lock_shared(struct vnode *);
+void	 vn_unlock_shared(struct vnode *);
 int	 vn_stat(struct vnode *, struct stat *);
 int	 vn_settimes(struct vnode *, struct timespec[2]);
 int	 vn_setmode(struct vnode *, mode_t mode);
@@ -15,6 +15,8 @@
 #include <osv/stubbing.hh>
 #include <osv/export.h>
 #include <osv/trace.hh>
+#include <osv/mmu.hh>
+#include <osv/numa.hh>
 #include <memory>
 
 #include <syscall.h>
@@ -51,11 +53,11 @@
 #include <sys/shm.h>
 #include <termios.h>
 #include <poll.h>
+#include <api/libaio.h>
 #ifdef __x86_64__
 #include "tls-switch.hh"
 #endif
 
-#include <unordered_map>
 
 #include <musl/src/internal/ksigaction.h>
 
@@ -72,92 +74,9 @@ extern "C" OSV_LIBC_API long gettid()
     return sched::thread::current()->id();
 }
 
-// We don't expect applications to use the Linux futex() system call (it is
-// normally only used to implement higher-level synchronization mechanisms),
-// but unfortunately gcc's C++ runtime uses a subset of futex in the
-// __cxa__guard_* functions, which safeguard the concurrent initialization
-// of function-scope static objects. We only implement here this subset.
-// The __cxa_guard_* functions only call futex in the rare case of contention,
-// in fact so rarely that OSv existed for a year before anyone noticed futex
-// was missing. So the performance of this implementation is not critical.
-static std::unordered_map<void*, waitqueue> queues;
-static mutex queues_mutex;
-
-#define FUTEX_BITSET_MATCH_ANY  0xffffffff
-
+// Implemented in core/futex.cc
 int futex(int *uaddr, int op, int val, const struct timespec *timeout,
-        int *uaddr2, uint32_t val3)
-{
-    switch (op & FUTEX_CMD_MASK) {
-    case FUTEX_WAIT_BITSET:
-        if (val3 != FUTEX_BITSET_MATCH_ANY) {
-            abort("Unimplemented futex() operation %d\n", op);
-        }
-
-    case FUTEX_WAIT:
-        WITH_LOCK(queues_mutex) {
-            if (*uaddr == val) {
-                waitqueue &q = queues[uaddr];
-                if (timeout) {
-                    sched::timer tmr(*sched::thread::current());
-                    if ((op & FUTEX_CMD_MASK) == FUTEX_WAIT_BITSET) {
-                        // If FUTEX_WAIT_BITSET we need to interpret timeout as an absolute
-                        // time point. If futex operation FUTEX_CLOCK_REALTIME is set we will use
-                        // real-time clock otherwise we will use monotonic clock
-                        if (op & FUTEX_CLOCK_REALTIME) {
-                            tmr.set(osv::clock::wall::time_point(std::chrono::seconds(timeout->tv_sec) +
-                                                                 std::chrono::nanoseconds(timeout->tv_nsec)));
-                        } else {
-                            tmr.set(osv::clock::uptime::time_point(std::chrono::seconds(timeout->tv_sec) +
-                                                                   std::chrono::nanoseconds(timeout->tv_nsec)));
-                        }
-                    } else {
-                        tmr.set(std::chrono::seconds(timeout->tv_sec) +
-                                std::chrono::nanoseconds(timeout->tv_nsec));
-                    }
-                    sched::thread::wait_for(queues_mutex, tmr, q);
-                    // FIXME: testing if tmr was expired isn't quite right -
-                    // we could have had both a wakeup and timer expiration
-                    // racing. It would be more correct to check if we were
-                    // waken by a FUTEX_WAKE. But how?
-                    if (tmr.expired()) {
-                        errno = ETIMEDOUT;
-                        return -1;
-                    }
-                } else {
-                    q.wait(queues_mutex);
-                }
-                return 0;
-            } else {
-                errno = EWOULDBLOCK;
-                return -1;
-            }
-        }
-    case FUTEX_WAKE:
-        if(val < 0) {
-            errno = EINVAL;
-            return -1;
-        }
-
-        WITH_LOCK(queues_mutex) {
-            auto i = queues.find(uaddr);
-            if (i != queues.end()) {
-                int waken = 0;
-                while( (val > waken) && !(i->second.empty()) ) {
-                    i->second.wake_one(queues_mutex);
-                    waken++;
-                }
-                if(i->second.empty()) {
-                    queues.erase(i);
-                }
-                return waken;
-            }
-        }
-        return 0;
-    default:
-        abort("Unimplemented futex() operation %d\n", op);
-    }
-}
+        int *uaddr2, uint32_t val3);
 
 #if CONF_core_syscall
 // We're not supposed to export the get_mempolicy() function, as this
@@ -166,48 +85,160 @@ int futex(int *uaddr, int op, int val, const struct timespec *timeout,
 // implementation of get_mempolicy() calls syscall(__NR_get_mempolicy,...),
 // so this is what we need to expose, below.
 
-#define MPOL_DEFAULT 0
+#define MPOL_DEFAULT        0
+#define MPOL_PREFERRED      1
+#define MPOL_BIND           2
+#define MPOL_INTERLEAVE     3
+#define MPOL_LOCAL          4
+#define MPOL_F_STATIC_NODES   (1<<15)
+#define MPOL_F_RELATIVE_NODES (1<<14)
 #define MPOL_F_NODE         (1<<0)
 #define MPOL_F_ADDR         (1<<1)
 #define MPOL_F_MEMS_ALLOWED (1<<2)
 
 #if CONF_syscall_get_mempolicy
-static long get_mempolicy(int *policy, unsigned long *nmask,
-        unsigned long maxnode, void *addr, int flags)
+static long report_nodes(u64 nodes, unsigned long *nmask, unsigned long maxnode)
 {
-    // As OSv has no support for NUMA nodes, we do here the minimum possible,
-    // which is basically to return the same policy (MPOL_DEFAULT) and list
-    // of nodes (just node 0) no matter if the caller asked for the default
-    // policy, the allowed policy, or the policy for a specific address.
-    if ((flags & MPOL_F_NODE)) {
-        *policy = 0; // in this case, store a node id, not a policy
+    if (!nmask) {
         return 0;
     }
+    if (maxnode < memory::numa_nodes()) {
+        errno = EINVAL;
+        return -1;
+    }
+    constexpr unsigned bits = 8 * sizeof(*nmask);
+    std::fill(nmask, nmask + (maxnode + bits - 1) / bits, 0);
+    for (unsigned node = 0; node < memory::numa_nodes(); node++) {
+        if (nodes & (1ULL << node)) {
+            nmask[node / bits] |= 1UL << (node % bits);
+        }
+    }
+    return 0;
+}
+
+static long report_policy(const memory::numa_policy& p, int *policy,
+        unsigned long *nmask, unsigned long maxnode)
+{
     if (policy) {
-        *policy = MPOL_DEFAULT;
+        switch (p.m) {
+        case memory::numa_policy::mode::local:      *policy = MPOL_DEFAULT; break;
+        case memory::numa_policy::mode::preferred:  *policy = MPOL_PREFERRED; break;
+        case memory::numa_policy::mode::bind:       *policy = MPOL_BIND; break;
+        case memory::numa_policy::mode::interleave: *policy = MPOL_INTERLEAVE; break;
+        }
     }
-    if (nmask) {
-        if (maxnode < 1) {
+    return report_nodes(p.nodes, nmask, maxnode);
+}
+
+static long get_mempolicy(int *policy, unsigned long *nmask,
+        unsigned long maxnode, void *addr, int flags)
+{
+    if (flags & MPOL_F_MEMS_ALLOWED) {
+        if (flags & (MPOL_F_NODE | MPOL_F_ADDR)) {
             errno = EINVAL;
             return -1;
         }
-        nmask[0] |= 1;
+        return report_nodes(~0ULL, nmask, maxnode);
+    }
+    if ((flags & MPOL_F_NODE)) {
+        // In this case, store a node id, not a policy
+        int node = memory::numa_current_node();
+        if (flags & MPOL_F_ADDR) {
+            // The node of the page at addr, which we fault in like Linux does
+            if (!mmu::isreadable(addr, 1)) {
+                errno = EFAULT;
+                return -1;
+            }
+            node = memory::numa_node_of(mmu::phys_to_virt(mmu::virt_to_phys(addr)));
+        }
+        if (policy) {
+            *policy = node;
+        }
+        return 0;
+    }
+    if (flags & MPOL_F_ADDR) {
+        memory::numa_policy p;
+        if (!mmu::get_numa_policy(addr, p)) {
+            errno = EFAULT;
+            return -1;
+        }
+        return report_policy(p, policy, nmask, maxnode);
+    }
+    return report_policy(memory::thread_numa_policy(), policy, nmask, maxnode);
+}
+#endif
+
+#if CONF_syscall_set_mempolicy || CONF_syscall_mbind
+// Like Linux, only looks at the first maxnode - 1 bits of nmask. Nodes
+// which do not exist are ignored.
+static bool to_numa_policy(int mode, const unsigned long *nmask,
+        unsigned long maxnode, memory::numa_policy& policy)
+{
+    constexpr unsigned bits = 8 * sizeof(*nmask);
+    u64 nodes = 0;
+    for (unsigned node = 0; nmask && node + 1 < maxnode && node < memory::numa_nodes(); node++) {
+        if (nmask[node / bits] & (1UL << (node % bits))) {
+            nodes |= 1ULL << node;
+        }
+    }
+    policy = memory::numa_policy();
+    switch (mode & ~(MPOL_F_STATIC_NODES | MPOL_F_RELATIVE_NODES)) {
+    case MPOL_DEFAULT:
+    case MPOL_LOCAL:
+        return nodes == 0;
+    case MPOL_PREFERRED:
+        // No node means the local one
+        if (nodes) {
+            policy.m = memory::numa_policy::mode::preferred;
+            policy.nodes = nodes;
+        }
+        return true;
+    case MPOL_BIND:
+        policy.m = memory::numa_policy::mode::bind;
+        policy.nodes = nodes;
+        return nodes != 0;
+    case MPOL_INTERLEAVE:
+        policy.m = memory::numa_policy::mode::interleave;
+        policy.nodes = nodes;
+        return nodes != 0;
+    default:
+        return false;
     }
-    return 0;
 }
 #endif
 
 #if CONF_syscall_set_mempolicy
+// The policy applies to the anonymous memory the thread touches first and
+// which has no policy of its own set with mbind()
 static long set_mempolicy(int policy, unsigned long *nmask,
         unsigned long maxnode)
 {
-    // OSv has very minimal support for NUMA - merely exposes
-    // all cpus as a single node0 and cannot really apply any meaningful policy
-    // Therefore we implement this as noop, ignore all arguments and return success
+    memory::numa_policy p;
+    if (!to_numa_policy(policy, nmask, maxnode, p)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memory::thread_numa_policy() = p;
     return 0;
 }
 #endif
 
+#if CONF_syscall_mbind
+// Pages which are already there are not moved, so MPOL_MF_MOVE and
+// MPOL_MF_STRICT are accepted but have no effect
+static long mbind(void *addr, unsigned long len, int mode,
+        const unsigned long *nmask, unsigned long maxnode, unsigned flags)
+{
+    memory::numa_policy p;
+    if (reinterpret_cast<uintptr_t>(addr) & (mmu::page_size - 1) ||
+            !to_numa_policy(mode, nmask, maxnode, p)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return mmu::set_numa_policy(addr, align_up(len, mmu::page_size), p).to_libc();
+}
+#endif
+
 #if CONF_syscall_sys_sched_getaffinity
 // As explained in the sched_getaffinity(2) manual page, the interface of the
 // sched_getaffinity() function is slightly different than that of the actual
@@ -445,7 +476,7 @@ static long sys_getcpu(unsigned int *cpu, unsigned int *node, void *tcache)
     }
 
     if (node) {
-       *node = 0;
+       *node = sched::cpu::current()->numa_node;
     }
 
     return 0;
@@ -692,6 +723,60 @@ static long sys_brk(void *addr)
 }
 #endif
 
+#if CONF_syscall_sys_io_setup || CONF_syscall_sys_io_destroy || CONF_syscall_sys_io_submit || \
+    CONF_syscall_sys_io_getevents || CONF_syscall_sys_io_cancel
+// The libaio functions return -errno like the raw system calls on Linux
+// do, so convert it to what syscall() is expected to return
+static long aio_syscall_ret(long ret)
+{
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return ret;
+}
+#endif
+
+#if CONF_syscall_sys_io_setup
+#define __NR_sys_io_setup __NR_io_setup
+static long sys_io_setup(unsigned nr_events, io_context_t *ctxp)
+{
+    return aio_syscall_ret(io_setup(nr_events, ctxp));
+}
+#endif
+
+#if CONF_syscall_sys_io_destroy
+#define __NR_sys_io_destroy __NR_io_destroy
+static long sys_io_destroy(io_context_t ctx)
+{
+    return aio_syscall_ret(io_destroy(ctx));
+}
+#endif
+
+#if CONF_syscall_sys_io_submit
+#define __NR_sys_io_submit __NR_io_submit
+static long sys_io_submit(io_context_t ctx, long nr, struct iocb **iocbpp)
+{
+    return aio_syscall_ret(io_submit(ctx, nr, iocbpp));
+}
+#endif
+
+#if CONF_syscall_sys_io_getevents
+#define __NR_sys_io_getevents __NR_io_getevents
+static long sys_io_getevents(io_context_t ctx, long min_nr, long nr, struct io_event *events, struct timespec *timeout)
+{
+    return aio_syscall_ret(io_getevents(ctx, min_nr, nr, events, timeout));
+}
+#endif
+
+#if CONF_syscall_sys_io_cancel
+#define __NR_sys_io_cancel __NR_io_cancel
+static long sys_io_cancel(io_context_t ctx, struct iocb *iocb, struct io_event *result)
+{
+    return aio_syscall_ret(io_cancel(ctx, iocb, result));
+}
+#endif
+
 #define __NR_utimensat4 __NR_utimensat
 extern int utimensat4(int dirfd, const char *pathname, const struct timespec times[2], int flags);
 #endif
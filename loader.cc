@@ -31,6 +31,7 @@
 #include "arch-setup.hh"
 #include "osv/trace.hh"
 #include <osv/strace.hh>
+#include <osv/tracecontrol.hh>
 #include <osv/power.hh>
 #include <osv/rcu.hh>
 #include <osv/mempool.hh>
@@ -156,6 +157,9 @@ static bool opt_list_tracepoints = false;
 #if CONF_tracepoints_strace
 static bool opt_strace = false;
 #endif
+#if CONF_tracepoints_stream
+static std::string opt_trace_stream;
+#endif
 #endif
 static bool opt_mount = true;
 static bool opt_pivot = true;
@@ -196,6 +200,10 @@ static void usage()
 #if CONF_tracepoints_strace
         "  --strace              start a thread to print tracepoints to the console on the fly\n"
 #endif
+#if CONF_tracepoints_stream
+        "  --trace-stream=arg    stream the trace buffers to the given file, or to the console\n"
+        "                        with 'console', instead of keeping only the last records\n"
+#endif
 #endif
 #if CONF_memory_tracker
         "  --leak                start leak detector after boot\n"
@@ -288,6 +296,12 @@ static void parse_options(int loader_argc, char** loader_argv)
     if (extract_option_flag(options_values, "trace-list")) {
         opt_list_tracepoints = true;
     }
+
+#if CONF_tracepoints_stream
+    if (options::option_value_exists(options_values, "trace-stream")) {
+        opt_trace_stream = options::extract_option_value(options_values, "trace-stream");
+    }
+#endif
 #endif
 
     if (extract_option_flag(options_values, "verbose")) {
@@ -717,6 +731,13 @@ void* do_main_thread(void *_main_args)
         }
     }
 
+#if CONF_tracepoints_stream
+    // Only now the file system to stream to is mounted
+    if (!opt_trace_stream.empty() && !trace::start_trace_stream(opt_trace_stream)) {
+        debug("Could not start streaming the trace.\n");
+    }
+#endif
+
     auto commands = prepare_commands(app_cmdline);
 
     // Run command lines in /init/* before the manual command line
@@ -23,6 +23,9 @@ void free_contiguous_aligned(void* p);
 #include <ext4_fs.h>
 #include <ext4_super.h>
 
+#include <fs/vfs/vfs_id.h>
+
+#include <atomic>
 #include <cstdlib>
 #include <cstddef>
 #include <cstdio>
@@ -38,6 +41,10 @@ extern "C" bool is_linear_mapped(const void *addr);
 
 int ext_init(void) { return 0;}
 
+// Counts mounts, so that pages cached for a previous mount of the
+// filesystem are never mistaken for pages of the current one
+static std::atomic<long> ext_mounts(0);
+
 static int blockdev_open(struct ext4_blockdev *bdev)
 {
     return EOK;
@@ -207,6 +214,10 @@ ext_mount(struct mount *mp, const char *dev, int flags, const void *data)
 
     ext_blockdev.fs = &ext_fs;
     mp->m_data = &ext_fs;
+    ext_mounts += 1;
+    mp->m_fsid.__val[0] = ext_mounts.load();
+    mp->m_fsid.__val[1] = EXT_ID >> 32;
+    mp->m_flags |= MNT_LOCAL;
     mp->m_root->d_vnode->v_ino = EXT4_INODE_ROOT_INDEX;
     mp->m_root->d_vnode->v_type = VDIR;
     //Enable write-back cache to optimize reading and writing of metadata blocks
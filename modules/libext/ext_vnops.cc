@@ -15,6 +15,10 @@
 //In effect, this vnops implementation bypasses the ext4.c layer of the lwext4
 //library and interacts with lower-layer functions like ext4_block_*(), ext4_dir_*(),
 //ext4_fs_*() and ext4_inode_*() in a similar way the original ext4.c does.
+//The file data however does not go through lwext4 at all: it is mapped to the
+//blocks on the device a run (extent) at a time and transferred with bios sent
+//straight to the device (see ext_data_io), so only metadata goes through the
+//lwext4 block cache and its lock.
 //
 //The libext does not implement journal (we can integrate it later and make it optional)
 //nor xattr which is not even supported by OSv VFS layer.
@@ -28,9 +32,15 @@ extern "C" {
 #include <osv/debug.h>
 #include <osv/file.h>
 #include <osv/vnode_attr.h>
+#include <osv/bio.h>
 
 void* alloc_contiguous_aligned(size_t size, size_t align);
 void free_contiguous_aligned(void* p);
+
+void* osv_pagecache_alloc_page();
+void osv_pagecache_free_page(void* page);
+void osv_pagecache_map_page(void* key, void* page);
+void osv_pagecache_invalidate(dev_t dev, ino_t ino, off_t offset, off_t size);
 }
 
 #include <ext4_errno.h>
@@ -39,6 +49,7 @@ void free_contiguous_aligned(void* p);
 #include <ext4_fs.h>
 #include <ext4_dir_idx.h>
 #include <ext4_trans.h>
+#include <ext4_extent.h>
 
 #include <cstdlib>
 #include <time.h>
@@ -47,6 +58,7 @@ void free_contiguous_aligned(void* p);
 
 #include <algorithm>
 #include <set>
+#include <vector>
 
 //#define CONF_debug_ext 1
 #if CONF_debug_ext
@@ -74,10 +86,14 @@ struct auto_inode_ref {
 struct ext_vdata {
     int ref_count;
     bool delete_on_last_close;
+    //Set once a page of the file has been read into the page cache, after
+    //which writes and truncation have to drop the pages they change
+    bool page_cached;
 
     ext_vdata() {
         ref_count = 0;
         delete_on_last_close = false;
+        page_cached = false;
     }
 };
 
@@ -108,6 +124,157 @@ typedef	struct vattr vattr_t;
     } \
 }
 
+//Maximum size of a single bio sent by ext_data_io, so that a long run of
+//blocks is split into several bios the device can work on in parallel
+#define EXT_MAX_BIO_SIZE (256 * 1024)
+//Maximum size of the buffer ext_read() and ext_write() move the data through
+#define EXT_MAX_BOUNCE_SIZE (4 * 1024 * 1024)
+
+//Transfers file data between memory and the device with bios sent straight
+//to the device, bypassing lwext4 and its block cache. Runs of blocks that
+//are contiguous both on the device and in memory are merged, and all bios
+//stay in flight until wait() is called, instead of one synchronous request
+//per run.
+class ext_data_io {
+public:
+    ext_data_io(struct ext4_fs *fs, bool read) :
+        _dev((struct device*)fs->bdev->bdif->p_user),
+        _block_size(ext4_sb_get_block_size(&fs->sb)),
+        _part_offset(fs->bdev->part_offset),
+        _read(read) {}
+    ~ext_data_io() {
+        //Only wait for the bios already sent on an error path
+        _count = 0;
+        wait();
+    }
+
+    //Queues the transfer of count blocks starting at fblock to or from buf,
+    //which must be linear mapped
+    int add(ext4_fsblk_t fblock, uint32_t count, uint8_t *buf)
+    {
+        if (_count && _fblock + _count == fblock && _buf + (uint64_t)_count * _block_size == buf) {
+            _count += count;
+            return EOK;
+        }
+        int r = submit();
+        _fblock = fblock;
+        _count = count;
+        _buf = buf;
+        return r;
+    }
+
+    //Sends what is still queued and waits for all transfers to complete,
+    //returns the first error
+    int wait()
+    {
+        int r = submit();
+        for (auto bio : _bios) {
+            int error = bio_wait(bio);
+            if (r == EOK) {
+                r = error;
+            }
+            destroy_bio(bio);
+        }
+        _bios.clear();
+        return r;
+    }
+private:
+    int submit()
+    {
+        uint64_t offset = _part_offset + _fblock * _block_size;
+        uint64_t size = (uint64_t)_count * _block_size;
+        _count = 0;
+        while (size) {
+            struct bio *bio = alloc_bio();
+            if (!bio)
+                return ENOMEM;
+
+            bio->bio_cmd = _read ? BIO_READ : BIO_WRITE;
+            bio->bio_dev = _dev;
+            bio->bio_offset = offset;
+            bio->bio_bcount = std::min(size, (uint64_t)EXT_MAX_BIO_SIZE);
+            bio->bio_data = _buf;
+            ext_debug("%s %ld bytes at offset %ld\n", _read ? "read" : "write", bio->bio_bcount, offset);
+            _dev->driver->devops->strategy(bio);
+            _bios.push_back(bio);
+
+            offset += bio->bio_bcount;
+            _buf += bio->bio_bcount;
+            size -= bio->bio_bcount;
+        }
+        return EOK;
+    }
+
+    struct device *_dev;
+    uint32_t _block_size;
+    uint64_t _part_offset;
+    bool _read;
+    ext4_fsblk_t _fblock = 0;
+    uint32_t _count = 0;
+    uint8_t *_buf = nullptr;
+    std::vector<struct bio*> _bios;
+};
+
+//Maps up to max_blocks blocks of a file starting at iblock to the run of
+//consecutive blocks on the device that holds them. Sets fblock to the first
+//block of the run, or 0 for a hole, and count to its length. Files with
+//extents get the whole run from one lookup, others are mapped block by block.
+static int
+ext_map_blocks(struct ext4_inode_ref *ref, uint32_t iblock, uint32_t max_blocks,
+    ext4_fsblk_t *fblock, uint32_t *count)
+{
+#if CONFIG_EXTENT_ENABLE
+    if (ext4_sb_feature_incom(&ref->fs->sb, EXT4_FINCOM_EXTENTS) &&
+        ext4_inode_has_flag(ref->inode, EXT4_INODE_FLAG_EXTENTS)) {
+        ext4_fsblk_t start = 0;
+        ext4_lblk_t blocks = 0;
+        int r = ext4_extent_get_blocks(ref, iblock, max_blocks, &start, false, &blocks);
+        if (r != EOK)
+            return r;
+
+        *fblock = start;
+        //The length of a hole is not known, it is mapped a block at a time
+        *count = blocks ? std::min(blocks, max_blocks) : 1;
+        return EOK;
+    }
+#endif
+    ext4_fsblk_t start, next;
+    int r = ext4_fs_get_inode_dblk_idx(ref, iblock, &start, true);
+    if (r != EOK)
+        return r;
+
+    uint32_t blocks = 1;
+    while (blocks < max_blocks) {
+        r = ext4_fs_get_inode_dblk_idx(ref, iblock + blocks, &next, true);
+        if (r != EOK)
+            return r;
+        if (next != (start ? start + blocks : 0))
+            break;
+        blocks++;
+    }
+    *fblock = start;
+    *count = blocks;
+    return EOK;
+}
+
+static dev_t
+ext_fsid(vnode_t *vp)
+{
+    auto *fsid = &vp->v_mount->m_fsid;
+    return ((uint32_t)fsid->__val[0]) | ((dev_t) ((uint32_t)fsid->__val[1]) << 32);
+}
+
+//Drops the pages of the file between offset and offset + size from the
+//page cache after their data has changed
+static void
+ext_invalidate_cached_pages(vnode_t *vp, uint64_t offset, uint64_t size)
+{
+    ext_vdata *vdata = (ext_vdata*) vp->v_data;
+    if (vdata && vdata->page_cached && size) {
+        osv_pagecache_invalidate(ext_fsid(vp), vp->v_ino, offset, size);
+    }
+}
+
 //TODO:
 //Ops:
 // - ext_ioctl
@@ -193,31 +360,34 @@ static int
 ext_internal_read(struct ext4_fs *fs, struct ext4_inode_ref *ref, uint64_t offset, void *buf, size_t size, size_t *rcnt)
 {
     ext4_fsblk_t fblock;
-    ext4_fsblk_t fblock_start;
+    uint32_t fblock_count;
 
     uint8_t *u8_buf = (uint8_t *)buf;
-    int r;
+    int r = EOK;
+
+    if (rcnt)
+        *rcnt = 0;
 
     if (!size)
         return EOK;
 
     struct ext4_sblock *const sb = &fs->sb;
 
-    if (rcnt)
-        *rcnt = 0;
-
     /*Sync file size*/
     uint64_t fsize = ext4_inode_get_size(sb, ref->inode);
+    if (offset >= fsize)
+        return EOK;
 
     uint32_t block_size = ext4_sb_get_block_size(sb);
     size = ((uint64_t)size > (fsize - offset))
         ? ((size_t)(fsize - offset)) : size;
 
     uint32_t iblock_idx = (uint32_t)((offset) / block_size);
-    uint32_t iblock_last = (uint32_t)((offset + size) / block_size);
     uint32_t unalg = (offset) % block_size;
 
-    uint32_t fblock_count = 0;
+    ext_data_io io(fs, true);
+    size_t done = 0;
+
     if (unalg) {
         size_t len =  size;
         if (size > (block_size - unalg))
@@ -242,47 +412,32 @@ ext_internal_read(struct ext4_fs *fs, struct ext4_inode_ref *ref, uint64_t offse
         u8_buf += len;
         size -= len;
         offset += len;
-
-        if (rcnt)
-            *rcnt += len;
+        done += len;
 
         iblock_idx++;
     }
 
-    fblock_start = 0;
     while (size >= block_size) {
-        while (iblock_idx < iblock_last) {
-            r = ext4_fs_get_inode_dblk_idx(ref, iblock_idx,
-                               &fblock, true);
-            if (r != EOK)
-                goto Finish;
-
-            iblock_idx++;
-
-            if (!fblock_start)
-                fblock_start = fblock;
-
-            if ((fblock_start + fblock_count) != fblock)
-                break;
-
-            fblock_count++;
-        }
-
-        ext_debug("ext4_blocks_get_direct: block_start:%ld, block_count:%d\n", fblock_start, fblock_count);
-        r = ext4_blocks_get_direct(fs->bdev, u8_buf, fblock_start,
-                       fblock_count);
+        r = ext_map_blocks(ref, iblock_idx, size / block_size, &fblock, &fblock_count);
         if (r != EOK)
             goto Finish;
 
-        size -= block_size * fblock_count;
-        u8_buf += block_size * fblock_count;
-        offset += block_size * fblock_count;
+        size_t len = (size_t)fblock_count * block_size;
+        if (fblock != 0) {
+            ext_debug("read: block_start:%ld, block_count:%d\n", fblock, fblock_count);
+            r = io.add(fblock, fblock_count, u8_buf);
+            if (r != EOK)
+                goto Finish;
+        } else {
+            memset(u8_buf, 0, len);
+        }
 
-        if (rcnt)
-            *rcnt += block_size * fblock_count;
+        size -= len;
+        u8_buf += len;
+        offset += len;
+        done += len;
 
-        fblock_start = fblock;
-        fblock_count = 1;
+        iblock_idx += fblock_count;
     }
 
     if (size) {
@@ -290,19 +445,25 @@ ext_internal_read(struct ext4_fs *fs, struct ext4_inode_ref *ref, uint64_t offse
         if (r != EOK)
             goto Finish;
 
-        uint64_t off = fblock * block_size;
-        ext_debug("ext4_block_readbytes: off:%ld, size:%ld\n", off, size);
-        r = ext4_block_readbytes(fs->bdev, off, u8_buf, size);
-        if (r != EOK)
-            goto Finish;
+        if (fblock != 0) {
+            uint64_t off = fblock * block_size;
+            ext_debug("ext4_block_readbytes: off:%ld, size:%ld\n", off, size);
+            r = ext4_block_readbytes(fs->bdev, off, u8_buf, size);
+            if (r != EOK)
+                goto Finish;
+        } else {
+            memset(u8_buf, 0, size);
+        }
 
         offset += size;
-
-        if (rcnt)
-            *rcnt += size;
+        done += size;
     }
 
+    r = io.wait();
+
 Finish:
+    if (rcnt && r == EOK)
+        *rcnt = done;
     return r;
 }
 
@@ -335,18 +496,29 @@ ext_read(vnode_t *vp, struct file *fp, uio_t *uio, int ioflag)
 
     // Total read amount is what they requested, or what is left
     uint64_t fsize = ext4_inode_get_size(&fs->sb, inode_ref._ref.inode);
+    if ((uint64_t)uio->uio_offset >= fsize)
+        return 0;
+
+    // The data is moved through a bounded buffer a chunk at a time
     uint64_t read_amt = std::min(fsize - uio->uio_offset, (uint64_t)uio->uio_resid);
-    void *buf = alloc_contiguous_aligned(read_amt, alignof(std::max_align_t));
+    size_t buf_size = std::min(read_amt, (uint64_t)EXT_MAX_BOUNCE_SIZE);
+    void *buf = alloc_contiguous_aligned(buf_size, alignof(std::max_align_t));
 
-    size_t read_count = 0;
-    int ret = ext_internal_read(fs, &inode_ref._ref, uio->uio_offset, buf, read_amt, &read_count);
-    if (ret) {
-        kprintf("[ext_read] Error reading data\n");
-        free(buf);
-        return ret;
-    }
+    int ret = 0;
+    while (read_amt) {
+        size_t len = std::min(read_amt, (uint64_t)buf_size);
+        size_t read_count = 0;
+        ret = ext_internal_read(fs, &inode_ref._ref, uio->uio_offset, buf, len, &read_count);
+        if (ret) {
+            kprintf("[ext_read] Error reading data\n");
+            break;
+        }
 
-    ret = uiomove(buf, read_count, uio);
+        ret = uiomove(buf, read_count, uio);
+        if (ret || read_count < len)
+            break;
+        read_amt -= len;
+    }
     free_contiguous_aligned(buf);
 
     return ret;
@@ -357,10 +529,10 @@ ext_internal_write(struct ext4_fs *fs, struct ext4_inode_ref *ref, uint64_t offs
 {
     ext_debug("[ext4_internal_write] Writing %ld bytes at offset:%ld\n", size, offset);
     ext4_fsblk_t fblock;
-    ext4_fsblk_t fblock_start = 0;
+    uint32_t fblock_count;
 
     uint8_t *u8_buf = (uint8_t *)buf;
-    int r, rr = EOK;
+    int r = EOK, rr;
 
     if (!size)
         return EOK;
@@ -374,13 +546,12 @@ ext_internal_write(struct ext4_fs *fs, struct ext4_inode_ref *ref, uint64_t offs
     uint64_t fsize = ext4_inode_get_size(sb, ref->inode);
     uint32_t block_size = ext4_sb_get_block_size(sb);
 
-    uint32_t iblock_last = (uint32_t)((offset + size) / block_size);
     uint32_t iblk_idx = (uint32_t)(offset / block_size);
     uint32_t ifile_blocks = (uint32_t)((fsize + block_size - 1) / block_size);
 
     uint32_t unalg = (offset) % block_size;
 
-    uint32_t fblock_count = 0;
+    ext_data_io io(fs, false);
 
     if (unalg) {
         size_t len = size;
@@ -433,65 +604,46 @@ ext_internal_write(struct ext4_fs *fs, struct ext4_inode_ref *ref, uint64_t offs
     }
 
     while (size >= block_size) {
-
-        while (iblk_idx < iblock_last) {
-            if (iblk_idx < ifile_blocks) {
-                r = ext4_fs_init_inode_dblk_idx(ref, iblk_idx,
-                                &fblock);
-                if (r != EOK)
-                    goto Finish;
-            } else {
-                rr = ext4_fs_append_inode_dblk(ref, &fblock,
-                                   &iblk_idx);
-                ext_debug("[ext_internal_write] Appended (3) block=%d, phys:%ld\n", iblk_idx, fblock);
-                if (rr != EOK) {
-                    /* Unable to append more blocks. But
-                     * some block might be allocated already
-                     * */
-                    break;
-                }
+        if (iblk_idx < ifile_blocks) {
+            //Blocks that are already there are overwritten a run at a time,
+            //only holes and unwritten extents need lwext4 to initialize them
+            uint32_t max_blocks = std::min((uint64_t)(size / block_size), (uint64_t)(ifile_blocks - iblk_idx));
+            r = ext_map_blocks(ref, iblk_idx, max_blocks, &fblock, &fblock_count);
+            if (r == EOK && fblock == 0) {
+                fblock_count = 1;
+                r = ext4_fs_init_inode_dblk_idx(ref, iblk_idx, &fblock);
             }
-
-            iblk_idx++;
-
-            if (!fblock_start) {
-                fblock_start = fblock;
+            if (r != EOK)
+                goto Finish;
+        } else {
+            r = ext4_fs_append_inode_dblk(ref, &fblock, &iblk_idx);
+            ext_debug("[ext_internal_write] Appended (3) block=%d, phys:%ld\n", iblk_idx, fblock);
+            if (r != EOK) {
+                /* Unable to append more blocks. But
+                 * some block might be allocated already
+                 * and node size should be updated.*/
+                goto out_fsize;
             }
-
-            if ((fblock_start + fblock_count) != fblock)
-                break;
-
-            fblock_count++;
+            fblock_count = 1;
+            ifile_blocks++;
         }
 
-        r = ext4_blocks_set_direct(fs->bdev, u8_buf, fblock_start,
-                       fblock_count);
-        ext_debug("[ext_internal_write] Wrote direct %d blocks at block %ld\n", fblock_count, fblock_start);
+        //Consecutive blocks, appended one by one, are merged into one run
+        r = io.add(fblock, fblock_count, u8_buf);
         if (r != EOK)
-            break;
+            goto Finish;
 
-        size -= block_size * fblock_count;
-        u8_buf += block_size * fblock_count;
-        offset += block_size * fblock_count;
+        size_t len = (size_t)fblock_count * block_size;
+        size -= len;
+        u8_buf += len;
+        offset += len;
 
         if (wcnt)
-            *wcnt += block_size * fblock_count;
-
-        fblock_start = fblock;
-        fblock_count = 1;
+            *wcnt += len;
 
-        if (rr != EOK) {
-            /*ext4_fs_append_inode_block has failed and no
-             * more blocks might be written. But node size
-             * should be updated.*/
-            r = rr;
-            goto out_fsize;
-        }
+        iblk_idx += fblock_count;
     }
 
-    if (r != EOK)
-        goto Finish;
-
     if (size) {
         uint64_t off;
         if (iblk_idx < ifile_blocks) {
@@ -519,6 +671,12 @@ ext_internal_write(struct ext4_fs *fs, struct ext4_inode_ref *ref, uint64_t offs
     }
 
 out_fsize:
+    rr = io.wait();
+    if (rr != EOK) {
+        r = rr;
+        goto Finish;
+    }
+
     if (offset > fsize) {
         ext4_inode_set_size(ref->inode, offset);
         ref->dirty = true;
@@ -569,21 +727,32 @@ ext_write(vnode_t *vp, uio_t *uio, int ioflag)
 
     ext_debug("write: %ld bytes at offset:%ld to file i-node=%ld\n", uio->uio_resid, uio->uio_offset, vp->v_ino);
 
+    // The data is moved through a bounded buffer a chunk at a time
     uio_t uio_copy = *uio;
-    void *buf = alloc_contiguous_aligned(uio->uio_resid, alignof(std::max_align_t));
-    int ret = uiomove(buf, uio->uio_resid, &uio_copy);
-    if (ret) {
-        kprintf("[ext_write] Error copying data\n");
-        free(buf);
-        return ret;
-    }
+    size_t buf_size = std::min((uint64_t)uio->uio_resid, (uint64_t)EXT_MAX_BOUNCE_SIZE);
+    void *buf = alloc_contiguous_aligned(buf_size, alignof(std::max_align_t));
+
+    uint64_t offset = uio->uio_offset;
+    int ret = 0;
+    while (uio_copy.uio_resid) {
+        size_t len = std::min((uint64_t)uio_copy.uio_resid, (uint64_t)buf_size);
+        ret = uiomove(buf, len, &uio_copy);
+        if (ret) {
+            kprintf("[ext_write] Error copying data\n");
+            break;
+        }
 
-    size_t write_count = 0;
-    ret = ext_internal_write(fs, &inode_ref._ref, uio->uio_offset, buf, uio->uio_resid, &write_count);
+        size_t write_count = 0;
+        ret = ext_internal_write(fs, &inode_ref._ref, offset, buf, len, &write_count);
 
-    uio->uio_resid -= write_count;
+        uio->uio_resid -= write_count;
+        offset += write_count;
+        if (ret || write_count < len)
+            break;
+    }
     free_contiguous_aligned(buf);
 
+    ext_invalidate_cached_pages(vp, uio->uio_offset, offset - uio->uio_offset);
     vp->v_size = ext4_inode_get_size(&fs->sb, inode_ref._ref.inode);
 
     return ret;
@@ -1225,8 +1394,8 @@ ext_getattr(vnode_t *vp, vattr_t *vap)
     get_inode_time(inode_ref._ref.inode, vap->va_mtime, modif, extra_avail);
     get_inode_time(inode_ref._ref.inode, vap->va_ctime, change_inode, extra_avail);
 
-    //auto *fsid = &vnode->v_mount->m_fsid; //TODO
-    //attr->va_fsid = ((uint32_t)fsid->__val[0]) | ((dev_t) ((uint32_t)fsid->__val[1]) << 32);
+    //The page cache tells files of different file systems apart by it
+    vap->va_fsid = ext_fsid(vp);
 
     return (EOK);
 }
@@ -1275,8 +1444,23 @@ ext_truncate(struct vnode *vp, off_t new_size)
 {
     ext_debug("truncate i-node=%ld, new_size:%ld\n", vp->v_ino, new_size);
     struct ext4_fs *fs = (struct ext4_fs *)vp->v_mount->m_data;
+    ext_vdata *vdata = (ext_vdata*) vp->v_data;
+    uint64_t old_size = 0;
+    if (vdata && vdata->page_cached) {
+        auto_inode_ref inode_ref(fs, vp->v_ino);
+        if (inode_ref._r != EOK) {
+            return inode_ref._r;
+        }
+        old_size = ext4_inode_get_size(&fs->sb, inode_ref._ref.inode);
+    }
     bool update_cmtimed = false;
     int r = ext_trunc_inode(fs, vp->v_ino, new_size, &update_cmtimed);
+    if (r == EOK) {
+        vp->v_size = new_size;
+    }
+    if ((uint64_t)new_size < old_size) {
+        ext_invalidate_cached_pages(vp, new_size, old_size - new_size);
+    }
     if (update_cmtimed) {
         auto_inode_ref inode_ref(fs, vp->v_ino);
         if (inode_ref._r != EOK) {
@@ -1417,6 +1601,8 @@ ext_inactive(vnode_t *vp)
 {
     if (vp->v_data) {
         ext_debug("inactive i-node=%ld with ref_count=%d\n", vp->v_ino, ((ext_vdata*)vp->v_data)->ref_count);
+        //Nothing maps the file any more, but its pages may still be pinned
+        ext_invalidate_cached_pages(vp, 0, vp->v_size);
         delete (ext_vdata*)vp->v_data;
         vp->v_data = nullptr;
     } else {
@@ -1425,7 +1611,54 @@ ext_inactive(vnode_t *vp)
     return EOK;
 }
 
-#define ext_arc         ((vnop_cache_t)nullptr)
+//Reads a page of a file into memory owned by the page cache when a mapping
+//of the file faults on it (see vfs_file::read_page_from_cache()), which lets
+//all mappings of the file share the page instead of each getting a copy of
+//the data, and MAP_SHARED mappings write back only the pages they dirty.
+//The page is freed by the page cache once it is no longer mapped.
+static int
+ext_map_cached_page(vnode_t *vp, file_t *fp, uio_t *uio)
+{
+    if (vp->v_type == VDIR)
+        return EISDIR;
+
+    if (vp->v_type != VREG)
+        return EINVAL;
+
+    if (uio->uio_offset < 0 || (uio->uio_offset & PAGE_MASK) || uio->uio_resid != PAGE_SIZE)
+        return EINVAL;
+
+    struct ext4_fs *fs = (struct ext4_fs *)vp->v_mount->m_data;
+    auto_inode_ref inode_ref(fs, vp->v_ino);
+    if (inode_ref._r != EOK) {
+        return inode_ref._r;
+    }
+
+    /* Nothing to map past the end of the file */
+    uint64_t fsize = ext4_inode_get_size(&fs->sb, inode_ref._ref.inode);
+    if ((uint64_t)uio->uio_offset >= fsize)
+        return EOK;
+
+    void *page = osv_pagecache_alloc_page();
+    size_t read_count = 0;
+    int r = ext_internal_read(fs, &inode_ref._ref, uio->uio_offset, page, PAGE_SIZE, &read_count);
+    if (r != EOK) {
+        kprintf("[ext_map_cached_page] Error reading data\n");
+        osv_pagecache_free_page(page);
+        return r;
+    }
+    memset((uint8_t *)page + read_count, 0, PAGE_SIZE - read_count);
+
+    ext_vdata *vdata = (ext_vdata*) vp->v_data;
+    if (vdata) {
+        vdata->page_cached = true;
+    }
+    osv_pagecache_map_page(uio->uio_iov->iov_base, page);
+    uio->uio_resid = 0;
+
+    return EOK;
+}
+
 #define ext_seek        ((vnop_seek_t)vop_nullop)
 
 struct vnops ext_vnops = {
@@ -1448,7 +1681,7 @@ struct vnops ext_vnops = {
     ext_inactive,   /* inactive */
     ext_truncate,   /* truncate */
     ext_link,       /* link */
-    ext_arc,        /* arc */
+    ext_map_cached_page, /* arc */
     ext_fallocate,  /* fallocate */
     ext_readlink,   /* read link */
     ext_symlink,    /* symbolic link */
@@ -42,6 +42,21 @@
 # (for files it is a block on a disk, for symlinks and directories it is an
 # offset in one of the 2 tables above)
 ##################################################################################
+#
+# With '-c lz4' the file data is compressed and the image gets version 2 (the
+# super block also records the compression and chunk size). Each file is split
+# into 32K chunks (the size of a ROFS cache segment) and stored as:
+#
+# Chunk index of N+1 64-bit offsets, where N is the number of chunks; chunk i
+# is stored between offsets i and i+1, which are relative to the beginning of
+# the index
+#
+# Chunks, each one compressed independently with LZ4 (block format), or stored
+# as is if it did not get any smaller
+#
+# The file data is padded to 512 bytes block as a whole and the i-node points
+# to the block where the chunk index starts.
+##################################################################################
 
 import os, optparse, io
 from struct import *
@@ -49,12 +64,22 @@ from ctypes import *
 from manifest_common import add_var, expand, unsymlink, read_manifest, defines, strip_file
 
 OSV_BLOCK_SIZE = 512
+CHUNK_SIZE = 32 * 1024
+
+ROFS_VERSION = 1
+ROFS_VERSION_COMPRESSED = 2
+COMPRESSION_NONE = 0
+COMPRESSION_LZ4 = 1
 
 DIR_MODE  = int('0x4000', 16)
 REG_MODE  = int('0x8000', 16)
 LINK_MODE = int('0xA000', 16)
 
 block = 0
+compression = COMPRESSION_NONE
+# Bytes of file data and bytes stored for it, padding included
+file_bytes = 0
+stored_bytes = 0
 
 class SuperBlock(Structure):
     _fields_ = [
@@ -65,7 +90,9 @@ class SuperBlock(Structure):
         ('structure_info_blocks_count', c_ulonglong),
         ('directory_entries_count', c_ulonglong),
         ('symlinks_count', c_ulonglong),
-        ('inodes_count', c_ulonglong)
+        ('inodes_count', c_ulonglong),
+        ('compression', c_ulonglong),
+        ('chunk_size', c_ulonglong)
     ]
 
 # data_offset and count represent different things depending on mode:
@@ -177,6 +204,95 @@ def write_file(fp, path):
 
     return total
 
+# LZ4 block format compressor used when the lz4 module is not installed. It
+# is much slower, but finds the same kind of matches.
+def lz4_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+def lz4_sequence(out, literals, offset, match_length):
+    literals_length = len(literals)
+    token = min(literals_length, 15) << 4
+    if offset:
+        token |= min(match_length - 4, 15)
+    out.append(token)
+    if literals_length >= 15:
+        lz4_length(out, literals_length - 15)
+    out += literals
+    if offset:
+        out += pack('<H', offset)
+        if match_length - 4 >= 15:
+            lz4_length(out, match_length - 4 - 15)
+
+def lz4_compress_block(data):
+    out = bytearray()
+    size = len(data)
+    anchor = 0
+    pos = 0
+    positions = {}
+    # The last match has to start at least 12 bytes and end at least 5 bytes
+    # before the end of the block
+    while pos < size - 12:
+        sequence = data[pos:pos + 4]
+        ref = positions.get(sequence)
+        positions[sequence] = pos
+        if ref is None or pos - ref > 65535:
+            pos += 1
+            continue
+        length = 4
+        max_length = size - 5 - pos
+        while length < max_length and data[ref + length] == data[pos + length]:
+            length += 1
+        lz4_sequence(out, data[anchor:pos], pos - ref, length)
+        pos += length
+        anchor = pos
+    lz4_sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+try:
+    import lz4.block
+    def lz4_compress(data):
+        return lz4.block.compress(data, mode='high_compression', store_size=False)
+except ImportError:
+    lz4_compress = lz4_compress_block
+
+def write_compressed_file(fp, path):
+    global block
+    global file_bytes
+    global stored_bytes
+
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    total = len(data)
+    if total == 0:
+        return 0
+
+    chunks = []
+    for offset in range(0, total, CHUNK_SIZE):
+        chunk = data[offset:offset + CHUNK_SIZE]
+        compressed = lz4_compress(chunk)
+        chunks.append(compressed if len(compressed) < len(chunk) else chunk)
+
+    offsets = [(len(chunks) + 1) * 8]
+    for chunk in chunks:
+        offsets.append(offsets[-1] + len(chunk))
+
+    fp.write(pack('<%dQ' % len(offsets), *offsets))
+    for chunk in chunks:
+        fp.write(chunk)
+
+    stored = offsets[-1]
+    if stored % OSV_BLOCK_SIZE:
+        stored += pad(fp, OSV_BLOCK_SIZE - stored % OSV_BLOCK_SIZE)
+    block += stored // OSV_BLOCK_SIZE
+
+    file_bytes += total
+    stored_bytes += stored
+    return total
+
 def write_inodes(fp):
     global inodes
 
@@ -219,7 +335,10 @@ def write_dir(fp, manifest, dirpath, parent_dir):
                 inode.mode = REG_MODE
                 global block
                 inode.data_offset = block
-                inode.count = write_file(fp, val)
+                if compression == COMPRESSION_LZ4:
+                    inode.count = write_compressed_file(fp, val)
+                else:
+                    inode.count = write_file(fp, val)
                 print('Adding %s' % (dirpath + '/' + entry))
 
     # This needs to be added so that later we can walk the tree
@@ -277,7 +396,12 @@ def gen_image(out, manifest):
     global symlinks
 
     sb = SuperBlock()
-    sb.version = 1
+    if compression == COMPRESSION_NONE:
+        sb.version = ROFS_VERSION
+    else:
+        sb.version = ROFS_VERSION_COMPRESSED
+        sb.compression = compression
+        sb.chunk_size = CHUNK_SIZE
     sb.magic = int('0xDEADBEAD', 16)
     sb.block_size = OSV_BLOCK_SIZE
     sb.structure_info_first_block = system_structure_block
@@ -290,6 +414,9 @@ def gen_image(out, manifest):
     print('Directory entries count %d' % sb.directory_entries_count)
     print('Symlinks count %d' % sb.symlinks_count)
     print('Inodes count %d' % sb.inodes_count)
+    if compression != COMPRESSION_NONE:
+        print('Compressed %d bytes of file data into %d bytes (%.1f%%)' %
+              (file_bytes, stored_bytes, 100.0 * stored_bytes / max(file_bytes, 1)))
 
     fp.seek(0)
     fp.write(sb)
@@ -347,6 +474,12 @@ def main():
                         dest='manifest',
                         help='read manifest from FILE',
                         metavar='FILE'),
+            make_option('-c',
+                        dest='compression',
+                        choices=['none', 'lz4'],
+                        default='none',
+                        help='compress file data with METHOD (none or lz4)',
+                        metavar='METHOD'),
             make_option('-D',
                         type='string',
                         help='define VAR=DATA',
@@ -357,6 +490,10 @@ def main():
 
     (options, args) = opt.parse_args()
 
+    global compression
+    if options.compression == 'lz4':
+        compression = COMPRESSION_LZ4
+
     manifest = read_manifest(options.manifest)
 
     outfile = os.path.abspath(options.output)
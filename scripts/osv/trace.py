@@ -366,6 +366,7 @@ class TraceDumpReader(TraceDumpReaderBase) :
     def __init__(self, filename):
         self.tracepoints = {}
         self.trace_buffers = []
+        self.dropped = []
         TraceDumpReaderBase.__init__(self, filename)
 
     def readStruct(self, tag, size):
@@ -375,6 +376,10 @@ class TraceDumpReader(TraceDumpReaderBase) :
             data = self.file.read(size)
             self.trace_buffers.append(data)
             return True
+        elif tag == 0x44524F50: # 'DROP', only in streams
+            n_cpus = self.read('I')
+            self.dropped = [self.read('Q') for i in range(0, n_cpus)]
+            return True
         else:
             return False
 
@@ -200,6 +200,15 @@ def start_osv_qemu(options):
         "-object", "memory-backend-file,id=mem,size=%s,mem-path=/dev/shm,share=on" % options.memsize,
         "-numa", "node,memdev=mem"]
 
+    if options.vsock_cid:
+        # vhost-vsock is a modern only device, whatever --virtio says
+        args += [
+        "-device", "vhost-vsock-pci,id=vsock0,guest-cid=%d" % options.vsock_cid]
+
+    if options.balloon:
+        args += [
+        "-device", "virtio-balloon-pci,id=balloon0,deflate-on-oom=on,free-page-reporting=on%s" % options.virtio_device_suffix]
+
     if options.second_nvme_image:
         args += [
         "-drive", "file=%s,if=none,id=nvm1" % (options.second_nvme_image),
@@ -634,6 +643,8 @@ if __name__ == "__main__":
                         help="path to loader-stripped.elf. defaults to build/$mode/loader-stripped.elf")
     parser.add_argument("--virtio", action="store", choices=["legacy","transitional","modern"], default="transitional",
                         help="specify virtio version: legacy, transitional or modern")
+    parser.add_argument("--packed-ring", action="store_true",
+                        help="offer the packed virtqueue layout on modern virtio devices")
     parser.add_argument("--arch", action="store", choices=["x86_64","aarch64"], default=host_arch,
                         help="specify QEMU architecture: x86_64, aarch64")
     parser.add_argument("--virtio-fs-tag", action="store",
@@ -642,6 +653,10 @@ if __name__ == "__main__":
                         help="path to the directory exposed via virtio-fs mount")
     parser.add_argument("--virtio-fs-dax", action="store",
                         help="DAX window size for virtio-fs device (disabled if not specified)")
+    parser.add_argument("--balloon", action="store_true",
+                        help="add a virtio-balloon device with deflate on OOM and free page reporting")
+    parser.add_argument("--vsock-cid", action="store", type=int,
+                        help="add a virtio-vsock device with the given guest CID (3 or higher, needs /dev/vhost-vsock)")
     parser.add_argument("--mount-fs", default=[], action="append",
                         help="extra mounts (forwarded to respective kernel command line option)")
     parser.add_argument("--ip", default=[], action="append",
@@ -691,6 +706,9 @@ if __name__ == "__main__":
     else:
         cmdargs.virtio_device_suffix = ""
 
+    if cmdargs.packed_ring:
+        cmdargs.virtio_device_suffix += ",packed=on"
+
     if cmdargs.networking and cmdargs.tap and (cmdargs.execute == None or '--ip=' not in cmdargs.execute):
         process = subprocess.run(["ip", "address", "show", cmdargs.tap], stdout=subprocess.PIPE)
         if process.returncode != 0:
@@ -8,6 +8,7 @@ import os
 
 import tests.test_net as test_net
 import tests.test_tracing as test_tracing
+import tests.test_virtio as test_virtio
 
 from operator import attrgetter
 from tests.testing import *
@@ -30,11 +31,13 @@ qemu_disabled_list= [
 
 firecracker_disabled_list= [
     "tracing_smoke_test",
+    "virtio_blk_packed_ring_test",
     "tcp_close_without_reading_on_qemu"
 ]
 
 linux_ld_disabled_list= [
     "tracing_smoke_test",
+    "virtio_blk_packed_ring_test",
     "tcp_close_without_reading_on_fc",
     "tcp_close_without_reading_on_qemu"
 ]
@@ -203,6 +206,7 @@ if __name__ == "__main__":
 
     test_net.set_arch(cmdargs.arch)
     test_tracing.set_arch(cmdargs.arch)
+    test_virtio.set_arch(cmdargs.arch)
 
     disabled_list.extend(cmdargs.disabled_list)
     main()
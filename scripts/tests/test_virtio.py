@@ -0,0 +1,24 @@
+from tests.testing import *
+import os
+
+arch = os.uname().machine
+def set_arch(_arch):
+    global arch
+    arch = _arch
+
+@test
+def virtio_blk_packed_ring_test():
+    global arch
+    run_args = ['--virtio', 'modern', '--packed-ring']
+    if os.uname().machine != arch:
+        run_args += ['--arch', arch]
+    path = '/tmp/packed-ring.tmp'
+    guest = Guest(['--verbose', '-e', '/tests/misc-concurrent-io.so setup %s 1; '
+                   '/tests/misc-concurrent-io.so read-diff-ranges %s 1' % (path, path)],
+        hold_with_poweroff=True, run_py_args=run_args)
+    try:
+        wait_for_line_contains(guest, 'packed ring')
+        wait_for_line_contains(guest, 'setup phase finished successfully!')
+        wait_for_line_starts(guest, 'Duration <')
+    finally:
+        guest.kill()
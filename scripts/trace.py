@@ -5,6 +5,8 @@ import argparse
 import re
 import os
 import math
+import base64
+import tempfile
 import subprocess
 import requests
 
@@ -687,6 +689,32 @@ def convert_dump(args):
         print("error: %s not found" % (args.dumpfile))
         sys.exit(1)
 
+def convert_stream(args):
+    if not os.path.isfile(args.streamfile):
+        print("error: %s not found" % (args.streamfile))
+        sys.exit(1)
+    if os.path.exists(args.tracefile):
+        os.remove(args.tracefile)
+    print("Converting stream %s -> %s" % (args.streamfile, args.tracefile))
+    with open(args.streamfile, 'rb') as f:
+        is_dump = f.read(4) in (b'TVSO', b'OSVT')
+    if is_dump:
+        td = trace.TraceDumpReader(args.streamfile)
+    else:
+        # A console log, the stream is in the lines with the prefix
+        prefix = b'OSVTRACE '
+        with tempfile.NamedTemporaryFile() as dump:
+            with open(args.streamfile, 'rb') as log:
+                for line in log:
+                    pos = line.find(prefix)
+                    if pos >= 0:
+                        dump.write(base64.b64decode(line[pos + len(prefix):].strip()))
+            dump.flush()
+            td = trace.TraceDumpReader(dump.name)
+    trace.write_to_file(args.tracefile, list(td.traces()))
+    if any(td.dropped):
+        print("%d records dropped (per cpu: %s)" % (sum(td.dropped), ' '.join(str(d) for d in td.dropped)))
+
 def download_dump(args):
     if os.path.exists(args.tracefile):
         os.remove(args.tracefile)
@@ -854,6 +882,18 @@ if __name__ == "__main__":
                                   default="buffers")
     cmd_convert_dump.set_defaults(func=convert_dump, paginate=False)
 
+    cmd_convert_stream = subparsers.add_parser("convert-stream", help="convert trace stream file"
+                                             , description="""
+                                             Converts a trace stream, written by an OSv started with
+                                             --trace-stream, to trace listing format. The stream can be
+                                             the file it was written to or a console log.
+                                             """)
+    add_trace_source_options(cmd_convert_stream)
+    cmd_convert_stream.add_argument("-f", "--streamfile", action="store",
+                                    help="Trace stream file or console log",
+                                    default="trace-stream")
+    cmd_convert_stream.set_defaults(func=convert_stream, paginate=False)
+
     cmd_download_dump = subparsers.add_parser("download", help="download trace dump file (REST)"
                                              , description="""
                                              Downloads a trace dump via REST Api
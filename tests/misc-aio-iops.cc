@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// A small fio-like benchmark of Linux native AIO: a single thread keeps
+// queue_depth random 4K O_DIRECT reads in flight against a block device
+// using io_submit()/io_getevents(), and reports IOPS and average latency
+// for queue depths 1, 2, 4, ... up to 128. When AIO is emulated with
+// synchronous I/O the IOPS stay flat as the queue depth grows; with requests
+// submitted to the device asynchronously they should scale until the
+// device (or its queues) saturate. With "eventfd" the completions are
+// waited for through an eventfd, like event-loop based servers do.
+//
+// The device is only read from. To compile on Linux, use:
+// g++ -O2 -std=c++11 tests/misc-aio-iops.cc -o misc-aio-iops
+//
+// Usage: misc-aio-iops.so [device] [seconds_per_run] [max_queue_depth] [eventfd]
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static constexpr size_t block_size = 4096;
+
+static long io_setup(unsigned nr, aio_context_t *ctx)
+{
+    return syscall(SYS_io_setup, nr, ctx);
+}
+
+static long io_destroy(aio_context_t ctx)
+{
+    return syscall(SYS_io_destroy, ctx);
+}
+
+static long io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+    return syscall(SYS_io_submit, ctx, nr, iocbpp);
+}
+
+static long io_getevents(aio_context_t ctx, long min_nr, long max_nr,
+                         struct io_event *events, struct timespec *timeout)
+{
+    return syscall(SYS_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
+struct result {
+    double iops;
+    double latency_us;
+};
+
+static bool run(int fd, int efd, uint64_t nblocks, int depth, double secs, result& res)
+{
+    aio_context_t ctx = 0;
+    if (io_setup(depth, &ctx) < 0) {
+        std::cerr << "io_setup failed: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    std::mt19937_64 rng(depth);
+    std::uniform_int_distribution<uint64_t> pick(0, nblocks - 1);
+    std::vector<struct iocb> iocbs(depth);
+    std::vector<struct iocb*> ptrs(depth);
+    std::vector<std::chrono::steady_clock::time_point> started(depth);
+    std::vector<struct io_event> events(depth);
+    std::vector<void*> bufs(depth);
+    for (int i = 0; i < depth; i++) {
+        posix_memalign(&bufs[i], block_size, block_size);
+        memset(&iocbs[i], 0, sizeof(iocbs[i]));
+        iocbs[i].aio_data = i;
+        iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+        iocbs[i].aio_fildes = fd;
+        iocbs[i].aio_buf = (uintptr_t)bufs[i];
+        iocbs[i].aio_nbytes = block_size;
+        if (efd >= 0) {
+            iocbs[i].aio_flags = IOCB_FLAG_RESFD;
+            iocbs[i].aio_resfd = efd;
+        }
+    }
+
+    auto prepare = [&](int i) {
+        iocbs[i].aio_offset = pick(rng) * block_size;
+        ptrs[i] = &iocbs[i];
+        started[i] = std::chrono::steady_clock::now();
+    };
+
+    for (int i = 0; i < depth; i++) {
+        prepare(i);
+    }
+    bool ok = io_submit(ctx, depth, ptrs.data()) == depth;
+    if (!ok) {
+        std::cerr << "io_submit failed: " << strerror(errno) << "\n";
+    }
+
+    long completed = 0, inflight = depth;
+    double total_latency = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(secs);
+    while (ok && inflight) {
+        if (efd >= 0) {
+            uint64_t n;
+            if (read(efd, &n, sizeof(n)) != sizeof(n)) {
+                std::cerr << "eventfd read failed: " << strerror(errno) << "\n";
+                ok = false;
+                break;
+            }
+        }
+        long n = io_getevents(ctx, efd >= 0 ? 0 : 1, depth, events.data(), nullptr);
+        if (n < 0) {
+            std::cerr << "io_getevents failed: " << strerror(errno) << "\n";
+            ok = false;
+            break;
+        }
+        auto now = std::chrono::steady_clock::now();
+        int resubmit = 0;
+        for (long e = 0; e < n; e++) {
+            int i = events[e].data;
+            if (events[e].res != (long)block_size) {
+                std::cerr << "read failed: " << strerror(-events[e].res) << "\n";
+                ok = false;
+            }
+            total_latency += std::chrono::duration<double>(now - started[i]).count();
+            completed++;
+            inflight--;
+            if (now < end) {
+                prepare(i);
+                ptrs[resubmit++] = &iocbs[i];
+            }
+        }
+        if (ok && resubmit) {
+            if (io_submit(ctx, resubmit, ptrs.data()) != resubmit) {
+                std::cerr << "io_submit failed: " << strerror(errno) << "\n";
+                ok = false;
+                break;
+            }
+            inflight += resubmit;
+        }
+    }
+    // Drain whatever is still in flight after an error
+    while (inflight > 0) {
+        long n = io_getevents(ctx, 1, depth, events.data(), nullptr);
+        if (n <= 0) {
+            break;
+        }
+        inflight -= n;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    io_destroy(ctx);
+    for (auto buf : bufs) {
+        free(buf);
+    }
+    res.iops = completed / elapsed;
+    res.latency_us = completed ? total_latency / completed * 1e6 : 0;
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    std::string dev = argc > 1 ? argv[1] : "/dev/vblk0";
+    double secs = argc > 2 ? atof(argv[2]) : 2.0;
+    int max_depth = argc > 3 ? atoi(argv[3]) : 128;
+    bool use_eventfd = argc > 4 && std::string(argv[4]) == "eventfd";
+    if (secs <= 0 || max_depth <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [device] [seconds_per_run] [max_queue_depth] [eventfd]\n";
+        return 1;
+    }
+
+    int fd = open(dev.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << dev << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    uint64_t size = 0;
+    if (ioctl(fd, BLKGETSIZE64, &size) < 0 || size < block_size) {
+        std::cerr << "Failed to get the size of " << dev << "\n";
+        return 1;
+    }
+    int efd = -1;
+    if (use_eventfd) {
+        efd = eventfd(0, 0);
+        if (efd < 0) {
+            std::cerr << "eventfd failed: " << strerror(errno) << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "Random " << block_size / 1024 << "K reads from " << dev
+              << (use_eventfd ? " (eventfd)" : "") << "\n";
+    std::cout << std::setw(8) << "depth" << std::setw(14) << "IOPS"
+              << std::setw(16) << "latency (us)" << "\n";
+    for (int depth = 1; depth <= max_depth; depth *= 2) {
+        result res;
+        if (!run(fd, efd, size / block_size, depth, secs, res)) {
+            return 1;
+        }
+        std::cout << std::setw(8) << depth << std::fixed << std::setprecision(0)
+                  << std::setw(14) << res.iops << std::setprecision(1)
+                  << std::setw(16) << res.latency_us << "\n";
+    }
+
+    if (efd >= 0) {
+        close(efd);
+    }
+    close(fd);
+    return 0;
+}
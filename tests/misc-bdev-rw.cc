@@ -1,5 +1,8 @@
 #include <iostream>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
 
 #include <osv/device.h>
 #include <osv/bio.h>
@@ -17,6 +20,11 @@ dd if=/dev/zero of=/tmp/test1.raw bs=1M count=512
 qemu-img convert -O qcow2 /tmp/test1.raw /tmp/test1.img
 
 ./scripts/run.py -e '/tests/misc-bdev-rw.so vblk1' --cloud-init-image /tmp/test1.img
+
+An optional second argument sets the number of threads submitting the
+requests, which exercises multi-queue drivers:
+
+./scripts/run.py -c 4 -e '/tests/misc-bdev-rw.so vblk1 4' --cloud-init-image /tmp/test1.img
 */
 
 using namespace std;
@@ -24,6 +32,8 @@ using namespace std;
 atomic<int> bio_inflights(0);
 atomic<bool> test_failed(false);
 vector<struct bio *> done_wbio;
+// Completions may be delivered concurrently on different queues
+mutex done_wbio_lock;
 
 static void fill_buffer(void *buff, size_t len)
 {
@@ -80,7 +90,10 @@ static void wbio_done(struct bio* wbio)
         cout << ".";
     }
 
-    done_wbio.push_back(wbio);
+    {
+        lock_guard<mutex> guard(done_wbio_lock);
+        done_wbio.push_back(wbio);
+    }
     bio_inflights--;
 }
 
@@ -88,7 +101,7 @@ int main(int argc, char const *argv[])
 {
     struct device *dev;
     if (argc < 2) {
-        cout << "Usage: " << argv[0] << "<dev-name>" << endl;
+        cout << "Usage: " << argv[0] << " <dev-name> [threads]" << endl;
         return 1;
     }
 
@@ -97,32 +110,48 @@ int main(int argc, char const *argv[])
         return 1;
     }
 
-    long written = 0;
-
-    //Do all writes
-    for(auto i = 1; i < 511; i++)
-    {
-        const size_t buff_size = i * memory::page_size;
+    int nthreads = argc > 2 ? atoi(argv[2]) : 1;
+    if (nthreads <= 0) {
+        nthreads = 1;
+    }
 
-        auto bio = alloc_bio();
-        bio_inflights++;
-        bio->bio_cmd = BIO_WRITE;
-        bio->bio_dev = dev;
-        bio->bio_data = new char[buff_size];
-        bio->bio_offset = written;
-        bio->bio_bcount = buff_size;
-        bio->bio_caller1 = bio;
-        bio->bio_done = wbio_done;
-
-        fill_buffer(bio->bio_data, buff_size);
-
-        dev->driver->devops->strategy(bio);
-        written += buff_size;
+    const int nbuffers = 510;
+    const long written = memory::page_size * nbuffers * (nbuffers + 1) / 2;
+    auto start = chrono::steady_clock::now();
+
+    //Do all writes, the i-th buffer is i pages long and they are laid out
+    //one after another so every thread can compute its offsets by itself
+    vector<thread> threads;
+    for (auto t = 0; t < nthreads; t++) {
+        threads.emplace_back([dev, t, nthreads] {
+            for (auto i = 1 + t; i <= nbuffers; i += nthreads)
+            {
+                const size_t buff_size = i * memory::page_size;
+
+                auto bio = alloc_bio();
+                bio_inflights++;
+                bio->bio_cmd = BIO_WRITE;
+                bio->bio_dev = dev;
+                bio->bio_data = new char[buff_size];
+                bio->bio_offset = memory::page_size * (i - 1) * i / 2;
+                bio->bio_bcount = buff_size;
+                bio->bio_caller1 = bio;
+                bio->bio_done = wbio_done;
+
+                fill_buffer(bio->bio_data, buff_size);
+
+                dev->driver->devops->strategy(bio);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
     }
 
     while (bio_inflights != 0) {
         usleep(2000);
     }
+    auto write_end = chrono::steady_clock::now();
 
     //Now do all reads and verify
     while(!done_wbio.empty())
@@ -147,9 +176,15 @@ int main(int argc, char const *argv[])
     while (bio_inflights != 0) {
         usleep(2000);
     }
+    auto read_end = chrono::steady_clock::now();
 
+    auto mb_per_sec = [written] (chrono::steady_clock::duration d) {
+        return written / MB / chrono::duration<double>(d).count();
+    };
     cout << endl
-         << "Processed " << written / MB << " MB" << endl
+         << "Processed " << written / MB << " MB with " << nthreads << " thread(s)" << endl
+         << "Write: " << mb_per_sec(write_end - start) << " MB/s, read: "
+         << mb_per_sec(read_end - write_end) << " MB/s" << endl
          << "Test " << (test_failed.load() ? "FAILED" : "PASSED") << endl;
 
     return test_failed.load() ? 1 : 0;
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures how BSD callouts scale with many connections
+// re-arming their timers concurrently, the way the TCP stack re-arms the
+// retransmit and keepalive timers on every segment. Each thread owns a set of
+// callouts (one per simulated connection, each with its own lock like an
+// inpcb) and keeps re-arming them with timeouts far in the future; a small
+// fraction is armed to expire right away, so the callout threads also have
+// work to dispatch. With a single ordered set under a global lock the
+// re-arm rate stays flat or drops as threads are added; with per-cpu timer
+// wheels it should scale with the number of cpus.
+//
+// Usage: misc-callout-scale.so [max_threads] [callouts_per_thread] [seconds_per_run]
+
+#include <stdlib.h>
+#include <sys/sysinfo.h>
+#include <bsd/porting/callout.h>
+#include <bsd/porting/netport.h>
+#include <bsd/porting/sync_stub.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+struct connection {
+    struct mtx lock;
+    struct callout timer;
+};
+
+static std::atomic<long> fired(0);
+
+static void timer_fn(void *arg)
+{
+    fired.fetch_add(1, std::memory_order_relaxed);
+}
+
+static double run(int nthreads, int per_thread, double secs, double& fire_rate)
+{
+    std::vector<std::vector<connection>> conns(nthreads);
+    for (auto& v : conns) {
+        v = std::vector<connection>(per_thread);
+        for (auto& c : v) {
+            mtx_init(&c.lock, "connection", NULL, 0);
+            callout_init_mtx(&c.timer, &c.lock, 0);
+        }
+    }
+
+    fired = 0;
+    std::atomic<bool> done(false);
+    std::atomic<long> total(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            auto& mine = conns[t];
+            long count = 0;
+            size_t i = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                auto& c = mine[i];
+                // Mostly like a retransmit timer pushed back by every ACK,
+                // sometimes like a delayed ACK timer that does fire
+                int ticks = (rng() % 64) ? hz / 5 + rng() % hz : 1 + rng() % 4;
+                mtx_lock(&c.lock);
+                callout_reset(&c.timer, ticks, timer_fn, &c);
+                mtx_unlock(&c.lock);
+                count++;
+                if (++i == mine.size()) {
+                    i = 0;
+                }
+            }
+            total += count;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+    done = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    fire_rate = fired / secs;
+
+    for (auto& v : conns) {
+        for (auto& c : v) {
+            callout_drain(&c.timer);
+            mtx_destroy(&c.lock);
+        }
+    }
+    return total / secs;
+}
+
+int main(int argc, char** argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 2 * get_nprocs();
+    int per_thread = argc > 2 ? atoi(argv[2]) : 1024;
+    double secs = argc > 3 ? atof(argv[3]) : 2.0;
+    if (max_threads <= 0 || per_thread <= 0 || secs <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [max_threads] [callouts_per_thread] [seconds_per_run]\n";
+        return 1;
+    }
+
+    std::cout << "Callout re-arms per second on " << get_nprocs() << " cpus, "
+              << per_thread << " callouts per thread\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "resets/s"
+              << std::setw(14) << "fired/s" << "\n";
+    for (int t = 1; t <= max_threads; t *= 2) {
+        double fire_rate;
+        double rate = run(t, per_thread, secs, fire_rate);
+        std::cout << std::setw(8) << t << std::fixed << std::setprecision(0)
+                  << std::setw(14) << rate << std::setw(14) << fire_rate << "\n";
+    }
+    return 0;
+}
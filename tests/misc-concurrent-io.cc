@@ -18,6 +18,12 @@
 //    make image=tests
 //    scripts/run.py -e "tests/misc-concurrent-io.so setup"
 //    scripts/run.py -e "tests/misc-concurrent-io.so <operation>"
+//
+// read-scale reads disjoint ranges with 1, 2, 4... up to num_threads threads
+// and reports the throughput of each step. Pointed at a block device, e.g.
+//    scripts/run.py -e "tests/misc-concurrent-io.so read-scale /dev/vblk1"
+// it measures how the disk driver scales with the number of submitters;
+// no setup is needed then.
 
 #include <sys/types.h>
 #include <fcntl.h>
@@ -30,8 +36,10 @@
 #include <assert.h>
 #include <pthread.h>
 #include <float.h>
+#include <algorithm>
 #include <chrono>
 #include <memory>
+#include <vector>
 
 using Clock = std::chrono::high_resolution_clock;
 
@@ -176,13 +184,15 @@ static void *write_function(void *arg)
 }
 
 static inline void do_run_test(int fd, bool diff_range, ssize_t range_length,
-    void *(*function)(void *))
+    void *(*function)(void *), int threads = num_threads)
 {
-    pthread_t thread_id[num_threads];
-    struct file_range file_ranges[num_threads];
+    std::vector<pthread_t> thread_id(threads);
+    std::vector<struct file_range> file_ranges(threads);
 
+    min_secs = FLT_MAX;
+    max_secs = 0;
     test_start = s_clock.now();
-    for (int i = 0; i < num_threads; i++) {
+    for (int i = 0; i < threads; i++) {
         file_ranges[i].thread_id = i;
         file_ranges[i].fd = fd;
         file_ranges[i].offset = (diff_range) ? i * file_range_length : 0;
@@ -193,11 +203,36 @@ static inline void do_run_test(int fd, bool diff_range, ssize_t range_length,
         assert(ret == 0);
     }
 
-    for (int i = 0; i < num_threads; i++) {
+    for (int i = 0; i < threads; i++) {
         assert(pthread_join(thread_id[i], nullptr) == 0);
     }
 }
 
+// Concurrently read different ranges with a growing number of threads.
+static void run_scale_test(const char *filepath)
+{
+    int fd = open(filepath, O_RDONLY);
+    if (fd == -1) {
+        perror("open");
+        _exit(-1);
+    }
+
+    for (int threads = 1; ; threads = std::min(threads * 2, num_threads)) {
+        do_run_test(fd, true, file_range_length, read_function, threads);
+        float secs = max_secs - min_secs;
+        printf("%d threads: %.2fms, %.2f MB/s\n\n", threads, secs * 1000,
+            threads * (file_range_length / (1024.0 * 1024)) / secs);
+        if (threads == num_threads) {
+            break;
+        }
+    }
+
+    if (close(fd) == -1) {
+        perror("close");
+        _exit(-1);
+    }
+}
+
 static void run_test(const char *filepath, int oflags, bool diff_range,
     ssize_t range_length, void *(*function)(void *))
 {
@@ -284,6 +319,8 @@ int main(int argc, char **argv)
     } else if (!strcmp(argv[1], "seeknread-same-range")) {
         run_test(filepath, O_RDONLY | O_SYNC, false, file_size,
             seek_n_read_function);
+    } else if (!strcmp(argv[1], "read-scale")) {
+        run_scale_test(filepath);
     } else if (!strcmp(argv[1], "write-diff-ranges")) {
         run_test(filepath, O_WRONLY | O_SYNC, true, file_range_length,
             write_function);
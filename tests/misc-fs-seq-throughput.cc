@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures the sequential throughput of a file system. Each
+// thread writes a file of its own from beginning to end, then reads it back
+// with read() and finally through a shared mapping, touching every page.
+// Running it with more threads shows whether I/O to independent files
+// scales, and running it with larger buffers whether large requests reach
+// the device as large requests.
+//
+// Usage: misc-fs-seq-throughput.so [directory] [file_mb] [buffer_kb] [threads]
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum { phase_write, phase_read, phase_mmap, phases };
+static const char* phase_names[phases] = { "write", "read", "mmap" };
+
+static void die(const char* what)
+{
+    perror(what);
+    exit(1);
+}
+
+// Returns the time in seconds each phase took
+static std::vector<double> run(const std::string& path, size_t size, size_t buffer_size)
+{
+    std::vector<double> seconds(phases);
+    std::vector<char> buf(buffer_size, 'x');
+
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        die("open");
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < size; done += buffer_size) {
+        if (write(fd, buf.data(), buffer_size) != (ssize_t)buffer_size) {
+            die("write");
+        }
+    }
+    fsync(fd);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds[phase_write] = elapsed.count();
+
+    start = std::chrono::steady_clock::now();
+    lseek(fd, 0, SEEK_SET);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buf.data(), buffer_size)) > 0) {
+        total += n;
+    }
+    if (n < 0 || total != size) {
+        die("read");
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    seconds[phase_read] = elapsed.count();
+
+    start = std::chrono::steady_clock::now();
+    auto p = static_cast<volatile char*>(mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0));
+    if (p == MAP_FAILED) {
+        die("mmap");
+    }
+    unsigned long sum = 0;
+    for (size_t i = 0; i < size; i += 4096) {
+        sum += p[i];
+    }
+    munmap((void*)p, size);
+    elapsed = std::chrono::steady_clock::now() - start;
+    seconds[phase_mmap] = elapsed.count();
+    if (sum != (size / 4096) * 'x') {
+        fprintf(stderr, "Wrong data read through the mapping of %s\n", path.c_str());
+        exit(1);
+    }
+
+    close(fd);
+    unlink(path.c_str());
+    return seconds;
+}
+
+int main(int argc, char** argv)
+{
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    long file_mb = argc > 2 ? atol(argv[2]) : 256;
+    long buffer_kb = argc > 3 ? atol(argv[3]) : 1024;
+    int threads = argc > 4 ? atoi(argv[4]) : 1;
+    if (file_mb <= 0 || buffer_kb <= 0 || threads <= 0 || (file_mb * 1024) % buffer_kb) {
+        fprintf(stderr, "Usage: %s [directory] [file_mb] [buffer_kb] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = file_mb * 1024 * 1024;
+    std::vector<std::vector<double>> seconds(threads);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&, i] {
+            seconds[i] = run(dir + "/seq-throughput-" + std::to_string(i), size, buffer_kb * 1024);
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    printf("%d threads, each with a %ld MB file in %s, %ldK buffer\n\n",
+        threads, file_mb, dir.c_str(), buffer_kb);
+    printf("phase     total (MB/s)   slowest (s)\n");
+    for (int phase = 0; phase < phases; phase++) {
+        double slowest = 0;
+        for (int i = 0; i < threads; i++) {
+            slowest = std::max(slowest, seconds[i][phase]);
+        }
+        printf("%-5s %16.2f %13.3f\n", phase_names[phase], threads * file_mb / slowest, slowest);
+    }
+    return 0;
+}
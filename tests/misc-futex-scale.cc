@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <linux/futex.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+// This benchmark complements misc-futex-perf.cc. Where that one measures a
+// single configuration, this one measures how the futex() implementation
+// scales when both the number of threads and the number of distinct futex
+// addresses grow. It runs a matrix of (nthreads x naddrs) configurations,
+// and in each one every thread loops over the naddrs futex-based mutexes
+// (starting at a different one per thread), locking each, incrementing its
+// counter and unlocking it. With a single global futex lock the throughput
+// does not improve with more addresses; with a hashed, per-bucket locked
+// table it should scale with naddrs until CPUs are saturated.
+//
+// A second phase exercises the condition-variable pattern: a broadcaster
+// uses FUTEX_CMP_REQUEUE to wake one waiter and move the rest onto the
+// mutex futex, like glibc's pthread_cond_broadcast() used to do.
+//
+// Usage: misc-futex-scale.so [max_threads] [max_addrs] [seconds_per_run]
+
+#pragma GCC optimize("00")
+
+inline uint32_t cmpxchg(uint32_t *addr, uint32_t expected, uint32_t desired)
+{
+    uint32_t *expected_addr = &expected;
+    __atomic_compare_exchange_n(addr, expected_addr, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return *expected_addr;
+}
+
+// The "Mutex, Take 2" from Ulrich Drepper's "Futexes Are Tricky", like
+// in misc-futex-perf.cc. Padded so that mutexes do not share cache lines.
+class alignas(64) fmutex {
+public:
+    fmutex() : _state(0) {}
+    void lock()
+    {
+        uint32_t c;
+        if ((c = cmpxchg(&_state, 0, 1)) != 0) {
+            do {
+                if (c == 2 || cmpxchg(&_state, 1, 2) != 0) {
+                    syscall(SYS_futex, &_state, FUTEX_WAIT_PRIVATE, 2, 0, 0, 0);
+                }
+            } while ((c = cmpxchg(&_state, 0, 2)) != 0);
+        }
+    }
+    void unlock()
+    {
+        if (__atomic_fetch_sub(&_state, 1, __ATOMIC_SEQ_CST) != 1) {
+            _state = 0;
+            syscall(SYS_futex, &_state, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+        }
+    }
+    uint32_t* word() { return &_state; }
+    long counter = 0;
+private:
+    uint32_t _state;
+};
+
+static double run_mutexes(int nthreads, int naddrs, double secs)
+{
+    std::vector<fmutex> mutexes(naddrs);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++) {
+        threads.emplace_back([&, t] {
+            int m = t % naddrs;
+            while (!done.load(std::memory_order_relaxed)) {
+                mutexes[m].lock();
+                mutexes[m].counter++;
+                mutexes[m].unlock();
+                if (++m == naddrs) {
+                    m = 0;
+                }
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+    done = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    long total = 0;
+    for (auto &m : mutexes) {
+        total += m.counter;
+    }
+    return total / secs;
+}
+
+// Condition variable built directly on futexes: waiters sleep on _seq and
+// broadcast requeues all but one of them onto the associated mutex so they
+// do not all stampede on it at once.
+class fcondvar {
+public:
+    void wait(fmutex& m)
+    {
+        uint32_t seq = _seq;
+        m.unlock();
+        syscall(SYS_futex, &_seq, FUTEX_WAIT_PRIVATE, seq, 0, 0, 0);
+        // We may have been requeued onto the mutex, so mark it contended
+        while (__atomic_exchange_n(m.word(), 2, __ATOMIC_SEQ_CST) != 0) {
+            syscall(SYS_futex, m.word(), FUTEX_WAIT_PRIVATE, 2, 0, 0, 0);
+        }
+    }
+    void broadcast(fmutex& m)
+    {
+        uint32_t seq = __atomic_add_fetch(&_seq, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &_seq, FUTEX_CMP_REQUEUE_PRIVATE, 1, INT32_MAX, m.word(), seq);
+    }
+private:
+    uint32_t _seq = 0;
+};
+
+static double run_broadcast(int nthreads, double secs)
+{
+    fmutex m;
+    fcondvar cv;
+    long generation = 0;
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++) {
+        threads.emplace_back([&] {
+            m.lock();
+            while (!done) {
+                long gen = generation;
+                while (gen == generation && !done) {
+                    cv.wait(m);
+                }
+            }
+            m.unlock();
+        });
+    }
+    long broadcasts = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(secs);
+    while (std::chrono::steady_clock::now() < end) {
+        m.lock();
+        generation++;
+        cv.broadcast(m);
+        m.unlock();
+        broadcasts++;
+    }
+    m.lock();
+    done = true;
+    cv.broadcast(m);
+    m.unlock();
+    for (auto &t : threads) {
+        t.join();
+    }
+    return broadcasts / secs;
+}
+
+int main(int argc, char** argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 2 * get_nprocs();
+    int max_addrs = argc > 2 ? atoi(argv[2]) : 64;
+    double secs = argc > 3 ? atof(argv[3]) : 2.0;
+    if (max_threads <= 0 || max_addrs <= 0 || secs <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [max_threads] [max_addrs] [seconds_per_run]\n";
+        return 1;
+    }
+
+    std::cout << "Lock/unlock operations per second on " << get_nprocs() << " cpus\n";
+    std::cout << std::setw(13) << "threads\\addrs";
+    for (int a = 1; a <= max_addrs; a *= 4) {
+        std::cout << std::setw(14) << a;
+    }
+    std::cout << "\n";
+    for (int t = 1; t <= max_threads; t *= 2) {
+        std::cout << std::setw(13) << t;
+        for (int a = 1; a <= max_addrs; a *= 4) {
+            std::cout << std::setw(14) << std::fixed << std::setprecision(0)
+                      << run_mutexes(t, a, secs) << std::flush;
+        }
+        std::cout << "\n";
+    }
+
+    std::cout << "\nCondition variable broadcasts (FUTEX_CMP_REQUEUE) per second\n";
+    for (int t = 1; t <= max_threads; t *= 2) {
+        std::cout << std::setw(13) << t << std::setw(14) << std::fixed
+                  << std::setprecision(0) << run_broadcast(t, secs) << "\n";
+    }
+    return 0;
+}
@@ -21,6 +21,7 @@
 #include <mutex>
 #include <memory>
 #include <cstdlib>
+#include <malloc.h>
 
 unsigned int threads = 2;
 using namespace std::chrono;
@@ -164,6 +165,45 @@ void do_run(std::function <void ()> fn, std::string name)
     std::cout << name << ",free,"   << fmin << "," << fmax << "," << fmean << "," << fstdev << "\n";
 }
 
+// Report how much memory objects of a given size really take, as a
+// fraction of what was asked for: the size classes round every request up.
+static void measure_overhead(long len)
+{
+    constexpr int count = 1000;
+    std::vector<void*> objs(count);
+    size_t usable = 0;
+    for (auto& obj : objs) {
+        obj = malloc(len);
+        usable += malloc_usable_size(obj);
+    }
+    for (auto obj : objs) {
+        free(obj);
+    }
+    std::cout << "overhead," << len << "," << (float)usable / (len * count) << "\n";
+}
+
+// Grow a buffer in small steps and shrink it back, the way string and
+// vector style buffers are resized, and report the average time per call.
+static void measure_realloc(long max, long step)
+{
+    void* p = nullptr;
+    long calls = 0;
+    auto t1 = s_clock.now();
+    for (int i = 0; i < 10; i++) {
+        for (long len = step; len <= max; len += step, calls++) {
+            p = realloc(p, len);
+            static_cast<char*>(p)[len - 1] = 0;
+        }
+        for (long len = max; len > step; len -= step, calls++) {
+            p = realloc(p, len);
+        }
+    }
+    auto t2 = s_clock.now();
+    free(p);
+    std::cout << "realloc," << max << "," << step << ","
+              << ((float)duration_cast<nanoseconds>(t2-t1).count()) / calls << "\n";
+}
+
 static constexpr long up_max = 1 << 20;
 static constexpr long smp_max = 256 << 10;
 
@@ -177,6 +217,13 @@ int main(int argc, char **argv)
         threads = atoi(argv[1]);
     }
 
+    for (long i : {24, 33, 100, 200, 300, 700, 1100, 1500, 3000}) {
+        measure_overhead(i);
+    }
+    measure_realloc(4096, 16);
+    measure_realloc(1 << 20, 4096);
+    measure_realloc(16 << 20, 64 << 10);
+
     for (long i = 8; i <= up_max; i <<= 1) {
         do_run([&] { measure_up([&] { return i; }); }, "up," + std::to_string(i));
     }
@@ -18,6 +18,8 @@
 #define MAX_SIZE (32 << 10)
 #define LOOPS 1000000
 #define RUNS 30
+#define SWEEP_MAX_SIZE (64 << 20)
+#define SWEEP_BYTES (4UL << 30)
 
 static float vector[RUNS];
 
@@ -131,7 +133,40 @@ void test_memset(size_t size)
     free(buf);
 }
 
-int main()
+// Copy (or set) SWEEP_BYTES in total in chunks of the given size and report
+// the throughput in GB/s. The sweep goes from 64 bytes to well beyond the
+// size of the last level cache, so that the points where memcpy() and
+// memset() switch between vector registers, rep movsb and non-temporal
+// stores show up.
+void sweep(const char *name, size_t size, size_t misalign, int set)
+{
+    char *_src = (char *)malloc(size + 64);
+    char *_dest = (char *)malloc(size + 64);
+    char *src = _src + misalign;
+    char *dest = _dest + misalign * 2;
+    size_t loops = SWEEP_BYTES / size;
+    size_t i;
+
+    memset(_src, 'c', size + 64);
+    memset(_dest, 'd', size + 64);
+
+    unsigned long t1 = gtime();
+    for (i = 0; i < loops; ++i) {
+        if (set) {
+            memset(dest, 'c', size);
+        } else {
+            memcpy(dest, src, size);
+        }
+    }
+    unsigned long t2 = gtime();
+
+    printf("%s,%zu,%f\n", name, size, (double)loops * size / (t2 - t1));
+
+    free(_src);
+    free(_dest);
+}
+
+int main(int argc, char **argv)
 {
     size_t i;
     size_t sizes[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 15, 16, 17,
@@ -139,18 +174,30 @@ int main()
             4096, 4097, 5000, 8192, 16386, 32768
     };
     size_t nsizes = sizeof(sizes) / sizeof(*sizes);
-    for (i = 0; i < nsizes; ++i) {
+    int sweep_only = argc > 1 && !strcmp(argv[1], "sweep");
+    for (i = 0; !sweep_only && i < nsizes; ++i) {
         test_memcpy(sizes[i]);
     }
 
-    for (i = 0; i < nsizes; ++i) {
+    for (i = 0; !sweep_only && i < nsizes; ++i) {
         test_unaligned_memcpy(sizes[i]);
     }
 
-    for (i = 0; i < nsizes; ++i) {
+    for (i = 0; !sweep_only && i < nsizes; ++i) {
         test_memset(sizes[i]);
     }
 
+    // Throughput in GB/s; pass "sweep" to run only this part
+    for (i = 64; i <= SWEEP_MAX_SIZE; i *= 2) {
+        sweep("memcpy_sweep", i, 0, 0);
+    }
+    for (i = 64; i <= SWEEP_MAX_SIZE; i *= 2) {
+        sweep("unaligned_memcpy_sweep", i, 3, 0);
+    }
+    for (i = 64; i <= SWEEP_MAX_SIZE; i *= 2) {
+        sweep("memset_sweep", i, 0, 1);
+    }
+
 
     return 0;
 }
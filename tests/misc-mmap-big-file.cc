@@ -64,6 +64,34 @@ void map_pass(const char *phase, unsigned char *addr, unsigned long passes,
     report(phase, passes, pages, start, end);
 }
 
+// Every thread maps the file on its own and touches each page of its share of
+// it, so that all faults go through the page cache at the same time. Returns
+// the number of pages faulted in per second by all the threads together.
+double fault_scaling_pass(int fd, unsigned nthreads, unsigned long pages)
+{
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned t = 0; t < nthreads; t++) {
+        threads.emplace_back([=] {
+            auto addr = static_cast<unsigned char *>(mmap(nullptr, pages * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0));
+            assert(addr != MAP_FAILED);
+            unsigned long first = t * (pages / nthreads);
+            for (unsigned long j = 0; j < pages; ++j) {
+                auto i = (first + j) % pages;
+                char x = *(addr + i * PAGE_SIZE);
+                assert(x == ch(i));
+            }
+            munmap(addr, pages * PAGE_SIZE);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    return double(pages) * nthreads / usec * 1000000;
+}
+
 char safe_buffers[PAGE_SIZE][2];
 char test_string[] = "test_string";
 
@@ -206,6 +234,15 @@ int main(int ac, char** av)
     ta4.join();
     std::cout << "Threaded pass many addresses ended OK\n";
 
+    // Fault in a part of the file that fits in memory from growing numbers
+    // of threads, each through its own mapping
+    unsigned long scaling_pages = std::min(pages / 4, 65536UL);
+    fault_scaling_pass(fd, 1, scaling_pages);
+    for (unsigned nthreads = 1; nthreads <= 2 * std::thread::hardware_concurrency(); nthreads *= 2) {
+        std::cout << "Fault scaling with " << nthreads << " threads: "
+                  << fault_scaling_pass(fd, nthreads, scaling_pages) << " pages / sec\n";
+    }
+
     for (int i = 0; i < 2; i++) {
         assert(memcmp(retanon + i * PAGE_SIZE, safe_buffers[i], PAGE_SIZE) == 0);
         assert(memcmp(retanon2 + i * PAGE_SIZE, safe_buffers[i], PAGE_SIZE) == 0);
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures the latency of page faults on anonymous memory
+// while another thread keeps changing the address space. Faulting threads
+// repeatedly map a region of their own and touch each of its pages, timing
+// every first touch, while a remapping thread maps, populates and unmaps
+// large unrelated regions. Faults on the regions of the faulting threads
+// should not have to wait for the remapping thread.
+//
+// Usage: misc-mmap-fault-contention.so [faulting_threads] [seconds] [remap_mb]
+
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static std::atomic<bool> done { false };
+
+static void remap(size_t mb, std::atomic<long>& remaps)
+{
+    size_t size = mb * 1024 * 1024;
+    while (!done.load(std::memory_order_relaxed)) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        mprotect(p, size, PROT_READ);
+        munmap(p, size);
+        remaps++;
+    }
+}
+
+// Returns the latency in nanoseconds of every fault taken
+static std::vector<double> fault(std::chrono::duration<double> duration)
+{
+    constexpr size_t size = 4 * 1024 * 1024;
+    std::vector<double> latencies;
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+        auto p = static_cast<char*>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        // Small pages only, so every page faults
+        madvise(p, size, MADV_NOHUGEPAGE);
+        for (size_t i = 0; i < size; i += 4096) {
+            auto start = std::chrono::steady_clock::now();
+            p[i] = 1;
+            latencies.push_back(std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        munmap(p, size);
+    }
+    return latencies;
+}
+
+static void run(int threads, double seconds, size_t remap_mb)
+{
+    std::vector<std::vector<double>> latencies(threads);
+    std::atomic<long> remaps { 0 };
+    done.store(false);
+    std::thread remapper;
+    if (remap_mb) {
+        remapper = std::thread([&] { remap(remap_mb, remaps); });
+    }
+    std::vector<std::thread> faulters;
+    for (int i = 0; i < threads; i++) {
+        faulters.emplace_back([&, i] {
+            latencies[i] = fault(std::chrono::duration<double>(seconds));
+        });
+    }
+    std::vector<double> all;
+    for (int i = 0; i < threads; i++) {
+        faulters[i].join();
+        all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+    }
+    done.store(true);
+    if (remap_mb) {
+        remapper.join();
+    }
+
+    std::sort(all.begin(), all.end());
+    auto n = all.size();
+    printf("%8s %10lu %8.0f %8.0f %8.0f %10.0f %8ld\n",
+        remap_mb ? "remap" : "idle", n, all[n / 2], all[n * 99 / 100],
+        all[n * 999 / 1000], all[n - 1], remaps.load());
+}
+
+int main(int argc, char** argv)
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    double seconds = argc > 2 ? atof(argv[2]) : 5;
+    long remap_mb = argc > 3 ? atol(argv[3]) : 256;
+    if (threads <= 0 || seconds <= 0 || remap_mb <= 0) {
+        fprintf(stderr, "Usage: %s [faulting_threads] [seconds] [remap_mb]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%d faulting threads, remapping %ld MB\n\n", threads, remap_mb);
+    printf("                     fault latency (ns)\n");
+    printf("   other     faults   median      p99    p99.9        max   remaps\n");
+    run(threads, seconds, 0);
+    run(threads, seconds, remap_mb);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures the bandwidth of memory reads and writes from the
+// cpus of each NUMA node to the memory of each node. The memory is bound to
+// a node with mbind(), and the benchmark checks the pages really come from
+// it. It uses the raw system calls, so it also runs on Linux:
+// g++ -O2 -std=c++11 tests/misc-numa-bandwidth.cc -o misc-numa-bandwidth
+//
+// Start the guest with more than one node, e.g. in QEMU with
+// -object memory-backend-ram,size=1G,id=m0 -numa node,nodeid=0,cpus=0-1,memdev=m0
+// -object memory-backend-ram,size=1G,id=m1 -numa node,nodeid=1,cpus=2-3,memdev=m1
+//
+// Usage: misc-numa-bandwidth.so [MB] [iterations]
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+#define MPOL_BIND           2
+#define MPOL_F_NODE         (1<<0)
+#define MPOL_F_ADDR         (1<<1)
+#define MPOL_F_MEMS_ALLOWED (1<<2)
+
+static const unsigned max_nodes = 64;
+
+static unsigned nr_nodes()
+{
+    unsigned long mask = 0;
+    if (syscall(SYS_get_mempolicy, nullptr, &mask, max_nodes + 1, nullptr, MPOL_F_MEMS_ALLOWED) < 0) {
+        return 1;
+    }
+    return mask ? 64 - __builtin_clzl(mask) : 1;
+}
+
+static int node_of_page(void* addr)
+{
+    int node;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) < 0) {
+        return -1;
+    }
+    return node;
+}
+
+// The first cpu of each node, -1 for a node without cpus
+static std::vector<int> first_cpus(unsigned nodes)
+{
+    std::vector<int> cpus(nodes, -1);
+    auto ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int cpu = 0; cpu < ncpus; cpu++) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        unsigned c, node;
+        if (sched_setaffinity(0, sizeof(set), &set) == 0 &&
+                syscall(SYS_getcpu, &c, &node, nullptr) == 0 &&
+                node < nodes && cpus[node] < 0) {
+            cpus[node] = cpu;
+        }
+    }
+    return cpus;
+}
+
+static double gbps(size_t bytes, std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return bytes / elapsed.count() / 1e9;
+}
+
+// Returns false if the memory is not on the node
+static bool measure(unsigned node, size_t size, int iterations, double& read_gbps, double& write_gbps)
+{
+    auto p = static_cast<unsigned long*>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_mbind, p, size, MPOL_BIND, &mask, max_nodes + 1, 0) < 0) {
+        std::cerr << "mbind failed: " << strerror(errno) << "\n";
+        munmap(p, size);
+        return false;
+    }
+    // Populate the memory from the cpu measuring it
+    memset(p, 1, size);
+    bool local = node_of_page(p) == int(node) &&
+                 node_of_page(reinterpret_cast<char*>(p) + size - 1) == int(node);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        memset(p, i, size);
+    }
+    write_gbps = gbps(size * iterations, start);
+
+    volatile unsigned long sink;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        unsigned long sum = 0;
+        for (size_t j = 0; j < size / sizeof(*p); j++) {
+            sum += p[j];
+        }
+        sink = sum;
+    }
+    (void)sink;
+    read_gbps = gbps(size * iterations, start);
+
+    munmap(p, size);
+    return local;
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? atol(argv[1]) : 256;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    if (!mb || iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [MB] [iterations]\n";
+        return 1;
+    }
+
+    auto nodes = nr_nodes();
+    auto cpus = first_cpus(nodes);
+    std::cout << nodes << " NUMA node(s), " << mb << " MB per run\n"
+              << "cpu node -> memory node: read GB/s, write GB/s\n";
+    bool ok = true;
+    for (unsigned cpu_node = 0; cpu_node < nodes; cpu_node++) {
+        if (cpus[cpu_node] < 0) {
+            continue;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[cpu_node], &set);
+        sched_setaffinity(0, sizeof(set), &set);
+        for (unsigned mem_node = 0; mem_node < nodes; mem_node++) {
+            double read_gbps = 0, write_gbps = 0;
+            bool on_node = measure(mem_node, mb << 20, iterations, read_gbps, write_gbps);
+            std::cout << std::fixed << std::setprecision(2)
+                      << cpu_node << " -> " << mem_node << ": "
+                      << read_gbps << ", " << write_gbps
+                      << (cpu_node == mem_node ? " (local)" : " (remote)")
+                      << (on_node ? "" : " - pages are not on the node!") << "\n";
+            ok &= on_node;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -16,7 +16,11 @@
 #include <errno.h>
 #include <dirent.h>
 #include <limits.h>
+#include <sys/sysinfo.h>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
 
 #define BUF_SIZE        4096
 
@@ -71,6 +75,53 @@ static void read_file(const char *path)
     close(fd);
 }
 
+// Several threads pread() random blocks of the same file for a while, and the
+// total throughput is reported. With the whole VOP_READ serialized by the vnode
+// lock this stays flat as threads are added; with shared vnode locking it
+// should scale with the number of cpus.
+static double pread_parallel(const char *path, int nthreads, double secs)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    off_t nblocks = st.st_size / BUF_SIZE;
+    if (nblocks == 0) {
+        fprintf(stderr, "%s is too small.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<long> total(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++) {
+        threads.emplace_back([&, t] {
+            char buf[BUF_SIZE];
+            unsigned seed = t;
+            long bytes = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                off_t offset = (rand_r(&seed) % nblocks) * BUF_SIZE;
+                ssize_t n = pread(fd, buf, sizeof(buf), offset);
+                if (n < 0) {
+                    perror("pread");
+                    exit(EXIT_FAILURE);
+                }
+                bytes += n;
+            }
+            total += bytes;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+    done = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    close(fd);
+    return (total >> 20) / secs;
+}
+
 static void path_cat(char *path, const char *dir, const char *d_name)
 {
     int length = snprintf(path, PATH_MAX, "%s/%s", dir, d_name);
@@ -138,5 +189,13 @@ int main(int argc, char **argv)
            total_files, total_read_bytes / 1024UL, to_msec(total_time),
            (total_read_bytes >> 20) / total_time);
 
+    // Read one of the files again, concurrently and now from the cache
+    const char *path = argc > 1 ? argv[1] : files[2];
+    int max_threads = argc > 2 ? atoi(argv[2]) : 2 * get_nprocs();
+    printf("\nPARALLEL PREAD of %s\n-----\n", path);
+    for (int t = 1; t <= max_threads; t *= 2) {
+        printf("%d threads:\t%.2f MBps\n", t, pread_parallel(path, t, 2.0));
+    }
+
     return 0;
 }
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures the throughput of serving a file over a loopback
+// TCP connection, the way static file servers do. It compares sendfile()
+// with doing the same thing in the application: mmap() + write() + munmap()
+// of every chunk (which is what sendfile() used to do internally) and a
+// plain pread() + write() loop. A receiver thread drains the connection.
+//
+// Pass a file on a filesystem using the page cache (e.g. ROFS) to measure the
+// zero-copy path; by default a file is created under /tmp, which is served
+// through the fallback path.
+//
+// Usage: misc-sendfile.so [file] [chunk_size] [seconds_per_run]
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+enum class method { sendfile, mmap_write, read_write };
+
+static bool connect_pair(int& sender, int& receiver)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(lfd, 1) < 0 || getsockname(lfd, (struct sockaddr*)&addr, &len) < 0) {
+        return false;
+    }
+    sender = socket(AF_INET, SOCK_STREAM, 0);
+    if (sender < 0 || connect(sender, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        return false;
+    }
+    receiver = accept(lfd, nullptr, nullptr);
+    close(lfd);
+    return receiver >= 0;
+}
+
+static ssize_t send_chunk(method m, int sock, int fd, off_t offset, size_t count, char* buf)
+{
+    switch (m) {
+    case method::sendfile:
+        return sendfile(sock, fd, &offset, count);
+    case method::mmap_write: {
+        off_t page_offset = offset & ~(off_t)(getpagesize() - 1);
+        size_t mapped = count + (offset - page_offset);
+        auto p = static_cast<char*>(mmap(nullptr, mapped, PROT_READ, MAP_SHARED, fd, page_offset));
+        if (p == MAP_FAILED) {
+            return -1;
+        }
+        auto ret = write(sock, p + (offset - page_offset), count);
+        munmap(p, mapped);
+        return ret;
+    }
+    case method::read_write: {
+        auto n = pread(fd, buf, count, offset);
+        return n <= 0 ? n : write(sock, buf, n);
+    }
+    }
+    return -1;
+}
+
+static double run(method m, int fd, off_t size, size_t chunk, double secs)
+{
+    int sender, receiver;
+    if (!connect_pair(sender, receiver)) {
+        std::cerr << "Failed to set up the connection: " << strerror(errno) << "\n";
+        exit(1);
+    }
+    std::thread drain([receiver] {
+        std::vector<char> buf(256 * 1024);
+        while (read(receiver, buf.data(), buf.size()) > 0) {
+        }
+    });
+
+    std::vector<char> buf(chunk);
+    long total = 0;
+    off_t offset = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(secs);
+    while (std::chrono::steady_clock::now() < end) {
+        size_t count = std::min<off_t>(chunk, size - offset);
+        auto n = send_chunk(m, sender, fd, offset, count, buf.data());
+        if (n <= 0) {
+            std::cerr << "Failed to send: " << strerror(errno) << "\n";
+            exit(1);
+        }
+        total += n;
+        offset += n;
+        if (offset == size) {
+            offset = 0;
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    shutdown(sender, SHUT_WR);
+    drain.join();
+    close(sender);
+    close(receiver);
+    return total / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "";
+    size_t chunk = argc > 2 ? atol(argv[2]) : 64 * 1024;
+    double secs = argc > 3 ? atof(argv[3]) : 2.0;
+    if (chunk == 0 || secs <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [file] [chunk_size] [seconds_per_run]\n";
+        return 1;
+    }
+
+    bool created = path.empty();
+    if (created) {
+        path = "/tmp/misc-sendfile.data";
+        int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        std::vector<char> data(1024 * 1024, 'x');
+        for (int i = 0; fd >= 0 && i < 16; i++) {
+            if (write(fd, data.data(), data.size()) != (ssize_t)data.size()) {
+                break;
+            }
+        }
+        if (fd < 0 || close(fd) < 0) {
+            std::cerr << "Failed to create " << path << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        std::cerr << "Failed to open " << path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    std::cout << "Sending " << path << " (" << st.st_size << " bytes) in "
+              << chunk << " byte chunks over loopback TCP\n";
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::setw(16) << "sendfile" << std::setw(12)
+              << run(method::sendfile, fd, st.st_size, chunk, secs) << " MB/s\n";
+    std::cout << std::setw(16) << "mmap+write" << std::setw(12)
+              << run(method::mmap_write, fd, st.st_size, chunk, secs) << " MB/s\n";
+    std::cout << std::setw(16) << "pread+write" << std::setw(12)
+              << run(method::read_write, fd, st.st_size, chunk, secs) << " MB/s\n";
+
+    close(fd);
+    if (created) {
+        unlink(path.c_str());
+    }
+    return 0;
+}
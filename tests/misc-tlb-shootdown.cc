@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures the cost of munmap() and mprotect() of small
+// ranges, which have to shoot down the TLB entries of the range on all
+// cpus running application threads. To make the shootdowns reach other
+// cpus, busy threads keep running on them while one or more threads
+// repeatedly map, touch and unmap (or change the protection of) ranges of
+// a few pages.
+//
+// Usage: misc-tlb-shootdown.so [busy_threads] [iterations] [mapping_threads]
+
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static std::atomic<bool> done { false };
+
+static void busy()
+{
+    volatile unsigned long counter = 0;
+    while (!done.load(std::memory_order_relaxed)) {
+        counter++;
+    }
+}
+
+static void touch(char* p, size_t size)
+{
+    for (size_t i = 0; i < size; i += 4096) {
+        p[i] = 1;
+    }
+}
+
+// Returns the average time in microseconds of one munmap()
+static double bench_munmap(size_t pages, int iterations)
+{
+    size_t size = pages * 4096;
+    std::chrono::duration<double, std::micro> total(0);
+    for (int i = 0; i < iterations; i++) {
+        auto p = static_cast<char*>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        touch(p, size);
+        auto start = std::chrono::steady_clock::now();
+        munmap(p, size);
+        total += std::chrono::steady_clock::now() - start;
+    }
+    return total.count() / iterations;
+}
+
+// Returns the average time in microseconds of one mprotect(), switching
+// the range between read-write and read-only
+static double bench_mprotect(size_t pages, int iterations)
+{
+    size_t size = pages * 4096;
+    auto p = static_cast<char*>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    std::chrono::duration<double, std::micro> total(0);
+    for (int i = 0; i < iterations; i++) {
+        touch(p, size);
+        auto start = std::chrono::steady_clock::now();
+        mprotect(p, size, PROT_READ);
+        mprotect(p, size, PROT_READ | PROT_WRITE);
+        total += std::chrono::steady_clock::now() - start;
+    }
+    munmap(p, size);
+    return total.count() / iterations / 2;
+}
+
+int main(int argc, char** argv)
+{
+    int busy_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency() - 1;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+    int mapping_threads = argc > 3 ? atoi(argv[3]) : 1;
+    if (busy_threads < 0 || iterations <= 0 || mapping_threads <= 0) {
+        fprintf(stderr, "Usage: %s [busy_threads] [iterations] [mapping_threads]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::thread> busy_pool;
+    for (int i = 0; i < busy_threads; i++) {
+        busy_pool.emplace_back(busy);
+    }
+
+    printf("%d busy threads, %d mapping threads, %d iterations\n\n",
+        busy_threads, mapping_threads, iterations);
+    printf("          time per call (us)\n");
+    printf("pages     munmap   mprotect\n");
+    for (size_t pages = 1; pages <= 256; pages *= 4) {
+        std::vector<double> unmap(mapping_threads), protect(mapping_threads);
+        std::vector<std::thread> mappers;
+        for (int i = 0; i < mapping_threads; i++) {
+            mappers.emplace_back([&, i] {
+                unmap[i] = bench_munmap(pages, iterations);
+                protect[i] = bench_mprotect(pages, iterations);
+            });
+        }
+        double unmap_avg = 0, protect_avg = 0;
+        for (int i = 0; i < mapping_threads; i++) {
+            mappers[i].join();
+            unmap_avg += unmap[i] / mapping_threads;
+            protect_avg += protect[i] / mapping_threads;
+        }
+        printf("%5lu %10.2f %10.2f\n", pages, unmap_avg, protect_avg);
+    }
+
+    done.store(true);
+    for (auto& t : busy_pool) {
+        t.join();
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures the rate at which small UDP datagrams can be
+// received over a real NIC, the way DNS-like services receive requests.
+// The receiver binds a port, counts the datagrams it gets for the given
+// number of seconds and reports the packet rate and the CPU time spent per
+// million packets. On OSv the CPU time (CLOCK_PROCESS_CPUTIME_ID) is the
+// non-idle time of all cpus, so it includes the driver Rx threads and the
+// network stack. With "connect" the receiver connects its socket to the
+// first sender it hears from, to measure connected sockets too.
+//
+// Run the receiver in the guest and the sender on the host (or any other
+// machine), for example with this same program built on Linux:
+// g++ -O2 -std=c++11 -pthread tests/misc-udp-pps.cc -o misc-udp-pps
+// ./misc-udp-pps send <guest_ip> [port] [seconds] [threads] [size]
+//
+// Usage: misc-udp-pps.so [port] [seconds] [connect]
+//        misc-udp-pps.so send <host> [port] [seconds] [threads] [size]
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static double cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int receive_udp(int port, double secs, bool connected)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "Failed to bind port " << port << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    // Wake up the receive loop once in a while to check the time
+    struct timeval tv = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    std::cout << "Waiting for datagrams on port " << port << "\n";
+    char buf[2048];
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    while (recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&peer, &len) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            std::cerr << "Failed to receive: " << strerror(errno) << "\n";
+            return 1;
+        }
+        len = sizeof(peer);
+    }
+    if (connected && connect(fd, (struct sockaddr*)&peer, sizeof(peer)) < 0) {
+        std::cerr << "Failed to connect: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    long packets = 0, bytes = 0;
+    auto cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(secs);
+    while (std::chrono::steady_clock::now() < end) {
+        auto n = recv(fd, buf, sizeof(buf), 0);
+        if (n >= 0) {
+            packets++;
+            bytes += n;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            std::cerr << "Failed to receive: " << strerror(errno) << "\n";
+            return 1;
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto cpu = cpu_seconds() - cpu_start;
+    close(fd);
+
+    std::cout << std::fixed << std::setprecision(0)
+              << "Received " << packets << " datagrams (" << bytes << " bytes) in "
+              << std::setprecision(1) << elapsed << " s: "
+              << std::setprecision(0) << packets / elapsed << " packets/s, "
+              << std::setprecision(3) << (packets ? cpu / (packets / 1e6) : 0)
+              << " cpu-seconds per million packets\n";
+    return 0;
+}
+
+static int send_udp(const char* host, int port, double secs, int threads, size_t size)
+{
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        std::cerr << "Invalid address " << host << "\n";
+        return 1;
+    }
+
+    std::atomic<bool> failed(false);
+    std::atomic<long> total(0);
+    std::vector<std::thread> senders;
+    for (int i = 0; i < threads; i++) {
+        senders.emplace_back([&] {
+            int fd = socket(AF_INET, SOCK_DGRAM, 0);
+            if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+                failed = true;
+                return;
+            }
+            std::vector<char> buf(size, 'x');
+            long sent = 0;
+            auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(secs);
+            while (std::chrono::steady_clock::now() < end) {
+                // ENOBUFS and ECONNREFUSED only mean the receiver is
+                // not keeping up or not there yet, keep going
+                if (send(fd, buf.data(), buf.size(), 0) >= 0) {
+                    sent++;
+                } else if (errno != ENOBUFS && errno != ECONNREFUSED) {
+                    failed = true;
+                    break;
+                }
+            }
+            total += sent;
+            close(fd);
+        });
+    }
+    for (auto& t : senders) {
+        t.join();
+    }
+    if (failed) {
+        std::cerr << "Failed to send to " << host << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    std::cout << std::fixed << std::setprecision(0)
+              << "Sent " << total << " datagrams: " << total / secs << " packets/s\n";
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 2 && std::string(argv[1]) == "send") {
+        int port = argc > 3 ? atoi(argv[3]) : 5001;
+        double secs = argc > 4 ? atof(argv[4]) : 10.0;
+        int threads = argc > 5 ? atoi(argv[5]) : 1;
+        long size = argc > 6 ? atol(argv[6]) : 64;
+        if (port <= 0 || secs <= 0 || threads <= 0 || size <= 0 || size > 1472) {
+            std::cerr << "Usage: " << argv[0] << " send <host> [port] [seconds] [threads] [size]\n";
+            return 1;
+        }
+        return send_udp(argv[2], port, secs, threads, size);
+    }
+
+    int port = argc > 1 ? atoi(argv[1]) : 5001;
+    double secs = argc > 2 ? atof(argv[2]) : 10.0;
+    bool connected = argc > 3 && std::string(argv[3]) == "connect";
+    if (port <= 0 || secs <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [port] [seconds] [connect]\n"
+                  << "       " << argv[0] << " send <host> [port] [seconds] [threads] [size]\n";
+        return 1;
+    }
+    return receive_udp(port, secs, connected);
+}
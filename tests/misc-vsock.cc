@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// This benchmark measures AF_VSOCK stream sockets between the guest and the
+// host: the throughput of a bulk transfer and the round trip latency of
+// small messages. The guest listens on the given port and, for every
+// connection, either reads everything it gets ("bulk" clients) or echoes it
+// back ("ping" clients). The client runs on the host, for example with this
+// same program built on Linux:
+// g++ -O2 -std=c++11 tests/misc-vsock.cc -o misc-vsock
+// ./misc-vsock bulk <guest_cid> [port] [seconds] [size]
+// ./misc-vsock ping <guest_cid> [port] [count] [size]
+//
+// Start the guest with a vsock device, e.g. scripts/run.py --vsock-cid 3
+//
+// Usage: misc-vsock.so [port] [connections]
+//        misc-vsock.so bulk|ping <cid> [port] [seconds|count] [size]
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/vm_sockets.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+static bool write_all(int fd, const char* buf, size_t len)
+{
+    while (len) {
+        auto n = write(fd, buf, len);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, char* buf, size_t len)
+{
+    while (len) {
+        auto n = read(fd, buf, len);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// The first byte a client sends tells what it wants
+static int serve(int port, int connections)
+{
+    int fd = socket(AF_VSOCK, SOCK_STREAM, 0);
+    struct sockaddr_vm addr = {};
+    addr.svm_family = AF_VSOCK;
+    addr.svm_cid = VMADDR_CID_ANY;
+    addr.svm_port = port;
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        std::cerr << "Failed to listen on port " << port << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    std::cout << "Waiting for connections on vsock port " << port << "\n";
+
+    std::vector<char> buf(256 * 1024);
+    for (int i = 0; i < connections; i++) {
+        int c = accept(fd, nullptr, nullptr);
+        char mode;
+        if (c < 0 || read(c, &mode, 1) != 1) {
+            std::cerr << "Failed to accept: " << strerror(errno) << "\n";
+            return 1;
+        }
+        long bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        ssize_t n;
+        while ((n = read(c, buf.data(), buf.size())) > 0) {
+            bytes += n;
+            if (mode == 'p' && !write_all(c, buf.data(), n)) {
+                break;
+            }
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        close(c);
+        if (mode == 'b') {
+            std::cout << std::fixed << std::setprecision(1)
+                      << "Received " << bytes / 1e6 << " MB in " << elapsed << " s: "
+                      << bytes * 8 / elapsed / 1e9 << " Gbit/s\n";
+        } else {
+            std::cout << "Echoed " << bytes << " bytes\n";
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static int connect_to(unsigned cid, int port)
+{
+    int fd = socket(AF_VSOCK, SOCK_STREAM, 0);
+    struct sockaddr_vm addr = {};
+    addr.svm_family = AF_VSOCK;
+    addr.svm_cid = cid;
+    addr.svm_port = port;
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "Failed to connect to " << cid << ":" << port << ": " << strerror(errno) << "\n";
+        return -1;
+    }
+    return fd;
+}
+
+static int bulk(unsigned cid, int port, double secs, size_t size)
+{
+    int fd = connect_to(cid, port);
+    if (fd < 0 || !write_all(fd, "b", 1)) {
+        return 1;
+    }
+    std::vector<char> buf(size, 'x');
+    long bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(secs);
+    while (std::chrono::steady_clock::now() < end) {
+        if (!write_all(fd, buf.data(), buf.size())) {
+            std::cerr << "Failed to send: " << strerror(errno) << "\n";
+            return 1;
+        }
+        bytes += buf.size();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(fd);
+    std::cout << std::fixed << std::setprecision(1)
+              << "Sent " << bytes / 1e6 << " MB in " << elapsed << " s: "
+              << bytes * 8 / elapsed / 1e9 << " Gbit/s\n";
+    return 0;
+}
+
+static int ping(unsigned cid, int port, long count, size_t size)
+{
+    int fd = connect_to(cid, port);
+    if (fd < 0 || !write_all(fd, "p", 1)) {
+        return 1;
+    }
+    std::vector<char> buf(size, 'x');
+    std::vector<double> rtt;
+    rtt.reserve(count);
+    for (long i = 0; i < count; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if (!write_all(fd, buf.data(), buf.size()) || !read_all(fd, buf.data(), buf.size())) {
+            std::cerr << "Failed to ping: " << strerror(errno) << "\n";
+            return 1;
+        }
+        rtt.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    close(fd);
+    std::sort(rtt.begin(), rtt.end());
+    std::cout << std::fixed << std::setprecision(1)
+              << "Round trip of " << size << " bytes: median " << rtt[count / 2]
+              << " us, 99th percentile " << rtt[count * 99 / 100] << " us\n";
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 2 && (std::string(argv[1]) == "bulk" || std::string(argv[1]) == "ping")) {
+        bool is_bulk = std::string(argv[1]) == "bulk";
+        unsigned cid = strtoul(argv[2], nullptr, 0);
+        int port = argc > 3 ? atoi(argv[3]) : 5001;
+        double arg = argc > 4 ? atof(argv[4]) : (is_bulk ? 10 : 10000);
+        long size = argc > 5 ? atol(argv[5]) : (is_bulk ? 64 * 1024 : 64);
+        if (port <= 0 || arg <= 0 || size <= 0) {
+            std::cerr << "Usage: " << argv[0] << " bulk|ping <cid> [port] [seconds|count] [size]\n";
+            return 1;
+        }
+        return is_bulk ? bulk(cid, port, arg, size) : ping(cid, port, arg, size);
+    }
+
+    int port = argc > 1 ? atoi(argv[1]) : 5001;
+    int connections = argc > 2 ? atoi(argv[2]) : 2;
+    if (port <= 0 || connections <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [port] [connections]\n"
+                  << "       " << argv[0] << " bulk|ping <cid> [port] [seconds|count] [size]\n";
+        return 1;
+    }
+    return serve(port, connections);
+}
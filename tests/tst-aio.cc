@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests Linux native AIO (io_setup/io_submit/io_getevents) on a regular
+// file, with and without O_DIRECT. Requests on regular files are performed
+// by io_submit() itself, so this checks their results and completions
+// rather than asynchrony (misc-aio-iops covers block devices).
+//
+// To compile on Linux, use: g++ -g -std=c++11 tests/tst-aio.cc
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/aio_abi.h>
+#include <iostream>
+
+static int tests = 0, fails = 0;
+
+template<typename T>
+bool do_expect(T actual, T expected, const char *actuals, const char *expecteds, const char *file, int line)
+{
+    ++tests;
+    if (actual != expected) {
+        fails++;
+        std::cout << "FAIL: " << file << ":" << line << ": For " << actuals
+                << " expected " << expecteds << "(" << expected << "), saw "
+                << actual << ".\n";
+        return false;
+    }
+    std::cout << "OK: " << file << ":" << line << ".\n";
+    return true;
+}
+#define expect(actual, expected) do_expect(actual, expected, #actual, #expected, __FILE__, __LINE__)
+
+static constexpr size_t block_size = 4096;
+static constexpr int nr_blocks = 4;
+
+static long io_setup(unsigned nr, aio_context_t *ctx)
+{
+    return syscall(SYS_io_setup, nr, ctx);
+}
+
+static long io_destroy(aio_context_t ctx)
+{
+    return syscall(SYS_io_destroy, ctx);
+}
+
+static long io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+    return syscall(SYS_io_submit, ctx, nr, iocbpp);
+}
+
+static long io_getevents(aio_context_t ctx, long min_nr, long max_nr,
+                         struct io_event *events, struct timespec *timeout)
+{
+    return syscall(SYS_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
+static void prep(struct iocb *cb, int fd, int cmd, void *buf, size_t len, off_t offset)
+{
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_fildes = fd;
+    cb->aio_lio_opcode = cmd;
+    cb->aio_buf = (uint64_t)(uintptr_t)buf;
+    cb->aio_nbytes = len;
+    cb->aio_offset = offset;
+    cb->aio_data = (uint64_t)(uintptr_t)cb;
+}
+
+// Submits nr requests and collects their completions, checking that each
+// iocb completed exactly once with the expected result
+static void submit_and_wait(aio_context_t ctx, struct iocb *cbs, int nr, long expected_res)
+{
+    struct iocb *ptrs[nr_blocks + 1];
+    for (int i = 0; i < nr; i++) {
+        ptrs[i] = &cbs[i];
+    }
+    expect(io_submit(ctx, nr, ptrs), (long)nr);
+    struct io_event events[nr_blocks + 1];
+    struct timespec timeout = {5, 0};
+    int done = 0;
+    while (done < nr) {
+        long ret = io_getevents(ctx, 1, nr - done, events + done, &timeout);
+        if (!expect(ret > 0, true)) {
+            return;
+        }
+        done += ret;
+    }
+    unsigned seen = 0;
+    for (int i = 0; i < nr; i++) {
+        auto cb = (struct iocb *)(uintptr_t)events[i].data;
+        expect((uintptr_t)events[i].obj, (uintptr_t)cb);
+        expect((long)events[i].res, expected_res);
+        seen |= 1u << (cb - cbs);
+    }
+    expect(seen, (1u << nr) - 1);
+}
+
+static void test_file(const char *path, int extra_flags)
+{
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR | extra_flags, 0666);
+    if (fd < 0 && errno == EINVAL && extra_flags) {
+        std::cout << "Skipping " << path << ": O_DIRECT not supported\n";
+        return;
+    }
+    expect(fd >= 0, true);
+
+    aio_context_t ctx = 0;
+    expect(io_setup(nr_blocks + 1, &ctx), 0L);
+
+    // O_DIRECT requires aligned buffers and offsets
+    char *wbuf, *rbuf;
+    expect(posix_memalign((void **)&wbuf, block_size, block_size * nr_blocks), 0);
+    expect(posix_memalign((void **)&rbuf, block_size, block_size * nr_blocks), 0);
+    for (int i = 0; i < nr_blocks; i++) {
+        memset(wbuf + i * block_size, 'a' + i, block_size);
+    }
+
+    // Several writes in one io_submit(), each to its own block
+    struct iocb cbs[nr_blocks + 1];
+    for (int i = 0; i < nr_blocks; i++) {
+        prep(&cbs[i], fd, IOCB_CMD_PWRITE, wbuf + i * block_size, block_size, i * block_size);
+    }
+    submit_and_wait(ctx, cbs, nr_blocks, block_size);
+
+    prep(&cbs[0], fd, IOCB_CMD_FSYNC, nullptr, 0, 0);
+    submit_and_wait(ctx, cbs, 1, 0);
+
+    // Read the blocks back in reverse order
+    memset(rbuf, 0, block_size * nr_blocks);
+    for (int i = 0; i < nr_blocks; i++) {
+        int blk = nr_blocks - 1 - i;
+        prep(&cbs[i], fd, IOCB_CMD_PREAD, rbuf + blk * block_size, block_size, blk * block_size);
+    }
+    submit_and_wait(ctx, cbs, nr_blocks, block_size);
+    expect(memcmp(rbuf, wbuf, block_size * nr_blocks), 0);
+
+    // A vectored read of the whole file
+    memset(rbuf, 0, block_size * nr_blocks);
+    struct iovec iov[nr_blocks];
+    for (int i = 0; i < nr_blocks; i++) {
+        iov[i].iov_base = rbuf + i * block_size;
+        iov[i].iov_len = block_size;
+    }
+    prep(&cbs[0], fd, IOCB_CMD_PREADV, iov, nr_blocks, 0);
+    submit_and_wait(ctx, cbs, 1, block_size * nr_blocks);
+    expect(memcmp(rbuf, wbuf, block_size * nr_blocks), 0);
+
+    // Reading at the end of the file returns 0 bytes
+    prep(&cbs[0], fd, IOCB_CMD_PREAD, rbuf, block_size, block_size * nr_blocks);
+    submit_and_wait(ctx, cbs, 1, 0);
+
+    // Completion is also signalled through an eventfd
+    int efd = eventfd(0, 0);
+    expect(efd >= 0, true);
+    prep(&cbs[0], fd, IOCB_CMD_PREAD, rbuf, block_size, 0);
+    cbs[0].aio_flags = IOCB_FLAG_RESFD;
+    cbs[0].aio_resfd = efd;
+    submit_and_wait(ctx, cbs, 1, block_size);
+    uint64_t count = 0;
+    expect(read(efd, &count, sizeof(count)), (ssize_t)sizeof(count));
+    expect(count, (uint64_t)1);
+    close(efd);
+
+    // A bad descriptor is reported by io_submit() itself
+    struct iocb *ptr = &cbs[0];
+    prep(&cbs[0], -1, IOCB_CMD_PREAD, rbuf, block_size, 0);
+    expect(io_submit(ctx, 1, &ptr), -1L);
+    expect(errno, EBADF);
+
+    expect(io_destroy(ctx), 0L);
+    free(wbuf);
+    free(rbuf);
+    close(fd);
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    test_file("/tmp/tst-aio", 0);
+    test_file("/tmp/tst-aio-direct", O_DIRECT);
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
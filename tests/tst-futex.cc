@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2026 OSv contributors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests for the futex() system call: the basic FUTEX_WAIT/FUTEX_WAKE pair
+// as well as the bitset, requeue and wake-op variants used by glibc
+// condition variables and by managed runtimes.
+//
+// To compile on Linux, use: g++ -g -pthread -std=c++11 tests/tst-futex.cc
+
+#include <string>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, std::string msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static long futex(int *uaddr, int op, int val, const struct timespec *timeout,
+                  int *uaddr2, int val3)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, uaddr2, val3);
+}
+
+static long futex_val2(int *uaddr, int op, int val, long val2, int *uaddr2, int val3)
+{
+    return syscall(SYS_futex, uaddr, op, val, val2, uaddr2, val3);
+}
+
+// Start nthreads threads each waiting on uaddr (while *uaddr == val) and
+// give them time to go to sleep.
+static std::vector<std::thread> start_waiters(int *uaddr, int nthreads,
+        std::atomic<int>& returned, int op = FUTEX_WAIT_PRIVATE,
+        int bitset = FUTEX_BITSET_MATCH_ANY, int val = 0)
+{
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.emplace_back([=, &returned] {
+            futex(uaddr, op, val, nullptr, nullptr, bitset);
+            returned++;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return threads;
+}
+
+static void wake_all_and_join(int *uaddr, std::vector<std::thread>& threads)
+{
+    *uaddr = 1;
+    futex(uaddr, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+static void test_wait_value_mismatch()
+{
+    int word = 1;
+    auto ret = futex(&word, FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+    report(ret == -1 && errno == EAGAIN, "FUTEX_WAIT with changed value returns EAGAIN");
+}
+
+static void test_wait_timeout()
+{
+    int word = 0;
+    struct timespec ts = { 0, 50 * 1000 * 1000 };
+    auto ret = futex(&word, FUTEX_WAIT_PRIVATE, 0, &ts, nullptr, 0);
+    report(ret == -1 && errno == ETIMEDOUT, "FUTEX_WAIT times out");
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += 50 * 1000 * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    ret = futex(&word, FUTEX_WAIT_BITSET_PRIVATE, 0, &ts, nullptr, FUTEX_BITSET_MATCH_ANY);
+    report(ret == -1 && errno == ETIMEDOUT, "FUTEX_WAIT_BITSET with absolute timeout times out");
+}
+
+static void test_wake()
+{
+    int word = 0;
+    std::atomic<int> returned(0);
+    auto threads = start_waiters(&word, 4, returned);
+    word = 1;
+    auto woken = futex(&word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    report(woken == 1, "FUTEX_WAKE wakes a single waiter");
+    woken = futex(&word, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    report(woken == 3, "FUTEX_WAKE wakes remaining waiters");
+    for (auto& t : threads) {
+        t.join();
+    }
+    report(returned == 4, "all waiters returned");
+}
+
+static void test_bitset()
+{
+    int word = 0;
+    std::atomic<int> returned(0);
+    auto threads = start_waiters(&word, 2, returned, FUTEX_WAIT_BITSET_PRIVATE, 0x1);
+    auto more = start_waiters(&word, 2, returned, FUTEX_WAIT_BITSET_PRIVATE, 0x2);
+    threads.insert(threads.end(), std::make_move_iterator(more.begin()),
+                   std::make_move_iterator(more.end()));
+
+    auto woken = futex(&word, FUTEX_WAKE_BITSET_PRIVATE, INT32_MAX, nullptr, nullptr, 0x4);
+    report(woken == 0, "FUTEX_WAKE_BITSET with disjoint bitset wakes nobody");
+    woken = futex(&word, FUTEX_WAKE_BITSET_PRIVATE, INT32_MAX, nullptr, nullptr, 0x2);
+    report(woken == 2, "FUTEX_WAKE_BITSET wakes only matching waiters");
+    auto ret = futex(&word, FUTEX_WAKE_BITSET_PRIVATE, 1, nullptr, nullptr, 0);
+    report(ret == -1 && errno == EINVAL, "FUTEX_WAKE_BITSET with empty bitset is EINVAL");
+    wake_all_and_join(&word, threads);
+    report(returned == 4, "all bitset waiters returned");
+}
+
+static void test_requeue()
+{
+    int word = 0, word2 = 0;
+    std::atomic<int> returned(0);
+    auto threads = start_waiters(&word, 4, returned);
+
+    auto woken = futex_val2(&word, FUTEX_REQUEUE_PRIVATE, 1, 2, &word2, 0);
+    report(woken == 3, "FUTEX_REQUEUE returns woken plus requeued");
+    woken = futex(&word2, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    report(woken == 2, "FUTEX_REQUEUE moved waiters to the second futex");
+
+    auto ret = futex_val2(&word, FUTEX_CMP_REQUEUE_PRIVATE, 0, 1, &word2, 1);
+    report(ret == -1 && errno == EAGAIN, "FUTEX_CMP_REQUEUE with changed value returns EAGAIN");
+    ret = futex_val2(&word, FUTEX_CMP_REQUEUE_PRIVATE, 0, 1, &word2, 0);
+    report(ret == 1, "FUTEX_CMP_REQUEUE returns woken plus requeued");
+    woken = futex(&word2, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    report(woken == 1, "FUTEX_CMP_REQUEUE moved the waiter");
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    report(returned == 4, "all requeued waiters returned");
+}
+
+static void test_wake_op()
+{
+    int word = 0, word2 = 5;
+    std::atomic<int> returned(0);
+    auto threads = start_waiters(&word, 2, returned);
+    auto more = start_waiters(&word2, 2, returned, FUTEX_WAIT_PRIVATE,
+                              FUTEX_BITSET_MATCH_ANY, 5);
+
+    // *word2 = 1, wake one on word and, since old *word2 (5) > 4, one on word2.
+    auto woken = futex_val2(&word, FUTEX_WAKE_OP_PRIVATE, 1, 1, &word2,
+                            FUTEX_OP(FUTEX_OP_SET, 1, FUTEX_OP_CMP_GT, 4));
+    report(woken == 2, "FUTEX_WAKE_OP wakes waiters on both futexes");
+    report(word2 == 1, "FUTEX_WAKE_OP stored the new value");
+
+    // *word2 += 1, old value 1 is not > 4 so only word is woken.
+    woken = futex_val2(&word, FUTEX_WAKE_OP_PRIVATE, 1, 1, &word2,
+                       FUTEX_OP(FUTEX_OP_ADD, 1, FUTEX_OP_CMP_GT, 4));
+    report(woken == 1 && word2 == 2, "FUTEX_WAKE_OP honors the comparison");
+
+    woken = futex(&word2, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    report(woken == 1, "one waiter left on the second futex");
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (auto& t : more) {
+        t.join();
+    }
+    report(returned == 4, "all wake-op waiters returned");
+}
+
+int main(int argc, char **argv)
+{
+    test_wait_value_mismatch();
+    test_wait_timeout();
+    test_wake();
+    test_bitset();
+    test_requeue();
+    test_wake_op();
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}